@@ -1005,6 +1005,12 @@ void GetAllocatorGlobalRange(uptr *begin, uptr *end) {
   *end = *begin + sizeof(__asan::get_allocator());
 }
 
+void GetAllocatorAddressRanges(uptr *primary_begin, uptr *primary_end,
+                               uptr *secondary_begin, uptr *secondary_end) {
+  __asan::get_allocator().GetAddressRangesLocked(
+      primary_begin, primary_end, secondary_begin, secondary_end);
+}
+
 uptr PointsIntoChunk(void* p) {
   uptr addr = reinterpret_cast<uptr>(p);
   __asan::AsanChunk *m = __asan::instance.GetAsanChunkByAddrFastLocked(addr);
@@ -1045,6 +1051,25 @@ void LsanMetadata::set_tag(ChunkTag value) {
   m->lsan_tag = value;
 }
 
+bool LsanMetadata::try_set_tag(ChunkTag old_value, ChunkTag value) {
+  // The tag is in the second 32 bits of the chunk header, along with fields
+  // that don't change while the world is stopped.
+  atomic_uint32_t *word =
+      reinterpret_cast<atomic_uint32_t *>(static_cast<char *>(metadata_) + 4);
+  u32 cmp = atomic_load_relaxed(word);
+  for (;;) {
+    __asan::ChunkHeader h;
+    internal_memcpy(reinterpret_cast<char *>(&h) + 4, &cmp, sizeof(cmp));
+    if (h.lsan_tag != old_value)
+      return false;
+    h.lsan_tag = value;
+    u32 xchg;
+    internal_memcpy(&xchg, reinterpret_cast<char *>(&h) + 4, sizeof(xchg));
+    if (atomic_compare_exchange_weak(word, &cmp, xchg, memory_order_relaxed))
+      return true;
+  }
+}
+
 uptr LsanMetadata::requested_size() const {
   __asan::AsanChunk *m = reinterpret_cast<__asan::AsanChunk *>(metadata_);
   return m->UsedSize(/*locked_version=*/true);
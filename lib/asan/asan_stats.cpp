@@ -124,9 +124,10 @@ static void PrintAccumulatedStats() {
   // Use lock to keep reports from mixing up.
   BlockingMutexLock lock(&print_lock);
   stats.Print();
-  StackDepotStats *stack_depot_stats = StackDepotGetStats();
-  Printf("Stats: StackDepot: %zd ids; %zdM allocated\n",
-         stack_depot_stats->n_uniq_ids, stack_depot_stats->allocated >> 20);
+  StackDepotStats stack_depot_stats = StackDepotGetStats();
+  Printf("Stats: StackDepot: %zd ids; %zdM allocated; %zdM saved\n",
+         stack_depot_stats.n_uniq_ids, stack_depot_stats.allocated >> 20,
+         stack_depot_stats.compression_saved >> 20);
   PrintInternalAllocatorStats();
 }
 
@@ -40,6 +40,75 @@ struct InputInfo {
   Vector<uint8_t> DataFlowTraceForFocusFunction;
 };
 
+// A discrete distribution over indices 0..size()-1 with mutable weights.
+// Weights are kept in a Fenwick tree, so that appending an index, changing
+// a weight and sampling are all O(log N).
+class WeightedIndexDistribution {
+ public:
+  size_t size() const { return Weights.size(); }
+  double Weight(size_t Idx) const { return Weights[Idx]; }
+  double TotalWeight() const { return Total; }
+
+  void Append(double W) {
+    assert(W >= 0);
+    Weights.push_back(W);
+    // Tree[N] holds the sum of the weights in (N - LowBit(N), N].
+    size_t N = Weights.size();
+    double Sum = W;
+    for (size_t K = N - 1; K > N - LowBit(N); K -= LowBit(K))
+      Sum += Tree[K];
+    Tree.push_back(Sum);
+    Total += W;
+  }
+
+  void SetWeight(size_t Idx, double W) {
+    assert(W >= 0);
+    double Delta = W - Weights[Idx];
+    if (Delta == 0)
+      return;
+    Weights[Idx] = W;
+    for (size_t K = Idx + 1; K < Tree.size(); K += LowBit(K))
+      Tree[K] += Delta;
+    Total += Delta;
+  }
+
+  // Returns an index with probability proportional to its weight.
+  // If all weights are zero, returns a uniformly random index.
+  size_t operator()(Random &Rand) {
+    size_t N = size();
+    assert(N);
+    if (Total <= 0)
+      return Rand(N);
+    double R = std::uniform_real_distribution<double>(0, Total)(Rand);
+    // Find the first index whose prefix sum exceeds R.
+    size_t Pos = 0;
+    size_t Step = 1;
+    while (Step * 2 <= N)
+      Step *= 2;
+    for (; Step; Step /= 2) {
+      if (Pos + Step <= N && Tree[Pos + Step] <= R) {
+        Pos += Step;
+        R -= Tree[Pos];
+      }
+    }
+    // Rounding errors may get us past the end or onto a zero weight.
+    if (Pos >= N)
+      Pos = N - 1;
+    while (Pos > 0 && Weights[Pos] == 0)
+      Pos--;
+    while (Weights[Pos] == 0)
+      Pos++;
+    return Pos;
+  }
+
+ private:
+  static size_t LowBit(size_t K) { return K & (~K + 1); }
+
+  Vector<double> Weights;
+  Vector<double> Tree = {0};  // 1-based, Tree[0] is unused.
+  double Total = 0;
+};
+
 class InputCorpus {
   static const size_t kFeatureSetSize = 1 << 21;
  public:
@@ -111,7 +180,8 @@ class InputCorpus {
     // But if we don't, we'll use the DFT of its base input.
     if (II.DataFlowTraceForFocusFunction.empty() && BaseII)
       II.DataFlowTraceForFocusFunction = BaseII->DataFlowTraceForFocusFunction;
-    UpdateCorpusDistribution();
+    CorpusDistribution.Append(0);
+    UpdateCorpusWeight(Inputs.size() - 1);
     PrintCorpus();
     // ValidateFeatureSet();
     return &II;
@@ -162,7 +232,6 @@ class InputCorpus {
     Hashes.insert(Sha1ToString(II->Sha1));
     II->U = U;
     II->Reduced = true;
-    UpdateCorpusDistribution();
   }
 
   bool HasUnit(const Unit &U) { return Hashes.count(Hash(U)); }
@@ -175,7 +244,7 @@ class InputCorpus {
 
   // Returns an index of random unit from the corpus to mutate.
   size_t ChooseUnitIdxToMutate(Random &Rand) {
-    size_t Idx = static_cast<size_t>(CorpusDistribution(Rand));
+    size_t Idx = CorpusDistribution(Rand);
     assert(Idx < Inputs.size());
     return Idx;
   }
@@ -224,8 +293,10 @@ class InputCorpus {
         InputInfo &II = *Inputs[OldIdx];
         assert(II.NumFeatures > 0);
         II.NumFeatures--;
-        if (II.NumFeatures == 0)
+        if (II.NumFeatures == 0) {
           DeleteInput(OldIdx);
+          UpdateCorpusWeight(OldIdx);
+        }
       } else {
         NumAddedFeatures++;
       }
@@ -262,37 +333,21 @@ private:
     }
   }
 
-  // Updates the probability distribution for the units in the corpus.
-  // Must be called whenever the corpus or unit weights are changed.
+  // Updates the probability of choosing the unit Idx for mutation.
+  // Must be called whenever the weight of the unit may have changed.
   //
   // Hypothesis: units added to the corpus last are more interesting.
   //
   // Hypothesis: inputs with infrequent features are more interesting.
-  void UpdateCorpusDistribution() {
-    size_t N = Inputs.size();
-    assert(N);
-    Intervals.resize(N + 1);
-    Weights.resize(N);
-    std::iota(Intervals.begin(), Intervals.end(), 0);
-    for (size_t i = 0; i < N; i++)
-      Weights[i] = Inputs[i]->NumFeatures
-                       ? (i + 1) * (Inputs[i]->HasFocusFunction ? 1000 : 1)
-                       : 0.;
-    if (FeatureDebug) {
-      for (size_t i = 0; i < N; i++)
-        Printf("%zd ", Inputs[i]->NumFeatures);
-      Printf("SCORE\n");
-      for (size_t i = 0; i < N; i++)
-        Printf("%f ", Weights[i]);
-      Printf("Weights\n");
-    }
-    CorpusDistribution = std::piecewise_constant_distribution<double>(
-        Intervals.begin(), Intervals.end(), Weights.begin());
+  void UpdateCorpusWeight(size_t Idx) {
+    const InputInfo &II = *Inputs[Idx];
+    double Weight =
+        II.NumFeatures ? (Idx + 1) * (II.HasFocusFunction ? 1000 : 1) : 0.;
+    if (FeatureDebug)
+      Printf("WEIGHT %zd NF %zd %f\n", Idx, II.NumFeatures, Weight);
+    CorpusDistribution.SetWeight(Idx, Weight);
   }
-  std::piecewise_constant_distribution<double> CorpusDistribution;
-
-  Vector<double> Intervals;
-  Vector<double> Weights;
+  WeightedIndexDistribution CorpusDistribution;
 
   std::unordered_set<std::string> Hashes;
   Vector<InputInfo*> Inputs;
@@ -491,7 +491,7 @@ void Merge(Fuzzer *F, FuzzingOptions &Options, const Vector<std::string> &Args,
   Vector<std::string> NewFiles;
   Set<uint32_t> NewFeatures, NewCov;
   CrashResistantMerge(Args, OldCorpus, NewCorpus, &NewFiles, {}, &NewFeatures,
-                      {}, &NewCov, CFPath, true);
+                      {}, &NewCov, CFPath, true, Flags.jobs);
   for (auto &Path : NewFiles)
     F->WriteToOutputCorpus(FileToVector(Path, Options.MaxLen));
   // We are done, delete the control file if it was a temporary one.
@@ -633,13 +633,14 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.close_fd_mask & 1)
     CloseStdout();
 
-  if (Flags.jobs > 0 && Flags.workers == 0) {
+  // With -merge=1, -jobs=N shards the merge (see FuzzerMerge.h).
+  if (Flags.jobs > 0 && Flags.workers == 0 && !Flags.merge) {
     Flags.workers = std::min(NumberOfCpuCores() / 2, Flags.jobs);
     if (Flags.workers > 1)
       Printf("Running %u workers\n", Flags.workers);
   }
 
-  if (Flags.workers > 0 && Flags.jobs > 0)
+  if (Flags.workers > 0 && Flags.jobs > 0 && !Flags.merge)
     return RunInMultipleProcesses(Args, Flags.workers, Flags.jobs);
 
   FuzzingOptions Options;
@@ -706,10 +707,21 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     Options.DataFlowTrace = Flags.data_flow_trace;
   if (Flags.features_dir)
     Options.FeaturesDir = Flags.features_dir;
+  if (Flags.fork_shared_map)
+    Options.ForkSharedMap = Flags.fork_shared_map;
   if (Flags.collect_data_flow)
     Options.CollectDataFlow = Flags.collect_data_flow;
   if (Flags.stop_file)
     Options.StopFile = Flags.stop_file;
+  if (Flags.corpus_pack) {
+    // The fork and merge modes pass the corpus dirs to the child processes,
+    // which would not see the pack.
+    if (Flags.fork || Flags.merge || Flags.merge_inner) {
+      Printf("ERROR: -corpus_pack can't be used with -fork or -merge\n");
+      exit(1);
+    }
+    Options.CorpusPack = Flags.corpus_pack;
+  }
 
   unsigned Seed = Flags.seed;
   // Initialize Seed.
@@ -719,6 +731,20 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.verbosity)
     Printf("INFO: Seed: %u\n", Seed);
 
+  if (Flags.write_corpus_pack) {
+    auto Files = ReadCorpora(*Inputs, ParseSeedInuts(Flags.seed_inputs));
+    size_t NumPacked = 0;
+    if (!WriteCorpusPack(Flags.write_corpus_pack, Files, Options.MaxLen,
+                         &NumPacked)) {
+      Printf("ERROR: failed to write the corpus pack %s\n",
+             Flags.write_corpus_pack);
+      exit(1);
+    }
+    Printf("INFO: wrote %zd inputs to the corpus pack %s\n", NumPacked,
+           Flags.write_corpus_pack);
+    exit(0);
+  }
+
   if (Flags.collect_data_flow && !Flags.fork && !Flags.merge) {
     if (RunIndividualFiles)
       return CollectDataFlow(Flags.collect_data_flow, Flags.data_flow_trace,
@@ -29,6 +29,98 @@
 
 namespace fuzzer {
 
+static const uint64_t kForkSharedMapMagic = 0x50414d4b524f464cULL; // LFORKMAP
+
+bool ForkSharedMap::Map(const std::string &MapPath) {
+  Close();
+  auto Data = MapSharedFile(MapPath, kMapSize);
+  if (!Data)
+    return false;
+  Path = MapPath;
+  Header = reinterpret_cast<MapHeader *>(Data);
+  FeatureWords =
+      reinterpret_cast<std::atomic<uint64_t> *>(Data + sizeof(MapHeader));
+  IndexSlots = FeatureWords + kNumFeatures / 64;
+  return true;
+}
+
+bool ForkSharedMap::Create(const std::string &MapPath) {
+  RemoveFile(MapPath);
+  if (!Map(MapPath))
+    return false;
+  // The file is freshly created, so both tables are already zeroed.
+  Header->NumFeatures = kNumFeatures;
+  Header->NumIndexSlots = kNumIndexSlots;
+  Header->Magic = kForkSharedMapMagic;
+  return true;
+}
+
+bool ForkSharedMap::Attach(const std::string &MapPath) {
+  if (FileSize(MapPath) < kMapSize || !Map(MapPath))
+    return false;
+  if (Header->Magic != kForkSharedMapMagic ||
+      Header->NumFeatures != kNumFeatures ||
+      Header->NumIndexSlots != kNumIndexSlots) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void ForkSharedMap::Close() {
+  if (!Header) return;
+  UnmapFile(reinterpret_cast<const uint8_t *>(Header), kMapSize);
+  Header = nullptr;
+  FeatureWords = IndexSlots = nullptr;
+  Path.clear();
+}
+
+bool ForkSharedMap::HasFeature(size_t Feature) const {
+  Feature %= kNumFeatures;
+  uint64_t Mask = 1ULL << (Feature % 64);
+  return FeatureWords[Feature / 64].load(std::memory_order_relaxed) & Mask;
+}
+
+bool ForkSharedMap::AddFeature(size_t Feature) {
+  Feature %= kNumFeatures;
+  uint64_t Mask = 1ULL << (Feature % 64);
+  auto &Word = FeatureWords[Feature / 64];
+  if (Word.load(std::memory_order_relaxed) & Mask)
+    return false;
+  return !(Word.fetch_or(Mask, std::memory_order_relaxed) & Mask);
+}
+
+// Index keys are the first 8 bytes of the SHA1; 0 marks an empty slot.
+static uint64_t IndexKey(const uint8_t *Sha1) {
+  uint64_t Key;
+  memcpy(&Key, Sha1, sizeof(Key));
+  return Key | 1;
+}
+
+bool ForkSharedMap::HasInput(const uint8_t *Sha1) const {
+  uint64_t Key = IndexKey(Sha1);
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    uint64_t Slot = IndexSlots[(Key + i) % kNumIndexSlots].load(
+        std::memory_order_relaxed);
+    if (Slot == Key) return true;
+    if (!Slot) return false;
+  }
+  return false;
+}
+
+bool ForkSharedMap::AddInput(const uint8_t *Sha1) {
+  uint64_t Key = IndexKey(Sha1);
+  for (size_t i = 0; i < kMaxProbes; i++) {
+    auto &Slot = IndexSlots[(Key + i) % kNumIndexSlots];
+    uint64_t Old = Slot.load(std::memory_order_relaxed);
+    if (!Old && Slot.compare_exchange_strong(Old, Key,
+                                             std::memory_order_relaxed))
+      return true;
+    if (Old == Key) return false;
+  }
+  return true;
+}
+
 struct Stats {
   size_t number_of_executed_units = 0;
   size_t peak_rss_mb = 0;
@@ -81,7 +173,8 @@ struct FuzzJob {
     RemoveFile(LogPath);
     RemoveFile(SeedListPath);
     RmDirRecursive(CorpusDir);
-    RmDirRecursive(FeaturesDir);
+    if (!FeaturesDir.empty())
+      RmDirRecursive(FeaturesDir);
   }
 };
 
@@ -95,6 +188,7 @@ struct GlobalEnv {
   Set<uint32_t> Features, Cov;
   Set<std::string> FilesWithDFT;
   Vector<std::string> Files;
+  ForkSharedMap SharedMap;
   Random *Rand;
   std::chrono::system_clock::time_point ProcessStartTime;
   int Verbosity = 0;
@@ -108,6 +202,23 @@ struct GlobalEnv {
 
   std::string StopFile() { return DirPlusFile(TempDir, "STOP"); }
 
+  // Publishes the initial corpus to the shared map. If the map can not be
+  // created the jobs fall back to passing feature sets through files.
+  void CreateSharedMap() {
+    if (!SharedMap.Create(DirPlusFile(TempDir, "shared.map"))) {
+      Printf("WARNING: -fork: failed to create the shared coverage map\n");
+      return;
+    }
+    for (auto Ft : Features)
+      SharedMap.AddFeature(Ft);
+    uint8_t Sha1[kSHA1NumBytes];
+    for (auto &Path : Files) {
+      auto U = FileToVector(Path);
+      ComputeSHA1(U.data(), U.size(), Sha1);
+      SharedMap.AddInput(Sha1);
+    }
+  }
+
   size_t secondsSinceProcessStartUp() const {
     return std::chrono::duration_cast<std::chrono::seconds>(
                std::chrono::system_clock::now() - ProcessStartTime)
@@ -152,17 +263,20 @@ struct GlobalEnv {
     }
     Job->LogPath = DirPlusFile(TempDir, std::to_string(JobId) + ".log");
     Job->CorpusDir = DirPlusFile(TempDir, "C" + std::to_string(JobId));
-    Job->FeaturesDir = DirPlusFile(TempDir, "F" + std::to_string(JobId));
     Job->CFPath = DirPlusFile(TempDir, std::to_string(JobId) + ".merge");
     Job->JobId = JobId;
 
 
     Cmd.addArgument(Job->CorpusDir);
-    Cmd.addFlag("features_dir", Job->FeaturesDir);
-
-    for (auto &D : {Job->CorpusDir, Job->FeaturesDir}) {
-      RmDirRecursive(D);
-      MkDir(D);
+    RmDirRecursive(Job->CorpusDir);
+    MkDir(Job->CorpusDir);
+    if (SharedMap.IsOpen()) {
+      Cmd.addFlag("fork_shared_map", SharedMap.GetPath());
+    } else {
+      Job->FeaturesDir = DirPlusFile(TempDir, "F" + std::to_string(JobId));
+      Cmd.addFlag("features_dir", Job->FeaturesDir);
+      RmDirRecursive(Job->FeaturesDir);
+      MkDir(Job->FeaturesDir);
     }
 
     Cmd.setOutputFile(Job->LogPath);
@@ -184,22 +298,27 @@ struct GlobalEnv {
     Vector<SizedFile> TempFiles, MergeCandidates;
     // Read all newly created inputs and their feature sets.
     // Choose only those inputs that have new features.
+    // With the shared map the job has already dropped the inputs without
+    // features missing from the map, so every input is a candidate.
     GetSizedFilesFromDir(Job->CorpusDir, &TempFiles);
     std::sort(TempFiles.begin(), TempFiles.end());
-    for (auto &F : TempFiles) {
-      auto FeatureFile = F.File;
-      FeatureFile.replace(0, Job->CorpusDir.size(), Job->FeaturesDir);
-      auto FeatureBytes = FileToVector(FeatureFile, 0, false);
-      assert((FeatureBytes.size() % sizeof(uint32_t)) == 0);
-      Vector<uint32_t> NewFeatures(FeatureBytes.size() / sizeof(uint32_t));
-      memcpy(NewFeatures.data(), FeatureBytes.data(), FeatureBytes.size());
-      for (auto Ft : NewFeatures) {
-        if (!Features.count(Ft)) {
-          MergeCandidates.push_back(F);
-          break;
+    if (SharedMap.IsOpen())
+      MergeCandidates = TempFiles;
+    else
+      for (auto &F : TempFiles) {
+        auto FeatureFile = F.File;
+        FeatureFile.replace(0, Job->CorpusDir.size(), Job->FeaturesDir);
+        auto FeatureBytes = FileToVector(FeatureFile, 0, false);
+        assert((FeatureBytes.size() % sizeof(uint32_t)) == 0);
+        Vector<uint32_t> NewFeatures(FeatureBytes.size() / sizeof(uint32_t));
+        memcpy(NewFeatures.data(), FeatureBytes.data(), FeatureBytes.size());
+        for (auto Ft : NewFeatures) {
+          if (!Features.count(Ft)) {
+            MergeCandidates.push_back(F);
+            break;
+          }
         }
       }
-    }
     // if (!FilesToAdd.empty() || Job->ExitCode != 0)
     Printf("#%zd: cov: %zd ft: %zd corp: %zd exec/s %zd "
            "oom/timeout/crash: %zd/%zd/%zd time: %zds job: %zd dft_time: %d\n",
@@ -212,13 +331,22 @@ struct GlobalEnv {
     Vector<std::string> FilesToAdd;
     Set<uint32_t> NewFeatures, NewCov;
     CrashResistantMerge(Args, {}, MergeCandidates, &FilesToAdd, Features,
-                        &NewFeatures, Cov, &NewCov, Job->CFPath, false);
+                        &NewFeatures, Cov, &NewCov, Job->CFPath, false,
+                        /*NumJobs=*/1);
     for (auto &Path : FilesToAdd) {
       auto U = FileToVector(Path);
       auto NewPath = DirPlusFile(MainCorpusDir, Hash(U));
       WriteToFile(U, NewPath);
       Files.push_back(NewPath);
+      if (SharedMap.IsOpen()) {
+        uint8_t Sha1[kSHA1NumBytes];
+        ComputeSHA1(U.data(), U.size(), Sha1);
+        SharedMap.AddInput(Sha1);
+      }
     }
+    if (SharedMap.IsOpen())
+      for (auto Ft : NewFeatures)
+        SharedMap.AddFeature(Ft);
     Features.insert(NewFeatures.begin(), NewFeatures.end());
     Cov.insert(NewCov.begin(), NewCov.end());
     for (auto Idx : NewCov)
@@ -312,8 +440,9 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
   auto CFPath = DirPlusFile(Env.TempDir, "merge.txt");
   CrashResistantMerge(Env.Args, {}, SeedFiles, &Env.Files, {}, &Env.Features,
                       {}, &Env.Cov,
-                      CFPath, false);
+                      CFPath, false, /*NumJobs=*/1);
   RemoveFile(CFPath);
+  Env.CreateSharedMap();
   Printf("INFO: -fork=%d: %zd seed inputs, starting to fuzz in %s\n", NumJobs,
          Env.Files.size(), Env.TempDir.c_str());
 
@@ -398,6 +527,7 @@ void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
 
   // The workers have terminated. Don't try to remove the directory before they
   // terminate to avoid a race condition preventing cleanup on Windows.
+  Env.SharedMap.Close();
   RmDirRecursive(Env.TempDir);
 
   // Use the exit code from the last child process.
@@ -13,9 +13,61 @@
 #include "FuzzerOptions.h"
 #include "FuzzerRandom.h"
 
+#include <atomic>
 #include <string>
 
 namespace fuzzer {
+
+// A feature bitmap and a corpus index that live in a file mapped by the
+// -fork=N parent and by all of its jobs. The parent publishes the features of
+// its merged corpus; jobs only write inputs that have features missing from
+// the bitmap and that no other job has written yet, so the parent does not
+// need per-input feature files to pick merge candidates.
+// Both tables are hints: the parent still merges the candidates exactly.
+class ForkSharedMap {
+ public:
+  // Same granularity as the features tracked by InputCorpus.
+  static const size_t kNumFeatures = 1 << 21;
+  static const size_t kNumIndexSlots = 1 << 18;
+
+  ~ForkSharedMap() { Close(); }
+
+  // Creates (or truncates) the map file at Path. Called by the parent.
+  bool Create(const std::string &Path);
+  // Maps an existing map file created by the parent. Called by the jobs.
+  bool Attach(const std::string &Path);
+  void Close();
+  bool IsOpen() const { return Header != nullptr; }
+  const std::string &GetPath() const { return Path; }
+
+  bool HasFeature(size_t Feature) const;
+  // Returns true if Feature was not in the map before.
+  bool AddFeature(size_t Feature);
+
+  bool HasInput(const uint8_t *Sha1) const;
+  // Returns false if Sha1 was already in the index. When the index is
+  // saturated the input is reported as new.
+  bool AddInput(const uint8_t *Sha1);
+
+ private:
+  struct MapHeader {
+    uint64_t Magic;
+    uint64_t NumFeatures;
+    uint64_t NumIndexSlots;
+    uint64_t Padding;
+  };
+  static const size_t kMapSize = sizeof(MapHeader) + kNumFeatures / 8 +
+                                 kNumIndexSlots * sizeof(uint64_t);
+  static const size_t kMaxProbes = 64;
+
+  bool Map(const std::string &Path);
+
+  std::string Path;
+  MapHeader *Header = nullptr;
+  std::atomic<uint64_t> *FeatureWords = nullptr;
+  std::atomic<uint64_t> *IndexSlots = nullptr;
+};
+
 void FuzzWithFork(Random &Rand, const FuzzingOptions &Options,
                   const Vector<std::string> &Args,
                   const Vector<std::string> &CorpusDirs, int NumJobs);
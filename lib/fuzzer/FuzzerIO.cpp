@@ -14,6 +14,7 @@
 #include "FuzzerUtil.h"
 #include <algorithm>
 #include <cstdarg>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <sys/stat.h>
@@ -50,6 +51,114 @@ Unit FileToVector(const std::string &Path, size_t MaxSize, bool ExitOnError) {
   return Res;
 }
 
+static const char kCorpusPackMagic[8] = {'L', 'F', 'P', 'A',
+                                         'C', 'K', '0', '1'};
+static const size_t kCorpusPackHeaderSize = 16;
+static const size_t kCorpusPackEntrySize = 16;
+
+static uint64_t ReadLE64(const uint8_t *P) {
+  uint64_t V = 0;
+  for (size_t i = 0; i < 8; i++)
+    V |= static_cast<uint64_t>(P[i]) << (8 * i);
+  return V;
+}
+
+static void WriteLE64(std::ostream &OS, uint64_t V) {
+  char Buf[8];
+  for (size_t i = 0; i < 8; i++)
+    Buf[i] = static_cast<char>(V >> (8 * i));
+  OS.write(Buf, sizeof(Buf));
+}
+
+bool CorpusPack::Open(const std::string &Path) {
+  Close();
+  size_t Size = 0;
+  const uint8_t *Data = MapFile(Path, &Size);
+  if (!Data)
+    return false;
+  Base = Data;
+  MappedSize = Size;
+  if (Size < kCorpusPackHeaderSize ||
+      memcmp(Data, kCorpusPackMagic, sizeof(kCorpusPackMagic))) {
+    Close();
+    return false;
+  }
+  uint64_t N = ReadLE64(Data + sizeof(kCorpusPackMagic));
+  if (N > (Size - kCorpusPackHeaderSize) / kCorpusPackEntrySize) {
+    Close();
+    return false;
+  }
+  NumInputs = N;
+  for (size_t i = 0; i < NumInputs; i++) {
+    uint64_t Offset = IndexEntry(i, 0), Len = IndexEntry(i, 1);
+    if (Offset > Size || Len > Size - Offset) {
+      Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void CorpusPack::Close() {
+  if (Base)
+    UnmapFile(Base, MappedSize);
+  Base = nullptr;
+  MappedSize = 0;
+  NumInputs = 0;
+}
+
+uint64_t CorpusPack::IndexEntry(size_t Idx, size_t Field) const {
+  return ReadLE64(Base + kCorpusPackHeaderSize + Idx * kCorpusPackEntrySize +
+                  Field * 8);
+}
+
+const uint8_t *CorpusPack::Data(size_t Idx) const {
+  assert(Idx < NumInputs);
+  return Base + IndexEntry(Idx, 0);
+}
+
+size_t CorpusPack::Size(size_t Idx) const {
+  assert(Idx < NumInputs);
+  return IndexEntry(Idx, 1);
+}
+
+bool WriteCorpusPack(const std::string &Path, const Vector<SizedFile> &Files,
+                     size_t MaxSize, size_t *NumPacked) {
+  std::ofstream OF(Path, std::ios::binary | std::ios::trunc);
+  OF.write(kCorpusPackMagic, sizeof(kCorpusPackMagic));
+  // The number of inputs and the payload sizes are known only after reading
+  // the files, so the header and the index are filled in at the end. Space is
+  // reserved for all files; the entries of the skipped ones stay unused.
+  uint64_t Offset =
+      kCorpusPackHeaderSize + Files.size() * kCorpusPackEntrySize;
+  OF.seekp(Offset);
+  Vector<uint64_t> Index;
+  Index.reserve(Files.size() * 2);
+  for (auto &SF : Files) {
+    size_t FileLen = SF.Size;
+    if (MaxSize)
+      FileLen = std::min(FileLen, MaxSize);
+    Unit U(FileLen);
+    std::ifstream T(SF.File, std::ios::binary);
+    T.read(reinterpret_cast<char *>(U.data()), FileLen);
+    if (!T) {
+      Printf("WARNING: failed to read %s, not adding it to the corpus pack\n",
+             SF.File.c_str());
+      continue;
+    }
+    OF.write(reinterpret_cast<const char *>(U.data()), U.size());
+    Index.push_back(Offset);
+    Index.push_back(U.size());
+    Offset += U.size();
+  }
+  *NumPacked = Index.size() / 2;
+  OF.seekp(sizeof(kCorpusPackMagic));
+  WriteLE64(OF, *NumPacked);
+  for (auto V : Index)
+    WriteLE64(OF, V);
+  return static_cast<bool>(OF);
+}
+
 std::string FileToString(const std::string &Path) {
   std::ifstream T(Path, std::ios::binary);
   return std::string((std::istreambuf_iterator<char>(T)),
@@ -59,6 +59,12 @@ void RawPrint(const char *Str);
 // Platform specific functions:
 bool IsFile(const std::string &Path);
 size_t FileSize(const std::string &Path);
+// Maps the whole file read-only, returns nullptr on failure.
+const uint8_t *MapFile(const std::string &Path, size_t *Size);
+void UnmapFile(const uint8_t *Data, size_t Size);
+// Maps 'Size' bytes of the file read-write and shared with other processes,
+// creating or extending the file if needed. Returns nullptr on failure.
+uint8_t *MapSharedFile(const std::string &Path, size_t Size);
 
 void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
                              Vector<std::string> *V, bool TopDir);
@@ -81,6 +87,40 @@ struct SizedFile {
 
 void GetSizedFilesFromDir(const std::string &Dir, Vector<SizedFile> *V);
 
+// A corpus pack holds many inputs in a single file, so that a large seed
+// corpus can be mapped into memory at once instead of being read file by file.
+// Layout, all integers are 64-bit little-endian:
+//   "LFPACK01" magic, the number of inputs N,
+//   N index entries {offset from the start of the file, size},
+//   the payloads.
+// scripts/corpus_pack.py converts between corpus dirs and packs.
+class CorpusPack {
+ public:
+  ~CorpusPack() { Close(); }
+  // Maps the pack and validates its index.
+  bool Open(const std::string &Path);
+  void Close();
+
+  size_t size() const { return NumInputs; }
+  bool empty() const { return NumInputs == 0; }
+  // The data stays valid until Close().
+  const uint8_t *Data(size_t Idx) const;
+  size_t Size(size_t Idx) const;
+
+ private:
+  uint64_t IndexEntry(size_t Idx, size_t Field) const;
+
+  const uint8_t *Base = nullptr;
+  size_t MappedSize = 0;
+  size_t NumInputs = 0;
+};
+
+// Writes the contents of Files (truncated to MaxSize, if non-zero) into a
+// corpus pack. The files which can't be read are skipped with a warning.
+// Returns false on failure, otherwise sets *NumPacked.
+bool WriteCorpusPack(const std::string &Path, const Vector<SizedFile> &Files,
+                     size_t MaxSize, size_t *NumPacked);
+
 char GetSeparator();
 // Similar to the basename utility: returns the file name w/o the dir prefix.
 std::string Basename(const std::string &Path);
@@ -17,7 +17,9 @@
 #include <dirent.h>
 #include <fstream>
 #include <iterator>
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -45,6 +47,45 @@ size_t FileSize(const std::string &Path) {
   return St.st_size;
 }
 
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return nullptr;
+  struct stat St;
+  if (fstat(Fd, &St) || St.st_size == 0) {
+    close(Fd);
+    return nullptr;
+  }
+  void *Data = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  if (Data == MAP_FAILED)
+    return nullptr;
+  *Size = St.st_size;
+  return static_cast<const uint8_t *>(Data);
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) {
+  munmap(const_cast<uint8_t *>(Data), Size);
+}
+
+uint8_t *MapSharedFile(const std::string &Path, size_t Size) {
+  int Fd = open(Path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (Fd < 0)
+    return nullptr;
+  struct stat St;
+  if (fstat(Fd, &St) ||
+      ((size_t)St.st_size < Size && ftruncate(Fd, Size))) {
+    close(Fd);
+    return nullptr;
+  }
+  void *Data =
+      mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if (Data == MAP_FAILED)
+    return nullptr;
+  return static_cast<uint8_t *>(Data);
+}
+
 std::string Basename(const std::string &Path) {
   size_t Pos = Path.rfind(GetSeparator());
   if (Pos == std::string::npos) return Path;
@@ -98,6 +98,53 @@ size_t FileSize(const std::string &Path) {
   return size.QuadPart;
 }
 
+const uint8_t *MapFile(const std::string &Path, size_t *Size) {
+  HANDLE File = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (File == INVALID_HANDLE_VALUE)
+    return nullptr;
+  LARGE_INTEGER FileSize;
+  if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0) {
+    CloseHandle(File);
+    return nullptr;
+  }
+  HANDLE Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(File);
+  if (!Mapping)
+    return nullptr;
+  void *Data = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(Mapping);
+  if (!Data)
+    return nullptr;
+  *Size = FileSize.QuadPart;
+  return static_cast<const uint8_t *>(Data);
+}
+
+void UnmapFile(const uint8_t *Data, size_t Size) {
+  UnmapViewOfFile(Data);
+}
+
+uint8_t *MapSharedFile(const std::string &Path, size_t Size) {
+  HANDLE File = CreateFileA(Path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (File == INVALID_HANDLE_VALUE)
+    return nullptr;
+  ULARGE_INTEGER MapSize;
+  MapSize.QuadPart = Size;
+  // Extends the file to Size if it is shorter.
+  HANDLE Mapping = CreateFileMappingA(File, NULL, PAGE_READWRITE,
+                                      MapSize.HighPart, MapSize.LowPart, NULL);
+  CloseHandle(File);
+  if (!Mapping)
+    return nullptr;
+  void *Data = MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, Size);
+  CloseHandle(Mapping);
+  if (!Data)
+    return nullptr;
+  return static_cast<uint8_t *>(Data);
+}
+
 void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
                              Vector<std::string> *V, bool TopDir) {
   auto E = GetEpoch(Dir);
@@ -14,6 +14,7 @@
 #include "FuzzerDataFlowTrace.h"
 #include "FuzzerDefs.h"
 #include "FuzzerExtFunctions.h"
+#include "FuzzerFork.h"
 #include "FuzzerInterface.h"
 #include "FuzzerOptions.h"
 #include "FuzzerSHA1.h"
@@ -141,6 +142,12 @@ private:
 
   Vector<uint32_t> UniqFeatureSetTmp;
 
+  // Shared with the -fork=N parent and the other jobs, if attached.
+  ForkSharedMap SharedMap;
+  // Set by RunOne if the new unit does not need to reach the output corpus
+  // because the -fork=N parent already has all of its features.
+  bool UnitIsKnownToForkParent = false;
+
   // Need to know our own thread.
   static thread_local bool IsMyThread;
 };
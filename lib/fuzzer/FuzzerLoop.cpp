@@ -152,6 +152,10 @@ Fuzzer::Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
     TPC.PrintModuleInfo();
   if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec)
     EpochOfLastReadOfOutputCorpus = GetEpoch(Options.OutputCorpus);
+  if (!Options.ForkSharedMap.empty() &&
+      !SharedMap.Attach(Options.ForkSharedMap))
+    Printf("WARNING: failed to attach the fork shared map %s\n",
+           Options.ForkSharedMap.c_str());
   MaxInputLen = MaxMutationLen = Options.MaxLen;
   TmpMaxMutationLen = 0;  // Will be set once we load the corpus.
   AllocateCurrentUnitData();
@@ -462,8 +466,20 @@ static void RenameFeatureSetFile(const std::string &FeaturesDir,
              DirPlusFile(FeaturesDir, NewFile));
 }
 
+// Returns true if the -fork=N parent already has all features of II.
+static bool IsKnownToForkParent(const ForkSharedMap &SharedMap,
+                                const InputInfo &II) {
+  if (!SharedMap.IsOpen())
+    return false;
+  for (auto Feature : II.UniqFeatureSet)
+    if (!SharedMap.HasFeature(Feature))
+      return false;
+  return true;
+}
+
 bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
                     InputInfo *II, bool *FoundUniqFeatures) {
+  UnitIsKnownToForkParent = false;
   if (!Size)
     return false;
 
@@ -491,6 +507,7 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
                                     UniqFeatureSetTmp, DFT, II);
     WriteFeatureSetToFile(Options.FeaturesDir, Sha1ToString(NewII->Sha1),
                           NewII->UniqFeatureSet);
+    UnitIsKnownToForkParent = IsKnownToForkParent(SharedMap, *NewII);
     return true;
   }
   if (II && FoundUniqFeaturesOfII &&
@@ -501,6 +518,7 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
     Corpus.Replace(II, {Data, Data + Size});
     RenameFeatureSetFile(Options.FeaturesDir, OldFeaturesFile,
                          Sha1ToString(II->Sha1));
+    UnitIsKnownToForkParent = IsKnownToForkParent(SharedMap, *II);
     return true;
   }
   return false;
@@ -606,7 +624,14 @@ void Fuzzer::ReportNewCoverage(InputInfo *II, const Unit &U) {
   II->NumSuccessfullMutations++;
   MD.RecordSuccessfulMutationSequence();
   PrintStatusForNewUnit(U, II->Reduced ? "REDUCE" : "NEW   ");
-  WriteToOutputCorpus(U);
+  if (SharedMap.IsOpen() && !UnitIsKnownToForkParent) {
+    // Skip the unit if another job has already written it.
+    uint8_t Sha1[kSHA1NumBytes];
+    ComputeSHA1(U.data(), U.size(), Sha1);
+    UnitIsKnownToForkParent = !SharedMap.AddInput(Sha1);
+  }
+  if (!UnitIsKnownToForkParent)
+    WriteToOutputCorpus(U);
   NumberOfNewUnitsAdded++;
   CheckExitOnSrcPosOrItem(); // Check only after the unit is saved to corpus.
   LastCorpusUpdateRun = TotalNumberOfRuns;
@@ -734,6 +759,17 @@ void Fuzzer::ReadAndExecuteSeedCorpora(Vector<SizedFile> &CorporaFiles) {
     MinSize = Min(File.Size, MinSize);
     TotalSize += File.Size;
   }
+  CorpusPack Pack;
+  if (!Options.CorpusPack.empty() && !Pack.Open(Options.CorpusPack)) {
+    Printf("ERROR: failed to open the corpus pack %s\n",
+           Options.CorpusPack.c_str());
+    exit(1);
+  }
+  for (size_t i = 0; i < Pack.size(); i++) {
+    MaxSize = Max(Pack.Size(i), MaxSize);
+    MinSize = Min(Pack.Size(i), MinSize);
+    TotalSize += Pack.Size(i);
+  }
   if (Options.MaxLen == 0)
     SetMaxInputLen(std::min(std::max(kMinDefaultLen, MaxSize), kMaxSaneLen));
   assert(MaxInputLen > 0);
@@ -742,18 +778,19 @@ void Fuzzer::ReadAndExecuteSeedCorpora(Vector<SizedFile> &CorporaFiles) {
   uint8_t dummy = 0;
   ExecuteCallback(&dummy, 0);
 
-  if (CorporaFiles.empty()) {
+  if (CorporaFiles.empty() && Pack.empty()) {
     Printf("INFO: A corpus is not provided, starting from an empty corpus\n");
     Unit U({'\n'}); // Valid ASCII input.
     RunOne(U.data(), U.size());
   } else {
     Printf("INFO: seed corpus: files: %zd min: %zdb max: %zdb total: %zdb"
            " rss: %zdMb\n",
-           CorporaFiles.size(), MinSize, MaxSize, TotalSize, GetPeakRSSMb());
+           CorporaFiles.size() + Pack.size(), MinSize, MaxSize, TotalSize,
+           GetPeakRSSMb());
     if (Options.ShuffleAtStartUp)
       std::shuffle(CorporaFiles.begin(), CorporaFiles.end(), MD.GetRand());
 
-    if (Options.PreferSmall) {
+    if (Options.PreferSmall && !CorporaFiles.empty()) {
       std::stable_sort(CorporaFiles.begin(), CorporaFiles.end());
       assert(CorporaFiles.front().Size <= CorporaFiles.back().Size);
     }
@@ -767,6 +804,29 @@ void Fuzzer::ReadAndExecuteSeedCorpora(Vector<SizedFile> &CorporaFiles) {
       TryDetectingAMemoryLeak(U.data(), U.size(),
                               /*DuringInitialCorpusExecution*/ true);
     }
+
+    // Execute inputs from the corpus pack in place. Only the inputs that
+    // get added to the corpus are copied.
+    if (!Pack.empty()) {
+      Printf("INFO: corpus pack: %zd inputs from %s\n", Pack.size(),
+             Options.CorpusPack.c_str());
+      Vector<size_t> Order(Pack.size());
+      for (size_t i = 0; i < Order.size(); i++)
+        Order[i] = i;
+      if (Options.ShuffleAtStartUp)
+        std::shuffle(Order.begin(), Order.end(), MD.GetRand());
+      if (Options.PreferSmall)
+        std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+          return Pack.Size(A) < Pack.Size(B);
+        });
+      for (auto Idx : Order) {
+        size_t Size = Min(Pack.Size(Idx), MaxInputLen);
+        RunOne(Pack.Data(Idx), Size);
+        CheckExitOnSrcPosOrItem();
+        TryDetectingAMemoryLeak(Pack.Data(Idx), Size,
+                                /*DuringInitialCorpusExecution*/ true);
+      }
+    }
   }
 
   PrintStats("INITED");
@@ -19,6 +19,7 @@
 #include <iterator>
 #include <set>
 #include <sstream>
+#include <thread>
 #include <unordered_set>
 
 namespace fuzzer {
@@ -296,6 +297,145 @@ static size_t WriteNewControlFile(const std::string &CFPath,
   return FilesToUse.size();
 }
 
+// Writes STARTED/FT/COV lines for files FirstFile, FirstFile + 1, ... taken
+// from the partial control files of Shards.size() merge shards; shard K has
+// processed files FirstFile + K, FirstFile + K + Shards.size(), etc.
+// An inner process records only the features not seen in the previous inputs
+// it has processed. The union of such features over any prefix is the same
+// as the union of all features, so we get the records of a single inner
+// process by dropping the features of all preceding files (SeenFeatures).
+// Stops at the first file that was not processed by its shard.
+// Returns the number of files written.
+size_t WriteShardedMergeRecords(std::ostream &OS, size_t FirstFile,
+                                const Vector<Merger> &Shards,
+                                Set<uint32_t> *SeenFeatures) {
+  const size_t NumShards = Shards.size();
+  size_t NumFiles = 0;
+  for (auto &S : Shards)
+    NumFiles += S.Files.size();
+  for (size_t i = 0; i < NumFiles; i++) {
+    auto &S = Shards[i % NumShards];
+    size_t Idx = i / NumShards;
+    if (Idx >= S.FirstNotProcessedFile)
+      return i;
+    auto &F = S.Files[Idx];
+    size_t FileId = FirstFile + i;
+    OS << "STARTED " << FileId << " " << F.Size << "\n";
+    // The last input of the shard has crashed, leave it unfinished.
+    if (Idx + 1 == S.FirstNotProcessedFile && !S.LastFailure.empty())
+      continue;
+    OS << "FT " << FileId;
+    for (auto Fe : F.Features)
+      if (SeenFeatures->insert(Fe).second)
+        OS << " " << Fe;
+    OS << "\n";
+    OS << "COV " << FileId;
+    for (auto Cov : F.Cov)
+      OS << " " << Cov;
+    OS << "\n";
+  }
+  return NumFiles;
+}
+
+// Executes the inner process until it passes.
+// Every inner process should execute at least one input.
+static void RunMergeInner(const Command &BaseCmd, const std::string &CFPath,
+                          size_t NumAttempts, bool V) {
+  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
+    Fuzzer::MaybeExitGracefully();
+    VPrintf(V, "MERGE-OUTER: attempt %zd\n", Attempt);
+    Command Cmd(BaseCmd);
+    Cmd.addFlag("merge_control_file", CFPath);
+    Cmd.addFlag("merge_inner", "1");
+    if (!V) {
+      Cmd.setOutputFile(getDevNull());
+      Cmd.combineOutAndErr();
+    }
+    auto ExitCode = ExecuteCommand(Cmd);
+    if (!ExitCode) {
+      VPrintf(V, "MERGE-OUTER: succesfull in %zd attempt(s)\n", Attempt);
+      break;
+    }
+  }
+}
+
+// Splits the not yet processed files of the control file between NumJobs
+// shards, runs the shards in parallel and appends their results to CFPath.
+static void RunShardedMergeInner(const Command &BaseCmd,
+                                 const std::string &CFPath, size_t NumJobs,
+                                 bool V) {
+  Merger M;
+  std::ifstream IF(CFPath);
+  M.ParseOrExit(IF, true);
+  IF.close();
+  const size_t FirstFile = M.FirstNotProcessedFile;
+  const size_t NumFiles = M.Files.size() - FirstFile;
+  NumJobs = std::min(NumJobs, NumFiles);
+  VPrintf(V, "MERGE-OUTER: processing %zd files in %zd shards\n", NumFiles,
+          NumJobs);
+
+  Vector<std::string> ShardPaths(NumJobs);
+  for (size_t J = 0; J < NumJobs; J++) {
+    ShardPaths[J] = CFPath + "." + std::to_string(J);
+    size_t NumShardFiles = 0, NumShardFilesInFirstCorpus = 0;
+    for (size_t i = FirstFile + J; i < M.Files.size(); i += NumJobs) {
+      NumShardFiles++;
+      if (i < M.NumFilesInFirstCorpus)
+        NumShardFilesInFirstCorpus++;
+    }
+    RemoveFile(ShardPaths[J]);
+    std::ofstream OF(ShardPaths[J]);
+    OF << NumShardFiles << "\n" << NumShardFilesInFirstCorpus << "\n";
+    for (size_t i = FirstFile + J; i < M.Files.size(); i += NumJobs)
+      OF << M.Files[i].Name << "\n";
+    if (!OF) {
+      Printf("MERGE-OUTER: failed to write to the control file: %s\n",
+             ShardPaths[J].c_str());
+      exit(1);
+    }
+  }
+
+  Vector<std::thread> Threads;
+  for (size_t J = 0; J < NumJobs; J++)
+    Threads.push_back(std::thread([&, J]() {
+      RunMergeInner(BaseCmd, ShardPaths[J], NumFiles / NumJobs + 1, V);
+    }));
+  for (auto &T : Threads)
+    T.join();
+
+  // Parse the partial control files in parallel, combine them sequentially.
+  Vector<Merger> Shards(NumJobs);
+  Vector<char> Parsed(NumJobs);
+  Threads.clear();
+  for (size_t J = 0; J < NumJobs; J++)
+    Threads.push_back(std::thread([&, J]() {
+      std::ifstream SF(ShardPaths[J]);
+      Parsed[J] = Shards[J].Parse(SF, true);
+    }));
+  for (auto &T : Threads)
+    T.join();
+  for (size_t J = 0; J < NumJobs; J++) {
+    if (!Parsed[J]) {
+      Printf("MERGE-OUTER: failed to parse the control file: %s\n",
+             ShardPaths[J].c_str());
+      exit(1);
+    }
+  }
+
+  Set<uint32_t> SeenFeatures;
+  for (size_t i = 0; i < FirstFile; i++)
+    SeenFeatures.insert(M.Files[i].Features.begin(),
+                        M.Files[i].Features.end());
+  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app);
+  size_t NumWritten =
+      WriteShardedMergeRecords(OF, FirstFile, Shards, &SeenFeatures);
+  OF.close();
+  VPrintf(V, "MERGE-OUTER: %zd of %zd files processed by the shards\n",
+          NumWritten, NumFiles);
+  for (auto &Path : ShardPaths)
+    RemoveFile(Path);
+}
+
 // Outer process. Does not call the target code and thus should not fail.
 void CrashResistantMerge(const Vector<std::string> &Args,
                          const Vector<SizedFile> &OldCorpus,
@@ -306,7 +446,8 @@ void CrashResistantMerge(const Vector<std::string> &Args,
                          const Set<uint32_t> &InitialCov,
                          Set<uint32_t> *NewCov,
                          const std::string &CFPath,
-                         bool V /*Verbose*/) {
+                         bool V /*Verbose*/,
+                         size_t NumJobs) {
   if (NewCorpus.empty() && OldCorpus.empty()) return;  // Nothing to merge.
   size_t NumAttempts = 0;
   Vector<MergeFileInfo> KnownFiles;
@@ -357,28 +498,16 @@ void CrashResistantMerge(const Vector<std::string> &Args,
     NumAttempts = WriteNewControlFile(CFPath, OldCorpus, NewCorpus, KnownFiles);
   }
 
-  // Execute the inner process until it passes.
-  // Every inner process should execute at least one input.
   Command BaseCmd(Args);
   BaseCmd.removeFlag("merge");
   BaseCmd.removeFlag("fork");
   BaseCmd.removeFlag("collect_data_flow");
-  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
-    Fuzzer::MaybeExitGracefully();
-    VPrintf(V, "MERGE-OUTER: attempt %zd\n", Attempt);
-    Command Cmd(BaseCmd);
-    Cmd.addFlag("merge_control_file", CFPath);
-    Cmd.addFlag("merge_inner", "1");
-    if (!V) {
-      Cmd.setOutputFile(getDevNull());
-      Cmd.combineOutAndErr();
-    }
-    auto ExitCode = ExecuteCommand(Cmd);
-    if (!ExitCode) {
-      VPrintf(V, "MERGE-OUTER: succesfull in %zd attempt(s)\n", Attempt);
-      break;
-    }
-  }
+  BaseCmd.removeFlag("jobs");
+  BaseCmd.removeFlag("workers");
+  if (NumJobs > 1 && NumAttempts > 1)
+    RunShardedMergeInner(BaseCmd, CFPath, NumJobs, V);
+  else
+    RunMergeInner(BaseCmd, CFPath, NumAttempts, V);
   // Read the control file and do the merge.
   Merger M;
   std::ifstream IF(CFPath);
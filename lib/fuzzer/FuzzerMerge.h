@@ -31,6 +31,12 @@
 //   Once all inputs are processed by the innner process(es) the outer process
 //   reads the control files and does the merge based entirely on the contents
 //   of control file.
+//
+//   With -jobs=N the inputs that are not yet processed are split between
+//   N shards, each with its own partial control file and its own sequence of
+//   inner processes. Once all shards are done the outer process combines the
+//   partial control files into the main one, so that the result is the same
+//   as if all inputs were processed by a single inner process.
 //   It uses a single pass greedy algorithm choosing first the smallest inputs
 //   within the same size the inputs that have more new features.
 //
@@ -70,6 +76,10 @@ struct Merger {
   Set<uint32_t> AllFeatures() const;
 };
 
+size_t WriteShardedMergeRecords(std::ostream &OS, size_t FirstFile,
+                                const Vector<Merger> &Shards,
+                                Set<uint32_t> *SeenFeatures);
+
 void CrashResistantMerge(const Vector<std::string> &Args,
                          const Vector<SizedFile> &OldCorpus,
                          const Vector<SizedFile> &NewCorpus,
@@ -79,7 +89,8 @@ void CrashResistantMerge(const Vector<std::string> &Args,
                          const Set<uint32_t> &InitialCov,
                          Set<uint32_t> *NewCov,
                          const std::string &CFPath,
-                         bool Verbose);
+                         bool Verbose,
+                         size_t NumJobs);
 
 }  // namespace fuzzer
 
@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+#===- lib/fuzzer/scripts/corpus_pack.py ------------------------------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===------------------------------------------------------------------------===#
+#
+# Convert between libFuzzer corpus dirs and corpus pack files
+# (see CorpusPack in FuzzerIO.h).
+# Usage:
+#   corpus_pack.py pack PACK DIR [DIR ...]
+#   corpus_pack.py unpack PACK DIR
+#   corpus_pack.py list PACK
+# The packed corpus is used with 'my_fuzzer -corpus_pack=PACK'.
+#
+#===------------------------------------------------------------------------===#
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+
+MAGIC = b'LFPACK01'
+ENTRY = struct.Struct('<QQ')
+
+def ListFiles(dirs):
+  for d in dirs:
+    for root, _, files in os.walk(d):
+      for f in sorted(files):
+        if not f.startswith('.'):
+          yield os.path.join(root, f)
+
+def Pack(args):
+  files = list(ListFiles(args.dirs))
+  offset = len(MAGIC) + 8 + len(files) * ENTRY.size
+  index = []
+  with open(args.pack, 'wb') as out:
+    out.seek(offset)
+    for path in files:
+      with open(path, 'rb') as f:
+        data = f.read()
+      out.write(data)
+      index.append((offset, len(data)))
+      offset += len(data)
+    out.seek(0)
+    out.write(MAGIC)
+    out.write(struct.pack('<Q', len(index)))
+    for entry in index:
+      out.write(ENTRY.pack(*entry))
+  print('Packed %d inputs into %s' % (len(index), args.pack))
+
+def ReadPack(path):
+  with open(path, 'rb') as f:
+    data = f.read()
+  if data[:len(MAGIC)] != MAGIC:
+    sys.exit('%s: not a corpus pack' % path)
+  n, = struct.unpack_from('<Q', data, len(MAGIC))
+  for i in range(n):
+    offset, size = ENTRY.unpack_from(data, len(MAGIC) + 8 + i * ENTRY.size)
+    if offset + size > len(data):
+      sys.exit('%s: input %d is out of bounds' % (path, i))
+    yield data[offset:offset + size]
+
+def Unpack(args):
+  if not os.path.isdir(args.dir):
+    os.makedirs(args.dir)
+  n = 0
+  for unit in ReadPack(args.pack):
+    # Name the files the same way libFuzzer does.
+    name = hashlib.sha1(unit).hexdigest()
+    with open(os.path.join(args.dir, name), 'wb') as f:
+      f.write(unit)
+    n += 1
+  print('Unpacked %d inputs into %s' % (n, args.dir))
+
+def List(args):
+  for i, unit in enumerate(ReadPack(args.pack)):
+    print('%d %d %s' % (i, len(unit), hashlib.sha1(unit).hexdigest()))
+
+def main(argv):
+  parser = argparse.ArgumentParser(description='libFuzzer corpus pack tool')
+  subparsers = parser.add_subparsers(dest='command')
+  pack = subparsers.add_parser('pack', help='pack corpus dirs')
+  pack.add_argument('pack')
+  pack.add_argument('dirs', nargs='+')
+  pack.set_defaults(func=Pack)
+  unpack = subparsers.add_parser('unpack', help='unpack into a corpus dir')
+  unpack.add_argument('pack')
+  unpack.add_argument('dir')
+  unpack.set_defaults(func=Unpack)
+  lst = subparsers.add_parser('list', help='list the inputs of a pack')
+  lst.add_argument('pack')
+  lst.set_defaults(func=List)
+  args = parser.parse_args(argv)
+  if not hasattr(args, 'func'):
+    parser.print_help()
+    return 1
+  args.func(args)
+  return 0
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv[1:]))
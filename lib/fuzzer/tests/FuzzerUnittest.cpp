@@ -11,6 +11,8 @@
 
 #include "FuzzerCorpus.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerFork.h"
+#include "FuzzerIO.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
@@ -609,6 +611,41 @@ TEST(Corpus, Distribution) {
   }
 }
 
+TEST(Corpus, WeightedIndexDistribution) {
+  Random Rand(0);
+  WeightedIndexDistribution D;
+  const size_t N = 37;
+  for (size_t i = 0; i < N; i++)
+    D.Append(i % 3 ? i : 0);
+  D.SetWeight(5, 0);
+  D.SetWeight(6, 100);
+  double Total = 0;
+  for (size_t i = 0; i < N; i++)
+    Total += D.Weight(i);
+  EXPECT_EQ(Total, D.TotalWeight());
+
+  const size_t kTries = 1 << 20;
+  Vector<size_t> Hist(N);
+  for (size_t i = 0; i < kTries; i++)
+    Hist[D(Rand)]++;
+  for (size_t i = 0; i < N; i++) {
+    double Expected = kTries * D.Weight(i) / Total;
+    if (Expected == 0)
+      EXPECT_EQ(Hist[i], 0U);
+    else
+      EXPECT_NEAR(Hist[i], Expected, Expected / 5 + 10);
+  }
+
+  // All weights are zero: uniform.
+  for (size_t i = 0; i < N; i++)
+    D.SetWeight(i, 0);
+  Vector<size_t> Hist2(N);
+  for (size_t i = 0; i < N * 1000; i++)
+    Hist2[D(Rand)]++;
+  for (size_t i = 0; i < N; i++)
+    EXPECT_GT(Hist2[i], 500U);
+}
+
 TEST(Merge, Bad) {
   const char *kInvalidInputs[] = {
     "",
@@ -762,6 +799,114 @@ TEST(Merge, Merge) {
         {"B", "D"}, 3);
 }
 
+// Builds a control file for Files[Ids[0]], Files[Ids[1]], ... the way a single
+// inner process would write it. Features of the input Crashed are not written.
+static std::string MergeControlFile(const Vector<Vector<uint32_t>> &Files,
+                                    const Vector<size_t> &Ids,
+                                    size_t NumFilesInFirstCorpus,
+                                    size_t Crashed) {
+  std::ostringstream OS;
+  OS << Ids.size() << "\n" << NumFilesInFirstCorpus << "\n";
+  for (auto Id : Ids)
+    OS << "F" << Id << "\n";
+  Set<uint32_t> Seen;
+  for (size_t i = 0; i < Ids.size(); i++) {
+    OS << "STARTED " << i << " " << 100 + Ids[i] << "\n";
+    if (Ids[i] == Crashed)
+      continue;
+    OS << "FT " << i;
+    for (auto Fe : Files[Ids[i]])
+      if (Seen.insert(Fe).second)
+        OS << " " << Fe;
+    OS << "\nCOV " << i << "\n";
+  }
+  return OS.str();
+}
+
+TEST(Merge, Sharded) {
+  Vector<Vector<uint32_t>> Files = {
+      {1, 2, 3}, {2, 3, 4}, {5}, {1, 5, 6}, {7}, {2, 7, 8}, {4, 8, 9}};
+  Vector<size_t> AllIds;
+  for (size_t i = 0; i < Files.size(); i++)
+    AllIds.push_back(i);
+  const size_t kNoCrash = Files.size();
+  for (size_t Crashed : {kNoCrash, (size_t)2}) {
+    std::string Serial = MergeControlFile(Files, AllIds, 2, Crashed);
+    for (size_t NumShards = 1; NumShards <= Files.size(); NumShards++) {
+      Vector<Merger> Shards(NumShards);
+      size_t NumFiles = 0;
+      for (size_t J = 0; J < NumShards; J++) {
+        Vector<size_t> Ids;
+        size_t NumFilesInFirstCorpus = 0;
+        for (size_t i = J; i < Files.size(); i += NumShards) {
+          Ids.push_back(i);
+          NumFilesInFirstCorpus += i < 2;
+        }
+        NumFiles += Ids.size();
+        EXPECT_TRUE(Shards[J].Parse(
+            MergeControlFile(Files, Ids, NumFilesInFirstCorpus, Crashed),
+            true));
+      }
+      std::ostringstream OS;
+      OS << Files.size() << "\n2\n";
+      for (auto Id : AllIds)
+        OS << "F" << Id << "\n";
+      Set<uint32_t> SeenFeatures;
+      EXPECT_EQ(NumFiles,
+                WriteShardedMergeRecords(OS, 0, Shards, &SeenFeatures));
+      if (Crashed == kNoCrash)
+        EXPECT_EQ(Serial, OS.str());
+
+      Merger SerialM, ShardedM;
+      EXPECT_TRUE(SerialM.Parse(Serial, true));
+      EXPECT_TRUE(ShardedM.Parse(OS.str(), true));
+      Vector<std::string> SerialFiles, ShardedFiles;
+      Set<uint32_t> SerialFeatures, ShardedFeatures, Cov;
+      EXPECT_EQ(
+          SerialM.Merge({}, &SerialFeatures, {}, &Cov, &SerialFiles),
+          ShardedM.Merge({}, &ShardedFeatures, {}, &Cov, &ShardedFiles));
+      EXPECT_EQ(SerialFiles, ShardedFiles);
+    }
+  }
+}
+
+TEST(Fork, SharedMap) {
+  std::string Path = TempPath(".map");
+  ForkSharedMap Parent, Job;
+  EXPECT_FALSE(Job.Attach(Path));
+  ASSERT_TRUE(Parent.Create(Path));
+  ASSERT_TRUE(Job.Attach(Path));
+
+  EXPECT_TRUE(Parent.AddFeature(10));
+  EXPECT_FALSE(Parent.AddFeature(10));
+  EXPECT_TRUE(Job.HasFeature(10));
+  EXPECT_FALSE(Job.AddFeature(10 + ForkSharedMap::kNumFeatures));
+  EXPECT_FALSE(Parent.HasFeature(11));
+  EXPECT_TRUE(Job.AddFeature(11));
+  EXPECT_TRUE(Parent.HasFeature(11));
+
+  uint8_t A[kSHA1NumBytes], B[kSHA1NumBytes];
+  ComputeSHA1(reinterpret_cast<const uint8_t *>("A"), 1, A);
+  ComputeSHA1(reinterpret_cast<const uint8_t *>("B"), 1, B);
+  EXPECT_FALSE(Job.HasInput(A));
+  EXPECT_TRUE(Parent.AddInput(A));
+  EXPECT_TRUE(Job.HasInput(A));
+  EXPECT_FALSE(Job.AddInput(A));
+  EXPECT_FALSE(Parent.HasInput(B));
+  EXPECT_TRUE(Job.AddInput(B));
+  EXPECT_TRUE(Parent.HasInput(B));
+
+  // Re-creating the map drops everything.
+  Job.Close();
+  ASSERT_TRUE(Parent.Create(Path));
+  ASSERT_TRUE(Job.Attach(Path));
+  EXPECT_FALSE(Job.HasFeature(10));
+  EXPECT_FALSE(Job.HasInput(A));
+  Job.Close();
+  Parent.Close();
+  RemoveFile(Path);
+}
+
 TEST(DFT, BlockCoverage) {
   BlockCoverage Cov;
   // Assuming C0 has 5 instrumented blocks,
@@ -237,6 +237,12 @@ void GetAllocatorGlobalRange(uptr *begin, uptr *end) {
   *end = *begin + sizeof(allocator);
 }
 
+void GetAllocatorAddressRanges(uptr *primary_begin, uptr *primary_end,
+                               uptr *secondary_begin, uptr *secondary_end) {
+  allocator.GetAddressRangesLocked(primary_begin, primary_end,
+                                   secondary_begin, secondary_end);
+}
+
 uptr PointsIntoChunk(void* p) {
   uptr addr = reinterpret_cast<uptr>(p);
   uptr chunk = reinterpret_cast<uptr>(allocator.GetBlockBeginFastLocked(p));
@@ -276,6 +282,24 @@ void LsanMetadata::set_tag(ChunkTag value) {
   reinterpret_cast<ChunkMetadata *>(metadata_)->tag = value;
 }
 
+bool LsanMetadata::try_set_tag(ChunkTag old_value, ChunkTag value) {
+  // The tag is in the first 32 bits of the metadata, along with fields that
+  // don't change while the world is stopped.
+  atomic_uint32_t *word = reinterpret_cast<atomic_uint32_t *>(metadata_);
+  u32 cmp = atomic_load_relaxed(word);
+  for (;;) {
+    ChunkMetadata m;
+    internal_memcpy(&m, &cmp, sizeof(cmp));
+    if (m.tag != old_value)
+      return false;
+    m.tag = value;
+    u32 xchg;
+    internal_memcpy(&xchg, &m, sizeof(xchg));
+    if (atomic_compare_exchange_weak(word, &cmp, xchg, memory_order_relaxed))
+      return true;
+  }
+}
+
 uptr LsanMetadata::requested_size() const {
   return reinterpret_cast<ChunkMetadata *>(metadata_)->requested_size;
 }
@@ -25,6 +25,12 @@
 #include "sanitizer_common/sanitizer_thread_registry.h"
 #include "sanitizer_common/sanitizer_tls_get_addr.h"
 
+#if defined(__x86_64__) && SANITIZER_WORDSIZE == 64
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #if CAN_SANITIZE_LEAKS
 namespace __lsan {
 
@@ -111,7 +117,14 @@ const char *MaybeCallLsanDefaultOptions() {
   return (&__lsan_default_options) ? __lsan_default_options() : "";
 }
 
+#if defined(__x86_64__) && SANITIZER_WORDSIZE == 64
+static bool have_avx2;
+#endif
+
 void InitCommonLsan() {
+#if defined(__x86_64__) && SANITIZER_WORDSIZE == 64
+  have_avx2 = CPUHasAVX2();
+#endif
   InitializeRootRegions();
   if (common_flags()->detect_leaks) {
     // Initialization which can fail or print warnings should only be done if
@@ -147,6 +160,123 @@ static inline bool CanBeAHeapPointer(uptr p) {
 #endif
 }
 
+// The address ranges of the primary and of the secondary allocator, set during
+// the leak checks: most words aren't within them, and are skipped before being
+// looked up.
+struct HeapRanges {
+  uptr begin[2];
+  uptr size[2];
+};
+static HeapRanges heap_ranges;
+static bool heap_ranges_set;
+
+// The number of words the heap ranges are checked for at once.
+static const uptr kFilterWords = 8;
+
+// Returns the mask of the kFilterWords words at |pp| that are within one of
+// the heap ranges.
+static u32 FilterHeapWordsGeneric(uptr pp) {
+  const uptr *words = reinterpret_cast<const uptr *>(pp);
+  u32 mask = 0;
+  for (uptr i = 0; i < kFilterWords; i++) {
+    const uptr word = words[i];
+    const bool in_heap = word - heap_ranges.begin[0] < heap_ranges.size[0] ||
+                         word - heap_ranges.begin[1] < heap_ranges.size[1];
+    mask |= static_cast<u32>(in_heap) << i;
+  }
+  return mask;
+}
+
+#if defined(__x86_64__) && SANITIZER_WORDSIZE == 64
+__attribute__((target("avx2"))) static u32 FilterHeapWordsAVX2(uptr pp) {
+  // AVX2 only compares signed integers: flipping the sign bits of both sides
+  // turns that into an unsigned comparison.
+  const __m256i sign = _mm256_set1_epi64x(static_cast<s64>(1ULL << 63));
+  const __m256i begin0 = _mm256_set1_epi64x(heap_ranges.begin[0]);
+  const __m256i begin1 = _mm256_set1_epi64x(heap_ranges.begin[1]);
+  const __m256i size0 =
+      _mm256_xor_si256(_mm256_set1_epi64x(heap_ranges.size[0]), sign);
+  const __m256i size1 =
+      _mm256_xor_si256(_mm256_set1_epi64x(heap_ranges.size[1]), sign);
+  u32 mask = 0;
+  for (uptr i = 0; i < kFilterWords; i += 4) {
+    const __m256i words =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pp) + i / 4);
+    const __m256i in_heap0 = _mm256_cmpgt_epi64(
+        size0, _mm256_xor_si256(_mm256_sub_epi64(words, begin0), sign));
+    const __m256i in_heap1 = _mm256_cmpgt_epi64(
+        size1, _mm256_xor_si256(_mm256_sub_epi64(words, begin1), sign));
+    mask |= static_cast<u32>(_mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_or_si256(in_heap0, in_heap1))))
+            << i;
+  }
+  return mask;
+}
+#elif defined(__aarch64__)
+static u32 FilterHeapWordsNEON(uptr pp) {
+  const uint64x2_t begin0 = vdupq_n_u64(heap_ranges.begin[0]);
+  const uint64x2_t begin1 = vdupq_n_u64(heap_ranges.begin[1]);
+  const uint64x2_t size0 = vdupq_n_u64(heap_ranges.size[0]);
+  const uint64x2_t size1 = vdupq_n_u64(heap_ranges.size[1]);
+  u32 mask = 0;
+  for (uptr i = 0; i < kFilterWords; i += 2) {
+    const uint64x2_t words =
+        vld1q_u64(reinterpret_cast<const uint64_t *>(pp) + i);
+    const uint64x2_t in_heap =
+        vorrq_u64(vcltq_u64(vsubq_u64(words, begin0), size0),
+                  vcltq_u64(vsubq_u64(words, begin1), size1));
+    mask |= static_cast<u32>(vgetq_lane_u64(in_heap, 0) & 1) << i;
+    mask |= static_cast<u32>(vgetq_lane_u64(in_heap, 1) & 1) << (i + 1);
+  }
+  return mask;
+}
+#endif
+
+static u32 FilterHeapWords(uptr pp) {
+#if defined(__x86_64__) && SANITIZER_WORDSIZE == 64
+  if (have_avx2)
+    return FilterHeapWordsAVX2(pp);
+  return FilterHeapWordsGeneric(pp);
+#elif defined(__aarch64__)
+  return FilterHeapWordsNEON(pp);
+#else
+  return FilterHeapWordsGeneric(pp);
+#endif
+}
+
+// Looks for a pointer into an allocator chunk at |pp|, within the range
+// starting at |begin| scanned by ScanRangeForPointers.
+ALWAYS_INLINE static void ScanWordForPointer(uptr pp, uptr begin,
+                                             Frontier *frontier,
+                                             ChunkTag tag) {
+  void *p = *reinterpret_cast<void **>(pp);
+  if (!CanBeAHeapPointer(reinterpret_cast<uptr>(p))) return;
+  uptr chunk = PointsIntoChunk(p);
+  if (!chunk) return;
+  // Pointers to self don't count. This matters when tag == kIndirectlyLeaked.
+  if (chunk == begin) return;
+  LsanMetadata m(chunk);
+  const ChunkTag old_tag = m.tag();
+  if (old_tag == kReachable || old_tag == kIgnored) return;
+
+  // Do this check relatively late so we can log only the interesting cases.
+  if (!flags()->use_poisoned && WordIsPoisoned(pp)) {
+    LOG_POINTERS(
+        "%p is poisoned: ignoring %p pointing into chunk %p-%p of size "
+        "%zu.\n",
+        pp, p, chunk, chunk + m.requested_size(), m.requested_size());
+    return;
+  }
+
+  // The flood fill may run on several threads: only the one that changes
+  // the tag adds the chunk to its frontier.
+  if (!m.try_set_tag(old_tag, tag)) return;
+  LOG_POINTERS("%p: found %p pointing into chunk %p-%p of size %zu.\n", pp, p,
+               chunk, chunk + m.requested_size(), m.requested_size());
+  if (frontier)
+    frontier->push_back(chunk);
+}
+
 // Scans the memory range, looking for byte patterns that point into allocator
 // chunks. Marks those chunks with |tag| and adds them to |frontier|.
 // There are two usage modes for this function: finding reachable chunks
@@ -162,30 +292,45 @@ void ScanRangeForPointers(uptr begin, uptr end,
   uptr pp = begin;
   if (pp % alignment)
     pp = pp + alignment - pp % alignment;
-  for (; pp + sizeof(void *) <= end; pp += alignment) {
-    void *p = *reinterpret_cast<void **>(pp);
-    if (!CanBeAHeapPointer(reinterpret_cast<uptr>(p))) continue;
-    uptr chunk = PointsIntoChunk(p);
-    if (!chunk) continue;
-    // Pointers to self don't count. This matters when tag == kIndirectlyLeaked.
-    if (chunk == begin) continue;
-    LsanMetadata m(chunk);
-    if (m.tag() == kReachable || m.tag() == kIgnored) continue;
-
-    // Do this check relatively late so we can log only the interesting cases.
-    if (!flags()->use_poisoned && WordIsPoisoned(pp)) {
-      LOG_POINTERS(
-          "%p is poisoned: ignoring %p pointing into chunk %p-%p of size "
-          "%zu.\n",
-          pp, p, chunk, chunk + m.requested_size(), m.requested_size());
-      continue;
+  if (alignment == sizeof(uptr) && heap_ranges_set) {
+    const uptr kFilterBytes = kFilterWords * sizeof(uptr);
+    for (; pp + kFilterBytes <= end; pp += kFilterBytes) {
+      for (u32 mask = FilterHeapWords(pp); mask; mask &= mask - 1) {
+        const uptr word = LeastSignificantSetBitIndex(mask);
+        ScanWordForPointer(pp + word * sizeof(uptr), begin, frontier, tag);
+      }
     }
+  }
+  for (; pp + sizeof(void *) <= end; pp += alignment)
+    ScanWordForPointer(pp, begin, frontier, tag);
+}
 
-    m.set_tag(tag);
-    LOG_POINTERS("%p: found %p pointing into chunk %p-%p of size %zu.\n", pp, p,
-                 chunk, chunk + m.requested_size(), m.requested_size());
-    if (frontier)
-      frontier->push_back(chunk);
+// Set during the incremental leak checks: the memory that was not written to
+// since the previous check can't hold pointers to the chunks allocated since.
+static DirtyPages *dirty_pages;
+
+// Scans the pages of the range written to since the previous leak check if it
+// is incremental, or the whole range otherwise.
+static void ScanWrittenRangeForPointers(uptr begin, uptr end,
+                                        Frontier *frontier,
+                                        const char *region_type) {
+  if (!dirty_pages) {
+    ScanRangeForPointers(begin, end, frontier, region_type, kReachable);
+    return;
+  }
+  const uptr page_size = GetPageSizeCached();
+  uptr page = RoundDownTo(begin, page_size);
+  while (page < end) {
+    if (!dirty_pages->IsDirty(page)) {
+      page += page_size;
+      continue;
+    }
+    uptr run_end = page + page_size;
+    while (run_end < end && dirty_pages->IsDirty(run_end))
+      run_end += page_size;
+    ScanRangeForPointers(Max(begin, page), Min(end, run_end), frontier,
+                         region_type, kReachable);
+    page = run_end;
   }
 }
 
@@ -197,12 +342,11 @@ void ScanGlobalRange(uptr begin, uptr end, Frontier *frontier) {
     CHECK_LE(allocator_begin, allocator_end);
     CHECK_LE(allocator_end, end);
     if (begin < allocator_begin)
-      ScanRangeForPointers(begin, allocator_begin, frontier, "GLOBAL",
-                           kReachable);
+      ScanWrittenRangeForPointers(begin, allocator_begin, frontier, "GLOBAL");
     if (allocator_end < end)
-      ScanRangeForPointers(allocator_end, end, frontier, "GLOBAL", kReachable);
+      ScanWrittenRangeForPointers(allocator_end, end, frontier, "GLOBAL");
   } else {
-    ScanRangeForPointers(begin, end, frontier, "GLOBAL", kReachable);
+    ScanWrittenRangeForPointers(begin, end, frontier, "GLOBAL");
   }
 }
 
@@ -318,8 +462,8 @@ void ScanRootRegion(Frontier *frontier, const RootRegion &root_region,
                region_begin, region_end,
                is_readable ? "readable" : "unreadable");
   if (is_readable)
-    ScanRangeForPointers(intersection_begin, intersection_end, frontier, "ROOT",
-                         kReachable);
+    ScanWrittenRangeForPointers(intersection_begin, intersection_end, frontier,
+                                "ROOT");
 }
 
 static void ProcessRootRegion(Frontier *frontier,
@@ -341,7 +485,7 @@ static void ProcessRootRegions(Frontier *frontier) {
   }
 }
 
-static void FloodFillTag(Frontier *frontier, ChunkTag tag) {
+static void ScanFrontier(Frontier *frontier, ChunkTag tag) {
   while (frontier->size()) {
     uptr next_chunk = frontier->back();
     frontier->pop_back();
@@ -351,6 +495,121 @@ static void FloodFillTag(Frontier *frontier, ChunkTag tag) {
   }
 }
 
+// The state of a flood fill running on several threads. Each thread scans the
+// chunks of its own frontier, and hands half of it over to the shared pool
+// when another thread runs out of chunks to scan.
+struct ParallelFloodFill {
+  ChunkTag tag;
+  SpinMutex mutex;
+  Frontier pool;  // Guarded by mutex.
+  uptr threads;   // Guarded by mutex.
+  uptr idle_threads;  // Guarded by mutex.
+  atomic_uint8_t hungry;
+};
+
+static const uptr kMaxMarkingThreads = 64;
+// The number of chunks a thread scans between checks for hungry threads.
+static const uptr kChunksBetweenHandOvers = 64;
+
+static void MoveHalf(Frontier *from, Frontier *to) {
+  uptr size = from->size();
+  uptr keep = size / 2;
+  for (uptr i = keep; i < size; i++)
+    to->push_back((*from)[i]);
+  from->resize(keep);
+}
+
+// Fills |frontier| with chunks from the pool. Returns false once all the
+// threads are out of chunks, which ends the flood fill.
+static bool WaitForChunks(ParallelFloodFill *fill, Frontier *frontier) {
+  bool idle = false;
+  for (;;) {
+    {
+      SpinMutexLock l(&fill->mutex);
+      if (fill->pool.size()) {
+        if (fill->pool.size() == 1) {
+          frontier->push_back(fill->pool.back());
+          fill->pool.pop_back();
+        } else {
+          MoveHalf(&fill->pool, frontier);
+        }
+        if (idle)
+          fill->idle_threads--;
+        return true;
+      }
+      if (!idle) {
+        idle = true;
+        fill->idle_threads++;
+      }
+      if (fill->idle_threads == fill->threads)
+        return false;
+    }
+    atomic_store_relaxed(&fill->hungry, 1);
+    internal_sched_yield();
+  }
+}
+
+static void FloodFillThread(void *arg) {
+  ParallelFloodFill *fill = reinterpret_cast<ParallelFloodFill *>(arg);
+  Frontier frontier;
+  {
+    SpinMutexLock l(&fill->mutex);
+    fill->threads++;
+  }
+  while (WaitForChunks(fill, &frontier)) {
+    while (frontier.size()) {
+      for (uptr i = 0; i < kChunksBetweenHandOvers && frontier.size(); i++) {
+        uptr next_chunk = frontier.back();
+        frontier.pop_back();
+        LsanMetadata m(next_chunk);
+        ScanRangeForPointers(next_chunk, next_chunk + m.requested_size(),
+                             &frontier, "HEAP", fill->tag);
+      }
+      if (frontier.size() > 1 && atomic_load_relaxed(&fill->hungry)) {
+        SpinMutexLock l(&fill->mutex);
+        MoveHalf(&frontier, &fill->pool);
+        atomic_store_relaxed(&fill->hungry, 0);
+      }
+    }
+  }
+}
+
+static uptr GetMarkingThreads() {
+  uptr threads = flags()->marking_threads > 0 ? flags()->marking_threads
+                                              : GetNumberOfCPUsCached();
+  return Min(Max<uptr>(threads, 1), kMaxMarkingThreads);
+}
+
+static void FloodFillTag(Frontier *frontier, ChunkTag tag) {
+  const uptr threads = GetMarkingThreads();
+  if (threads == 1 || frontier->size() < 2) {
+    ScanFrontier(frontier, tag);
+    return;
+  }
+
+  // The threads join the flood fill as they start, the ones that start once
+  // it's over find no chunks and return right away.
+  ParallelFloodFill fill;
+  fill.tag = tag;
+  fill.mutex.Init();
+  fill.pool.swap(*frontier);
+  fill.threads = 0;
+  fill.idle_threads = 0;
+  atomic_store_relaxed(&fill.hungry, 0);
+  void *marking_threads[kMaxMarkingThreads];
+  uptr started = 0;
+  for (uptr i = 1; i < threads; i++) {
+    marking_threads[started] = StartMarkingThread(FloodFillThread, &fill);
+    if (marking_threads[started])
+      started++;
+  }
+  LOG_POINTERS("Flood fill on %zu threads.\n", started + 1);
+  FloodFillThread(&fill);
+  for (uptr i = 0; i < started; i++)
+    JoinMarkingThread(marking_threads[i]);
+  CHECK_EQ(0, fill.pool.size());
+}
+
 // ForEachChunk callback. If the chunk is marked as leaked, marks all chunks
 // which are reachable from it as indirectly leaked.
 static void MarkIndirectlyLeakedCb(uptr chunk, void *arg) {
@@ -375,6 +634,18 @@ static void CollectIgnoredCb(uptr chunk, void *arg) {
   }
 }
 
+// ForEachChunk callback. During an incremental leak check, scans the pages of
+// the chunks found reachable by the previous checks that were written to
+// since: they may now point to new chunks.
+static void ScanWrittenReachableCb(uptr chunk, void *arg) {
+  CHECK(arg);
+  chunk = GetUserBegin(chunk);
+  LsanMetadata m(chunk);
+  if (m.allocated() && m.tag() == kReachable)
+    ScanWrittenRangeForPointers(chunk, chunk + m.requested_size(),
+                                reinterpret_cast<Frontier *>(arg), "HEAP");
+}
+
 static uptr GetCallerPC(u32 stack_id, StackDepotReverseMap *map) {
   CHECK(stack_id);
   StackTrace stack = map->Get(stack_id);
@@ -442,12 +713,23 @@ void ProcessPC(Frontier *frontier) {
   ForEachChunk(MarkInvalidPCCb, &arg);
 }
 
-// Sets the appropriate tag on each chunk.
-static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads) {
+// Sets the appropriate tag on each chunk. If |incremental|, the chunks tagged
+// kReachable by the previous check are assumed to still be.
+static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads,
+                              bool incremental) {
   // Holds the flood fill frontier.
   Frontier frontier;
 
+  uptr heap_ends[2];
+  GetAllocatorAddressRanges(&heap_ranges.begin[0], &heap_ends[0],
+                            &heap_ranges.begin[1], &heap_ends[1]);
+  for (uptr i = 0; i < 2; i++)
+    heap_ranges.size[i] = heap_ends[i] - heap_ranges.begin[i];
+  heap_ranges_set = true;
+
   ForEachChunk(CollectIgnoredCb, &frontier);
+  if (incremental)
+    ForEachChunk(ScanWrittenReachableCb, &frontier);
   ProcessGlobalRegions(&frontier);
   ProcessThreads(suspended_threads, &frontier);
   ProcessRootRegions(&frontier);
@@ -467,6 +749,7 @@ static void ClassifyAllChunks(SuspendedThreadsList const &suspended_threads) {
   // leaked chunks.
   LOG_POINTERS("Scanning leaked chunks.\n");
   ForEachChunk(MarkIndirectlyLeakedCb, nullptr);
+  heap_ranges_set = false;
 }
 
 // ForEachChunk callback. Resets the tags to pre-leak-check state.
@@ -478,6 +761,17 @@ static void ResetTagsCb(uptr chunk, void *arg) {
     m.set_tag(kDirectlyLeaked);
 }
 
+// ForEachChunk callback. Resets the tags of the leaked chunks to
+// pre-leak-check state, keeping the reachable ones for the next incremental
+// leak check.
+static void ResetLeakedTagsCb(uptr chunk, void *arg) {
+  (void)arg;
+  chunk = GetUserBegin(chunk);
+  LsanMetadata m(chunk);
+  if (m.allocated() && m.tag() == kIndirectlyLeaked)
+    m.set_tag(kDirectlyLeaked);
+}
+
 static void PrintStackTraceById(u32 stack_trace_id) {
   CHECK(stack_trace_id);
   StackDepotGet(stack_trace_id).Print();
@@ -523,9 +817,19 @@ static void PrintMatchedSuppressions() {
 
 struct CheckForLeaksParam {
   bool success;
+  // Whether the check scans all the memory, even if the previous check kept
+  // the tags of the reachable chunks.
+  bool full_check;
+  // Whether the tags of the reachable chunks may be kept for the next check.
+  bool keep_reachable_tags;
   LeakReport leak_report;
 };
 
+// Whether the chunks tagged kReachable by the previous leak check kept their
+// tags, and the number of recoverable checks since the last periodic full one.
+static bool reachable_tags_kept;
+static int recoverable_checks;
+
 static void ReportIfNotSuspended(ThreadContextBase *tctx, void *arg) {
   const InternalMmapVector<tid_t> &suspended_threads =
       *(const InternalMmapVector<tid_t> *)arg;
@@ -556,20 +860,45 @@ static void CheckForLeaksCallback(const SuspendedThreadsList &suspended_threads,
   CHECK(param);
   CHECK(!param->success);
   ReportUnsuspendedThreads(suspended_threads);
-  ClassifyAllChunks(suspended_threads);
+  DirtyPages pages;
+  bool incremental = false;
+  if (reachable_tags_kept) {
+    if (!param->full_check && pages.Init()) {
+      dirty_pages = &pages;
+      incremental = true;
+    } else {
+      ForEachChunk(ResetTagsCb, nullptr);
+    }
+  }
+  LOG_POINTERS("Running a%s leak check.\n",
+               incremental ? "n incremental" : " full");
+  ClassifyAllChunks(suspended_threads, incremental);
+  dirty_pages = nullptr;
   ForEachChunk(CollectLeaksCb, &param->leak_report);
   // Clean up for subsequent leak checks. This assumes we did not overwrite any
-  // kIgnored tags.
-  ForEachChunk(ResetTagsCb, nullptr);
+  // kIgnored tags. The dirty pages are reset last, so that the tags written
+  // here don't make the next check scan the chunks.
+  if (param->keep_reachable_tags) {
+    ForEachChunk(ResetLeakedTagsCb, nullptr);
+    reachable_tags_kept = ResetDirtyPages();
+  } else {
+    reachable_tags_kept = false;
+  }
+  if (!reachable_tags_kept)
+    ForEachChunk(ResetTagsCb, nullptr);
   param->success = true;
 }
 
-static bool CheckForLeaks() {
+// Unless |full_check|, the leak check may be an incremental one. If
+// |keep_reachable_tags|, the next leak check may be an incremental one.
+static bool CheckForLeaks(bool full_check, bool keep_reachable_tags) {
   if (&__lsan_is_turned_off && __lsan_is_turned_off())
       return false;
   EnsureMainThreadIDIsCorrect();
   CheckForLeaksParam param;
   param.success = false;
+  param.full_check = full_check;
+  param.keep_reachable_tags = keep_reachable_tags;
   LockStuffAndStopTheWorld(CheckForLeaksCallback, &param);
 
   if (!param.success) {
@@ -581,6 +910,7 @@ static bool CheckForLeaks() {
         "HINT: LeakSanitizer does not work under ptrace (strace, gdb, etc)\n");
     Die();
   }
+  param.leak_report.SymbolizeStacks();
   param.leak_report.ApplySuppressions();
   uptr unsuppressed_count = param.leak_report.UnsuppressedLeakCount();
   if (unsuppressed_count > 0) {
@@ -610,13 +940,22 @@ void DoLeakCheck() {
   static bool already_done;
   if (already_done) return;
   already_done = true;
-  has_reported_leaks = CheckForLeaks();
+  has_reported_leaks = CheckForLeaks(/* full_check */ true,
+                                     /* keep_reachable_tags */ false);
   if (has_reported_leaks) HandleLeaks();
 }
 
 static int DoRecoverableLeakCheck() {
   BlockingMutexLock l(&global_mutex);
-  bool have_leaks = CheckForLeaks();
+  bool full_check = true;
+  if (flags()->incremental) {
+    // Every full_check_period-th check is a full one.
+    full_check = flags()->full_check_period > 0 &&
+                 ++recoverable_checks >= flags()->full_check_period;
+    if (full_check)
+      recoverable_checks = 0;
+  }
+  bool have_leaks = CheckForLeaks(full_check, flags()->incremental);
   return have_leaks ? 1 : 0;
 }
 
@@ -760,6 +1099,35 @@ void LeakReport::PrintSummary() {
   ReportErrorSummary(summary.data());
 }
 
+// Symbolizes the PCs of the leak stacks up front, in as few batches as
+// possible, so that the suppressions and the report below find their frames
+// in the symbolizer cache.
+void LeakReport::SymbolizeStacks() {
+  const int cache_size = common_flags()->symbolize_cache_size;
+  if (leaks_.empty() || cache_size <= 0)
+    return;
+  InternalMmapVector<uptr> pcs;
+  for (uptr i = 0; i < leaks_.size(); i++) {
+    StackTrace stack = StackDepotGet(leaks_[i].stack_trace_id);
+    for (uptr j = 0; j < stack.size && stack.trace[j]; j++)
+      pcs.push_back(StackTrace::GetPreviousInstructionPc(stack.trace[j]));
+  }
+  if (pcs.empty())
+    return;
+  Sort(pcs.data(), pcs.size());
+  uptr num_pcs = 1;
+  for (uptr i = 1; i < pcs.size(); i++) {
+    if (pcs[i] != pcs[num_pcs - 1])
+      pcs[num_pcs++] = pcs[i];
+  }
+  // The PCs past the cache capacity would evict the first ones.
+  num_pcs = Min(num_pcs, static_cast<uptr>(cache_size));
+  InternalMmapVector<SymbolizedStack *> stacks(num_pcs);
+  Symbolizer::GetOrInit()->SymbolizePCs(pcs.data(), num_pcs, stacks.data());
+  for (uptr i = 0; i < num_pcs; i++)
+    stacks[i]->ClearAll();
+}
+
 void LeakReport::ApplySuppressions() {
   for (uptr i = 0; i < leaks_.size(); i++) {
     Suppression *s = GetSuppressionForStack(leaks_[i].stack_trace_id);
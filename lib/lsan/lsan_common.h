@@ -102,6 +102,7 @@ class LeakReport {
                       ChunkTag tag);
   void ReportTopLeaks(uptr max_leaks);
   void PrintSummary();
+  void SymbolizeStacks();
   void ApplySuppressions();
   uptr UnsuppressedLeakCount();
 
@@ -132,6 +133,31 @@ void ScanRootRegion(Frontier *frontier, RootRegion const &region,
 // Run stoptheworld while holding any platform-specific locks, as well as the
 // allocator and thread registry locks.
 void LockStuffAndStopTheWorld(StopTheWorldCallback callback, void* argument);
+// Start a thread running |func|(|arg|) that can run while the world is
+// stopped, and wait for it to finish. StartMarkingThread returns nullptr if
+// the thread can't be started, or isn't supported on the platform.
+void *StartMarkingThread(void (*func)(void *), void *arg);
+void JoinMarkingThread(void *thread);
+
+// Tracks the pages written to since the last call to ResetDirtyPages(), for
+// the incremental leak checks. ResetDirtyPages() returns false if that is not
+// supported, as does DirtyPages::Init().
+bool ResetDirtyPages();
+class DirtyPages {
+ public:
+  DirtyPages() {}
+  ~DirtyPages();
+  bool Init();
+  bool IsDirty(uptr addr);
+
+ private:
+  static const uptr kWindowSize = 512;
+  fd_t fd_ = kInvalidFd;
+  // Page-map entries of the pages [window_begin_, window_end_).
+  uptr window_begin_ = 0;
+  uptr window_end_ = 0;
+  u64 window_[kWindowSize];
+};
 
 void ScanRangeForPointers(uptr begin, uptr end,
                           Frontier *frontier,
@@ -199,6 +225,11 @@ inline bool IsSpecialCaseOfOperatorNew0(uptr chunk_beg, uptr chunk_size,
 void ForEachChunk(ForEachChunkCallback callback, void *arg);
 // Returns the address range occupied by the global allocator object.
 void GetAllocatorGlobalRange(uptr *begin, uptr *end);
+// Returns the address ranges of the primary and of the secondary allocator:
+// PointsIntoChunk() finds no chunk for the addresses outside of them. Must be
+// called with the allocator locked.
+void GetAllocatorAddressRanges(uptr *primary_begin, uptr *primary_end,
+                               uptr *secondary_begin, uptr *secondary_end);
 // Wrappers for allocator's ForceLock()/ForceUnlock().
 void LockAllocator();
 void UnlockAllocator();
@@ -245,6 +276,9 @@ class LsanMetadata {
   bool allocated() const;
   ChunkTag tag() const;
   void set_tag(ChunkTag value);
+  // Atomically changes the tag from |old_value| to |value|. Returns false if
+  // the tag was not |old_value|, e.g. because another thread changed it.
+  bool try_set_tag(ChunkTag old_value, ChunkTag value);
   uptr requested_size() const;
   u32 stack_trace_id() const;
  private:
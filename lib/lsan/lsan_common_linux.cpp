@@ -16,9 +16,13 @@
 #include "lsan_common.h"
 
 #if CAN_SANITIZE_LEAKS && (SANITIZER_LINUX || SANITIZER_NETBSD)
+#include <errno.h>
 #include <link.h>
+#include <sched.h>
+#include <sys/wait.h>
 
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_file.h"
 #include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_getauxval.h"
 #include "sanitizer_common/sanitizer_linux.h"
@@ -126,6 +130,148 @@ static int LockStuffAndStopTheWorldCallback(struct dl_phdr_info *info,
   return 1;
 }
 
+#if SANITIZER_LINUX && (defined(__x86_64__) || defined(__mips__) || \
+                        defined(__aarch64__) || defined(__powerpc64__) || \
+                        defined(__i386__) || defined(__arm__))
+// The marking threads are tasks sharing the address space, like the tracer
+// task of StopTheWorld, since pthread_create() may take locks that are held
+// by the suspended threads. They don't use TLS either.
+struct MarkingThread {
+  void (*func)(void *);
+  void *arg;
+  uptr pid;
+  uptr mapping_size;
+};
+
+static int MarkingThreadMain(void *arg) {
+  MarkingThread *thread = reinterpret_cast<MarkingThread *>(arg);
+  thread->func(thread->arg);
+  return 0;
+}
+
+void *StartMarkingThread(void (*func)(void *), void *arg) {
+  const uptr kStackSize = 1 << 20;
+  const uptr page_size = GetPageSizeCached();
+  // The thread is described at the bottom of its stack, above a guard page.
+  const uptr mapping_size = kStackSize + page_size;
+  uptr mapping = reinterpret_cast<uptr>(
+      MmapOrDieOnFatalError(mapping_size, "MarkingThread"));
+  if (!mapping)
+    return nullptr;
+  CHECK(MprotectNoAccess(mapping, page_size));
+  MarkingThread *thread =
+      reinterpret_cast<MarkingThread *>(mapping + page_size);
+  thread->func = func;
+  thread->arg = arg;
+  thread->mapping_size = mapping_size;
+  thread->pid = internal_clone(
+      MarkingThreadMain, reinterpret_cast<void *>(mapping + mapping_size),
+      CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_UNTRACED, thread,
+      nullptr /* parent_tidptr */, nullptr /* newtls */,
+      nullptr /* child_tidptr */);
+  int local_errno;
+  if (internal_iserror(thread->pid, &local_errno)) {
+    VReport(1, "Failed spawning a marking thread (errno %d).\n", local_errno);
+    UnmapOrDie(reinterpret_cast<void *>(mapping), mapping_size);
+    return nullptr;
+  }
+  return thread;
+}
+
+void JoinMarkingThread(void *arg) {
+  MarkingThread *thread = reinterpret_cast<MarkingThread *>(arg);
+  uptr waitpid_status;
+  HANDLE_EINTR(waitpid_status, internal_waitpid(thread->pid, nullptr, __WALL));
+  (void)waitpid_status;
+  UnmapOrDie(reinterpret_cast<char *>(thread) - GetPageSizeCached(),
+             thread->mapping_size);
+}
+#else
+void *StartMarkingThread(void (*func)(void *), void *arg) { return nullptr; }
+
+void JoinMarkingThread(void *thread) {}
+#endif
+
+#if SANITIZER_LINUX
+// The soft-dirty bit of the page-map entries, see
+// Documentation/admin-guide/mm/soft-dirty.rst in the kernel sources.
+static const u64 kPagemapSoftDirty = 1ULL << 55;
+
+static bool ReadPagemapEntry(fd_t fd, uptr addr, u64 *entry) {
+  const uptr offset = addr / GetPageSizeCached() * sizeof(u64);
+  uptr read_len;
+  return internal_lseek(fd, offset, SEEK_SET) == offset &&
+         ReadFromFile(fd, entry, sizeof(*entry), &read_len) &&
+         read_len == sizeof(*entry);
+}
+
+bool ResetDirtyPages() {
+  fd_t fd = OpenFile("/proc/self/clear_refs", WrOnly);
+  if (fd == kInvalidFd)
+    return false;
+  bool success = WriteToFile(fd, "4", 1);
+  CloseFile(fd);
+  if (!success)
+    return false;
+  // Kernels built without soft-dirty support accept the write, but then
+  // never mark the pages dirty: check that a page written to is.
+  static int supported = -1;
+  if (supported == -1) {
+    const uptr page_size = GetPageSizeCached();
+    char *page = reinterpret_cast<char *>(MmapOrDie(page_size, "DirtyPages"));
+    u64 entry = 0;
+    fd = OpenFile("/proc/self/pagemap", RdOnly);
+    if (fd != kInvalidFd) {
+      *reinterpret_cast<volatile char *>(page) = 1;
+      if (!ReadPagemapEntry(fd, reinterpret_cast<uptr>(page), &entry))
+        entry = 0;
+      CloseFile(fd);
+    }
+    UnmapOrDie(page, page_size);
+    supported = (entry & kPagemapSoftDirty) != 0;
+    VReport(1, "LeakSanitizer: dirty page tracking is %ssupported.\n",
+            supported ? "" : "not ");
+  }
+  return supported;
+}
+
+DirtyPages::~DirtyPages() {
+  if (fd_ != kInvalidFd)
+    CloseFile(fd_);
+}
+
+bool DirtyPages::Init() {
+  fd_ = OpenFile("/proc/self/pagemap", RdOnly);
+  return fd_ != kInvalidFd;
+}
+
+bool DirtyPages::IsDirty(uptr addr) {
+  const uptr page = addr / GetPageSizeCached();
+  if (page < window_begin_ || page >= window_end_) {
+    // The chunks are mostly visited in address order, so read the entries of
+    // the following pages too.
+    uptr read_len;
+    window_begin_ = page;
+    window_end_ = page;
+    if (internal_lseek(fd_, page * sizeof(u64), SEEK_SET) !=
+            page * sizeof(u64) ||
+        !ReadFromFile(fd_, window_, sizeof(window_), &read_len) ||
+        read_len < sizeof(u64))
+      return true;
+    window_end_ = page + read_len / sizeof(u64);
+  }
+  return (window_[page - window_begin_] & kPagemapSoftDirty) != 0;
+}
+#else
+bool ResetDirtyPages() { return false; }
+
+DirtyPages::~DirtyPages() {}
+
+bool DirtyPages::Init() { return false; }
+
+bool DirtyPages::IsDirty(uptr addr) { return true; }
+#endif
+
 // LSan calls dl_iterate_phdr() from the tracer task. This may deadlock: if one
 // of the threads is frozen while holding the libdl lock, the tracer will hang
 // in dl_iterate_phdr() forever.
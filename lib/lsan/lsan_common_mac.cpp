@@ -193,6 +193,19 @@ void ProcessPlatformSpecificAllocations(Frontier *frontier) {
 // causes rare race conditions.
 void HandleLeaks() {}
 
+// Starting threads takes locks that the suspended threads may hold.
+void *StartMarkingThread(void (*func)(void *), void *arg) { return nullptr; }
+
+void JoinMarkingThread(void *thread) {}
+
+bool ResetDirtyPages() { return false; }
+
+DirtyPages::~DirtyPages() {}
+
+bool DirtyPages::Init() { return false; }
+
+bool DirtyPages::IsDirty(uptr addr) { return true; }
+
 void LockStuffAndStopTheWorld(StopTheWorldCallback callback, void *argument) {
   LockThreadRegistry();
   LockAllocator();
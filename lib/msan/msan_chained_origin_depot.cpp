@@ -21,7 +21,6 @@ struct ChainedOriginDepotDesc {
 };
 
 struct ChainedOriginDepotNode {
-  ChainedOriginDepotNode *link;
   u32 id;
   u32 here_id;
   u32 prev_id;
@@ -74,7 +73,7 @@ struct ChainedOriginDepotNode {
     return h;
   }
   static bool is_valid(const args_type &args) { return true; }
-  void store(const args_type &args, u32 other_hash) {
+  void store(const args_type &args, u32 other_hash, uptr storage_size) {
     here_id = args.here_id;
     prev_id = args.prev_id;
   }
@@ -101,7 +100,7 @@ struct ChainedOriginDepotNode {
 
 static StackDepotBase<ChainedOriginDepotNode, 4, 20> chainedOriginDepot;
 
-StackDepotStats *ChainedOriginDepotGetStats() {
+StackDepotStats ChainedOriginDepotGetStats() {
   return chainedOriginDepot.GetStats();
 }
 
@@ -156,6 +156,29 @@ int __llvm_orderfile_dump(void);
  * \c Name is not copied, so it must remain valid.  Passing NULL resets the
  * filename logic to the default behaviour.
  *
+ * \c Name, like the LLVM_PROFILE_FILE environment variable, may contain the
+ * following specifiers:
+ *   - \c %p is replaced by the process ID.
+ *   - \c %h is replaced by the host name.
+ *   - \c %m, or \c %Nm with N from 1 to 9, enables on-line merging into a
+ *     pool of N files named after the binary.
+ *   - \c %c enables the continuous mode: the profile is written as soon as
+ *     the filename is set, and the counters are mapped from the file, so that
+ *     they are persisted as they are updated, even if the process is killed.
+ *     Nothing is written at exit, and no value profile data is written. This
+ *     can't be used with \c %m. A forked child writes its own profile at exit
+ *     instead.
+ *
+ *     Continuous mode needs a counters section that starts and ends on a page
+ *     boundary, and is disabled with a warning otherwise. On ELF platforms,
+ *     link with \c -Wl,-u,__llvm_profile_page_aligned_counters to get it: the
+ *     runtime then pads the section to a page boundary, which other binaries
+ *     don't pay for. This pads the start of the section, but the end is only
+ *     aligned if the padding comes last, which depends on the link order: the
+ *     profile runtime must come after all the instrumented objects and static
+ *     libraries, as it does by default, and the input sections must not be
+ *     sorted.
+ *
  * Note: There may be multiple copies of the profile runtime (one for each
  * instrumented image/DSO). This API only modifies the filename within the
  * copy of the runtime available to the calling image.
@@ -0,0 +1,30 @@
+/*===- InstrProfilingContinuous.c - Page aligned counters section --------===*\
+|*
+|* Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+|* See https://llvm.org/LICENSE.txt for license information.
+|* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+|*
+\*===----------------------------------------------------------------------===*/
+
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__Fuchsia__) || \
+    (defined(__sun__) && defined(__svr4__)) || defined(__NetBSD__)
+
+#include "InstrProfiling.h"
+
+/* The largest page size of the target. */
+#if defined(__aarch64__) || defined(__powerpc64__)
+#define PROF_CNTS_ALIGN 0x10000
+#else
+#define PROF_CNTS_ALIGN 0x1000
+#endif
+
+/* Continuous mode maps the counters from the profile file, which needs a page
+ * aligned counters section. This object isn't linked in unless it is asked
+ * for with -Wl,-u,__llvm_profile_page_aligned_counters, so that the other
+ * binaries don't pay for the padding. Its dummy counters align the start of
+ * the section, and, when they come last, its end as well. */
+COMPILER_RT_VISIBILITY uint64_t __llvm_profile_page_aligned_counters[0]
+    COMPILER_RT_ALIGNAS(PROF_CNTS_ALIGN)
+    COMPILER_RT_SECTION(INSTR_PROF_CNTS_SECT_NAME);
+
+#endif
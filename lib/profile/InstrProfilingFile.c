@@ -22,6 +22,8 @@
 #include <io.h>
 #include <process.h>
 #else
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/file.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -64,7 +66,7 @@ static const char *getPNSStr(ProfileNameSpecifier PNS) {
 #define MAX_PID_SIZE 16
 /* Data structure holding the result of parsed filename pattern. */
 typedef struct lprofFilename {
-  /* File name string possibly with %p or %h specifiers. */
+  /* File name string possibly with %p, %h, %m or %c specifiers. */
   const char *FilenamePat;
   /* A flag indicating if FilenamePat's memory is allocated
    * by runtime. */
@@ -82,11 +84,16 @@ typedef struct lprofFilename {
    * 2 profile data files. %1m is equivalent to %m. Also %m specifier
    * can only appear once at the end of the name pattern. */
   unsigned MergePoolSize;
+  /* A flag indicating if the counters should be mapped from the profile
+   * file, so that they are persisted as they are updated instead of being
+   * written out at exit. This is specified by the %c specifier, which can't
+   * be used with %m. */
+  unsigned ContinuousMode;
   ProfileNameSpecifier PNS;
 } lprofFilename;
 
 static lprofFilename lprofCurFilename = {0, 0, 0, {0},        {0},
-                                         0, 0, 0, PNS_unknown};
+                                         0, 0, 0, 0, PNS_unknown};
 
 static int ProfileMergeRequested = 0;
 static int isProfileMergeRequested() { return ProfileMergeRequested; }
@@ -356,6 +363,139 @@ static void truncateCurrentFile(void) {
   fclose(File);
 }
 
+/* The counters when they are mapped from the profile file in continuous
+ * mode, or NULL, along with the file descriptor and the offset they are
+ * mapped from. */
+static char *MappedCounters = NULL;
+static size_t MappedCountersSize = 0;
+static int MappedFd = -1;
+static uint64_t MappedOffset = 0;
+
+#if defined(_WIN32)
+static void unmapCountersFromFile(void) {}
+static void initializeProfileForContinuousMode(void) {}
+#else
+/* Map the counters privately from the profile file, so that they are no
+ * longer written to it. Unlike anonymous pages, this keeps their values. */
+static void unmapCountersFromFile(void) {
+  char *Pages = MappedCounters;
+
+  if (!Pages)
+    return;
+
+  if (mmap(Pages, MappedCountersSize, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED, MappedFd, MappedOffset) == MAP_FAILED) {
+    PROF_ERR("Failed to unmap the counters from the profile file: %s\n",
+             strerror(errno));
+    return;
+  }
+  close(MappedFd);
+  MappedCounters = NULL;
+  MappedCountersSize = 0;
+  MappedFd = -1;
+}
+
+/* A forked child would update the counters of its parent in the file. The
+ * child writes its profile at exit instead. */
+static void onForkInChild(void) {
+  char *Pages = MappedCounters;
+  size_t Size = MappedCountersSize;
+  size_t I;
+
+  unmapCountersFromFile();
+  if (MappedCounters)
+    return;
+  /* Until they are written to, the private pages still show the changes the
+   * parent makes to the file. */
+  for (I = 0; I < Size; I += getpagesize()) {
+    volatile char *P = Pages + I;
+    *P = *P;
+  }
+}
+
+/* Write the profile to the current file, and map the counters from it, so
+ * that they are persisted by the kernel as they are updated. Falls back to
+ * writing the profile at exit on failure. */
+static void initializeProfileForContinuousMode(void) {
+  static int AtForkRegistered = 0;
+  uint64_t *CountersBegin = __llvm_profile_begin_counters();
+  uint64_t *CountersEnd = __llvm_profile_end_counters();
+  const uint64_t PageSize = getpagesize();
+  const size_t CountersSize = (char *)CountersEnd - (char *)CountersBegin;
+  const uint64_t Offset = lprofGetContinuousModeCountersOffset(PageSize);
+  const char *Filename;
+  char *FilenameBuf;
+  FILE *File;
+  void *Pages = MAP_FAILED;
+  int Length, Fd = -1;
+
+  if (CountersBegin == CountersEnd)
+    return;
+
+  /* Only whole pages can be mapped, and the pages must hold nothing but the
+   * counters. */
+  if ((uintptr_t)CountersBegin % PageSize || CountersSize % PageSize) {
+    PROF_WARN("The counters section is not aligned to the page size (%u), "
+              "continuous mode is disabled. Link with "
+              "-Wl,-u,__llvm_profile_page_aligned_counters.\n",
+              (unsigned)PageSize);
+    return;
+  }
+
+  Length = getCurFilenameLength();
+  FilenameBuf = (char *)COMPILER_RT_ALLOCA(Length + 1);
+  Filename = getCurFilename(FilenameBuf, 0);
+  if (!Filename)
+    return;
+
+  /* The counters updated between the copy and the mapping are lost, so this
+   * is best done before the threads are started. */
+  File = fopen(Filename, "w+b");
+  if (!File) {
+    PROF_ERR("Failed to open %s for continuous mode: %s\n", Filename,
+             strerror(errno));
+    unmapCountersFromFile();
+    return;
+  }
+  ProfDataWriter FileWriter;
+  initFileWriter(&FileWriter, File);
+  if (lprofWriteDataForContinuousMode(&FileWriter, PageSize) ||
+      fflush(File) || (Fd = dup(fileno(File))) == -1) {
+    PROF_ERR("Failed to write file \"%s\": %s\n", Filename, strerror(errno));
+  } else {
+    fcntl(Fd, F_SETFD, FD_CLOEXEC);
+    Pages = mmap(CountersBegin, CountersSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, Fd, Offset);
+    if (Pages == MAP_FAILED) {
+      PROF_ERR("Failed to map the counters from \"%s\": %s\n", Filename,
+               strerror(errno));
+      close(Fd);
+    }
+  }
+  if (Pages == MAP_FAILED) {
+    /* Leave an empty file to be written at exit. */
+    if (ftruncate(fileno(File), 0))
+      PROF_WARN("Failed to truncate \"%s\".\n", Filename);
+    fclose(File);
+    unmapCountersFromFile();
+    return;
+  }
+  fclose(File);
+
+  /* The pages were mapped from another file before. */
+  if (MappedFd != -1)
+    close(MappedFd);
+  MappedCounters = (char *)Pages;
+  MappedCountersSize = CountersSize;
+  MappedFd = Fd;
+  MappedOffset = Offset;
+  if (!AtForkRegistered) {
+    AtForkRegistered = 1;
+    pthread_atfork(NULL, NULL, onForkInChild);
+  }
+}
+#endif
+
 static const char *DefaultProfileName = "default.profraw";
 static void resetFilenameToDefault(void) {
   if (lprofCurFilename.FilenamePat && lprofCurFilename.OwnsFilenamePat) {
@@ -419,6 +559,8 @@ static int parseFilenamePattern(const char *FilenamePat,
                       FilenamePat);
             return -1;
           }
+      } else if (FilenamePat[I] == 'c') {
+        lprofCurFilename.ContinuousMode = 1;
       } else if (containsMergeSpecifier(FilenamePat, I)) {
         if (MergingEnabled) {
           PROF_WARN("%%m specifier can only be specified once in %s.\n",
@@ -435,6 +577,19 @@ static int parseFilenamePattern(const char *FilenamePat,
       }
     }
 
+  if (lprofCurFilename.ContinuousMode) {
+#if defined(_WIN32)
+    PROF_WARN("%%c specifier is not supported on this platform in %s, "
+              "continuous mode is disabled.\n",
+              FilenamePat);
+#else
+    if (MergingEnabled)
+      PROF_WARN("%%c specifier can't be used with %%m in %s, continuous mode "
+                "is disabled.\n",
+                FilenamePat);
+#endif
+  }
+
   lprofCurFilename.NumPids = NumPids;
   lprofCurFilename.NumHosts = NumHosts;
   return 0;
@@ -475,6 +630,12 @@ static void parseAndSetFilename(const char *FilenamePat,
   }
 
   truncateCurrentFile();
+  /* The pages holding the counters may hold other data too, which must not
+   * be shared through the file by several processes. */
+  if (lprofCurFilename.ContinuousMode && !lprofCurFilename.MergePoolSize)
+    initializeProfileForContinuousMode();
+  else
+    unmapCountersFromFile();
 }
 
 /* Return buffer length that is required to store the current profile
@@ -487,7 +648,7 @@ static int getCurFilenameLength() {
     return 0;
 
   if (!(lprofCurFilename.NumPids || lprofCurFilename.NumHosts ||
-        lprofCurFilename.MergePoolSize))
+        lprofCurFilename.MergePoolSize || lprofCurFilename.ContinuousMode))
     return strlen(lprofCurFilename.FilenamePat);
 
   Len = strlen(lprofCurFilename.FilenamePat) +
@@ -511,7 +672,7 @@ static const char *getCurFilename(char *FilenameBuf, int ForceUseBuf) {
     return 0;
 
   if (!(lprofCurFilename.NumPids || lprofCurFilename.NumHosts ||
-        lprofCurFilename.MergePoolSize)) {
+        lprofCurFilename.MergePoolSize || lprofCurFilename.ContinuousMode)) {
     if (!ForceUseBuf)
       return lprofCurFilename.FilenamePat;
 
@@ -665,6 +826,10 @@ int __llvm_profile_write_file(void) {
     return 0;
   }
 
+  /* The counters are already in the file in continuous mode. */
+  if (MappedCounters)
+    return 0;
+
   Length = getCurFilenameLength();
   FilenameBuf = (char *)COMPILER_RT_ALLOCA(Length + 1);
   Filename = getCurFilename(FilenameBuf, 0);
@@ -701,7 +866,7 @@ int __llvm_profile_write_file(void) {
 
 COMPILER_RT_VISIBILITY
 int __llvm_profile_dump(void) {
-  if (!doMerging())
+  if (!doMerging() && !MappedCounters)
     PROF_WARN("Later invocation of __llvm_profile_dump can lead to clobbering "
               " of previously dumped profile data : %s. Either use %%m "
               "in profile name or change profile name before dumping.\n",
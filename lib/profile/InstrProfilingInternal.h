@@ -150,6 +150,13 @@ int lprofWriteDataImpl(ProfDataWriter *Writer,
                        VPDataReaderType *VPDataReader, const char *NamesBegin,
                        const char *NamesEnd, int SkipNameDataWrite);
 
+/* Write the profile data of continuous mode, where the page aligned counters
+ * are copied to the file at the page aligned offset returned by
+ * lprofGetContinuousModeCountersOffset, so that they can be mapped from the
+ * file over the counters. There is no value profile data in that mode. */
+int lprofWriteDataForContinuousMode(ProfDataWriter *Writer, uint64_t PageSize);
+uint64_t lprofGetContinuousModeCountersOffset(uint64_t PageSize);
+
 /* Merge value profile data pointed to by SrcValueProfData into
  * in-memory profile counters pointed by to DstData.  */
 void lprofMergeValueProfData(struct ValueProfData *SrcValueProfData,
@@ -284,3 +284,66 @@ lprofWriteDataImpl(ProfDataWriter *Writer, const __llvm_profile_data *DataBegin,
 
   return writeValueProfData(Writer, VPDataReader, DataBegin, DataEnd);
 }
+
+COMPILER_RT_VISIBILITY uint64_t
+lprofGetContinuousModeCountersOffset(uint64_t PageSize) {
+  const uint64_t DataSize = __llvm_profile_get_data_size(
+      __llvm_profile_begin_data(), __llvm_profile_end_data());
+  const uint64_t Offset =
+      sizeof(__llvm_profile_header) + DataSize * sizeof(__llvm_profile_data);
+  return (Offset + PageSize - 1) & ~(PageSize - 1);
+}
+
+COMPILER_RT_VISIBILITY int
+lprofWriteDataForContinuousMode(ProfDataWriter *Writer, uint64_t PageSize) {
+  const __llvm_profile_data *DataBegin = __llvm_profile_begin_data();
+  const __llvm_profile_data *DataEnd = __llvm_profile_end_data();
+  const char *NamesBegin = __llvm_profile_begin_names();
+  const char *NamesEnd = __llvm_profile_end_names();
+
+  /* The counters, which are page aligned and mapped from the file. */
+  const uint64_t *PagesBegin = __llvm_profile_begin_counters();
+  const uint64_t *PagesEnd = __llvm_profile_end_counters();
+
+  /* Calculate size of sections. */
+  const uint64_t DataSize = __llvm_profile_get_data_size(DataBegin, DataEnd);
+  const uint64_t NamesSize = NamesEnd - NamesBegin;
+  const uint64_t Padding = __llvm_profile_get_num_padding_bytes(NamesSize);
+  const uint64_t PaddingBeforePages =
+      lprofGetContinuousModeCountersOffset(PageSize) -
+      sizeof(__llvm_profile_header) - DataSize * sizeof(__llvm_profile_data);
+
+  /* The raw format has no room for padding before the counters, so the
+   * counters section is made to cover the padding: the readers only look at
+   * the counters the data records point to, and the padding is never read
+   * back. */
+  const uintptr_t CountersBegin = (uintptr_t)PagesBegin - PaddingBeforePages;
+  const uint64_t CountersSize =
+      PaddingBeforePages / sizeof(uint64_t) + (PagesEnd - PagesBegin);
+
+  /* Enough zeroes for padding. */
+  const char Zeroes[sizeof(uint64_t)] = {0};
+
+  /* Create the header. */
+  __llvm_profile_header Header;
+
+  if (!DataSize)
+    return 0;
+
+/* Initialize header structure.  */
+#define INSTR_PROF_RAW_HEADER(Type, Name, Init) Header.Name = Init;
+#include "InstrProfData.inc"
+
+  /* Write the data. The file is new, so skipping the padding before the
+   * pages leaves zeroes in it. */
+  ProfDataIOVec IOVec[] = {
+      {&Header, sizeof(__llvm_profile_header), 1},
+      {DataBegin, sizeof(__llvm_profile_data), DataSize},
+      {NULL, sizeof(uint8_t), PaddingBeforePages},
+      {PagesBegin, sizeof(uint64_t), PagesEnd - PagesBegin},
+      {NamesBegin, sizeof(uint8_t), NamesSize},
+      {Zeroes, sizeof(uint8_t), Padding}};
+  if (Writer->Write(Writer, IOVec, sizeof(IOVec) / sizeof(*IOVec)))
+    return -1;
+  return 0;
+}
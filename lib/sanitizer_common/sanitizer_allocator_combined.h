@@ -142,6 +142,15 @@ class CombinedAllocator {
     return secondary_.GetBlockBeginFastLocked(p);
   }
 
+  // GetBlockBeginFastLocked() finds no block for the addresses outside of the
+  // two ranges, of the primary and of the secondary allocator. Must be called
+  // with the allocator locked.
+  void GetAddressRangesLocked(uptr *primary_begin, uptr *primary_end,
+                              uptr *secondary_begin, uptr *secondary_end) {
+    primary_.GetAddressRange(primary_begin, primary_end);
+    secondary_.GetAddressRangeLocked(secondary_begin, secondary_end);
+  }
+
   uptr GetActuallyAllocatedSize(void *p) {
     if (primary_.PointerIsMine(p))
       return primary_.GetActuallyAllocatedSize(p);
@@ -196,6 +196,19 @@ class SizeClassAllocator32 {
     return GetSizeClass(p) != 0;
   }
 
+  // The blocks are within [*begin, *end). With sign extended addresses, or if
+  // the space ends at the top of the address space, that is all of it.
+  void GetAddressRange(uptr *begin, uptr *end) const {
+    if (SANITIZER_SIGN_EXTENDED_ADDRESSES ||
+        kSpaceSize - 1 > static_cast<u64>(~static_cast<uptr>(0) - kSpaceBeg)) {
+      *begin = 0;
+      *end = ~static_cast<uptr>(0);
+      return;
+    }
+    *begin = kSpaceBeg;
+    *end = kSpaceBeg + kSpaceSize;
+  }
+
   uptr GetSizeClass(const void *p) {
     return possible_regions[ComputeRegionId(reinterpret_cast<uptr>(p))];
   }
@@ -161,6 +161,12 @@ class SizeClassAllocator64 {
     return P >= SpaceBeg() && P < SpaceEnd();
   }
 
+  // The blocks are within [*begin, *end).
+  void GetAddressRange(uptr *begin, uptr *end) const {
+    *begin = SpaceBeg();
+    *end = SpaceEnd();
+  }
+
   uptr GetRegionBegin(const void *p) {
     if (kUsingConstantSpaceBeg)
       return reinterpret_cast<uptr>(p) & ~(kRegionSize - 1);
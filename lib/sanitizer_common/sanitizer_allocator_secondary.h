@@ -213,6 +213,22 @@ class LargeMmapAllocator {
     chunks_sorted_ = true;
   }
 
+  // GetBlockBeginFastLocked() finds no block for the addresses outside of
+  // [*begin, *end). Must be called with the allocator locked.
+  void GetAddressRangeLocked(uptr *begin, uptr *end) {
+    mutex_.CheckLocked();
+    uptr n = n_chunks_;
+    if (!n) {
+      *begin = *end = 0;
+      return;
+    }
+    EnsureSortedChunks();
+    Header *const *chunks = AddressSpaceView::Load(chunks_, n_chunks_);
+    *begin = reinterpret_cast<uptr>(chunks[0]);
+    *end = reinterpret_cast<uptr>(chunks[n - 1]) +
+           AddressSpaceView::Load(chunks[n - 1])->map_size;
+  }
+
   // This function does the same as GetBlockBegin, but is much faster.
   // Must be called with the allocator locked.
   void *GetBlockBeginFastLocked(void *ptr) {
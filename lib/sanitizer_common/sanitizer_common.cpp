@@ -18,6 +18,10 @@
 #include "sanitizer_libc.h"
 #include "sanitizer_placement_new.h"
 
+#if defined(__x86_64__) && !SANITIZER_WINDOWS
+#include <cpuid.h>
+#endif
+
 namespace __sanitizer {
 
 const char *SanitizerToolName = "SanitizerTool";
@@ -308,6 +312,28 @@ void RunFreeHooks(const void *ptr) {
   }
 }
 
+bool CPUHasAVX2() {
+#if defined(__x86_64__) && !SANITIZER_WINDOWS
+  u32 eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+  // The OS must save the ymm registers on context switch.
+  const u32 kXSave = bit_OSXSAVE | bit_AVX;
+  if ((ecx & kXSave) != kXSave)
+    return false;
+  u32 xcr0_lo, xcr0_hi;
+  __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  if ((xcr0_lo & 6) != 6)
+    return false;
+  if (__get_cpuid_max(0, nullptr) < 7)
+    return false;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return ebx & bit_AVX2;
+#else
+  return false;
+#endif
+}
+
 static int InstallMallocFreeHooks(void (*malloc_hook)(const void *, uptr),
                                   void (*free_hook)(const void *)) {
   if (!malloc_hook || !free_hook) return 0;
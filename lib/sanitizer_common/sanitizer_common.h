@@ -956,6 +956,7 @@ INLINE void AvoidCVE_2016_2143() {}
 struct StackDepotStats {
   uptr n_uniq_ids;
   uptr allocated;
+  uptr compression_saved;  // See compress_stack_depot flag.
 };
 
 // The default value for allocator_release_to_os_interval_ms common flag to
@@ -977,6 +978,11 @@ INLINE u32 GetNumberOfCPUsCached() {
   return NumberOfCPUsCached;
 }
 
+// Returns true if the CPU supports AVX2 and the OS saves the AVX registers
+// on context switch. Always false on architectures other than x86_64, and on
+// Windows, where <cpuid.h> and the GNU inline assembly aren't available.
+bool CPUHasAVX2();
+
 }  // namespace __sanitizer
 
 inline void *operator new(__sanitizer::operator_new_size_type size,
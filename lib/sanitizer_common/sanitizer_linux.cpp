@@ -750,6 +750,10 @@ uptr internal_lseek(fd_t fd, OFF_T offset, int whence) {
 uptr internal_prctl(int option, uptr arg2, uptr arg3, uptr arg4, uptr arg5) {
   return internal_syscall(SYSCALL(prctl), option, arg2, arg3, arg4, arg5);
 }
+
+uptr internal_getcpu(unsigned *cpu, unsigned *node) {
+  return internal_syscall(SYSCALL(getcpu), (uptr)cpu, (uptr)node, 0);
+}
 #endif
 
 uptr internal_sigaltstack(const void *ss, void *oss) {
@@ -18,17 +18,134 @@
 
 namespace __sanitizer {
 
+// With compress_stack_depot=1 stack traces are stored packed. The outermost
+// frames of a trace are split into kStackSegmentSize-frame segments which are
+// deduplicated in a separate depot keyed by (outer segment id, frames). The
+// segments thus form a prefix tree rooted at the outermost frame, and traces
+// with common callers share it. Only the innermost 1..kStackSegmentSize frames
+// and the id of the innermost shared segment are kept in the trace node.
+//
+// Frames are encoded as zigzag varints of the difference to the previous
+// frame. Neighbouring frames mostly belong to the same module, so this takes
+// 2-4 bytes per frame instead of sizeof(uptr).
+static const uptr kStackSegmentSize = 8;
+
+// Returns the number of bytes needed to pack pcs. Writes them to p, if set.
+static uptr PackFrames(u8 *p, const uptr *pcs, uptr n) {
+  uptr bytes = 0;
+  uptr prev = 0;
+  for (uptr i = 0; i < n; i++) {
+    uptr d = pcs[i] - prev;
+    prev = pcs[i];
+    d = (d << 1) ^ (uptr)((sptr)d >> (sizeof(uptr) * 8 - 1));
+    for (; d >= 0x80; d >>= 7, bytes++)
+      if (p) p[bytes] = (u8)(d | 0x80);
+    if (p) p[bytes] = (u8)d;
+    bytes++;
+  }
+  return bytes;
+}
+
+class FrameUnpacker {
+ public:
+  explicit FrameUnpacker(const u8 *p) : p_(p), prev_(0) {}
+  uptr Next() {
+    uptr d = 0;
+    for (uptr shift = 0;; shift += 7) {
+      u8 b = *p_++;
+      d |= (uptr)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) break;
+    }
+    prev_ += (d >> 1) ^ (0 - (d & 1));
+    return prev_;
+  }
+  // Returns true if the next n frames are equal to pcs.
+  bool Equal(const uptr *pcs, uptr n) {
+    for (uptr i = 0; i < n; i++)
+      if (Next() != pcs[i]) return false;
+    return true;
+  }
+
+ private:
+  const u8 *p_;
+  uptr prev_;
+};
+
+struct StackSegment {
+  u32 parent;  // Id of the segment holding the next outer frames, or 0.
+  u32 size;
+  const uptr *trace;  // Raw frames, for Put().
+  const u8 *packed;   // Packed frames, returned by Get().
+};
+
+struct StackSegmentNode {
+  u32 id;
+  u32 parent;
+  u32 size;
+  u8 packed[1];  // [PackFrames(size)]
+
+  typedef StackSegment args_type;
+  bool eq(u32 hash, const args_type &args) const {
+    return parent == args.parent && size == args.size &&
+           FrameUnpacker(packed).Equal(args.trace, size);
+  }
+  static uptr storage_size(const args_type &args) {
+    return RoundUpTo(sizeof(StackSegmentNode) - 1 +
+                         PackFrames(nullptr, args.trace, args.size),
+                     sizeof(uptr));
+  }
+  static u32 hash(const args_type &args) {
+    MurMur2HashBuilder H(args.size * sizeof(uptr));
+    H.add(args.parent);
+    for (uptr i = 0; i < args.size; i++) H.add(args.trace[i]);
+    return H.get();
+  }
+  static bool is_valid(const args_type &args) { return args.size > 0; }
+  void store(const args_type &args, u32 hash, uptr storage_size) {
+    parent = args.parent;
+    size = args.size;
+    PackFrames(packed, args.trace, size);
+  }
+  args_type load() const {
+    args_type ret = {parent, size, nullptr, packed};
+    return ret;
+  }
+  StackSegmentNode *get_handle() { return this; }
+
+  typedef StackSegmentNode *handle_type;
+};
+
+static StackDepotBase<StackSegmentNode, 0, SANITIZER_ANDROID ? 12 : 16>
+    theSegments;
+
+// Bytes the packed traces would have taken unpacked, minus what they take.
+static atomic_uintptr_t packed_saved;
+
+// Tail of a StackDepotNode holding a packed trace.
+struct StackDepotPackedTrace {
+  // The frames unpacked by the first Get(), or 0. They are never freed, as
+  // StackTrace refers to them by pointer.
+  atomic_uintptr_t unpacked;
+  u32 parent;    // Innermost segment of the outer frames.
+  u8 frames[1];  // Innermost frames, packed.
+
+  // Number of the innermost frames not stored in segments.
+  static uptr top_size(uptr size) {
+    return size - (size - 1) / kStackSegmentSize * kStackSegmentSize;
+  }
+};
+
 struct StackDepotNode {
-  StackDepotNode *link;
   u32 id;
   atomic_uint32_t hash_and_use_count; // hash_bits : 12; use_count : 20;
-  u32 size;
+  u32 size : 31;
+  u32 is_packed : 1;
   u32 tag;
-  uptr stack[1];  // [size]
+  uptr stack[1];  // [size], or StackDepotPackedTrace if is_packed.
 
   static const u32 kTabSizeLog = SANITIZER_ANDROID ? 16 : 20;
-  // Lower kTabSizeLog bits are equal for all items in one bucket.
-  // We use these bits to store the per-stack use counter.
+  // Lower kTabSizeLog bits are equal for all items in one bucket (the table
+  // only grows), so we use these bits to store the per-stack use counter.
   static const u32 kUseCountBits = kTabSizeLog;
   static const u32 kMaxUseCount = 1 << kUseCountBits;
   static const u32 kUseCountMask = (1 << kUseCountBits) - 1;
@@ -40,15 +157,37 @@ struct StackDepotNode {
         atomic_load(&hash_and_use_count, memory_order_relaxed) & kHashMask;
     if ((hash & kHashMask) != hash_bits || args.size != size || args.tag != tag)
       return false;
+    if (is_packed) return packed_eq(args);
     uptr i = 0;
     for (; i < size; i++) {
       if (stack[i] != args.trace[i]) return false;
     }
     return true;
   }
-  static uptr storage_size(const args_type &args) {
+  static uptr raw_storage_size(const args_type &args) {
     return sizeof(StackDepotNode) + (args.size - 1) * sizeof(uptr);
   }
+  static uptr packed_storage_size(const args_type &args) {
+    uptr top = StackDepotPackedTrace::top_size(args.size);
+    return RoundUpTo(sizeof(StackDepotNode) - sizeof(uptr) +
+                         __builtin_offsetof(StackDepotPackedTrace, frames) +
+                         PackFrames(nullptr, args.trace, top),
+                     sizeof(uptr));
+  }
+  // Short traces may not get smaller when packed, they are kept raw.
+  static bool use_packed(const args_type &args) {
+    return common_flags()->compress_stack_depot &&
+           packed_storage_size(args) < raw_storage_size(args);
+  }
+  static uptr storage_size(const args_type &args) {
+    if (use_packed(args)) return packed_storage_size(args);
+    return raw_storage_size(args);
+  }
+  // storage_size() has chosen the layout. The flag may have changed since,
+  // so it is not read again.
+  static bool is_packed_size(const args_type &args, uptr storage_size) {
+    return storage_size < raw_storage_size(args);
+  }
   static u32 hash(const args_type &args) {
     MurMur2HashBuilder H(args.size * sizeof(uptr));
     for (uptr i = 0; i < args.size; i++) H.add(args.trace[i]);
@@ -57,20 +196,94 @@ struct StackDepotNode {
   static bool is_valid(const args_type &args) {
     return args.size > 0 && args.trace;
   }
-  void store(const args_type &args, u32 hash) {
+  void store(const args_type &args, u32 hash, uptr storage_size) {
     atomic_store(&hash_and_use_count, hash & kHashMask, memory_order_relaxed);
     size = args.size;
     tag = args.tag;
-    internal_memcpy(stack, args.trace, size * sizeof(uptr));
+    is_packed = is_packed_size(args, storage_size);
+    if (is_packed)
+      store_packed(args, storage_size);
+    else
+      internal_memcpy(stack, args.trace, size * sizeof(uptr));
   }
   args_type load() const {
+    if (is_packed) return args_type(unpack(), size, tag);
     return args_type(&stack[0], size, tag);
   }
   StackDepotHandle get_handle() { return StackDepotHandle(this); }
 
   typedef StackDepotHandle handle_type;
+
+ private:
+  StackDepotPackedTrace *packed_trace() const {
+    return (StackDepotPackedTrace *)&stack[0];
+  }
+  void store_packed(const args_type &args, uptr storage_size);
+  bool packed_eq(const args_type &args) const;
+  const uptr *unpack() const;
 };
 
+void StackDepotNode::store_packed(const args_type &args, uptr storage_size) {
+  StackDepotPackedTrace *p = packed_trace();
+  uptr top = StackDepotPackedTrace::top_size(size);
+  u32 parent = 0;
+  for (uptr end = size; end > top; end -= kStackSegmentSize) {
+    StackSegment seg = {parent, kStackSegmentSize,
+                        args.trace + end - kStackSegmentSize, nullptr};
+    parent = theSegments.Put(seg)->id;
+  }
+  atomic_store_relaxed(&p->unpacked, 0);
+  p->parent = parent;
+  PackFrames(p->frames, args.trace, top);
+  atomic_fetch_add(&packed_saved, raw_storage_size(args) - storage_size,
+                   memory_order_relaxed);
+}
+
+bool StackDepotNode::packed_eq(const args_type &args) const {
+  const StackDepotPackedTrace *p = packed_trace();
+  uptr pos = StackDepotPackedTrace::top_size(size);
+  if (!FrameUnpacker(p->frames).Equal(args.trace, pos)) return false;
+  for (u32 id = p->parent; id;) {
+    StackSegment seg = theSegments.Get(id);
+    if (!FrameUnpacker(seg.packed).Equal(args.trace + pos, seg.size))
+      return false;
+    pos += seg.size;
+    id = seg.parent;
+  }
+  return true;
+}
+
+// StackTrace refers to the frames by pointer, and the callers keep traces for
+// as long as they like, so a packed trace is unpacked once into persistent
+// memory. Only the traces which are retrieved, e.g. for a report, pay for it.
+static StaticSpinMutex unpack_mu;
+// Bytes allocated for the unpacked traces.
+static atomic_uintptr_t unpacked_allocated;
+
+const uptr *StackDepotNode::unpack() const {
+  StackDepotPackedTrace *p = packed_trace();
+  uptr *trace = (uptr *)atomic_load(&p->unpacked, memory_order_acquire);
+  if (trace) return trace;
+  SpinMutexLock l(&unpack_mu);
+  trace = (uptr *)atomic_load(&p->unpacked, memory_order_relaxed);
+  if (trace) return trace;
+  trace = (uptr *)PersistentAlloc(size * sizeof(uptr));
+  atomic_fetch_add(&unpacked_allocated, size * sizeof(uptr),
+                   memory_order_relaxed);
+  uptr pos = StackDepotPackedTrace::top_size(size);
+  FrameUnpacker top(p->frames);
+  for (uptr i = 0; i < pos; i++) trace[i] = top.Next();
+  for (u32 id = p->parent; id;) {
+    StackSegment seg = theSegments.Get(id);
+    FrameUnpacker u(seg.packed);
+    for (uptr i = 0; i < seg.size; i++) trace[pos++] = u.Next();
+    id = seg.parent;
+  }
+  CHECK_EQ(pos, size);
+  atomic_store(&p->unpacked, (uptr)trace, memory_order_release);
+  return trace;
+}
+
 COMPILER_CHECK(StackDepotNode::kMaxUseCount == (u32)kStackDepotMaxUseCount);
 
 u32 StackDepotHandle::id() { return node_->id; }
@@ -90,8 +303,15 @@ typedef StackDepotBase<StackDepotNode, 1, StackDepotNode::kTabSizeLog>
     StackDepot;
 static StackDepot theDepot;
 
-StackDepotStats *StackDepotGetStats() {
-  return theDepot.GetStats();
+StackDepotStats StackDepotGetStats() {
+  StackDepotStats stats = theDepot.GetStats();
+  uptr unpacked = atomic_load(&unpacked_allocated, memory_order_relaxed);
+  uptr overhead = theSegments.GetStats().allocated + unpacked;
+  sptr saved = (sptr)atomic_load(&packed_saved, memory_order_relaxed) -
+               (sptr)overhead;
+  stats.allocated += overhead;
+  stats.compression_saved = saved > 0 ? saved : 0;
+  return stats;
 }
 
 u32 StackDepotPut(StackTrace stack) {
@@ -109,9 +329,13 @@ StackTrace StackDepotGet(u32 id) {
 
 void StackDepotLockAll() {
   theDepot.LockAll();
+  theSegments.LockAll();
+  unpack_mu.Lock();
 }
 
 void StackDepotUnlockAll() {
+  unpack_mu.Unlock();
+  theSegments.UnlockAll();
   theDepot.UnlockAll();
 }
 
@@ -122,15 +346,19 @@ bool StackDepotReverseMap::IdDescPair::IdComparator(
 }
 
 StackDepotReverseMap::StackDepotReverseMap() {
-  map_.reserve(StackDepotGetStats()->n_uniq_ids + 100);
-  for (int idx = 0; idx < StackDepot::kTabSize; idx++) {
-    atomic_uintptr_t *p = &theDepot.tab[idx];
-    uptr v = atomic_load(p, memory_order_consume);
-    StackDepotNode *s = (StackDepotNode*)(v & ~1);
-    for (; s; s = s->link) {
-      IdDescPair pair = {s->id, s};
-      map_.push_back(pair);
-    }
+  map_.reserve(StackDepotGetStats().n_uniq_ids + 100);
+  // All nodes are chained in a single list starting at the bucket 0 sentinel.
+  StackDepot::Cell *c = &theDepot.head;
+  for (; c; c = (StackDepot::Cell *)atomic_load(&c->next,
+                                                memory_order_consume)) {
+    if (c->is_sentinel())
+      continue;
+    u32 id = atomic_load(StackDepot::id_of(c->node()), memory_order_acquire);
+    // The node is being inserted right now.
+    if (!id)
+      continue;
+    IdDescPair pair = {id, c->node()};
+    map_.push_back(pair);
   }
   Sort(map_.data(), map_.size(), &IdDescPair::IdComparator);
 }
@@ -8,6 +8,13 @@
 //
 // Implementation of a mapping from arbitrary values to unique 32-bit
 // identifiers.
+//
+// The depot is a split-ordered list (Shalev, Shavit: "Split-Ordered Lists:
+// Lock-Free Extensible Hash Tables"): all nodes live in a single linked list
+// sorted by the bit-reversed hash, and the hash table buckets are shortcuts
+// into that list. Growing the table never moves nodes, it only adds new
+// buckets which are lazily spliced into the list. Since nodes are never
+// removed, both lookups and insertions are lock-free.
 //===----------------------------------------------------------------------===//
 
 #ifndef SANITIZER_STACKDEPOTBASE_H
@@ -30,54 +37,134 @@ class StackDepotBase {
   // Retrieves a stored stack trace by the id.
   args_type Get(u32 id);
 
-  StackDepotStats *GetStats() { return &stats; }
+  StackDepotStats GetStats() const;
 
   void LockAll();
   void UnlockAll();
 
  private:
-  static Node *find(Node *s, args_type args, u32 hash);
-  static Node *lock(atomic_uintptr_t *p);
-  static void unlock(atomic_uintptr_t *p, Node *s);
+  // An element of the split-ordered list. Cells with an even key are bucket
+  // sentinels, cells with an odd key are followed by a Node.
+  struct Cell {
+    atomic_uintptr_t next;
+    u64 key;
+
+    bool is_sentinel() const { return (key & 1) == 0; }
+    Node *node() { return reinterpret_cast<Node *>(this + 1); }
+  };
+
+  static u32 reverse_bits(u32 x);
+  static u64 node_key(u32 hash) { return ((u64)reverse_bits(hash) << 1) | 1; }
+  static u64 sentinel_key(u32 idx) { return (u64)reverse_bits(idx) << 1; }
+  static uptr parent_bucket(uptr idx) {
+    return idx & ~((uptr)1 << MostSignificantSetBitIndex(idx));
+  }
+
+  static Node *find(Cell **prev, Cell **next, u64 key, args_type args,
+                    u32 hash);
+  static Cell *link_sentinel(Cell *prev, Cell *s);
+  // A node gets its id only after it is linked, so that the nodes which lose
+  // an insertion race don't use up ids. Until then the id is 0.
+  static atomic_uint32_t *id_of(Node *node) {
+    return reinterpret_cast<atomic_uint32_t *>(&node->id);
+  }
+  static void wait_for_id(Node *node);
+  Cell *alloc_cell(uptr *memsz);
+  void free_cell(Cell *s, uptr memsz);
 
-  static const int kTabSize = 1 << kTabSizeLog;  // Hash table size.
-  static const int kPartBits = 8;
-  static const int kPartShift = sizeof(u32) * 8 - kPartBits - kReservedBits;
-  static const int kPartCount =
-      1 << kPartBits;  // Number of subparts in the table.
-  static const int kPartSize = kTabSize / kPartCount;
-  static const int kMaxId = 1 << kPartShift;
+  uptr tab_mask() const;
+  atomic_uintptr_t *bucket_slot(uptr idx, bool create);
+  Cell *find_bucket(uptr idx);
+  Cell *get_bucket(uptr idx);
+  atomic_uintptr_t *id_slot(u32 id, bool create);
+  void maybe_grow(u32 n);
 
-  atomic_uintptr_t tab[kTabSize];   // Hash table of Node's.
-  atomic_uint32_t seq[kPartCount];  // Unique id generators.
+  void lock_inserts();
+  void unlock_inserts();
 
-  StackDepotStats stats;
+  static const int kTabSize = 1 << kTabSizeLog;  // Initial hash table size.
+  // The table doubles in size when the average chain length exceeds kMaxLoad.
+  static const int kMaxLoad = 2;
+  static const int kMaxTabSizeLog = 30;
+  static const int kSegmentCount = kMaxTabSizeLog - kTabSizeLog + 1;
+  static const uptr kMaxId = (uptr)1 << (sizeof(u32) * 8 - kReservedBits);
+  static const int kIdChunkLog = 16;
+  static const uptr kIdChunkSize = 1 << kIdChunkLog;
+  static const uptr kIdChunkCount = kMaxId >> kIdChunkLog;
+
+  static const u32 kInsertWriter = 1;
+  static const u32 kInsertReader = 2;
+
+  Cell head;                          // Sentinel of bucket 0.
+  atomic_uintptr_t tab[kTabSize];     // Initial buckets, point to sentinels.
+  // segments[i] holds buckets [kTabSize << (i - 1), kTabSize << i).
+  atomic_uintptr_t segments[kSegmentCount];
+  atomic_uint32_t tab_grow;           // log2 of current size / kTabSize.
+  atomic_uintptr_t ids[kIdChunkCount];  // Two-level map from id to Node.
+  atomic_uint32_t seq;                // Unique id generator.
+  atomic_uint32_t insert_state;       // Allows LockAll to stop insertions.
+  // A cell which lost an insertion race, kept for the next insertion. Its
+  // key holds its size.
+  atomic_uintptr_t spare;
+  atomic_uintptr_t allocated;         // Bytes taken by the cells.
 
   friend class StackDepotReverseMap;
 };
 
 template <class Node, int kReservedBits, int kTabSizeLog>
-Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::find(Node *s,
-                                                             args_type args,
-                                                             u32 hash) {
-  // Searches linked list s for the stack, returns its id.
-  for (; s; s = s->link) {
-    if (s->eq(hash, args)) {
-      return s;
-    }
+u32 StackDepotBase<Node, kReservedBits, kTabSizeLog>::reverse_bits(u32 x) {
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::find(
+    Cell **prev, Cell **next, u64 key, args_type args, u32 hash) {
+  // Walks the list starting after *prev. Returns the node equal to args, or
+  // nullptr with *prev and *next set to the place where args belongs.
+  Cell *p = *prev;
+  Cell *s;
+  for (;;) {
+    s = (Cell *)atomic_load(&p->next, memory_order_consume);
+    if (!s || s->key > key) break;
+    if (s->key == key && s->node()->eq(hash, args)) return s->node();
+    p = s;
   }
+  *prev = p;
+  *next = s;
   return nullptr;
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
-Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::lock(
-    atomic_uintptr_t *p) {
-  // Uses the pointer lsb as mutex.
-  for (int i = 0;; i++) {
-    uptr cmp = atomic_load(p, memory_order_relaxed);
-    if ((cmp & 1) == 0 &&
-        atomic_compare_exchange_weak(p, &cmp, cmp | 1, memory_order_acquire))
-      return (Node *)cmp;
+typename StackDepotBase<Node, kReservedBits, kTabSizeLog>::Cell *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::link_sentinel(Cell *prev,
+                                                                Cell *s) {
+  // Inserts sentinel s after prev, or returns the existing sentinel with the
+  // same key if another thread has inserted it first.
+  for (;;) {
+    Cell *next = (Cell *)atomic_load(&prev->next, memory_order_consume);
+    if (next && next->key < s->key) {
+      prev = next;
+      continue;
+    }
+    if (next && next->key == s->key) return next;
+    atomic_store(&s->next, (uptr)next, memory_order_relaxed);
+    uptr cmp = (uptr)next;
+    if (atomic_compare_exchange_strong(&prev->next, &cmp, (uptr)s,
+                                       memory_order_release))
+      return s;
+  }
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+void StackDepotBase<Node, kReservedBits, kTabSizeLog>::wait_for_id(
+    Node *node) {
+  // The node is found right after another thread has linked it. Its id shows
+  // up as soon as that thread has mapped it, so Get(id) never fails.
+  for (int i = 0; !atomic_load(id_of(node), memory_order_acquire); i++) {
     if (i < 10)
       proc_yield(10);
     else
@@ -86,10 +173,137 @@ Node *StackDepotBase<Node, kReservedBits, kTabSizeLog>::lock(
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
-void StackDepotBase<Node, kReservedBits, kTabSizeLog>::unlock(
-    atomic_uintptr_t *p, Node *s) {
-  DCHECK_EQ((uptr)s & 1, 0);
+typename StackDepotBase<Node, kReservedBits, kTabSizeLog>::Cell *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::alloc_cell(uptr *memsz) {
+  // Returns a cell of at least *memsz bytes, and sets *memsz to its size.
+  Cell *s = (Cell *)atomic_exchange(&spare, 0, memory_order_acquire);
+  if (s && s->key >= *memsz) {
+    *memsz = s->key;
+    return s;
+  }
+  if (s) free_cell(s, s->key);
+  s = (Cell *)PersistentAlloc(*memsz);
+  atomic_fetch_add(&allocated, *memsz, memory_order_relaxed);
+  return s;
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+void StackDepotBase<Node, kReservedBits, kTabSizeLog>::free_cell(Cell *s,
+                                                                 uptr memsz) {
+  // The persistent memory can't be freed. Only one cell is kept, so a few
+  // are lost if several insertions race at once.
+  s->key = memsz;
+  uptr cmp = 0;
+  atomic_compare_exchange_strong(&spare, &cmp, (uptr)s,
+                                 memory_order_release);
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+uptr StackDepotBase<Node, kReservedBits, kTabSizeLog>::tab_mask() const {
+  u32 grow = atomic_load(&tab_grow, memory_order_relaxed);
+  return ((uptr)kTabSize << grow) - 1;
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+atomic_uintptr_t *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::bucket_slot(uptr idx,
+                                                              bool create) {
+  if (idx < kTabSize) return &tab[idx];
+  uptr seg = MostSignificantSetBitIndex(idx) - kTabSizeLog + 1;
+  CHECK_LT(seg, kSegmentCount);
+  uptr seg_size = (uptr)kTabSize << (seg - 1);
+  atomic_uintptr_t *p = &segments[seg];
+  uptr v = atomic_load(p, memory_order_consume);
+  if (!v) {
+    if (!create) return nullptr;
+    uptr size = seg_size * sizeof(atomic_uintptr_t);
+    uptr mem = (uptr)MmapOrDie(size, "stack depot");
+    if (atomic_compare_exchange_strong(p, &v, mem, memory_order_acq_rel))
+      v = mem;
+    else
+      UnmapOrDie((void *)mem, size);
+  }
+  return &((atomic_uintptr_t *)v)[idx - seg_size];
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+typename StackDepotBase<Node, kReservedBits, kTabSizeLog>::Cell *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::find_bucket(uptr idx) {
+  // Returns the sentinel of bucket idx or of its closest initialized parent.
+  // Any of them is a valid starting point for a search, so lookups never
+  // have to allocate.
+  for (; idx; idx = parent_bucket(idx)) {
+    atomic_uintptr_t *p = bucket_slot(idx, false);
+    if (!p) continue;
+    uptr v = atomic_load(p, memory_order_consume);
+    if (v) return (Cell *)v;
+  }
+  return &head;
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+typename StackDepotBase<Node, kReservedBits, kTabSizeLog>::Cell *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::get_bucket(uptr idx) {
+  if (idx == 0) return &head;
+  atomic_uintptr_t *p = bucket_slot(idx, true);
+  uptr v = atomic_load(p, memory_order_consume);
+  if (v) return (Cell *)v;
+  Cell *parent = get_bucket(parent_bucket(idx));
+  Cell *s = (Cell *)PersistentAlloc(sizeof(Cell));
+  atomic_fetch_add(&allocated, sizeof(Cell), memory_order_relaxed);
+  s->key = sentinel_key(idx);
+  // All racing threads agree on the sentinel returned by link_sentinel.
+  s = link_sentinel(parent, s);
   atomic_store(p, (uptr)s, memory_order_release);
+  return s;
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+atomic_uintptr_t *
+StackDepotBase<Node, kReservedBits, kTabSizeLog>::id_slot(u32 id,
+                                                          bool create) {
+  atomic_uintptr_t *p = &ids[id >> kIdChunkLog];
+  uptr v = atomic_load(p, memory_order_consume);
+  if (!v) {
+    if (!create) return nullptr;
+    uptr size = kIdChunkSize * sizeof(atomic_uintptr_t);
+    uptr mem = (uptr)MmapOrDie(size, "stack depot");
+    if (atomic_compare_exchange_strong(p, &v, mem, memory_order_acq_rel))
+      v = mem;
+    else
+      UnmapOrDie((void *)mem, size);
+  }
+  return &((atomic_uintptr_t *)v)[id & (kIdChunkSize - 1)];
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+void StackDepotBase<Node, kReservedBits, kTabSizeLog>::maybe_grow(u32 n) {
+  u32 grow = atomic_load(&tab_grow, memory_order_relaxed);
+  if (n <= ((uptr)kMaxLoad * kTabSize << grow) ||
+      grow + 1 >= (u32)kSegmentCount)
+    return;
+  // Losing the race is fine, somebody else has grown the table.
+  atomic_compare_exchange_strong(&tab_grow, &grow, grow + 1,
+                                 memory_order_relaxed);
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+void StackDepotBase<Node, kReservedBits, kTabSizeLog>::lock_inserts() {
+  for (int i = 0;; i++) {
+    u32 prev =
+        atomic_fetch_add(&insert_state, kInsertReader, memory_order_acquire);
+    if ((prev & kInsertWriter) == 0) return;
+    atomic_fetch_sub(&insert_state, kInsertReader, memory_order_relaxed);
+    if (i < 10)
+      proc_yield(10);
+    else
+      internal_sched_yield();
+  }
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+void StackDepotBase<Node, kReservedBits, kTabSizeLog>::unlock_inserts() {
+  atomic_fetch_sub(&insert_state, kInsertReader, memory_order_release);
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
@@ -98,38 +312,59 @@ StackDepotBase<Node, kReservedBits, kTabSizeLog>::Put(args_type args,
                                                       bool *inserted) {
   if (inserted) *inserted = false;
   if (!Node::is_valid(args)) return handle_type();
-  uptr h = Node::hash(args);
-  atomic_uintptr_t *p = &tab[h % kTabSize];
-  uptr v = atomic_load(p, memory_order_consume);
-  Node *s = (Node *)(v & ~1);
+  u32 h = Node::hash(args);
+  u64 key = node_key(h);
+  uptr idx = h & tab_mask();
   // First, try to find the existing stack.
-  Node *node = find(s, args, h);
-  if (node) return node->get_handle();
-  // If failed, lock, retry and insert new.
-  Node *s2 = lock(p);
-  if (s2 != s) {
-    node = find(s2, args, h);
-    if (node) {
-      unlock(p, s2);
-      return node->get_handle();
+  Cell *prev = find_bucket(idx);
+  Cell *next;
+  Node *node = find(&prev, &next, key, args, h);
+  if (node) {
+    wait_for_id(node);
+    return node->get_handle();
+  }
+  // If failed, splice a new node into the list. LockAll only needs to wait
+  // for insertions, as lookups never block and never allocate.
+  lock_inserts();
+  prev = get_bucket(idx);
+  Cell *s = nullptr;
+  uptr memsz = 0;
+  u32 id = 0;
+  for (;;) {
+    node = find(&prev, &next, key, args, h);
+    if (node) break;
+    if (!s) {
+      // The node is stored in the layout storage_size() has chosen.
+      uptr storage_size = Node::storage_size(args);
+      memsz = sizeof(Cell) + storage_size;
+      s = alloc_cell(&memsz);
+      s->key = key;
+      atomic_store(id_of(s->node()), 0, memory_order_relaxed);
+      s->node()->store(args, h, storage_size);
+    }
+    atomic_store(&s->next, (uptr)next, memory_order_relaxed);
+    uptr cmp = (uptr)next;
+    if (atomic_compare_exchange_strong(&prev->next, &cmp, (uptr)s,
+                                       memory_order_release)) {
+      node = s->node();
+      if (inserted) *inserted = true;
+      // Map the id before publishing it, so that it resolves once visible.
+      id = atomic_fetch_add(&seq, 1, memory_order_relaxed) + 1;
+      CHECK_LT(id, kMaxId);
+      CHECK_EQ(id & (((u32)-1) >> kReservedBits), id);
+      atomic_store(id_slot(id, true), (uptr)node, memory_order_release);
+      atomic_store(id_of(node), id, memory_order_release);
+      break;
     }
   }
-  uptr part = (h % kTabSize) / kPartSize;
-  u32 id = atomic_fetch_add(&seq[part], 1, memory_order_relaxed) + 1;
-  stats.n_uniq_ids++;
-  CHECK_LT(id, kMaxId);
-  id |= part << kPartShift;
-  CHECK_NE(id, 0);
-  CHECK_EQ(id & (((u32)-1) >> kReservedBits), id);
-  uptr memsz = Node::storage_size(args);
-  s = (Node *)PersistentAlloc(memsz);
-  stats.allocated += memsz;
-  s->id = id;
-  s->store(args, h);
-  s->link = s2;
-  unlock(p, s);
-  if (inserted) *inserted = true;
-  return s->get_handle();
+  // Another thread has inserted the same args first.
+  if (s && !id) free_cell(s, memsz);
+  unlock_inserts();
+  if (id)
+    maybe_grow(id);
+  else
+    wait_for_id(node);
+  return node->get_handle();
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
@@ -139,37 +374,49 @@ StackDepotBase<Node, kReservedBits, kTabSizeLog>::Get(u32 id) {
     return args_type();
   }
   CHECK_EQ(id & (((u32)-1) >> kReservedBits), id);
-  // High kPartBits contain part id, so we need to scan at most kPartSize lists.
-  uptr part = id >> kPartShift;
-  for (int i = 0; i != kPartSize; i++) {
-    uptr idx = part * kPartSize + i;
-    CHECK_LT(idx, kTabSize);
-    atomic_uintptr_t *p = &tab[idx];
-    uptr v = atomic_load(p, memory_order_consume);
-    Node *s = (Node *)(v & ~1);
-    for (; s; s = s->link) {
-      if (s->id == id) {
-        return s->load();
-      }
-    }
-  }
-  return args_type();
+  atomic_uintptr_t *p = id_slot(id, false);
+  if (!p) return args_type();
+  Node *s = (Node *)atomic_load(p, memory_order_consume);
+  if (!s) return args_type();
+  return s->load();
+}
+
+template <class Node, int kReservedBits, int kTabSizeLog>
+StackDepotStats StackDepotBase<Node, kReservedBits, kTabSizeLog>::GetStats()
+    const {
+  StackDepotStats stats = {};
+  stats.n_uniq_ids = atomic_load(&seq, memory_order_relaxed);
+  stats.allocated = atomic_load(&allocated, memory_order_relaxed);
+  return stats;
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
 void StackDepotBase<Node, kReservedBits, kTabSizeLog>::LockAll() {
-  for (int i = 0; i < kTabSize; ++i) {
-    lock(&tab[i]);
+  for (int i = 0;; i++) {
+    u32 cmp = atomic_load(&insert_state, memory_order_relaxed);
+    if ((cmp & kInsertWriter) == 0 &&
+        atomic_compare_exchange_weak(&insert_state, &cmp, cmp | kInsertWriter,
+                                     memory_order_acquire))
+      break;
+    if (i < 10)
+      proc_yield(10);
+    else
+      internal_sched_yield();
+  }
+  // Wait for the in-flight insertions to finish.
+  for (int i = 0;
+       atomic_load(&insert_state, memory_order_acquire) != kInsertWriter;
+       i++) {
+    if (i < 10)
+      proc_yield(10);
+    else
+      internal_sched_yield();
   }
 }
 
 template <class Node, int kReservedBits, int kTabSizeLog>
 void StackDepotBase<Node, kReservedBits, kTabSizeLog>::UnlockAll() {
-  for (int i = 0; i < kTabSize; ++i) {
-    atomic_uintptr_t *p = &tab[i];
-    uptr s = atomic_load(p, memory_order_relaxed);
-    unlock(p, (Node *)(s & ~1UL));
-  }
+  atomic_fetch_sub(&insert_state, kInsertWriter, memory_order_release);
 }
 
 } // namespace __sanitizer
@@ -26,12 +26,20 @@ void StackTrace::Print() const {
   InternalScopedString frame_desc(GetPageSizeCached() * 2);
   InternalScopedString dedup_token(GetPageSizeCached());
   int dedup_frames = common_flags()->dedup_token_length;
+  // PCs in stack traces are actually the return addresses, that is,
+  // addresses of the next instructions after the call.
+  uptr num_pcs = 0;
+  while (num_pcs < size && trace[num_pcs]) num_pcs++;
+  InternalMmapVector<uptr> pcs(num_pcs);
+  for (uptr i = 0; i < num_pcs; i++)
+    pcs[i] = GetPreviousInstructionPc(trace[i]);
+  // Symbolize the whole trace at once, so that the symbolizer may handle the
+  // PCs in batches.
+  InternalMmapVector<SymbolizedStack *> stacks(num_pcs);
+  Symbolizer::GetOrInit()->SymbolizePCs(pcs.data(), num_pcs, stacks.data());
   uptr frame_num = 0;
-  for (uptr i = 0; i < size && trace[i]; i++) {
-    // PCs in stack traces are actually the return addresses, that is,
-    // addresses of the next instructions after the call.
-    uptr pc = GetPreviousInstructionPc(trace[i]);
-    SymbolizedStack *frames = Symbolizer::GetOrInit()->SymbolizePC(pc);
+  for (uptr i = 0; i < num_pcs; i++) {
+    SymbolizedStack *frames = stacks[i];
     CHECK(frames);
     for (SymbolizedStack *cur = frames; cur; cur = cur->next) {
       frame_desc.clear();
@@ -11,6 +11,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_allocator_internal.h"
+#include "sanitizer_flags.h"
 #include "sanitizer_platform.h"
 #include "sanitizer_internal_defs.h"
 #include "sanitizer_libc.h"
@@ -111,6 +112,127 @@ const char *Symbolizer::ModuleNameOwner::GetOwnedCopy(const char *str) {
   return last_match_;
 }
 
+// Returns a copy of the frames, for |addr|.
+static SymbolizedStack *CopyFrames(const SymbolizedStack *frames, uptr addr) {
+  SymbolizedStack *first = nullptr;
+  SymbolizedStack **last = &first;
+  for (const SymbolizedStack *cur = frames; cur; cur = cur->next) {
+    SymbolizedStack *copy = SymbolizedStack::New(addr);
+    const AddressInfo &info = cur->info;
+    copy->info.FillModuleInfo(info.module, info.module_offset,
+                              info.module_arch);
+    copy->info.function = info.function ? internal_strdup(info.function)
+                                        : nullptr;
+    copy->info.function_offset = info.function_offset;
+    copy->info.file = info.file ? internal_strdup(info.file) : nullptr;
+    copy->info.line = info.line;
+    copy->info.column = info.column;
+    *last = copy;
+    last = &copy->next;
+  }
+  return first;
+}
+
+static uptr HashModuleOffset(const char *module, uptr module_offset) {
+  u64 hash = (reinterpret_cast<uptr>(module) >> 4) ^ module_offset;
+  hash *= 0x9e3779b97f4a7c15ULL;
+  return static_cast<uptr>(hash >> 32);
+}
+
+u32 *SymbolizerFrameCache::FindInBucket(const char *module,
+                                        uptr module_offset) {
+  u32 *index = &buckets_[HashModuleOffset(module, module_offset) &
+                         (buckets_.size() - 1)];
+  while (*index != kNone) {
+    const Entry &entry = entries_[*index];
+    if (entry.module == module && entry.module_offset == module_offset)
+      break;
+    index = &entries_[*index].next_in_bucket;
+  }
+  return index;
+}
+
+void SymbolizerFrameCache::Unlink(u32 index) {
+  const Entry &entry = entries_[index];
+  if (entry.newer != kNone)
+    entries_[entry.newer].older = entry.older;
+  else
+    newest_ = entry.older;
+  if (entry.older != kNone)
+    entries_[entry.older].newer = entry.newer;
+  else
+    oldest_ = entry.newer;
+}
+
+void SymbolizerFrameCache::LinkNewest(u32 index) {
+  Entry &entry = entries_[index];
+  entry.newer = kNone;
+  entry.older = newest_;
+  if (newest_ != kNone)
+    entries_[newest_].newer = index;
+  else
+    oldest_ = index;
+  newest_ = index;
+}
+
+SymbolizedStack *SymbolizerFrameCache::Get(const char *module,
+                                           uptr module_offset, uptr address) {
+  if (buckets_.empty())
+    return nullptr;
+  u32 index = *FindInBucket(module, module_offset);
+  if (index == kNone)
+    return nullptr;
+  Unlink(index);
+  LinkNewest(index);
+  return CopyFrames(entries_[index].frames, address);
+}
+
+void SymbolizerFrameCache::Put(const char *module, uptr module_offset,
+                               const SymbolizedStack *frames) {
+  const int capacity = common_flags()->symbolize_cache_size;
+  if (capacity <= 0)
+    return;
+  if (buckets_.empty()) {
+    entries_.reserve(capacity);
+    buckets_.resize(RoundUpToPowerOfTwo(2 * capacity));
+    internal_memset(buckets_.data(), 0xff, buckets_.size() * sizeof(u32));
+  }
+  if (*FindInBucket(module, module_offset) != kNone)
+    return;
+  u32 index;
+  if (entries_.size() < static_cast<uptr>(capacity)) {
+    index = entries_.size();
+    entries_.push_back(Entry());
+  } else {
+    // Evict the least recently used entry.
+    index = oldest_;
+    Entry &entry = entries_[index];
+    *FindInBucket(entry.module, entry.module_offset) = entry.next_in_bucket;
+    Unlink(index);
+    entry.frames->ClearAll();
+  }
+  Entry &entry = entries_[index];
+  entry.module = module;
+  entry.module_offset = module_offset;
+  entry.frames = CopyFrames(frames, frames->info.address);
+  u32 &bucket = buckets_[HashModuleOffset(module, module_offset) &
+                         (buckets_.size() - 1)];
+  entry.next_in_bucket = bucket;
+  bucket = index;
+  LinkNewest(index);
+}
+
+void SymbolizerFrameCache::Clear() {
+  for (Entry &entry : entries_)
+    entry.frames->ClearAll();
+  // Release the memory too.
+  InternalMmapVector<Entry> entries;
+  entries_.swap(entries);
+  InternalMmapVector<u32> buckets;
+  buckets_.swap(buckets);
+  newest_ = oldest_ = kNone;
+}
+
 Symbolizer::Symbolizer(IntrusiveList<SymbolizerTool> tools)
     : module_names_(&mu_), modules_(), modules_fresh_(false), tools_(tools),
       start_hook_(0), end_hook_(0) {}
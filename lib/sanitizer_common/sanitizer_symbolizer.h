@@ -104,6 +104,42 @@ struct FrameInfo {
   void Clear();
 };
 
+// An LRU cache of the frames symbolized for the module offsets, so that the
+// PCs found in many stack traces are only symbolized once. It holds up to
+// symbolize_cache_size entries. The module names are compared as pointers, so
+// the Symbolizer passes the copies owned by its ModuleNameOwner. It does not
+// provide any synchronization.
+class SymbolizerFrameCache {
+ public:
+  // Returns a copy of the frames cached for the module offset, for
+  // |address|, or nullptr.
+  SymbolizedStack *Get(const char *module, uptr module_offset, uptr address);
+  // Caches a copy of |frames|.
+  void Put(const char *module, uptr module_offset,
+           const SymbolizedStack *frames);
+  void Clear();
+
+ private:
+  static const u32 kNone = ~0U;
+  struct Entry {
+    const char *module;
+    uptr module_offset;
+    SymbolizedStack *frames;
+    // The next entry in the bucket, and the neighbours in the LRU list.
+    u32 next_in_bucket;
+    u32 newer;
+    u32 older;
+  };
+  u32 *FindInBucket(const char *module, uptr module_offset);
+  void Unlink(u32 index);
+  void LinkNewest(u32 index);
+
+  InternalMmapVector<Entry> entries_;
+  InternalMmapVector<u32> buckets_;
+  u32 newest_ = kNone;
+  u32 oldest_ = kNone;
+};
+
 class SymbolizerTool;
 
 class Symbolizer final {
@@ -115,6 +151,11 @@ class Symbolizer final {
   // Returns a list of symbolized frames for a given address (containing
   // all inlined functions, if necessary).
   SymbolizedStack *SymbolizePC(uptr address);
+  // Does the same as SymbolizePC for each of the |count| addresses, setting
+  // |stacks|, but sends the addresses a symbolizer tool may handle in batches
+  // to it.
+  void SymbolizePCs(const uptr *addresses, uptr count,
+                    SymbolizedStack **stacks);
   bool SymbolizeData(uptr address, DataInfo *info);
   bool SymbolizeFrame(uptr address, FrameInfo *info);
 
@@ -172,6 +213,14 @@ class Symbolizer final {
     BlockingMutex *mu_;
   } module_names_;
 
+  SymbolizerFrameCache frame_cache_;
+
+  // Creates the stack for |address|, with the module info filled, and returns
+  // whether the tools have to symbolize it: not if the module is unknown or
+  // if the frames were found in the cache.
+  bool PrepareStack(uptr address, SymbolizedStack **stack);
+  void CacheFrames(const SymbolizedStack *stack);
+
   /// Platform-specific function for creating a Symbolizer object.
   static Symbolizer *PlatformInit();
 
@@ -0,0 +1,813 @@
+//===-- sanitizer_symbolizer_elf.cpp --------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+// In-process ELF implementation of symbolizer parts.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_platform.h"
+
+#include "sanitizer_symbolizer_elf.h"
+
+#if SANITIZER_ELF_SYMBOLIZER
+#include "sanitizer_allocator_internal.h"
+#include "sanitizer_file.h"
+#include "sanitizer_placement_new.h"
+#include "sanitizer_posix.h"
+
+#include <link.h>
+#include <sys/mman.h>
+
+#ifndef SHF_COMPRESSED
+# define SHF_COMPRESSED 0x800
+#endif
+#ifndef STT_GNU_IFUNC
+# define STT_GNU_IFUNC 10
+#endif
+#endif  // SANITIZER_ELF_SYMBOLIZER
+
+namespace __sanitizer {
+
+#if SANITIZER_ELF_SYMBOLIZER
+
+namespace {
+
+// The DWARF constants of the line tables.
+enum {
+  DW_LNS_copy = 1,
+  DW_LNS_advance_pc = 2,
+  DW_LNS_advance_line = 3,
+  DW_LNS_set_file = 4,
+  DW_LNS_set_column = 5,
+  DW_LNS_const_add_pc = 8,
+  DW_LNS_fixed_advance_pc = 9,
+
+  DW_LNE_end_sequence = 1,
+  DW_LNE_set_address = 2,
+
+  DW_LNCT_path = 1,
+  DW_LNCT_directory_index = 2,
+
+  DW_FORM_data2 = 0x05,
+  DW_FORM_data4 = 0x06,
+  DW_FORM_data8 = 0x07,
+  DW_FORM_string = 0x08,
+  DW_FORM_block = 0x09,
+  DW_FORM_data1 = 0x0b,
+  DW_FORM_strp = 0x0e,
+  DW_FORM_udata = 0x0f,
+  DW_FORM_data16 = 0x1e,
+  DW_FORM_line_strp = 0x1f,
+};
+
+// Reads the data of a section, in the byte order of the host. Reading past
+// the end returns zeros, and makes ok() return false.
+class DataReader {
+ public:
+  DataReader() : pos_(nullptr), end_(nullptr), ok_(true) {}
+  DataReader(const u8 *data, uptr size)
+      : pos_(data), end_(data + size), ok_(true) {}
+
+  bool ok() const { return ok_; }
+  bool AtEnd() const { return pos_ == end_; }
+  const u8 *pos() const { return pos_; }
+
+  template <typename T>
+  T Read() {
+    T value = 0;
+    if (Check(sizeof(T))) {
+      internal_memcpy(&value, pos_, sizeof(T));
+      pos_ += sizeof(T);
+    }
+    return value;
+  }
+
+  u64 ReadUnsigned(u64 size) {
+    switch (size) {
+      case 1: return Read<u8>();
+      case 2: return Read<u16>();
+      case 4: return Read<u32>();
+      case 8: return Read<u64>();
+    }
+    Fail();
+    return 0;
+  }
+
+  u64 ReadOffset(bool dwarf64) { return dwarf64 ? Read<u64>() : Read<u32>(); }
+
+  u64 ReadULEB128() {
+    u64 value = 0;
+    for (uptr shift = 0;; shift += 7) {
+      u8 byte = Read<u8>();
+      if (shift < 64)
+        value |= static_cast<u64>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+  }
+
+  s64 ReadSLEB128() {
+    u64 value = 0;
+    uptr shift = 0;
+    u8 byte;
+    do {
+      byte = Read<u8>();
+      if (shift < 64)
+        value |= static_cast<u64>(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40))
+      value |= ~0ULL << shift;
+    return static_cast<s64>(value);
+  }
+
+  const char *ReadCString() {
+    const char *str = reinterpret_cast<const char *>(pos_);
+    uptr length = internal_strnlen(str, end_ - pos_);
+    if (!Check(length + 1))
+      return nullptr;
+    pos_ += length + 1;
+    return str;
+  }
+
+  void Skip(u64 size) {
+    if (Check(size))
+      pos_ += size;
+  }
+
+  // Returns a reader of the next |size| bytes, and skips them.
+  DataReader ReadSub(u64 size) {
+    if (!Check(size))
+      return DataReader();
+    DataReader sub(pos_, size);
+    pos_ += size;
+    return sub;
+  }
+
+ private:
+  bool Check(u64 size) {
+    if (ok_ && size <= static_cast<u64>(end_ - pos_))
+      return true;
+    Fail();
+    return false;
+  }
+
+  void Fail() {
+    ok_ = false;
+    pos_ = end_;
+  }
+
+  const u8 *pos_;
+  const u8 *end_;
+  bool ok_;
+};
+
+}  // namespace
+
+// A module mapped from its file, with the index of its symbols and its line
+// table, decoded the first time it is needed.
+class ElfSymbolizerModule {
+ public:
+  struct Symbol {
+    uptr address;
+    uptr size;
+    const char *name;
+    bool global;
+  };
+
+  struct LineRow {
+    uptr address;
+    u32 file;
+    u32 line;
+    u32 column;
+  };
+
+  // A sequence of rows with increasing addresses, ending at |end|.
+  struct LineSequence {
+    uptr begin;
+    uptr end;
+    uptr first_row;
+    uptr num_rows;
+  };
+
+  explicit ElfSymbolizerModule(const char *path);
+
+  bool ok() const { return data_ != nullptr; }
+  const char *path() const { return path_; }
+
+  const Symbol *FindFunction(uptr offset) const {
+    return FindSymbol(functions_, offset);
+  }
+  const Symbol *FindObject(uptr offset) const {
+    return FindSymbol(objects_, offset);
+  }
+  const LineRow *FindLine(uptr offset);
+  // Returns the path of the file of a row, allocated with InternalAlloc, or
+  // nullptr.
+  char *GetFileName(u32 file) const;
+
+ private:
+  struct Section {
+    const u8 *data;
+    uptr size;
+  };
+
+  struct LineFile {
+    const char *dir;
+    const char *name;
+  };
+
+  static const u32 kNoFile = ~0U;
+
+  bool Map();
+  void ReadSections();
+  Section GetSection(const ElfW(Shdr) &shdr) const;
+  void ReadSymbols(const ElfW(Shdr) &symtab, const ElfW(Shdr) &strtab);
+  static const Symbol *FindSymbol(const InternalMmapVector<Symbol> &symbols,
+                                  uptr offset);
+
+  void DecodeLines();
+  bool DecodeLineUnit(DataReader *unit, bool dwarf64,
+                      InternalMmapVector<const char *> *dirs);
+  bool ReadLineEntries(DataReader *header, bool dwarf64,
+                       InternalMmapVector<const char *> *dirs,
+                       bool are_files);
+  bool ReadForm(DataReader *reader, u64 form, bool dwarf64, u64 *value,
+                const char **str) const;
+  void EndSequence(uptr *first_row, uptr end);
+
+  char *path_;
+  const u8 *data_ = nullptr;
+  uptr size_ = 0;
+
+  InternalMmapVector<Symbol> functions_;
+  InternalMmapVector<Symbol> objects_;
+
+  Section debug_line_ = {};
+  Section debug_line_str_ = {};
+  Section debug_str_ = {};
+  bool lines_decoded_ = false;
+  InternalMmapVector<LineFile> files_;
+  InternalMmapVector<LineRow> rows_;
+  InternalMmapVector<LineSequence> sequences_;
+};
+
+// Returns the NUL terminated string at |offset| in the section, or nullptr.
+static const char *StringAt(const u8 *data, uptr size, u64 offset) {
+  if (offset >= size)
+    return nullptr;
+  const char *str = reinterpret_cast<const char *>(data + offset);
+  if (internal_strnlen(str, size - offset) == size - offset)
+    return nullptr;
+  return str;
+}
+
+ElfSymbolizerModule::ElfSymbolizerModule(const char *path)
+    : path_(internal_strdup(path)) {
+  if (Map())
+    ReadSections();
+}
+
+bool ElfSymbolizerModule::Map() {
+  fd_t fd = OpenFile(path_, RdOnly);
+  if (fd == kInvalidFd)
+    return false;
+  uptr size = internal_filesize(fd);
+  uptr map = 0;
+  if (size != (uptr)-1 && size >= sizeof(ElfW(Ehdr)))
+    map = internal_mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  CloseFile(fd);
+  if (!map || internal_iserror(map))
+    return false;
+  const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(map);
+  const u8 kElfClass = SANITIZER_WORDSIZE == 64 ? ELFCLASS64 : ELFCLASS32;
+  const u8 kElfData = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? ELFDATA2LSB
+                                                                : ELFDATA2MSB;
+  if (internal_memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != kElfClass ||
+      ehdr->e_ident[EI_DATA] != kElfData) {
+    internal_munmap(reinterpret_cast<void *>(map), size);
+    return false;
+  }
+  data_ = reinterpret_cast<const u8 *>(map);
+  size_ = size;
+  return true;
+}
+
+ElfSymbolizerModule::Section ElfSymbolizerModule::GetSection(
+    const ElfW(Shdr) &shdr) const {
+  Section section = {};
+  if (shdr.sh_type != SHT_NOBITS && shdr.sh_offset <= size_ &&
+      shdr.sh_size <= size_ - shdr.sh_offset) {
+    section.data = data_ + shdr.sh_offset;
+    section.size = shdr.sh_size;
+  }
+  return section;
+}
+
+void ElfSymbolizerModule::ReadSections() {
+  const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(data_);
+  uptr shoff = ehdr->e_shoff;
+  if (ehdr->e_shentsize != sizeof(ElfW(Shdr)) || !shoff || shoff >= size_ ||
+      shoff % sizeof(uptr) ||
+      (size_ - shoff) / sizeof(ElfW(Shdr)) < 1)
+    return;
+  const ElfW(Shdr) *shdrs = reinterpret_cast<const ElfW(Shdr) *>(data_ + shoff);
+  // With more than SHN_LORESERVE sections, the first one holds their number
+  // and the index of the section names.
+  uptr shnum = ehdr->e_shnum ? ehdr->e_shnum : shdrs[0].sh_size;
+  uptr shstrndx =
+      ehdr->e_shstrndx == SHN_XINDEX ? shdrs[0].sh_link : ehdr->e_shstrndx;
+  if ((size_ - shoff) / sizeof(ElfW(Shdr)) < shnum || shstrndx >= shnum)
+    return;
+  Section names = GetSection(shdrs[shstrndx]);
+  const ElfW(Shdr) *symtab = nullptr;
+  const ElfW(Shdr) *dynsym = nullptr;
+  for (uptr i = 0; i < shnum; i++) {
+    const ElfW(Shdr) &shdr = shdrs[i];
+    if (shdr.sh_type == SHT_SYMTAB) {
+      symtab = &shdr;
+      continue;
+    }
+    if (shdr.sh_type == SHT_DYNSYM) {
+      dynsym = &shdr;
+      continue;
+    }
+    // The compressed debug sections are not supported.
+    if (shdr.sh_type != SHT_PROGBITS || (shdr.sh_flags & SHF_COMPRESSED))
+      continue;
+    const char *name = StringAt(names.data, names.size, shdr.sh_name);
+    if (!name)
+      continue;
+    if (!internal_strcmp(name, ".debug_line"))
+      debug_line_ = GetSection(shdr);
+    else if (!internal_strcmp(name, ".debug_line_str"))
+      debug_line_str_ = GetSection(shdr);
+    else if (!internal_strcmp(name, ".debug_str"))
+      debug_str_ = GetSection(shdr);
+  }
+  // .dynsym only holds the exported symbols, which .symtab has too.
+  const ElfW(Shdr) *symbols = symtab ? symtab : dynsym;
+  if (symbols && symbols->sh_link < shnum)
+    ReadSymbols(*symbols, shdrs[symbols->sh_link]);
+}
+
+static uptr CountLeadingUnderscores(const char *name) {
+  uptr count = 0;
+  while (name[count] == '_') count++;
+  return count;
+}
+
+static bool CompareSymbols(const ElfSymbolizerModule::Symbol &a,
+                           const ElfSymbolizerModule::Symbol &b) {
+  if (a.address != b.address)
+    return a.address < b.address;
+  // For the aliases, prefer the global symbols, then the public names, as
+  // malloc over __interceptor_malloc, then the sized ones.
+  if (a.global != b.global)
+    return a.global;
+  const uptr a_underscores = CountLeadingUnderscores(a.name);
+  const uptr b_underscores = CountLeadingUnderscores(b.name);
+  if (a_underscores != b_underscores)
+    return a_underscores < b_underscores;
+  return a.size > b.size;
+}
+
+static void SortSymbols(InternalMmapVector<ElfSymbolizerModule::Symbol> *v) {
+  if (v->empty())
+    return;
+  Sort(v->data(), v->size(), CompareSymbols);
+  uptr size = 1;
+  for (uptr i = 1; i < v->size(); i++) {
+    if ((*v)[i].address != (*v)[size - 1].address)
+      (*v)[size++] = (*v)[i];
+  }
+  v->resize(size);
+}
+
+void ElfSymbolizerModule::ReadSymbols(const ElfW(Shdr) &symtab,
+                                      const ElfW(Shdr) &strtab) {
+  if (symtab.sh_entsize != sizeof(ElfW(Sym)))
+    return;
+  Section symbols = GetSection(symtab);
+  Section strings = GetSection(strtab);
+  for (uptr i = 0; i < symbols.size / sizeof(ElfW(Sym)); i++) {
+    ElfW(Sym) sym;
+    internal_memcpy(&sym, symbols.data + i * sizeof(sym), sizeof(sym));
+    if (sym.st_shndx == SHN_UNDEF || sym.st_shndx == SHN_ABS ||
+        !sym.st_value)
+      continue;
+    // The type and the binding are in the same bits of st_info for ELF32 and
+    // ELF64.
+    const u8 type = ELF64_ST_TYPE(sym.st_info);
+    InternalMmapVector<Symbol> *v;
+    if (type == STT_FUNC || type == STT_GNU_IFUNC)
+      v = &functions_;
+    else if (type == STT_OBJECT)
+      v = &objects_;
+    else
+      continue;
+    const char *name = StringAt(strings.data, strings.size, sym.st_name);
+    if (!name || !name[0])
+      continue;
+    Symbol symbol = {sym.st_value, sym.st_size, name,
+                     ELF64_ST_BIND(sym.st_info) != STB_LOCAL};
+#if defined(__arm__)
+    // The lowest bit of the Thumb functions is set.
+    if (v == &functions_)
+      symbol.address &= ~static_cast<uptr>(1);
+#endif
+    v->push_back(symbol);
+  }
+  SortSymbols(&functions_);
+  SortSymbols(&objects_);
+}
+
+static bool SymbolStartsAtOrBefore(const ElfSymbolizerModule::Symbol &symbol,
+                                   uptr offset) {
+  return symbol.address <= offset;
+}
+
+const ElfSymbolizerModule::Symbol *ElfSymbolizerModule::FindSymbol(
+    const InternalMmapVector<Symbol> &symbols, uptr offset) {
+  uptr i = InternalLowerBound(symbols, 0, symbols.size(), offset,
+                              SymbolStartsAtOrBefore);
+  if (i == 0)
+    return nullptr;
+  const Symbol &symbol = symbols[i - 1];
+  // The symbols without a size extend to the next one.
+  if (symbol.size ? offset - symbol.address < symbol.size
+                  : i < symbols.size() && offset < symbols[i].address)
+    return &symbol;
+  return nullptr;
+}
+
+bool ElfSymbolizerModule::ReadForm(DataReader *reader, u64 form, bool dwarf64,
+                                   u64 *value, const char **str) const {
+  *value = 0;
+  *str = nullptr;
+  switch (form) {
+    case DW_FORM_string:
+      *str = reader->ReadCString();
+      break;
+    case DW_FORM_line_strp:
+      *str = StringAt(debug_line_str_.data, debug_line_str_.size,
+                      reader->ReadOffset(dwarf64));
+      break;
+    case DW_FORM_strp:
+      *str = StringAt(debug_str_.data, debug_str_.size,
+                      reader->ReadOffset(dwarf64));
+      break;
+    case DW_FORM_data1:
+      *value = reader->Read<u8>();
+      break;
+    case DW_FORM_data2:
+      *value = reader->Read<u16>();
+      break;
+    case DW_FORM_data4:
+      *value = reader->Read<u32>();
+      break;
+    case DW_FORM_data8:
+      *value = reader->Read<u64>();
+      break;
+    case DW_FORM_udata:
+      *value = reader->ReadULEB128();
+      break;
+    case DW_FORM_data16:
+      reader->Skip(16);
+      break;
+    case DW_FORM_block:
+      reader->Skip(reader->ReadULEB128());
+      break;
+    default:
+      return false;
+  }
+  return reader->ok();
+}
+
+// Reads the directories, or the files, of a DWARF 5 line table header.
+bool ElfSymbolizerModule::ReadLineEntries(
+    DataReader *header, bool dwarf64, InternalMmapVector<const char *> *dirs,
+    bool are_files) {
+  u8 format_count = header->Read<u8>();
+  const u8 *format_begin = header->pos();
+  for (u8 i = 0; i < format_count; i++) {
+    header->ReadULEB128();
+    header->ReadULEB128();
+  }
+  DataReader format(format_begin, header->pos() - format_begin);
+  u64 count = header->ReadULEB128();
+  for (u64 i = 0; i < count && header->ok(); i++) {
+    DataReader entry_format = format;
+    const char *path = nullptr;
+    u64 dir = 0;
+    for (u8 j = 0; j < format_count; j++) {
+      u64 content = entry_format.ReadULEB128();
+      u64 form = entry_format.ReadULEB128();
+      u64 value;
+      const char *str;
+      if (!ReadForm(header, form, dwarf64, &value, &str))
+        return false;
+      if (content == DW_LNCT_path)
+        path = str;
+      else if (content == DW_LNCT_directory_index)
+        dir = value;
+    }
+    if (!are_files)
+      dirs->push_back(path);
+    else
+      files_.push_back({dir < dirs->size() ? (*dirs)[dir] : nullptr, path});
+  }
+  return header->ok();
+}
+
+void ElfSymbolizerModule::EndSequence(uptr *first_row, uptr end) {
+  const uptr num_rows = rows_.size() - *first_row;
+  const uptr begin = num_rows ? rows_[*first_row].address : 0;
+  // The sequences of the functions discarded by the linker start at 0.
+  if (num_rows && begin && end > begin)
+    sequences_.push_back({begin, end, *first_row, num_rows});
+  else
+    rows_.resize(*first_row);
+  *first_row = rows_.size();
+}
+
+bool ElfSymbolizerModule::DecodeLineUnit(
+    DataReader *unit, bool dwarf64, InternalMmapVector<const char *> *dirs) {
+  const u16 version = unit->Read<u16>();
+  if (version < 2 || version > 5)
+    return false;
+  if (version >= 5) {
+    unit->Read<u8>();  // address_size
+    unit->Read<u8>();  // segment_selector_size
+  }
+  DataReader header = unit->ReadSub(unit->ReadOffset(dwarf64));
+  const u8 min_inst_length = header.Read<u8>();
+  if (version >= 4)
+    header.Read<u8>();  // maximum_operations_per_instruction
+  header.Read<u8>();    // default_is_stmt
+  const s8 line_base = header.Read<s8>();
+  const u8 line_range = header.Read<u8>();
+  const u8 opcode_base = header.Read<u8>();
+  if (!line_range || !opcode_base)
+    return false;
+  const u8 *standard_opcode_lengths = header.pos();
+  header.Skip(opcode_base - 1);
+
+  const uptr first_file = files_.size();
+  dirs->clear();
+  if (version >= 5) {
+    if (!ReadLineEntries(&header, dwarf64, dirs, /*are_files*/ false) ||
+        !ReadLineEntries(&header, dwarf64, dirs, /*are_files*/ true)) {
+      files_.resize(first_file);
+      return false;
+    }
+  } else {
+    // The compilation directory isn't in the line table before DWARF 5.
+    dirs->push_back(nullptr);
+    while (const char *dir = header.ReadCString()) {
+      if (!dir[0])
+        break;
+      dirs->push_back(dir);
+    }
+    while (const char *name = header.ReadCString()) {
+      if (!name[0])
+        break;
+      u64 dir = header.ReadULEB128();
+      header.ReadULEB128();  // modification time
+      header.ReadULEB128();  // length
+      files_.push_back({dir < dirs->size() ? (*dirs)[dir] : nullptr, name});
+    }
+    if (!header.ok()) {
+      files_.resize(first_file);
+      return false;
+    }
+  }
+  // The files are numbered from 1 before DWARF 5.
+  const u64 file_number_base = version >= 5 ? 0 : 1;
+  const u64 num_files = files_.size() - first_file;
+
+  uptr address = 0;
+  u64 file = 1;
+  s64 line = 1;
+  u64 column = 0;
+  uptr first_row = rows_.size();
+  auto add_row = [&]() {
+    u32 file_index = kNoFile;
+    if (file >= file_number_base && file - file_number_base < num_files)
+      file_index = first_file + file - file_number_base;
+    rows_.push_back({address, file_index, static_cast<u32>(line),
+                     static_cast<u32>(column)});
+  };
+  while (!unit->AtEnd()) {
+    const u8 opcode = unit->Read<u8>();
+    if (opcode >= opcode_base) {
+      const u8 adjusted = opcode - opcode_base;
+      address += (adjusted / line_range) * min_inst_length;
+      line += line_base + adjusted % line_range;
+      add_row();
+      continue;
+    }
+    switch (opcode) {
+      case 0: {
+        const u64 length = unit->ReadULEB128();
+        DataReader extended = unit->ReadSub(length);
+        const u8 extended_opcode = extended.Read<u8>();
+        if (extended_opcode == DW_LNE_end_sequence) {
+          EndSequence(&first_row, address);
+          address = 0;
+          file = 1;
+          line = 1;
+          column = 0;
+        } else if (extended_opcode == DW_LNE_set_address) {
+          address = extended.ReadUnsigned(length - 1);
+        }
+        break;
+      }
+      case DW_LNS_copy:
+        add_row();
+        break;
+      case DW_LNS_advance_pc:
+        address += unit->ReadULEB128() * min_inst_length;
+        break;
+      case DW_LNS_advance_line:
+        line += unit->ReadSLEB128();
+        break;
+      case DW_LNS_set_file:
+        file = unit->ReadULEB128();
+        break;
+      case DW_LNS_set_column:
+        column = unit->ReadULEB128();
+        break;
+      case DW_LNS_const_add_pc:
+        address += ((255 - opcode_base) / line_range) * min_inst_length;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += unit->Read<u16>();
+        break;
+      default:
+        // The operands of the other opcodes are all ULEB128.
+        for (u8 i = 0; i < standard_opcode_lengths[opcode - 1]; i++)
+          unit->ReadULEB128();
+        break;
+    }
+  }
+  // Drop the rows of a truncated sequence.
+  rows_.resize(first_row);
+  return unit->ok();
+}
+
+static bool CompareSequences(const ElfSymbolizerModule::LineSequence &a,
+                             const ElfSymbolizerModule::LineSequence &b) {
+  return a.begin < b.begin;
+}
+
+void ElfSymbolizerModule::DecodeLines() {
+  lines_decoded_ = true;
+  DataReader section(debug_line_.data, debug_line_.size);
+  InternalMmapVector<const char *> dirs;
+  while (!section.AtEnd()) {
+    u64 length = section.Read<u32>();
+    bool dwarf64 = false;
+    if (length == 0xffffffff) {
+      length = section.Read<u64>();
+      dwarf64 = true;
+    } else if (length >= 0xfffffff0) {
+      break;
+    }
+    DataReader unit = section.ReadSub(length);
+    if (!section.ok())
+      break;
+    DecodeLineUnit(&unit, dwarf64, &dirs);
+  }
+  if (!sequences_.empty())
+    Sort(sequences_.data(), sequences_.size(), CompareSequences);
+}
+
+static bool SequenceBeginsAtOrBefore(
+    const ElfSymbolizerModule::LineSequence &sequence, uptr offset) {
+  return sequence.begin <= offset;
+}
+
+static bool RowAtOrBefore(const ElfSymbolizerModule::LineRow &row,
+                          uptr offset) {
+  return row.address <= offset;
+}
+
+const ElfSymbolizerModule::LineRow *ElfSymbolizerModule::FindLine(
+    uptr offset) {
+  if (!lines_decoded_)
+    DecodeLines();
+  uptr i = InternalLowerBound(sequences_, 0, sequences_.size(), offset,
+                              SequenceBeginsAtOrBefore);
+  if (i == 0 || offset >= sequences_[i - 1].end)
+    return nullptr;
+  const LineSequence &sequence = sequences_[i - 1];
+  // The first row of the sequence is at its beginning, so there is a row
+  // before |offset|.
+  uptr row = InternalLowerBound(rows_, sequence.first_row,
+                                sequence.first_row + sequence.num_rows, offset,
+                                RowAtOrBefore);
+  return &rows_[row - 1];
+}
+
+char *ElfSymbolizerModule::GetFileName(u32 file) const {
+  if (file >= files_.size() || !files_[file].name)
+    return nullptr;
+  const char *dir = files_[file].dir;
+  const char *name = files_[file].name;
+  if (!dir || !dir[0] || name[0] == '/')
+    return internal_strdup(name);
+  const uptr dir_length = internal_strlen(dir);
+  const uptr name_length = internal_strlen(name);
+  char *path = static_cast<char *>(InternalAlloc(dir_length + name_length + 2));
+  internal_memcpy(path, dir, dir_length);
+  path[dir_length] = '/';
+  internal_memcpy(path + dir_length + 1, name, name_length + 1);
+  return path;
+}
+
+ElfSymbolizer *ElfSymbolizer::get(LowLevelAllocator *alloc) {
+  return new(*alloc) ElfSymbolizer(alloc);
+}
+
+ElfSymbolizerModule *ElfSymbolizer::GetModule(const char *module_name) {
+  if (!module_name)
+    return nullptr;
+  ElfSymbolizerModule *module = nullptr;
+  for (uptr i = 0; i < modules_.size(); i++) {
+    if (!internal_strcmp(modules_[i]->path(), module_name)) {
+      module = modules_[i];
+      break;
+    }
+  }
+  if (!module) {
+    // Keep the modules which can't be read too, not to try them again.
+    module = new(*allocator_) ElfSymbolizerModule(module_name);
+    modules_.push_back(module);
+  }
+  return module->ok() ? module : nullptr;
+}
+
+bool ElfSymbolizer::SymbolizePC(uptr addr, SymbolizedStack *stack) {
+  AddressInfo *info = &stack->info;
+  ElfSymbolizerModule *module = GetModule(info->module);
+  if (!module)
+    return false;
+  const uptr offset = info->module_offset;
+  const ElfSymbolizerModule::Symbol *function = module->FindFunction(offset);
+  const ElfSymbolizerModule::LineRow *row = module->FindLine(offset);
+  if (!function && !row)
+    return false;
+  if (function) {
+    info->function = internal_strdup(DemangleSwiftAndCXX(function->name));
+    info->function_offset = offset - function->address;
+  }
+  if (row) {
+    info->file = module->GetFileName(row->file);
+    if (info->file) {
+      info->line = row->line;
+      info->column = row->column;
+    }
+  }
+  return true;
+}
+
+bool ElfSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
+  ElfSymbolizerModule *module = GetModule(info->module);
+  if (!module)
+    return false;
+  const ElfSymbolizerModule::Symbol *object =
+      module->FindObject(info->module_offset);
+  if (!object)
+    return false;
+  info->name = internal_strdup(DemangleSwiftAndCXX(object->name));
+  info->start = addr - info->module_offset + object->address;
+  info->size = object->size;
+  return true;
+}
+
+#else  // SANITIZER_ELF_SYMBOLIZER
+
+ElfSymbolizer *ElfSymbolizer::get(LowLevelAllocator *alloc) {
+  return nullptr;
+}
+
+bool ElfSymbolizer::SymbolizePC(uptr addr, SymbolizedStack *stack) {
+  (void)allocator_;
+  return false;
+}
+
+bool ElfSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
+  return false;
+}
+
+#endif  // SANITIZER_ELF_SYMBOLIZER
+
+}  // namespace __sanitizer
@@ -0,0 +1,56 @@
+//===-- sanitizer_symbolizer_elf.h ------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is shared between AddressSanitizer and ThreadSanitizer
+// run-time libraries.
+// Header for the in-process ELF symbolizer, which reads the symbol tables and
+// the DWARF line tables of the modules without starting another process.
+//===----------------------------------------------------------------------===//
+#ifndef SANITIZER_SYMBOLIZER_ELF_H
+#define SANITIZER_SYMBOLIZER_ELF_H
+
+#include "sanitizer_platform.h"
+#include "sanitizer_common.h"
+#include "sanitizer_symbolizer_internal.h"
+
+#if SANITIZER_LINUX || SANITIZER_FREEBSD || SANITIZER_NETBSD
+# define SANITIZER_ELF_SYMBOLIZER 1
+#else
+# define SANITIZER_ELF_SYMBOLIZER 0
+#endif
+
+namespace __sanitizer {
+
+class ElfSymbolizerModule;
+
+// Symbolizes the addresses with the functions and the objects of the .symtab
+// section of their module, or of .dynsym if it was stripped, and with the
+// .debug_line section for the file and line. The line table of a module is
+// only decoded the first time it is needed. There are no inlined frames, as
+// they would require decoding .debug_info.
+class ElfSymbolizer final : public SymbolizerTool {
+ public:
+  // Returns nullptr on the platforms which don't use ELF.
+  static ElfSymbolizer *get(LowLevelAllocator *alloc);
+
+  bool SymbolizePC(uptr addr, SymbolizedStack *stack) override;
+  bool SymbolizeData(uptr addr, DataInfo *info) override;
+
+ private:
+  explicit ElfSymbolizer(LowLevelAllocator *alloc) : allocator_(alloc) {}
+  ElfSymbolizerModule *GetModule(const char *module_name);
+
+  LowLevelAllocator *allocator_;
+  // The modules are mapped the first time an address in them is symbolized,
+  // and are never unmapped.
+  InternalMmapVector<ElfSymbolizerModule *> modules_;
+};
+
+}  // namespace __sanitizer
+
+#endif  // SANITIZER_SYMBOLIZER_ELF_H
@@ -53,6 +53,22 @@ class SymbolizerTool {
     UNIMPLEMENTED();
   }
 
+  // Does the same as SymbolizePC for each of the |count| addresses for which
+  // |pending| is set, clearing it for those it could symbolize, and returns
+  // their number. Overridden by the tools that can handle several addresses
+  // at once.
+  virtual uptr SymbolizePCs(const uptr *addrs, SymbolizedStack *const *stacks,
+                            bool *pending, uptr count) {
+    uptr symbolized = 0;
+    for (uptr i = 0; i < count; i++) {
+      if (pending[i] && SymbolizePC(addrs[i], stacks[i])) {
+        pending[i] = false;
+        symbolized++;
+      }
+    }
+    return symbolized;
+  }
+
   // The |info| parameter is inout. It is pre-filled with the module base
   // and module offset values.
   virtual bool SymbolizeData(uptr addr, DataInfo *info) {
@@ -78,6 +94,14 @@ class SymbolizerProcess {
  public:
   explicit SymbolizerProcess(const char *path, bool use_posix_spawn = false);
   const char *SendCommand(const char *command);
+  // Sends the |count| commands concatenated in |commands| before reading any
+  // reply, and returns the replies concatenated, or nullptr on failure. Only
+  // for the processes whose replies end with an empty line, as those of
+  // llvm-symbolizer. The commands must fit in the pipe buffer, at most
+  // kMaxBatchSize bytes, since the process may block on writing the replies
+  // until they are read.
+  const char *SendCommands(const char *commands, uptr count);
+  static const uptr kMaxBatchSize = 4096;
 
  protected:
   /// The maximum number of arguments required to invoke a tool process.
@@ -101,6 +125,7 @@ class SymbolizerProcess {
   bool Restart();
   const char *SendCommandImpl(const char *command);
   bool WriteToSymbolizer(const char *buffer, uptr length);
+  bool ReadRepliesFromSymbolizer(uptr count);
 
   const char *path_;
   fd_t input_fd_;
@@ -108,6 +133,9 @@ class SymbolizerProcess {
 
   static const uptr kBufferSize = 16 * 1024;
   char buffer_[kBufferSize];
+  // Holds the replies read by SendCommands.
+  static const uptr kMaxRepliesSize = 16 << 20;
+  InternalMmapVector<char> replies_;
 
   static const uptr kMaxTimesRestarted = 5;
   static const int kSymbolizerStartupTimeMillis = 10;
@@ -126,6 +154,8 @@ class LLVMSymbolizer : public SymbolizerTool {
   explicit LLVMSymbolizer(const char *path, LowLevelAllocator *allocator);
 
   bool SymbolizePC(uptr addr, SymbolizedStack *stack) override;
+  uptr SymbolizePCs(const uptr *addrs, SymbolizedStack *const *stacks,
+                    bool *pending, uptr count) override;
   bool SymbolizeData(uptr addr, DataInfo *info) override;
   bool SymbolizeFrame(uptr addr, FrameInfo *info) override;
 
@@ -133,6 +163,11 @@ class LLVMSymbolizer : public SymbolizerTool {
   const char *FormatAndSendCommand(const char *command_prefix,
                                    const char *module_name, uptr module_offset,
                                    ModuleArch arch);
+  // Writes the command to |buffer| and returns its length, or 0 if it doesn't
+  // fit.
+  uptr FormatCommand(const char *command_prefix, const char *module_name,
+                     uptr module_offset, ModuleArch arch, char *buffer,
+                     uptr size);
 
   LLVMSymbolizerProcess *symbolizer_process_;
   static const uptr kBufferSize = 16 * 1024;
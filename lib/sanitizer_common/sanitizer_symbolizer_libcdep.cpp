@@ -81,26 +81,68 @@ const char *ExtractTokenUpToDelimiter(const char *str, const char *delimiter,
   return prefix_end;
 }
 
-SymbolizedStack *Symbolizer::SymbolizePC(uptr addr) {
-  BlockingMutexLock l(&mu_);
+bool Symbolizer::PrepareStack(uptr addr, SymbolizedStack **stack) {
   const char *module_name;
   uptr module_offset;
   ModuleArch arch;
-  SymbolizedStack *res = SymbolizedStack::New(addr);
   if (!FindModuleNameAndOffsetForAddress(addr, &module_name, &module_offset,
-                                         &arch))
-    return res;
+                                         &arch)) {
+    *stack = SymbolizedStack::New(addr);
+    return false;
+  }
+  *stack = frame_cache_.Get(module_names_.GetOwnedCopy(module_name),
+                            module_offset, addr);
+  if (*stack)
+    return false;
+  *stack = SymbolizedStack::New(addr);
   // Always fill data about module name and offset.
-  res->info.FillModuleInfo(module_name, module_offset, arch);
+  (*stack)->info.FillModuleInfo(module_name, module_offset, arch);
+  return true;
+}
+
+void Symbolizer::CacheFrames(const SymbolizedStack *stack) {
+  frame_cache_.Put(module_names_.GetOwnedCopy(stack->info.module),
+                   stack->info.module_offset, stack);
+}
+
+SymbolizedStack *Symbolizer::SymbolizePC(uptr addr) {
+  BlockingMutexLock l(&mu_);
+  SymbolizedStack *res;
+  if (!PrepareStack(addr, &res))
+    return res;
   for (auto &tool : tools_) {
     SymbolizerScope sym_scope(this);
     if (tool.SymbolizePC(addr, res)) {
-      return res;
+      CacheFrames(res);
+      break;
     }
   }
   return res;
 }
 
+void Symbolizer::SymbolizePCs(const uptr *addresses, uptr count,
+                              SymbolizedStack **stacks) {
+  BlockingMutexLock l(&mu_);
+  InternalMmapVector<bool> uncached(count);
+  InternalMmapVector<bool> pending(count);
+  uptr num_pending = 0;
+  for (uptr i = 0; i < count; i++) {
+    uncached[i] = pending[i] = PrepareStack(addresses[i], &stacks[i]);
+    num_pending += pending[i];
+  }
+  for (auto &tool : tools_) {
+    if (!num_pending)
+      break;
+    SymbolizerScope sym_scope(this);
+    num_pending -= tool.SymbolizePCs(addresses, stacks, pending.data(), count);
+  }
+  // Don't cache the PCs no tool could symbolize, the next attempt may succeed.
+  for (uptr i = 0; i < count; i++) {
+    if (uncached[i] && !pending[i])
+      CacheFrames(stacks[i]);
+  }
+}
+
 bool Symbolizer::SymbolizeData(uptr addr, DataInfo *info) {
   BlockingMutexLock l(&mu_);
   const char *module_name;
@@ -154,6 +196,7 @@ bool Symbolizer::GetModuleNameAndOffsetForPC(uptr pc, const char **module_name,
 
 void Symbolizer::Flush() {
   BlockingMutexLock l(&mu_);
+  frame_cache_.Clear();
   for (auto &tool : tools_) {
     SymbolizerScope sym_scope(this);
     tool.Flush();
@@ -409,6 +452,62 @@ bool LLVMSymbolizer::SymbolizePC(uptr addr, SymbolizedStack *stack) {
   return false;
 }
 
+uptr LLVMSymbolizer::SymbolizePCs(const uptr *addrs,
+                                  SymbolizedStack *const *stacks,
+                                  bool *pending, uptr count) {
+  // The commands of a batch are written to |buffer_|, and it holds as many as
+  // fit in kMaxBatchSize bytes.
+  static const uptr kMaxBatchCommands = 256;
+  InternalMmapVector<uptr> batch(kMaxBatchCommands);
+  uptr symbolized = 0;
+  uptr i = 0;
+  while (i < count) {
+    uptr length = 0;
+    uptr batch_size = 0;
+    for (; i < count && batch_size < kMaxBatchCommands; i++) {
+      if (!pending[i])
+        continue;
+      const AddressInfo &info = stacks[i]->info;
+      uptr command_length =
+          FormatCommand("CODE", info.module, info.module_offset,
+                        info.module_arch, buffer_ + length,
+                        SymbolizerProcess::kMaxBatchSize - length);
+      if (!command_length)
+        break;
+      length += command_length;
+      batch[batch_size++] = i;
+    }
+    if (!batch_size) {
+      if (i == count)
+        break;
+      // The command doesn't fit in a batch on its own.
+      if (SymbolizePC(addrs[i], stacks[i])) {
+        pending[i] = false;
+        symbolized++;
+      }
+      i++;
+      continue;
+    }
+    buffer_[length] = '\0';
+    const char *replies =
+        symbolizer_process_->SendCommands(buffer_, batch_size);
+    for (uptr j = 0; j < batch_size; j++) {
+      SymbolizedStack *stack = stacks[batch[j]];
+      // If the batch failed, send the commands one at a time, which restarts
+      // the process if needed.
+      if (replies) {
+        ParseSymbolizePCOutput(replies, stack);
+        replies = internal_strstr(replies, "\n\n") + 2;
+      } else if (!SymbolizePC(addrs[batch[j]], stack)) {
+        continue;
+      }
+      pending[batch[j]] = false;
+      symbolized++;
+    }
+  }
+  return symbolized;
+}
+
 bool LLVMSymbolizer::SymbolizeData(uptr addr, DataInfo *info) {
   const char *buf = FormatAndSendCommand(
       "DATA", info->module, info->module_offset, info->module_arch);
@@ -430,25 +529,32 @@ bool LLVMSymbolizer::SymbolizeFrame(uptr addr, FrameInfo *info) {
   return false;
 }
 
+uptr LLVMSymbolizer::FormatCommand(const char *command_prefix,
+                                   const char *module_name, uptr module_offset,
+                                   ModuleArch arch, char *buffer, uptr size) {
+  CHECK(module_name);
+  int length;
+  if (arch == kModuleArchUnknown) {
+    length = internal_snprintf(buffer, size, "%s \"%s\" 0x%zx\n",
+                               command_prefix, module_name, module_offset);
+  } else {
+    length = internal_snprintf(buffer, size, "%s \"%s:%s\" 0x%zx\n",
+                               command_prefix, module_name,
+                               ModuleArchToString(arch), module_offset);
+  }
+  if (length < 0 || length >= static_cast<int>(size))
+    return 0;
+  return length;
+}
+
 const char *LLVMSymbolizer::FormatAndSendCommand(const char *command_prefix,
                                                  const char *module_name,
                                                  uptr module_offset,
                                                  ModuleArch arch) {
-  CHECK(module_name);
-  if (arch == kModuleArchUnknown) {
-    if (internal_snprintf(buffer_, kBufferSize, "%s \"%s\" 0x%zx\n",
-                          command_prefix, module_name,
-                          module_offset) >= static_cast<int>(kBufferSize)) {
-      Report("WARNING: Command buffer too small");
-      return nullptr;
-    }
-  } else {
-    if (internal_snprintf(buffer_, kBufferSize, "%s \"%s:%s\" 0x%zx\n",
-                          command_prefix, module_name, ModuleArchToString(arch),
-                          module_offset) >= static_cast<int>(kBufferSize)) {
-      Report("WARNING: Command buffer too small");
-      return nullptr;
-    }
+  if (!FormatCommand(command_prefix, module_name, module_offset, arch,
+                     buffer_, kBufferSize)) {
+    Report("WARNING: Command buffer too small");
+    return nullptr;
   }
   return symbolizer_process_->SendCommand(buffer_);
 }
@@ -495,6 +601,29 @@ const char *SymbolizerProcess::SendCommand(const char *command) {
   return 0;
 }
 
+const char *SymbolizerProcess::SendCommands(const char *commands,
+                                            uptr count) {
+  // Leave reporting the failures to SendCommand.
+  if (failed_to_start_ || IsSameModule(path_))
+    return nullptr;
+  if (input_fd_ == kInvalidFd || output_fd_ == kInvalidFd) {
+    if (times_restarted_ >= kMaxTimesRestarted)
+      return nullptr;
+    times_restarted_++;
+    if (!Restart())
+      return nullptr;
+  }
+  uptr length = internal_strlen(commands);
+  CHECK_LE(length, kMaxBatchSize);
+  if (!WriteToSymbolizer(commands, length) ||
+      !ReadRepliesFromSymbolizer(count)) {
+    // Some replies may be left to read: start over.
+    Restart();
+    return nullptr;
+  }
+  return replies_.data();
+}
+
 const char *SymbolizerProcess::SendCommandImpl(const char *command) {
   if (input_fd_ == kInvalidFd || output_fd_ == kInvalidFd)
       return 0;
@@ -540,6 +669,36 @@ bool SymbolizerProcess::ReadFromSymbolizer(char *buffer, uptr max_length) {
   return true;
 }
 
+bool SymbolizerProcess::ReadRepliesFromSymbolizer(uptr count) {
+  uptr read_len = 0;
+  uptr replies = 0;
+  while (replies < count) {
+    if (replies_.size() - read_len < kBufferSize) {
+      if (replies_.size() >= kMaxRepliesSize) {
+        Report("WARNING: Symbolizer buffer too small\n");
+        return false;
+      }
+      replies_.resize(Max(replies_.size() * 2, kBufferSize));
+    }
+    uptr just_read = 0;
+    bool success =
+        ReadFromFile(input_fd_, replies_.data() + read_len,
+                     replies_.size() - read_len - 1, &just_read);
+    if (!success || just_read == 0) {
+      Report("WARNING: Can't read from symbolizer at fd %d\n", input_fd_);
+      return false;
+    }
+    // Each reply ends with an empty line.
+    for (uptr i = Max<uptr>(read_len, 1); i < read_len + just_read; i++) {
+      if (replies_[i] == '\n' && replies_[i - 1] == '\n')
+        replies++;
+    }
+    read_len += just_read;
+  }
+  replies_[read_len] = '\0';
+  return true;
+}
+
 bool SymbolizerProcess::WriteToSymbolizer(const char *buffer, uptr length) {
   if (length == 0)
     return true;
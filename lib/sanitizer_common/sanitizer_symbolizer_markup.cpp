@@ -70,6 +70,12 @@ SymbolizedStack *Symbolizer::SymbolizePC(uptr addr) {
   return s;
 }
 
+void Symbolizer::SymbolizePCs(const uptr *addresses, uptr count,
+                              SymbolizedStack **stacks) {
+  for (uptr i = 0; i < count; i++)
+    stacks[i] = SymbolizePC(addresses[i]);
+}
+
 // Always claim we succeeded, so that RenderDataInfo will be called.
 bool Symbolizer::SymbolizeData(uptr addr, DataInfo *info) {
   info->Clear();
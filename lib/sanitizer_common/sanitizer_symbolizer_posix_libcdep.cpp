@@ -22,6 +22,7 @@
 #include "sanitizer_placement_new.h"
 #include "sanitizer_posix.h"
 #include "sanitizer_procmaps.h"
+#include "sanitizer_symbolizer_elf.h"
 #include "sanitizer_symbolizer_internal.h"
 #include "sanitizer_symbolizer_libbacktrace.h"
 #include "sanitizer_symbolizer_mac.h"
@@ -460,6 +461,12 @@ static void ChooseSymbolizerTools(IntrusiveList<SymbolizerTool> *list,
     return;
   }
 
+  if (common_flags()->symbolize_in_process) {
+    if (SymbolizerTool *tool = ElfSymbolizer::get(allocator)) {
+      VReport(2, "Using in-process ELF symbolizer.\n");
+      list->push_back(tool);
+    }
+  }
   if (SymbolizerTool *tool = ChooseExternalSymbolizer(allocator)) {
     list->push_back(tool);
   }
@@ -666,6 +666,20 @@ void TestCombinedAllocator() {
       }
     }
 
+    // Test GetAddressRangesLocked(...)
+    {
+      uptr ranges[4];
+      a->ForceLock();
+      a->GetAddressRangesLocked(&ranges[0], &ranges[1], &ranges[2],
+                                &ranges[3]);
+      a->ForceUnlock();
+      for (const auto &allocated_ptr : allocated) {
+        uptr p = reinterpret_cast<uptr>(allocated_ptr);
+        ASSERT_TRUE((p >= ranges[0] && p < ranges[1]) ||
+                    (p >= ranges[2] && p < ranges[3]));
+      }
+    }
+
     for (uptr i = 0; i < kNumAllocs; i++) {
       void *x = allocated[i];
       uptr *meta = reinterpret_cast<uptr*>(a->GetMetaData(x));
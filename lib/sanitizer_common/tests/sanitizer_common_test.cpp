@@ -373,6 +373,15 @@ TEST(SanitizerCommon, GetRandom) {
 }
 #endif
 
+TEST(SanitizerCommon, CPUHasAVX2) {
+#if defined(__x86_64__) && !SANITIZER_WINDOWS
+  // The compiler's check also requires the OS to save the AVX registers.
+  EXPECT_EQ(!!__builtin_cpu_supports("avx2"), CPUHasAVX2());
+#else
+  EXPECT_FALSE(CPUHasAVX2());
+#endif
+}
+
 TEST(SanitizerCommon, ReservedAddressRangeInit) {
   uptr init_size = 0xffff;
   ReservedAddressRange address_range;
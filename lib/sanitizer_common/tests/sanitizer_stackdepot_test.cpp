@@ -10,10 +10,17 @@
 //
 //===----------------------------------------------------------------------===//
 #include "sanitizer_common/sanitizer_stackdepot.h"
+#include "sanitizer_common/sanitizer_stackdepotbase.h"
+#include "sanitizer_common/sanitizer_flags.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #include "sanitizer_common/sanitizer_libc.h"
 #include "gtest/gtest.h"
 
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
 namespace __sanitizer {
 
 TEST(SanitizerCommon, StackDepotBasic) {
@@ -89,4 +96,186 @@ TEST(SanitizerCommon, StackDepotReverseMap) {
   }
 }
 
+TEST(SanitizerCommon, StackDepotThreaded) {
+  // Every thread inserts the same set of stacks concurrently, so all of them
+  // must end up with the same ids.
+  static const int kNumThreads = 8;
+  static const int kNumStacks = 2000;
+  std::vector<u32> ids[kNumThreads];
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    ids[t].resize(kNumStacks);
+    threads.emplace_back([t, &ids]() {
+      for (int i = 0; i < kNumStacks; i++) {
+        int k = (i + t * 97) % kNumStacks;
+        uptr array[] = {0x1000, (uptr)k, 0x2000, (uptr)k * 3};
+        StackTrace s(array, ARRAY_SIZE(array));
+        ids[t][k] = StackDepotPut(s);
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+  for (int i = 0; i < kNumStacks; i++) {
+    u32 id = ids[0][i];
+    for (int t = 1; t < kNumThreads; t++)
+      EXPECT_EQ(id, ids[t][i]);
+    StackTrace stack = StackDepotGet(id);
+    ASSERT_EQ(4U, stack.size);
+    EXPECT_EQ((uptr)i, stack.trace[1]);
+  }
+}
+
+TEST(SanitizerCommon, StackDepotCompressed) {
+  CommonFlags cf;
+  cf.CopyFrom(*common_flags());
+  cf.compress_stack_depot = true;
+  OverrideCommonFlags(cf);
+  // Traces of different depths with distinct innermost frames and shared
+  // outer frames, as well as traces which only differ in the outermost frame.
+  static const uptr kNumStacks = 300;
+  std::vector<uptr> traces[kNumStacks];
+  u32 ids[kNumStacks];
+  uptr saved_before = StackDepotGetStats().compression_saved;
+  for (uptr i = 0; i < kNumStacks; i++) {
+    uptr depth = 1 + i % 64;
+    for (uptr j = 0; j < depth; j++)
+      traces[i].push_back(0x7f0000400000 + (depth - j) * 0x40 +
+                          (j < 3 ? i * 0x1000 : 0));
+    traces[i].push_back(i % 2 ? 0x400100 : 0x7ffff0000000);
+    StackTrace s(traces[i].data(), traces[i].size(), i % 2);
+    ids[i] = StackDepotPut(s);
+    EXPECT_EQ(ids[i], StackDepotPut(s));
+  }
+  EXPECT_GT(StackDepotGetStats().compression_saved, saved_before);
+  uptr allocated = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (uptr i = 0; i < kNumStacks; i++) {
+      StackTrace stack = StackDepotGet(ids[i]);
+      ASSERT_EQ(traces[i].size(), stack.size);
+      EXPECT_EQ(i % 2, stack.tag);
+      EXPECT_EQ(0, internal_memcmp(stack.trace, traces[i].data(),
+                                   stack.size * sizeof(uptr)));
+    }
+    // The traces are unpacked once, retrieving them again takes no memory.
+    if (pass)
+      EXPECT_EQ(allocated, StackDepotGetStats().allocated);
+    allocated = StackDepotGetStats().allocated;
+  }
+  // A retrieved trace stays valid however many traces are retrieved after it.
+  StackTrace first = StackDepotGet(ids[kNumStacks - 1]);
+  for (uptr i = 0; i < kNumStacks - 1; i++) StackDepotGet(ids[i]);
+  ASSERT_EQ(traces[kNumStacks - 1].size(), first.size);
+  EXPECT_EQ(0, internal_memcmp(first.trace, traces[kNumStacks - 1].data(),
+                               first.size * sizeof(uptr)));
+  cf.compress_stack_depot = false;
+  OverrideCommonFlags(cf);
+  // Packed traces are still found after switching the mode back.
+  StackTrace s(traces[42].data(), traces[42].size(), 0);
+  EXPECT_EQ(ids[42], StackDepotPut(s));
+}
+
+struct TestDepotNode {
+  u32 id;
+  u32 value;
+
+  typedef u32 args_type;
+  typedef TestDepotNode *handle_type;
+
+  bool eq(u32 hash, const args_type &args) const { return value == args; }
+  static uptr storage_size(const args_type &args) {
+    return sizeof(TestDepotNode);
+  }
+  // Fibonacci hashing spreads consecutive values evenly over the buckets.
+  static u32 hash(const args_type &args) { return args * 0x9e3779b1; }
+  static bool is_valid(const args_type &args) { return true; }
+  void store(const args_type &args, u32 hash, uptr storage_size) {
+    value = args;
+  }
+  args_type load() const { return value; }
+  handle_type get_handle() { return this; }
+};
+
+static StackDepotBase<TestDepotNode, 8, 4> test_depot;
+
+TEST(SanitizerCommon, StackDepotGrow) {
+  static const u32 kNumValues = 100000;
+  std::vector<u32> ids;
+  for (u32 v = 1; v <= kNumValues; v++) {
+    bool inserted = false;
+    ids.push_back(test_depot.Put(v, &inserted)->id);
+    EXPECT_TRUE(inserted);
+  }
+  EXPECT_EQ(kNumValues, test_depot.GetStats().n_uniq_ids);
+  for (u32 v = 1; v <= kNumValues; v++) {
+    bool inserted = true;
+    EXPECT_EQ(ids[v - 1], test_depot.Put(v, &inserted)->id);
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(v, test_depot.Get(ids[v - 1]));
+  }
+}
+
+TEST(SanitizerCommon, StackDepotRacingPuts) {
+  // All threads insert the same values at once. The threads which lose an
+  // insertion race must not use up ids, and an id must resolve as soon as
+  // Put returns it.
+  static StackDepotBase<TestDepotNode, 8, 4> depot;
+  static const int kNumThreads = 8;
+  static const u32 kNumValues = 20000;
+  std::vector<u32> ids[kNumThreads];
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    ids[t].resize(kNumValues);
+    threads.emplace_back([t, &ids]() {
+      for (u32 v = 1; v <= kNumValues; v++) {
+        u32 id = depot.Put(v)->id;
+        CHECK_EQ(v, depot.Get(id));
+        ids[t][v - 1] = id;
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+  EXPECT_EQ(kNumValues, depot.GetStats().n_uniq_ids);
+  for (u32 v = 1; v <= kNumValues; v++) {
+    EXPECT_NE(0U, ids[0][v - 1]);
+    EXPECT_LE(ids[0][v - 1], kNumValues);
+    for (int t = 1; t < kNumThreads; t++)
+      EXPECT_EQ(ids[0][v - 1], ids[t][v - 1]);
+  }
+}
+
+static void StackDepotBenchmark(int num_threads) {
+  // Each thread inserts its own stacks and then looks all of them up again,
+  // which is the common case for allocation-heavy programs.
+  static const int kStacksPerThread = 1 << 15;
+  static const int kLookupRounds = 8;
+  static uptr base = 0;
+  base += 1 << 28;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([t]() {
+      uptr array[8];
+      for (int r = 0; r <= kLookupRounds; r++) {
+        for (int i = 0; i < kStacksPerThread; i++) {
+          for (uptr j = 0; j < ARRAY_SIZE(array); j++)
+            array[j] = base + ((uptr)t << 20) + i * 8 + j;
+          StackTrace s(array, ARRAY_SIZE(array));
+          CHECK_NE(0, StackDepotPut(s));
+        }
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+  double secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+  double ops = (double)num_threads * kStacksPerThread * (kLookupRounds + 1);
+  printf("StackDepotPut: %2d threads: %.2f Mops/s\n", num_threads,
+         ops / secs / 1e6);
+}
+
+TEST(DISABLED_BENCH, StackDepot) {
+  for (int threads : {1, 4, 16, 64})
+    StackDepotBenchmark(threads);
+}
+
 }  // namespace __sanitizer
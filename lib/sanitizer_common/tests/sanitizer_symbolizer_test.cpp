@@ -11,9 +11,19 @@
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_common/sanitizer_allocator_internal.h"
+#include "sanitizer_common/sanitizer_symbolizer.h"
+#include "sanitizer_common/sanitizer_symbolizer_elf.h"
 #include "sanitizer_common/sanitizer_symbolizer_internal.h"
 #include "gtest/gtest.h"
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
 namespace __sanitizer {
 
 TEST(Symbolizer, ExtractToken) {
@@ -68,4 +78,332 @@ TEST(Symbolizer, DemangleSwiftAndCXX) {
 }
 #endif
 
+static void ExpectSameFrames(const SymbolizedStack *a,
+                             const SymbolizedStack *b) {
+  for (; a && b; a = a->next, b = b->next) {
+    EXPECT_EQ(a->info.address, b->info.address);
+    EXPECT_STREQ(a->info.module, b->info.module);
+    EXPECT_EQ(a->info.module_offset, b->info.module_offset);
+    EXPECT_STREQ(a->info.function, b->info.function);
+    EXPECT_STREQ(a->info.file, b->info.file);
+    EXPECT_EQ(a->info.line, b->info.line);
+  }
+  EXPECT_EQ(a, b);
+}
+
+// Sets the symbolize_cache_size flag, and returns its previous value.
+static int SetSymbolizeCacheSize(int size) {
+  CommonFlags cf;
+  cf.CopyFrom(*common_flags());
+  int old_size = cf.symbolize_cache_size;
+  cf.symbolize_cache_size = size;
+  OverrideCommonFlags(cf);
+  return old_size;
+}
+
+TEST(Symbolizer, SymbolizePCs) {
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  uptr pcs[] = {reinterpret_cast<uptr>(&ExtractToken),
+                reinterpret_cast<uptr>(&ExtractInt),
+                reinterpret_cast<uptr>(&ExtractToken) + 1,
+                reinterpret_cast<uptr>(&ExtractInt),
+                0};
+  const uptr kNumPCs = ARRAY_SIZE(pcs);
+  // The expected frames are symbolized one PC at a time, without the cache.
+  symbolizer->Flush();
+  int cache_size = SetSymbolizeCacheSize(0);
+  SymbolizedStack *expected[kNumPCs];
+  for (uptr i = 0; i < kNumPCs; i++)
+    expected[i] = symbolizer->SymbolizePC(pcs[i]);
+  SetSymbolizeCacheSize(cache_size);
+  // The first time around, the frames are symbolized in a batch, and the
+  // second time, they are found in the cache.
+  SymbolizedStack *stacks[kNumPCs];
+  for (int pass = 0; pass < 2; pass++) {
+    symbolizer->SymbolizePCs(pcs, kNumPCs, stacks);
+    for (uptr i = 0; i < kNumPCs; i++) {
+      ASSERT_NE(nullptr, stacks[i]);
+      ExpectSameFrames(expected[i], stacks[i]);
+      stacks[i]->ClearAll();
+    }
+  }
+  for (uptr i = 0; i < kNumPCs; i++)
+    expected[i]->ClearAll();
+  symbolizer->Flush();
+}
+
+static void PutFrame(SymbolizerFrameCache *cache, const char *module,
+                     uptr module_offset, const char *function) {
+  SymbolizedStack *frames = SymbolizedStack::New(0x1000 + module_offset);
+  frames->info.FillModuleInfo(module, module_offset, kModuleArchUnknown);
+  frames->info.function = internal_strdup(function);
+  cache->Put(module, module_offset, frames);
+  frames->ClearAll();
+}
+
+// Expects the frame cached for the module offset to be in |function|, or no
+// frame to be cached if it is null.
+static void ExpectCachedFrame(SymbolizerFrameCache *cache, const char *module,
+                              uptr module_offset, const char *function) {
+  SymbolizedStack *frames =
+      cache->Get(module, module_offset, 0x2000 + module_offset);
+  if (!function) {
+    EXPECT_EQ(nullptr, frames);
+    return;
+  }
+  ASSERT_NE(nullptr, frames);
+  EXPECT_EQ(0x2000 + module_offset, frames->info.address);
+  EXPECT_EQ(module_offset, frames->info.module_offset);
+  EXPECT_STREQ(function, frames->info.function);
+  EXPECT_EQ(nullptr, frames->next);
+  frames->ClearAll();
+}
+
+TEST(Symbolizer, FrameCache) {
+  int cache_size = SetSymbolizeCacheSize(3);
+  // The modules are compared as pointers.
+  static const char kModule[] = "module";
+  static const char kOtherModule[] = "module";
+  SymbolizerFrameCache cache;
+  ExpectCachedFrame(&cache, kModule, 1, nullptr);
+  PutFrame(&cache, kModule, 1, "a");
+  PutFrame(&cache, kModule, 2, "b");
+  PutFrame(&cache, kOtherModule, 1, "c");
+  ExpectCachedFrame(&cache, kModule, 1, "a");
+  ExpectCachedFrame(&cache, kOtherModule, 1, "c");
+  ExpectCachedFrame(&cache, kModule, 2, "b");
+
+  // The least recently used entry is evicted.
+  PutFrame(&cache, kModule, 3, "d");
+  ExpectCachedFrame(&cache, kModule, 1, nullptr);
+  ExpectCachedFrame(&cache, kOtherModule, 1, "c");
+  ExpectCachedFrame(&cache, kModule, 2, "b");
+  ExpectCachedFrame(&cache, kModule, 3, "d");
+
+  // Caching the frames of a module offset again keeps the first ones, and
+  // doesn't count as a use.
+  PutFrame(&cache, kOtherModule, 1, "e");
+  PutFrame(&cache, kModule, 4, "f");
+  ExpectCachedFrame(&cache, kOtherModule, 1, nullptr);
+  ExpectCachedFrame(&cache, kModule, 2, "b");
+  ExpectCachedFrame(&cache, kModule, 3, "d");
+  ExpectCachedFrame(&cache, kModule, 4, "f");
+
+  cache.Clear();
+  ExpectCachedFrame(&cache, kModule, 2, nullptr);
+
+  // Nothing is cached with a size of 0.
+  SetSymbolizeCacheSize(0);
+  PutFrame(&cache, kModule, 2, "b");
+  ExpectCachedFrame(&cache, kModule, 2, nullptr);
+  SetSymbolizeCacheSize(cache_size);
+}
+
+#if SANITIZER_LINUX
+// Writes a fake llvm-symbolizer to |path|. It replies to each CODE command
+// with a function named after the module offset, preceded by an inlined one
+// for the odd offsets. If |fail_once|, its first instance reads a command and
+// exits without replying.
+static void WriteFakeLLVMSymbolizer(const std::string &path, bool fail_once) {
+  std::string script = "#!/bin/sh\n";
+  if (fail_once) {
+    std::string marker = path + ".started";
+    script += "if [ ! -e " + marker + " ]; then\n  touch " + marker +
+              "\n  read command\n  exit 1\nfi\n";
+  }
+  script +=
+      "while read command module offset; do\n"
+      "  case $offset in\n"
+      "  *[13579bdf]) printf '%s_inlined\\ninlined.cpp:3:1\\n' $offset;;\n"
+      "  esac\n"
+      "  printf '%s_function\\nfunction.cpp:7:1\\n\\n' $offset\n"
+      "done\n";
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0700);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(static_cast<ssize_t>(script.size()),
+            write(fd, script.data(), script.size()));
+  close(fd);
+}
+
+// Symbolizes more PCs than fit in a batch with the fake llvm-symbolizer, and
+// checks that each gets the frames of its own reply. If |fail_once|, the
+// first batch fails, and its PCs are symbolized one at a time.
+static void SymbolizePCsWithFakeLLVMSymbolizer(bool fail_once) {
+  char dir[] = "/tmp/sanitizer_symbolizer_test.XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(dir));
+  std::string path = std::string(dir) + "/llvm-symbolizer";
+  WriteFakeLLVMSymbolizer(path, fail_once);
+  static LowLevelAllocator allocator;
+  LLVMSymbolizer *tool = new (allocator) LLVMSymbolizer(path.c_str(),
+                                                       &allocator);
+
+  // Every third PC is not pending, and must be left alone.
+  const uptr kNumPCs = 400;
+  std::vector<uptr> addrs(kNumPCs);
+  std::vector<SymbolizedStack *> stacks(kNumPCs);
+  bool pending[kNumPCs];
+  uptr num_pending = 0;
+  for (uptr i = 0; i < kNumPCs; i++) {
+    addrs[i] = 0x10000 + i;
+    stacks[i] = SymbolizedStack::New(addrs[i]);
+    stacks[i]->info.FillModuleInfo("/fake/module", 0x100 + i,
+                                   kModuleArchUnknown);
+    pending[i] = i % 3 != 0;
+    num_pending += pending[i];
+  }
+  EXPECT_EQ(num_pending,
+            tool->SymbolizePCs(addrs.data(), stacks.data(), pending, kNumPCs));
+  for (uptr i = 0; i < kNumPCs; i++) {
+    SymbolizedStack *frame = stacks[i];
+    EXPECT_FALSE(pending[i]);
+    if (i % 3 == 0) {
+      EXPECT_EQ(nullptr, frame->info.function);
+      frame->ClearAll();
+      continue;
+    }
+    char function[64];
+    if (i % 2) {
+      snprintf(function, sizeof(function), "0x%zx_inlined", 0x100 + i);
+      EXPECT_STREQ(function, frame->info.function);
+      EXPECT_STREQ("inlined.cpp", frame->info.file);
+      EXPECT_EQ(3U, frame->info.line);
+      frame = frame->next;
+      ASSERT_NE(nullptr, frame);
+    }
+    snprintf(function, sizeof(function), "0x%zx_function", 0x100 + i);
+    EXPECT_STREQ(function, frame->info.function);
+    EXPECT_STREQ("function.cpp", frame->info.file);
+    EXPECT_EQ(7U, frame->info.line);
+    EXPECT_EQ(addrs[i], frame->info.address);
+    EXPECT_EQ(nullptr, frame->next);
+    stacks[i]->ClearAll();
+  }
+  unlink(path.c_str());
+  unlink((path + ".started").c_str());
+  rmdir(dir);
+}
+
+TEST(Symbolizer, LLVMSymbolizerBatches) {
+  SymbolizePCsWithFakeLLVMSymbolizer(/*fail_once=*/false);
+}
+
+TEST(Symbolizer, LLVMSymbolizerFailedBatch) {
+  SymbolizePCsWithFakeLLVMSymbolizer(/*fail_once=*/true);
+}
+#endif
+
+#if SANITIZER_ELF_SYMBOLIZER
+static NOINLINE int ElfSymbolizerTestFunction() { return __LINE__; }
+int elf_symbolizer_test_global[4];
+
+TEST(Symbolizer, ElfSymbolizer) {
+  static LowLevelAllocator allocator;
+  ElfSymbolizer *elf = ElfSymbolizer::get(&allocator);
+  ASSERT_NE(nullptr, elf);
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+
+  uptr pc = reinterpret_cast<uptr>(&ElfSymbolizerTestFunction);
+  const char *module;
+  uptr offset;
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset));
+  SymbolizedStack *stack = SymbolizedStack::New(pc);
+  stack->info.FillModuleInfo(module, offset, kModuleArchUnknown);
+  ASSERT_TRUE(elf->SymbolizePC(pc, stack));
+  ASSERT_NE(nullptr, stack->info.function);
+  EXPECT_NE(nullptr, internal_strstr(stack->info.function,
+                                     "ElfSymbolizerTestFunction"));
+  EXPECT_EQ(0U, stack->info.function_offset);
+  ASSERT_NE(nullptr, stack->info.file);
+  EXPECT_NE(nullptr,
+            internal_strstr(stack->info.file, "sanitizer_symbolizer_test.cpp"));
+  EXPECT_EQ(static_cast<uptr>(ElfSymbolizerTestFunction()), stack->info.line);
+  stack->ClearAll();
+
+  uptr addr = reinterpret_cast<uptr>(&elf_symbolizer_test_global[2]);
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(addr, &module, &offset));
+  DataInfo info;
+  info.module = internal_strdup(module);
+  info.module_offset = offset;
+  ASSERT_TRUE(elf->SymbolizeData(addr, &info));
+  EXPECT_STREQ("__sanitizer::elf_symbolizer_test_global", info.name);
+  EXPECT_EQ(reinterpret_cast<uptr>(&elf_symbolizer_test_global[0]), info.start);
+  EXPECT_EQ(sizeof(elf_symbolizer_test_global), info.size);
+  info.Clear();
+}
+
+// Symbolizes the test function and the test global against a copy of the
+// test binary, truncated to |size| bytes, with |num_corrupted| bytes from
+// |corrupt_begin| on overwritten. The copy is at another path, so that it is
+// mapped anew. Unless |must_fail|, the symbolization may succeed or fail, but
+// must not crash.
+static void SymbolizeBrokenCopy(ElfSymbolizer *elf,
+                                const InternalMmapVector<char> &binary,
+                                uptr size, uptr corrupt_begin,
+                                uptr num_corrupted, bool must_fail) {
+  char path[] = "/tmp/sanitizer_symbolizer_test.XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  InternalMmapVector<char> copy(size);
+  internal_memcpy(copy.data(), binary.data(), size);
+  u32 seed = 42;
+  for (uptr i = 0; i < num_corrupted && corrupt_begin + i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    copy[corrupt_begin + i] = static_cast<char>(seed >> 16);
+  }
+  ASSERT_EQ(static_cast<ssize_t>(size), write(fd, copy.data(), size));
+  close(fd);
+
+  const char *module;
+  uptr offset;
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  uptr pc = reinterpret_cast<uptr>(&ElfSymbolizerTestFunction);
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset));
+  SymbolizedStack *stack = SymbolizedStack::New(pc);
+  stack->info.FillModuleInfo(path, offset, kModuleArchUnknown);
+  bool symbolized = elf->SymbolizePC(pc, stack);
+  if (must_fail)
+    EXPECT_FALSE(symbolized);
+  stack->ClearAll();
+
+  uptr addr = reinterpret_cast<uptr>(&elf_symbolizer_test_global[2]);
+  ASSERT_TRUE(symbolizer->GetModuleNameAndOffsetForPC(addr, &module, &offset));
+  DataInfo info;
+  info.module = internal_strdup(path);
+  info.module_offset = offset;
+  symbolized = elf->SymbolizeData(addr, &info);
+  if (must_fail)
+    EXPECT_FALSE(symbolized);
+  info.Clear();
+  unlink(path);
+}
+
+TEST(Symbolizer, ElfSymbolizerBrokenModule) {
+  static LowLevelAllocator allocator;
+  ElfSymbolizer *elf = ElfSymbolizer::get(&allocator);
+  ASSERT_NE(nullptr, elf);
+  const char *module;
+  uptr offset;
+  uptr pc = reinterpret_cast<uptr>(&ElfSymbolizerTestFunction);
+  ASSERT_TRUE(Symbolizer::GetOrInit()->GetModuleNameAndOffsetForPC(
+      pc, &module, &offset));
+  InternalMmapVector<char> binary;
+  ASSERT_TRUE(ReadFileToVector(module, &binary, 1 << 30));
+  const uptr size = binary.size();
+  ASSERT_GT(size, 4096U);
+
+  // Empty, or truncated in the ELF header.
+  SymbolizeBrokenCopy(elf, binary, 0, 0, 0, true);
+  SymbolizeBrokenCopy(elf, binary, 32, 0, 0, true);
+  // Truncated in the middle of the sections, or before the section headers,
+  // which are at the end of the file.
+  SymbolizeBrokenCopy(elf, binary, size / 2, 0, 0, true);
+  SymbolizeBrokenCopy(elf, binary, size - 1, 0, 0, true);
+  // Corrupted ELF header, section headers, or contents.
+  SymbolizeBrokenCopy(elf, binary, size, 16, 48, false);
+  SymbolizeBrokenCopy(elf, binary, size, size - 2048, 2048, false);
+  for (uptr i = 1; i < 8; i++)
+    SymbolizeBrokenCopy(elf, binary, size, size / 8 * i, 4096, false);
+}
+#endif
+
 }  // namespace __sanitizer
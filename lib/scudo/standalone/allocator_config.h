@@ -16,6 +16,7 @@
 #include "primary64.h"
 #include "size_class_map.h"
 #include "tsd_exclusive.h"
+#include "tsd_percpu.h"
 #include "tsd_shared.h"
 
 namespace scudo {
@@ -58,7 +58,15 @@ enum Origin : u8 {
   Memalign = 3,
 };
 
-enum State : u8 { Available = 0, Allocated = 1, Quarantined = 2 };
+// With deferred_header_checks, a freed chunk is marked as AvailableUnverified
+// but keeps the checksum of its Allocated header, which will be verified in
+// bulk before its block is put in the thread cache.
+enum State : u8 {
+  Available = 0,
+  Allocated = 1,
+  Quarantined = 2,
+  AvailableUnverified = 3
+};
 
 typedef u64 PackedHeader;
 // Update the 'Mask' constants to reflect changes in this structure.
@@ -128,6 +136,35 @@ void loadHeader(u32 Cookie, const void *Ptr,
     reportHeaderCorruption(const_cast<void *>(Ptr));
 }
 
+// Loads the header without verifying its checksum, which must be done later on
+// with verifyHeader.
+INLINE void loadHeaderUnverified(const void *Ptr,
+                                 UnpackedHeader *NewUnpackedHeader) {
+  PackedHeader NewPackedHeader = atomic_load_relaxed(getConstAtomicHeader(Ptr));
+  *NewUnpackedHeader = bit_cast<UnpackedHeader>(NewPackedHeader);
+}
+
+INLINE void verifyHeader(u32 Cookie, const void *Ptr,
+                         UnpackedHeader *UnpackedHeader) {
+  if (UNLIKELY(UnpackedHeader->Checksum !=
+               computeHeaderChecksum(Cookie, Ptr, UnpackedHeader)))
+    reportHeaderCorruption(const_cast<void *>(Ptr));
+}
+
+// Same as compareExchangeHeader, but the checksum of the old header is kept,
+// so that it can be verified later on. Only the State is allowed to change.
+INLINE void compareExchangeHeaderUnverified(void *Ptr,
+                                            UnpackedHeader *NewUnpackedHeader,
+                                            UnpackedHeader *OldUnpackedHeader) {
+  DCHECK_EQ(NewUnpackedHeader->Checksum, OldUnpackedHeader->Checksum);
+  PackedHeader NewPackedHeader = bit_cast<PackedHeader>(*NewUnpackedHeader);
+  PackedHeader OldPackedHeader = bit_cast<PackedHeader>(*OldUnpackedHeader);
+  if (UNLIKELY(!atomic_compare_exchange_strong(
+          getAtomicHeader(Ptr), &OldPackedHeader, NewPackedHeader,
+          memory_order_relaxed)))
+    reportHeaderRace(Ptr);
+}
+
 INLINE void compareExchangeHeader(u32 Cookie, void *Ptr,
                                   UnpackedHeader *NewUnpackedHeader,
                                   UnpackedHeader *OldUnpackedHeader) {
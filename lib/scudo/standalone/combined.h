@@ -20,6 +20,10 @@
 #include "secondary.h"
 #include "tsd.h"
 
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
 namespace scudo {
 
 template <class Params> class Allocator {
@@ -123,23 +127,49 @@ public:
     Options.ZeroContents = getFlags()->zero_contents;
     Options.DeallocTypeMismatch = getFlags()->dealloc_type_mismatch;
     Options.DeleteSizeMismatch = getFlags()->delete_size_mismatch;
+    Options.DeferredHeaderChecks = getFlags()->deferred_header_checks;
     Options.QuarantineMaxChunkSize =
         static_cast<u32>(getFlags()->quarantine_max_chunk_size);
 
     Stats.initLinkerInitialized();
     Primary.initLinkerInitialized(getFlags()->release_to_os_interval_ms);
-    Secondary.initLinkerInitialized(&Stats);
+    Secondary.initLinkerInitialized(
+        &Stats, getFlags()->release_to_os_interval_ms,
+        static_cast<u32>(Max(getFlags()->secondary_cache_max_entries, 0)),
+        static_cast<uptr>(Max(getFlags()->secondary_cache_max_size_kb, 0))
+            << 10);
 
     Quarantine.init(
         static_cast<uptr>(getFlags()->quarantine_size_kb << 10),
         static_cast<uptr>(getFlags()->thread_local_quarantine_size_kb << 10));
+
+    if (getFlags()->track_allocation_sizes)
+      SizeHistogram = reinterpret_cast<atomic_uptr *>(
+          map(nullptr, getSizeHistogramMapSize(), "scudo:histogram"));
+
+    // The releaser thread is started by startBackgroundRelease(), as
+    // creating a thread here might require allocating memory.
+    if (getFlags()->release_to_os_background &&
+        getFlags()->release_to_os_interval_ms >= 0) {
+      Releaser.PeriodMs = static_cast<u32>(
+          Max(getFlags()->release_to_os_interval_ms, MinReleaserPeriodMs));
+      Releaser.TargetRss =
+          getFlags()->release_to_os_target_rss_mb < 0
+              ? -1
+              : static_cast<sptr>(getFlags()->release_to_os_target_rss_mb)
+                    << 20;
+      atomic_store_relaxed(&Releaser.State, ReleaserPending);
+    }
   }
 
   void reset() { memset(this, 0, sizeof(*this)); }
 
   void unmapTestOnly() {
+    stopReleaser();
     TSDRegistry.unmapTestOnly();
     Primary.unmapTestOnly();
+    if (SizeHistogram)
+      unmap(SizeHistogram, getSizeHistogramMapSize());
   }
 
   TSDRegistryT *getTSDRegistry() { return &TSDRegistry; }
@@ -147,11 +177,13 @@ public:
   void initCache(CacheT *Cache) { Cache->init(&Stats, &Primary); }
 
   // Release the resources used by a TSD, which involves:
+  // - verifying the chunks freed without checking their header;
   // - draining the local quarantine cache to the global quarantine;
   // - releasing the cached pointers back to the Primary;
   // - unlinking the local stats from the global ones (destroying the cache does
   //   the last two items).
   void commitBack(TSD<ThisT> *TSD) {
+    commitUnverifiedChunks(TSD);
     Quarantine.drain(&TSD->QuarantineCache,
                      QuarantineCallback(*this, TSD->Cache));
     TSD->Cache.destroy(&Stats);
@@ -193,6 +225,9 @@ public:
     if (LIKELY(PrimaryT::canAllocate(NeededSize))) {
       ClassId = SizeClassMap::getClassIdBySize(NeededSize);
       DCHECK_NE(ClassId, 0U);
+      if (UNLIKELY(SizeHistogram))
+        atomic_fetch_add(&SizeHistogram[NeededSize >> MinAlignmentLog], 1U,
+                         memory_order_relaxed);
       bool UnlockRequired;
       auto *TSD = TSDRegistry.getTSDAndLock(&UnlockRequired);
       Block = TSD->Cache.allocate(ClassId);
@@ -200,7 +235,8 @@ public:
         TSD->unlock();
     } else {
       ClassId = 0;
-      Block = Secondary.allocate(NeededSize, Alignment, &BlockEnd);
+      Block = Secondary.allocate(NeededSize, Alignment, &BlockEnd,
+                                 ZeroContents || Options.ZeroContents);
     }
 
     if (UNLIKELY(!Block)) {
@@ -209,7 +245,7 @@ public:
       reportOutOfMemory(NeededSize);
     }
 
-    // We only need to zero the contents for Primary backed allocations. This
+    // The Secondary takes care of zeroing the blocks it reuses. This
     // condition is not necessarily unlikely, but since memset is costly, we
     // might as well mark it as such.
     if (UNLIKELY((ZeroContents || Options.ZeroContents) && ClassId))
@@ -262,8 +298,20 @@ public:
     if (UNLIKELY(!isAligned(reinterpret_cast<uptr>(Ptr), MinAlignment)))
       reportMisalignedPointer(AllocatorAction::Deallocating, Ptr);
 
+    // With deferred_header_checks, the checksum of a Primary chunk that goes
+    // directly back to the cache is not verified here, but in bulk before its
+    // block is put in the cache, or prior to reporting an error.
     Chunk::UnpackedHeader Header;
-    Chunk::loadHeader(Cookie, Ptr, &Header);
+    bool Verified = true;
+    if (Options.DeferredHeaderChecks) {
+      Chunk::loadHeaderUnverified(Ptr, &Header);
+      Verified = !Header.ClassId || Quarantine.getCacheSize() ||
+                 Header.State != Chunk::State::Allocated;
+      if (Verified)
+        verifyDeferredHeader(Ptr, Header);
+    } else {
+      Chunk::loadHeader(Cookie, Ptr, &Header);
+    }
 
     if (UNLIKELY(Header.State != Chunk::State::Allocated))
       reportInvalidChunkState(AllocatorAction::Deallocating, Ptr);
@@ -271,19 +319,25 @@ public:
       if (Header.Origin != Origin) {
         // With the exception of memalign'd chunks, that can be still be free'd.
         if (UNLIKELY(Header.Origin != Chunk::Origin::Memalign ||
-                     Origin != Chunk::Origin::Malloc))
+                     Origin != Chunk::Origin::Malloc)) {
+          if (!Verified)
+            verifyDeferredHeader(Ptr, Header);
           reportDeallocTypeMismatch(AllocatorAction::Deallocating, Ptr,
                                     Header.Origin, Origin);
+        }
       }
     }
 
     const uptr Size = getSize(Ptr, &Header);
     if (DeleteSize && Options.DeleteSizeMismatch) {
-      if (UNLIKELY(DeleteSize != Size))
+      if (UNLIKELY(DeleteSize != Size)) {
+        if (!Verified)
+          verifyDeferredHeader(Ptr, Header);
         reportDeleteSizeMismatch(Ptr, DeleteSize, Size);
+      }
     }
 
-    quarantineOrDeallocateChunk(Ptr, &Header, Size);
+    quarantineOrDeallocateChunk(Ptr, &Header, Size, Verified);
   }
 
   void *reallocate(void *OldPtr, uptr NewSize, uptr Alignment = MinAlignment) {
@@ -396,7 +450,19 @@ public:
     Str.output();
   }
 
-  void releaseToOS() { Primary.releaseToOS(); }
+  // Starts the background releaser thread if release_to_os_background is set.
+  // Until then memory is released when it is freed. This must not be called
+  // from an allocation or deallocation path, as creating the thread might
+  // allocate memory.
+  void startBackgroundRelease() {
+    initThreadMaybe();
+    startReleaser();
+  }
+
+  void releaseToOS() {
+    Primary.releaseToOS();
+    Secondary.releaseToOS();
+  }
 
   // Iterate over all chunks and call a callback for all busy chunks located
   // within the provided memory range. Said callback must not use this allocator
@@ -471,11 +537,39 @@ private:
 
   u32 Cookie;
 
+  // Number of Primary allocations per needed size (in MinAlignment units),
+  // with track_allocation_sizes.
+  static const uptr SizeHistogramCount =
+      (SizeClassMap::MaxSize >> MinAlignmentLog) + 1;
+  atomic_uptr *SizeHistogram;
+
+  // Background release of the Primary memory to the OS, enabled with
+  // release_to_os_background. While the thread runs, the Primary doesn't
+  // release memory when blocks are pushed back to it.
+  static const s32 MinReleaserPeriodMs = 100;
+  enum : u8 { ReleaserDisabled = 0, ReleaserPending, ReleaserRunning };
+  struct {
+    atomic_u8 State;
+    bool Stop;
+    u32 PeriodMs;
+    sptr TargetRss; // In bytes, negative if there is no target.
+    pthread_t Thread;
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+    // Statistics, only written by the releaser thread.
+    atomic_uptr Passes;
+    atomic_uptr ForcedPasses;
+    atomic_uptr ReleasedBytes;
+    atomic_uptr LastRss;
+    atomic_u64 LastPassNs;
+  } Releaser;
+
   struct {
     u8 MayReturnNull : 1;       // may_return_null
     u8 ZeroContents : 1;        // zero_contents
     u8 DeallocTypeMismatch : 1; // dealloc_type_mismatch
     u8 DeleteSizeMismatch : 1;  // delete_size_mismatch
+    u8 DeferredHeaderChecks : 1; // deferred_header_checks
     u32 QuarantineMaxChunkSize; // quarantine_max_chunk_size
   } Options;
 
@@ -534,14 +628,29 @@ private:
     TSDRegistry.initThreadMaybe(this, MinimalInit);
   }
 
+  // If HeaderVerified is false, the chunk must be a Primary one that bypasses
+  // the quarantine, and its header keeps its current checksum.
   void quarantineOrDeallocateChunk(void *Ptr, Chunk::UnpackedHeader *Header,
-                                   uptr Size) {
+                                   uptr Size, bool HeaderVerified = true) {
     Chunk::UnpackedHeader NewHeader = *Header;
     // If the quarantine is disabled, the actual size of a chunk is 0 or larger
     // than the maximum allowed, we return a chunk directly to the backend.
     const bool BypassQuarantine = !Quarantine.getCacheSize() || !Size ||
                                   (Size > Options.QuarantineMaxChunkSize);
-    if (BypassQuarantine) {
+    if (BypassQuarantine && !HeaderVerified) {
+      DCHECK_NE(Header->ClassId, 0U);
+      NewHeader.State = Chunk::State::AvailableUnverified;
+      Chunk::compareExchangeHeaderUnverified(Ptr, &NewHeader, Header);
+      // The block can't be located with an unverified header, the chunk is
+      // recorded instead.
+      bool UnlockRequired;
+      auto *TSD = TSDRegistry.getTSDAndLock(&UnlockRequired);
+      if (TSD->NumUnverifiedChunks == ARRAY_SIZE(TSD->UnverifiedChunks))
+        commitUnverifiedChunks(TSD);
+      TSD->UnverifiedChunks[TSD->NumUnverifiedChunks++] = Ptr;
+      if (UnlockRequired)
+        TSD->unlock();
+    } else if (BypassQuarantine) {
       NewHeader.State = Chunk::State::Available;
       Chunk::compareExchangeHeader(Cookie, Ptr, &NewHeader, Header);
       void *BlockBegin = getBlockBegin(Ptr, &NewHeader);
@@ -567,6 +676,29 @@ private:
     }
   }
 
+  // With deferred_header_checks, a header loaded with loadHeaderUnverified is
+  // verified as the Allocated header it was when the chunk was freed.
+  void verifyDeferredHeader(const void *Ptr, Chunk::UnpackedHeader Header) {
+    if (Header.State == Chunk::State::AvailableUnverified)
+      Header.State = Chunk::State::Allocated;
+    Chunk::verifyHeader(Cookie, Ptr, &Header);
+  }
+
+  // Verifies the headers of the chunks recorded by a TSD, which must be
+  // locked, and puts their blocks in its cache.
+  void commitUnverifiedChunks(TSD<ThisT> *TSD) {
+    for (u32 I = 0; I < TSD->NumUnverifiedChunks; I++) {
+      void *Ptr = TSD->UnverifiedChunks[I];
+      Chunk::UnpackedHeader Header;
+      Chunk::loadHeaderUnverified(Ptr, &Header);
+      if (UNLIKELY(Header.State != Chunk::State::AvailableUnverified))
+        reportHeaderCorruption(Ptr);
+      verifyDeferredHeader(Ptr, Header);
+      TSD->Cache.deallocate(Header.ClassId, getBlockBegin(Ptr, &Header));
+    }
+    TSD->NumUnverifiedChunks = 0;
+  }
+
   // This only cares about valid busy chunks. This might change in the future.
   uptr getChunkFromBlock(uptr Block, uptr *Size) {
     u32 Offset = 0;
@@ -583,7 +715,125 @@ private:
     return P;
   }
 
+  void startReleaser() {
+    if (atomic_compare_exchange(&Releaser.State, ReleaserPending,
+                                ReleaserRunning) != ReleaserPending)
+      return;
+    pthread_condattr_t CondAttr;
+    pthread_condattr_init(&CondAttr);
+    pthread_condattr_setclock(&CondAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&Releaser.Cond, &CondAttr);
+    pthread_condattr_destroy(&CondAttr);
+    pthread_mutex_init(&Releaser.Mutex, nullptr);
+    // The releaser thread should not be handling the application's signals.
+    sigset_t BlockAll, OldMask;
+    sigfillset(&BlockAll);
+    pthread_sigmask(SIG_SETMASK, &BlockAll, &OldMask);
+    const bool Started =
+        pthread_create(&Releaser.Thread, nullptr, releaserThread, this) == 0;
+    pthread_sigmask(SIG_SETMASK, &OldMask, nullptr);
+    if (UNLIKELY(!Started)) {
+      // Fall back to releasing memory on deallocation.
+      pthread_cond_destroy(&Releaser.Cond);
+      pthread_mutex_destroy(&Releaser.Mutex);
+      atomic_store_relaxed(&Releaser.State, ReleaserDisabled);
+    }
+  }
+
+  void stopReleaser() {
+    if (atomic_load_relaxed(&Releaser.State) != ReleaserRunning)
+      return;
+    pthread_mutex_lock(&Releaser.Mutex);
+    Releaser.Stop = true;
+    pthread_cond_signal(&Releaser.Cond);
+    pthread_mutex_unlock(&Releaser.Mutex);
+    pthread_join(Releaser.Thread, nullptr);
+    pthread_cond_destroy(&Releaser.Cond);
+    pthread_mutex_destroy(&Releaser.Mutex);
+    atomic_store_relaxed(&Releaser.State, ReleaserDisabled);
+  }
+
+  static uptr getSizeHistogramMapSize() {
+    return roundUpTo(SizeHistogramCount * sizeof(atomic_uptr),
+                     getPageSizeCached());
+  }
+
+  // The format is parsed by tools/compute_size_class_config.cpp.
+  void getSizeHistogramStats(ScopedString *Str) {
+    const uptr EntriesPerLine = 8U;
+    uptr Entries = 0;
+    for (uptr I = 0; I < SizeHistogramCount; I++) {
+      const uptr Count = atomic_load_relaxed(&SizeHistogram[I]);
+      if (!Count)
+        continue;
+      if (Entries % EntriesPerLine == 0)
+        Str->append("%sStats: SizeHistogram:", Entries ? "\n" : "");
+      Str->append(" %zu:%zu", I << MinAlignmentLog, Count);
+      Entries++;
+    }
+    if (Entries)
+      Str->append("\n");
+  }
+
+  static void *releaserThread(void *Arg) {
+    reinterpret_cast<ThisT *>(Arg)->runReleaser();
+    return nullptr;
+  }
+
+  void runReleaser() {
+    const u64 PeriodNs = static_cast<u64>(Releaser.PeriodMs) * 1000000ULL;
+    pthread_mutex_lock(&Releaser.Mutex);
+    while (!Releaser.Stop) {
+      pthread_mutex_unlock(&Releaser.Mutex);
+      const u64 Start = getMonotonicTime();
+      // If we miss a couple of periods, let deallocations release memory.
+      Primary.setBackgroundReleaseDeadline(Start + 2 * PeriodNs);
+      releaseInBackground();
+      atomic_store_relaxed(&Releaser.LastPassNs, getMonotonicTime() - Start);
+      const u64 Deadline = Start + PeriodNs;
+      timespec TS;
+      TS.tv_sec = static_cast<time_t>(Deadline / 1000000000ULL);
+      TS.tv_nsec = static_cast<long>(Deadline % 1000000000ULL);
+      pthread_mutex_lock(&Releaser.Mutex);
+      while (!Releaser.Stop && pthread_cond_timedwait(
+                                   &Releaser.Cond, &Releaser.Mutex, &TS) == 0) {
+      }
+    }
+    pthread_mutex_unlock(&Releaser.Mutex);
+    Primary.setBackgroundReleaseDeadline(0);
+  }
+
+  void releaseInBackground() {
+    bool Force = false;
+    if (Releaser.TargetRss >= 0) {
+      const uptr Rss = getResidentSetSize();
+      atomic_store_relaxed(&Releaser.LastRss, Rss);
+      // Only release memory when above the target, and as much as possible.
+      if (Rss <= static_cast<uptr>(Releaser.TargetRss))
+        return;
+      Force = true;
+      atomic_fetch_add(&Releaser.ForcedPasses, 1U, memory_order_relaxed);
+    }
+    const uptr Released =
+        Primary.releaseToOSInBackground(Force) +
+        (Force ? Secondary.releaseToOS() : Secondary.releaseExpiredToOS());
+    atomic_fetch_add(&Releaser.Passes, 1U, memory_order_relaxed);
+    atomic_fetch_add(&Releaser.ReleasedBytes, Released, memory_order_relaxed);
+  }
+
   uptr getStats(ScopedString *Str) {
+    if (atomic_load_relaxed(&Releaser.State) == ReleaserRunning)
+      Str->append("Stats: Releaser: %zu passes (%zu forced); %zuK released; "
+                  "last pass took %zuus; rss %zuK (target %zdK)\n",
+                  atomic_load_relaxed(&Releaser.Passes),
+                  atomic_load_relaxed(&Releaser.ForcedPasses),
+                  atomic_load_relaxed(&Releaser.ReleasedBytes) >> 10,
+                  static_cast<uptr>(atomic_load_relaxed(&Releaser.LastPassNs) /
+                                    1000U),
+                  atomic_load_relaxed(&Releaser.LastRss) >> 10,
+                  Releaser.TargetRss < 0 ? -1 : Releaser.TargetRss >> 10);
+    if (SizeHistogram)
+      getSizeHistogramStats(Str);
     Primary.getStats(Str);
     Secondary.getStats(Str);
     Quarantine.getStats(Str);
@@ -127,11 +127,24 @@ INLINE uptr getPageSizeCached() {
 }
 
 u32 getNumberOfCPUs();
+// Returns one more than the highest id of the CPUs of the system, which may
+// exceed getNumberOfCPUs() if the process is restricted to some of them.
+u32 getNumberOfPossibleCPUs();
+
+// Returns the CPU the calling thread is running on, through a system call.
+u32 getCurrentCPU();
+// Returns a pointer to a word holding the CPU the calling thread is running on,
+// kept up to date by the kernel, or nullptr if the platform can't provide one.
+// The pointer is only valid for the calling thread.
+const volatile u32 *getCurrentCPUIdPtr();
 
 const char *getEnv(const char *Name);
 
 u64 getMonotonicTime();
 
+// Returns the resident set size of the process in bytes, or 0 if unknown.
+uptr getResidentSetSize();
+
 // Our randomness gathering function is limited to 256 bytes to ensure we get
 // as many bytes as requested, and avoid interruptions (on Linux).
 constexpr uptr MaxRandomLength = 256U;
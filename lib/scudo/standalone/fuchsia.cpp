@@ -18,6 +18,7 @@
 #include <limits.h>         // for PAGE_SIZE
 #include <stdlib.h>         // for getenv()
 #include <zircon/compiler.h>
+#include <zircon/process.h>
 #include <zircon/sanitizer.h>
 #include <zircon/syscalls.h>
 
@@ -168,8 +169,23 @@ void HybridMutex::unlock() __TA_NO_THREAD_SAFETY_ANALYSIS {
 
 u64 getMonotonicTime() { return _zx_clock_get_monotonic(); }
 
+uptr getResidentSetSize() {
+  zx_info_task_stats_t Info;
+  if (_zx_object_get_info(_zx_process_self(), ZX_INFO_TASK_STATS, &Info,
+                          sizeof(Info), nullptr, nullptr) != ZX_OK)
+    return 0;
+  return Info.mem_private_bytes + Info.mem_scaled_shared_bytes;
+}
+
 u32 getNumberOfCPUs() { return _zx_system_get_num_cpus(); }
 
+u32 getNumberOfPossibleCPUs() { return getNumberOfCPUs(); }
+
+// There is no way to query the current CPU on Fuchsia.
+u32 getCurrentCPU() { return 0; }
+
+const volatile u32 *getCurrentCPUIdPtr() { return nullptr; }
+
 bool getRandom(void *Buffer, uptr Length, UNUSED bool Blocking) {
   COMPILER_CHECK(MaxRandomLength <= ZX_CPRNG_DRAW_MAX_LEN);
   if (UNLIKELY(!Buffer || !Length || Length > MaxRandomLength))
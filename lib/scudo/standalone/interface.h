@@ -22,6 +22,10 @@ WEAK INTERFACE void __scudo_deallocate_hook(void *ptr);
 
 WEAK INTERFACE void __scudo_print_stats(void);
 
+// Starts the background releaser thread, if release_to_os_background is set.
+// Should be called early, e.g. from main(), and not from a signal handler.
+WEAK INTERFACE void __scudo_start_background_release(void);
+
 typedef void (*iterate_callback)(uintptr_t base, size_t size, void *arg);
 
 } // extern "C"
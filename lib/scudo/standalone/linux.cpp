@@ -122,12 +122,99 @@ u64 getMonotonicTime() {
          static_cast<u64>(TS.tv_nsec);
 }
 
+uptr getResidentSetSize() {
+  // The second field of /proc/self/statm is the number of resident pages.
+  const int FileDesc = open("/proc/self/statm", O_RDONLY);
+  if (FileDesc == -1)
+    return 0;
+  char Buffer[64];
+  const ssize_t ReadBytes = read(FileDesc, Buffer, sizeof(Buffer) - 1);
+  close(FileDesc);
+  if (ReadBytes <= 0)
+    return 0;
+  Buffer[ReadBytes] = '\0';
+  const char *P = strchr(Buffer, ' ');
+  if (!P)
+    return 0;
+  uptr Pages = 0;
+  for (P++; *P >= '0' && *P <= '9'; P++)
+    Pages = Pages * 10 + static_cast<uptr>(*P - '0');
+  return Pages * getPageSizeCached();
+}
+
 u32 getNumberOfCPUs() {
   cpu_set_t CPUs;
   CHECK_EQ(sched_getaffinity(0, sizeof(cpu_set_t), &CPUs), 0);
   return static_cast<u32>(CPU_COUNT(&CPUs));
 }
 
+u32 getNumberOfPossibleCPUs() {
+  // The ids of the configured CPUs are usually dense, but make sure that the
+  // ones we are allowed to run on are covered.
+  cpu_set_t CPUs;
+  CHECK_EQ(sched_getaffinity(0, sizeof(cpu_set_t), &CPUs), 0);
+  u32 N = 0;
+  for (u32 I = 0; I < CPU_SETSIZE; I++)
+    if (CPU_ISSET(I, &CPUs))
+      N = I + 1;
+  const long Configured = sysconf(_SC_NPROCESSORS_CONF);
+  return Max(N, Configured > 0 ? static_cast<u32>(Configured) : 0U);
+}
+
+u32 getCurrentCPU() {
+  const int CPU = sched_getcpu();
+  return CPU < 0 ? 0U : static_cast<u32>(CPU);
+}
+
+// We only use restartable sequences to have the kernel maintain the current
+// CPU of a thread in its registered area, no critical section is defined.
+// See include/uapi/linux/rseq.h in the kernel sources.
+struct ALIGNED(32) RseqArea {
+  u32 CPUIdStart;
+  u32 CPUId;
+  u64 CriticalSection;
+  u32 Flags;
+};
+
+static constexpr u32 RseqCPUIdUninitialized = ~0U;
+static constexpr u32 RseqSignature = 0x53053053U;
+
+// Since 2.35, glibc registers an area for each thread and exports its offset
+// from the thread pointer.
+extern "C" WEAK const sptr __rseq_offset;
+extern "C" WEAK const unsigned int __rseq_size;
+
+static uptr getThreadPointer() {
+  uptr P = 0;
+#if defined(__x86_64__)
+  __asm__("mov %%fs:0, %0" : "=r"(P));
+#elif defined(__i386__)
+  __asm__("movl %%gs:0, %0" : "=r"(P));
+#elif defined(__aarch64__)
+  __asm__("mrs %0, tpidr_el0" : "=r"(P));
+#endif
+  return P;
+}
+
+#if !SCUDO_ANDROID
+static THREADLOCAL RseqArea ThreadRseq = {0, RseqCPUIdUninitialized, 0, 0};
+#endif
+
+const volatile u32 *getCurrentCPUIdPtr() {
+  // glibc sets __rseq_size to 0 if the registration failed or is disabled.
+  const uptr ThreadPointer = getThreadPointer();
+  if (&__rseq_offset && &__rseq_size && __rseq_size != 0 && ThreadPointer)
+    return &reinterpret_cast<RseqArea *>(ThreadPointer + __rseq_offset)->CPUId;
+#if !SCUDO_ANDROID && defined(SYS_rseq)
+  // The kernel updates CPUId as soon as the area is registered.
+  if (ThreadRseq.CPUId != RseqCPUIdUninitialized ||
+      syscall(SYS_rseq, &ThreadRseq, sizeof(ThreadRseq), 0, RseqSignature) ==
+          0)
+    return &ThreadRseq.CPUId;
+#endif
+  return nullptr;
+}
+
 // Blocking is possibly unused if the getrandom block is not compiled in.
 bool getRandom(void *Buffer, uptr Length, UNUSED bool Blocking) {
   if (!Buffer || !Length || Length > MaxRandomLength)
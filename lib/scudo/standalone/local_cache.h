@@ -10,6 +10,7 @@
 #define SCUDO_LOCAL_CACHE_H_
 
 #include "internal_defs.h"
+#include "list.h"
 #include "report.h"
 #include "stats.h"
 
@@ -48,6 +49,16 @@ template <class SizeClassAllocator> struct SizeClassAllocatorLocalCache {
     void *Batch[MaxNumCached];
   };
 
+  // Count contiguous blocks starting at Beg, carved by the Primary off one of
+  // its regions, up to MaxBatches TransferBatches worth. They are shuffled on
+  // the cache side using RandState.
+  struct BlockSpan {
+    static const u32 MaxBatches = 8U;
+    uptr Beg;
+    u32 Count;
+    u32 RandState;
+  };
+
   void initLinkerInitialized(GlobalStats *S, SizeClassAllocator *A) {
     Stats.initLinkerInitialized();
     if (LIKELY(S))
@@ -153,9 +164,14 @@ private:
 
   NOINLINE bool refill(PerClass *C, uptr ClassId) {
     initCacheMaybe(C);
-    TransferBatch *B = Allocator->popBatch(this, ClassId);
-    if (UNLIKELY(!B))
-      return false;
+    BlockSpan Span = {};
+    TransferBatch *B = Allocator->popBatchOrSpan(this, ClassId, &Span);
+    if (!B) {
+      if (UNLIKELY(!Span.Count))
+        return false;
+      refillFromSpan(C, ClassId, &Span);
+      return true;
+    }
     DCHECK_GT(B->getCount(), 0);
     C->Count = B->getCount();
     B->copyToArray(C->Chunks);
@@ -163,6 +179,37 @@ private:
     return true;
   }
 
+  // The blocks of the span are shuffled all together. The cache keeps one
+  // batch worth, the others are handed back to the Primary in TransferBatches,
+  // all at once.
+  NOINLINE void refillFromSpan(PerClass *C, uptr ClassId, BlockSpan *Span) {
+    void *Blocks[BlockSpan::MaxBatches * TransferBatch::MaxNumCached];
+    const u32 MaxCount = C->MaxCount / 2;
+    DCHECK_LE(Span->Count, BlockSpan::MaxBatches * MaxCount);
+    const uptr ClassSize = C->ClassSize;
+    for (u32 I = 0; I < Span->Count; I++)
+      Blocks[I] = reinterpret_cast<void *>(Span->Beg + I * ClassSize);
+    // No need to shuffle the batches size class.
+    if (ClassId != SizeClassMap::BatchClassId)
+      shuffle(Blocks, Span->Count, &Span->RandState);
+    C->Count = Min(Span->Count, MaxCount);
+    memcpy(C->Chunks, Blocks, C->Count * sizeof(Blocks[0]));
+    if (C->Count == Span->Count)
+      return;
+    IntrusiveList<TransferBatch> Batches;
+    Batches.clear();
+    for (u32 I = C->Count; I < Span->Count; I += MaxCount) {
+      const u32 Count = Min(MaxCount, Span->Count - I);
+      TransferBatch *B = createBatch(ClassId, Blocks[I]);
+      if (UNLIKELY(!B))
+        reportOutOfMemory(
+            SizeClassAllocator::getSizeByClassId(SizeClassMap::BatchClassId));
+      B->setFromArray(&Blocks[I], Count);
+      Batches.push_back(B);
+    }
+    Allocator->pushUnusedBatches(ClassId, &Batches, Span->Count - C->Count);
+  }
+
   NOINLINE void drain(PerClass *C, uptr ClassId) {
     const u32 Count = Min(C->MaxCount / 2, C->Count);
     const uptr FirstIndexToDrain = C->Count - Count;
@@ -46,6 +46,7 @@ public:
   typedef SizeClassAllocator32<SizeClassMapT, RegionSizeLog> ThisT;
   typedef SizeClassAllocatorLocalCache<ThisT> CacheT;
   typedef typename CacheT::TransferBatch TransferBatch;
+  typedef typename CacheT::BlockSpan BlockSpan;
 
   static uptr getSizeByClassId(uptr ClassId) {
     return (ClassId == SizeClassMap::BatchClassId)
@@ -103,14 +104,24 @@ public:
       Sci->FreeList.pop_front();
     } else {
       B = populateFreeList(C, ClassId, Sci);
-      if (UNLIKELY(!B))
-        return nullptr;
+      if (UNLIKELY(!B)) {
+        if (!waitForRelease(Sci) || !(B = Sci->FreeList.front()))
+          return nullptr;
+        Sci->FreeList.pop_front();
+      }
     }
     DCHECK_GT(B->getCount(), 0);
     Sci->Stats.PoppedBlocks += B->getCount();
     return B;
   }
 
+  // Blocks are carved off whole regions at once here, so unlike the 64-bit
+  // Primary, we always return a TransferBatch.
+  TransferBatch *popBatchOrSpan(CacheT *C, uptr ClassId,
+                                UNUSED BlockSpan *Span) {
+    return popBatch(C, ClassId);
+  }
+
   void pushBatch(uptr ClassId, TransferBatch *B) {
     DCHECK_LT(ClassId, NumClasses);
     DCHECK_GT(B->getCount(), 0);
@@ -122,6 +133,13 @@ public:
       releaseToOSMaybe(Sci, ClassId);
   }
 
+  // Spans are never handed out by this Primary, see popBatchOrSpan().
+  void pushUnusedBatches(UNUSED uptr ClassId,
+                         UNUSED IntrusiveList<TransferBatch> *Batches,
+                         UNUSED u32 BlockCount) {
+    UNREACHABLE("The 32-bit Primary doesn't return spans");
+  }
+
   void disable() {
     for (uptr I = 0; I < NumClasses; I++)
       getSizeClassInfo(I)->Mutex.lock();
@@ -173,6 +191,31 @@ public:
     return TotalReleasedBytes;
   }
 
+  // Same as releaseToOS, but called periodically by the background releaser:
+  // size classes that are currently locked are skipped, and unless Force is
+  // set, the release interval and the release eligibility of each size class
+  // are honored.
+  uptr releaseToOSInBackground(bool Force) {
+    uptr TotalReleasedBytes = 0;
+    for (uptr I = 0; I < NumClasses; I++) {
+      if (I == SizeClassMap::BatchClassId)
+        continue;
+      SizeClassInfo *Sci = getSizeClassInfo(I);
+      if ((!Force && !Sci->CanRelease) || !Sci->Mutex.tryLock())
+        continue;
+      TotalReleasedBytes +=
+          releaseToOSMaybe(Sci, I, Force, /*Background=*/true);
+      Sci->Mutex.unlock();
+    }
+    return TotalReleasedBytes;
+  }
+
+  // Until the monotonic time reaches Ns, releasing memory is left to the
+  // background releaser rather than done when blocks are pushed back.
+  void setBackgroundReleaseDeadline(u64 Ns) {
+    atomic_store_relaxed(&BackgroundReleaseDeadlineNs, Ns);
+  }
+
 private:
   static const uptr NumClasses = SizeClassMap::NumClasses;
   static const uptr RegionSize = 1UL << RegionSizeLog;
@@ -200,6 +243,7 @@ private:
     IntrusiveList<TransferBatch> FreeList;
     SizeClassStats Stats;
     bool CanRelease;
+    bool Releasing; // Pages are being released, with Mutex dropped.
     u32 RandState;
     uptr AllocatedUser;
     ReleaseToOsInfo ReleaseInfo;
@@ -341,11 +385,30 @@ private:
                 AvailableChunks, Rss >> 10);
   }
 
+  // When no region can be allocated, an empty free list might only be
+  // detached by releaseToOSMaybe. Waits until it is back, with Sci->Mutex
+  // held. Returns false if no release was in progress.
+  bool waitForRelease(SizeClassInfo *Sci) {
+    if (!Sci->Releasing)
+      return false;
+    do {
+      Sci->Mutex.unlock();
+      yieldProcessor(16);
+      Sci->Mutex.lock();
+    } while (Sci->Releasing);
+    return true;
+  }
+
+  // Called with Sci->Mutex held, which is dropped while the pages are
+  // released.
   NOINLINE uptr releaseToOSMaybe(SizeClassInfo *Sci, uptr ClassId,
-                                 bool Force = false) {
+                                 bool Force = false, bool Background = false) {
     const uptr BlockSize = getSizeByClassId(ClassId);
     const uptr PageSize = getPageSizeCached();
 
+    if (Sci->Releasing)
+      return 0; // Another thread is releasing the pages of this class.
+
     CHECK_GE(Sci->Stats.PoppedBlocks, Sci->Stats.PushedBlocks);
     const uptr BytesInFreeList =
         Sci->AllocatedUser -
@@ -362,9 +425,13 @@ private:
       const s32 IntervalMs = ReleaseToOsIntervalMs;
       if (IntervalMs < 0)
         return 0;
+      const u64 Now = getMonotonicTime();
+      if (!Background &&
+          Now < atomic_load_relaxed(&BackgroundReleaseDeadlineNs))
+        return 0; // The background releaser takes care of it.
       if (Sci->ReleaseInfo.LastReleaseAtNs +
               static_cast<uptr>(IntervalMs) * 1000000ULL >
-          getMonotonicTime()) {
+          Now) {
         return 0; // Memory was returned recently.
       }
     }
@@ -372,20 +439,35 @@ private:
     // TODO(kostyak): currently not ideal as we loop over all regions and
     // iterate multiple times over the same freelist if a ClassId spans multiple
     // regions. But it will have to do for now.
+    // The free list is detached while the mutex is dropped, so that its
+    // blocks can't be handed out while their pages are released. The blocks
+    // pushed in the meantime aren't in it, so their pages are kept.
+    IntrusiveList<TransferBatch> FreeList = Sci->FreeList;
+    Sci->FreeList.clear();
+    const uptr PushedBlocks = Sci->Stats.PushedBlocks;
+    Sci->Releasing = true;
+    Sci->Mutex.unlock();
+
     uptr TotalReleasedBytes = 0;
+    uptr RangesReleased = 0;
     for (uptr I = MinRegionIndex; I <= MaxRegionIndex; I++) {
       if (PossibleRegions[I] == ClassId) {
         ReleaseRecorder Recorder(I * RegionSize);
-        releaseFreeMemoryToOS(&Sci->FreeList, I * RegionSize,
+        releaseFreeMemoryToOS(&FreeList, I * RegionSize,
                               RegionSize / PageSize, BlockSize, &Recorder);
-        if (Recorder.getReleasedRangesCount() > 0) {
-          Sci->ReleaseInfo.PushedBlocksAtLastRelease = Sci->Stats.PushedBlocks;
-          Sci->ReleaseInfo.RangesReleased += Recorder.getReleasedRangesCount();
-          Sci->ReleaseInfo.LastReleasedBytes = Recorder.getReleasedBytes();
-          TotalReleasedBytes += Sci->ReleaseInfo.LastReleasedBytes;
-        }
+        RangesReleased += Recorder.getReleasedRangesCount();
+        TotalReleasedBytes += Recorder.getReleasedBytes();
       }
     }
+
+    Sci->Mutex.lock();
+    Sci->Releasing = false;
+    Sci->FreeList.append_back(&FreeList);
+    if (RangesReleased > 0) {
+      Sci->ReleaseInfo.PushedBlocksAtLastRelease = PushedBlocks;
+      Sci->ReleaseInfo.RangesReleased += RangesReleased;
+      Sci->ReleaseInfo.LastReleasedBytes = TotalReleasedBytes;
+    }
     Sci->ReleaseInfo.LastReleaseAtNs = getMonotonicTime();
     return TotalReleasedBytes;
   }
@@ -398,6 +480,7 @@ private:
   uptr MinRegionIndex;
   uptr MaxRegionIndex;
   s32 ReleaseToOsIntervalMs;
+  atomic_u64 BackgroundReleaseDeadlineNs;
   // Unless several threads request regions simultaneously from different size
   // classes, the stash rarely contains more than 1 entry.
   static constexpr uptr MaxStashedRegions = 4;
@@ -30,6 +30,8 @@ namespace scudo {
 // those mappings being split into equally sized Blocks based on the size class
 // they belong to. The Blocks created are shuffled to prevent predictable
 // address patterns (the predictability increases with the size of the Blocks).
+// When refilling a thread specific cache, new Blocks are handed over as a span
+// of contiguous Blocks, shuffled by the cache once the Region lock is released.
 //
 // The 1st Region (for size class 0) holds the TransferBatches. This is a
 // structure used to transfer arrays of available pointers from the class size
@@ -44,6 +46,7 @@ public:
   typedef SizeClassAllocator64<SizeClassMap, RegionSizeLog> ThisT;
   typedef SizeClassAllocatorLocalCache<ThisT> CacheT;
   typedef typename CacheT::TransferBatch TransferBatch;
+  typedef typename CacheT::BlockSpan BlockSpan;
 
   static uptr getSizeByClassId(uptr ClassId) {
     return (ClassId == SizeClassMap::BatchClassId)
@@ -106,14 +109,41 @@ public:
       Region->FreeList.pop_front();
     } else {
       B = populateFreeList(C, ClassId, Region);
-      if (UNLIKELY(!B))
-        return nullptr;
+      if (UNLIKELY(!B)) {
+        if (!waitForRelease(Region) || !(B = Region->FreeList.front()))
+          return nullptr;
+        Region->FreeList.pop_front();
+      }
     }
     DCHECK_GT(B->getCount(), 0);
     Region->Stats.PoppedBlocks += B->getCount();
     return B;
   }
 
+  // Same as popBatch, except that if the free list is empty, new blocks are
+  // carved off the region and returned as a span (with a null batch), instead
+  // of having TransferBatches built and shuffled with the region lock held.
+  TransferBatch *popBatchOrSpan(CacheT *C, uptr ClassId, BlockSpan *Span) {
+    DCHECK_LT(ClassId, NumClasses);
+    RegionInfo *Region = getRegionInfo(ClassId);
+    ScopedLock L(Region->Mutex);
+    TransferBatch *B = Region->FreeList.front();
+    if (B) {
+      Region->FreeList.pop_front();
+      DCHECK_GT(B->getCount(), 0);
+      Region->Stats.PoppedBlocks += B->getCount();
+      return B;
+    }
+    if (LIKELY(carveSpan(C, ClassId, Region, Span))) {
+      Region->Stats.PoppedBlocks += Span->Count;
+    } else if (waitForRelease(Region) && (B = Region->FreeList.front())) {
+      Region->FreeList.pop_front();
+      Region->Stats.PoppedBlocks += B->getCount();
+      return B;
+    }
+    return nullptr;
+  }
+
   void pushBatch(uptr ClassId, TransferBatch *B) {
     DCHECK_GT(B->getCount(), 0);
     RegionInfo *Region = getRegionInfo(ClassId);
@@ -124,6 +154,16 @@ public:
       releaseToOSMaybe(Region, ClassId);
   }
 
+  // Pushes back the blocks of a span which the cache didn't keep. They were
+  // never handed out, so they don't count as popped nor pushed.
+  void pushUnusedBatches(uptr ClassId, IntrusiveList<TransferBatch> *Batches,
+                         u32 BlockCount) {
+    RegionInfo *Region = getRegionInfo(ClassId);
+    ScopedLock L(Region->Mutex);
+    Region->FreeList.append_front(Batches);
+    Region->Stats.PoppedBlocks -= BlockCount;
+  }
+
   void disable() {
     for (uptr I = 0; I < NumClasses; I++)
       getRegionInfo(I)->Mutex.lock();
@@ -180,6 +220,31 @@ public:
     return TotalReleasedBytes;
   }
 
+  // Same as releaseToOS, but called periodically by the background releaser:
+  // size classes that are currently locked are skipped, and unless Force is
+  // set, the release interval and the release eligibility of each size class
+  // are honored.
+  uptr releaseToOSInBackground(bool Force) {
+    uptr TotalReleasedBytes = 0;
+    for (uptr I = 0; I < NumClasses; I++) {
+      if (I == SizeClassMap::BatchClassId)
+        continue;
+      RegionInfo *Region = getRegionInfo(I);
+      if ((!Force && !Region->CanRelease) || !Region->Mutex.tryLock())
+        continue;
+      TotalReleasedBytes +=
+          releaseToOSMaybe(Region, I, Force, /*Background=*/true);
+      Region->Mutex.unlock();
+    }
+    return TotalReleasedBytes;
+  }
+
+  // Until the monotonic time reaches Ns, releasing memory is left to the
+  // background releaser rather than done when blocks are pushed back.
+  void setBackgroundReleaseDeadline(u64 Ns) {
+    atomic_store_relaxed(&BackgroundReleaseDeadlineNs, Ns);
+  }
+
 private:
   static const uptr RegionSize = 1UL << RegionSizeLog;
   static const uptr NumClasses = SizeClassMap::NumClasses;
@@ -206,6 +271,7 @@ private:
     RegionStats Stats;
     bool CanRelease;
     bool Exhausted;
+    bool Releasing; // Pages are being released, with Mutex dropped.
     u32 RandState;
     uptr RegionBeg;
     uptr MappedUser;    // Bytes mapped for user memory.
@@ -219,6 +285,7 @@ private:
   RegionInfo *RegionInfoArray;
   MapPlatformData Data;
   s32 ReleaseToOsIntervalMs;
+  atomic_u64 BackgroundReleaseDeadlineNs;
 
   RegionInfo *getRegionInfo(uptr ClassId) const {
     DCHECK_LT(ClassId, NumClasses);
@@ -253,15 +320,11 @@ private:
     return true;
   }
 
-  NOINLINE TransferBatch *populateFreeList(CacheT *C, uptr ClassId,
-                                           RegionInfo *Region) {
-    const uptr Size = getSizeByClassId(ClassId);
-    const u32 MaxCount = TransferBatch::getMaxCached(Size);
-
+  // Ensures that at least TotalUserBytes are mapped for the region.
+  bool mapUserMemory(CacheT *C, uptr ClassId, RegionInfo *Region,
+                     uptr TotalUserBytes) {
     const uptr RegionBeg = Region->RegionBeg;
     const uptr MappedUser = Region->MappedUser;
-    const uptr TotalUserBytes = Region->AllocatedUser + MaxCount * Size;
-    // Map more space for blocks, if necessary.
     if (TotalUserBytes > MappedUser) {
       // Do the mmap for the user memory.
       const uptr UserMapSize =
@@ -274,20 +337,56 @@ private:
           getStats(&Str);
           Str.append(
               "Scudo OOM: The process has Exhausted %zuM for size class %zu.\n",
-              RegionSize >> 20, Size);
+              RegionSize >> 20, getSizeByClassId(ClassId));
           Str.output();
         }
-        return nullptr;
+        return false;
       }
       if (UNLIKELY(MappedUser == 0))
         Region->Data = Data;
       if (UNLIKELY(!map(reinterpret_cast<void *>(RegionBeg + MappedUser),
                         UserMapSize, "scudo:primary",
                         MAP_ALLOWNOMEM | MAP_RESIZABLE, &Region->Data)))
-        return nullptr;
+        return false;
       Region->MappedUser += UserMapSize;
       C->getStats().add(StatMapped, UserMapSize);
     }
+    return true;
+  }
+
+  // Carves the next blocks off the region, up to BlockSpan::MaxBatches
+  // TransferBatches worth from the memory already mapped, without touching
+  // them: the cache does the rest outside of the lock.
+  bool carveSpan(CacheT *C, uptr ClassId, RegionInfo *Region,
+                 BlockSpan *Span) {
+    const uptr Size = getSizeByClassId(ClassId);
+    const u32 MaxCount = TransferBatch::getMaxCached(Size);
+    if (UNLIKELY(!mapUserMemory(C, ClassId, Region,
+                                Region->AllocatedUser + MaxCount * Size)))
+      return false;
+    const u32 Count = static_cast<u32>(
+        Min(static_cast<uptr>(BlockSpan::MaxBatches * MaxCount),
+            (Region->MappedUser - Region->AllocatedUser) / Size));
+    DCHECK_GE(Count, MaxCount);
+    Span->Beg = Region->RegionBeg + Region->AllocatedUser;
+    Span->Count = Count;
+    Span->RandState = getRandomU32(&Region->RandState);
+    const uptr AllocatedUser = Count * Size;
+    C->getStats().add(StatFree, AllocatedUser);
+    Region->AllocatedUser += AllocatedUser;
+    Region->Exhausted = false;
+    if (Region->CanRelease)
+      Region->ReleaseInfo.LastReleaseAtNs = getMonotonicTime();
+    return true;
+  }
+
+  NOINLINE TransferBatch *populateFreeList(CacheT *C, uptr ClassId,
+                                           RegionInfo *Region) {
+    const uptr Size = getSizeByClassId(ClassId);
+    const u32 MaxCount = TransferBatch::getMaxCached(Size);
+    if (UNLIKELY(!mapUserMemory(C, ClassId, Region,
+                                Region->AllocatedUser + MaxCount * Size)))
+      return nullptr;
 
     const uptr NumberOfBlocks = Min(
         8UL * MaxCount, (Region->MappedUser - Region->AllocatedUser) / Size);
@@ -297,7 +396,7 @@ private:
     constexpr uptr ShuffleArraySize = 48;
     void *ShuffleArray[ShuffleArraySize];
     u32 Count = 0;
-    const uptr P = RegionBeg + Region->AllocatedUser;
+    const uptr P = Region->RegionBeg + Region->AllocatedUser;
     const uptr AllocatedUser = NumberOfBlocks * Size;
     for (uptr I = P; I < P + AllocatedUser; I += Size) {
       ShuffleArray[Count++] = reinterpret_cast<void *>(I);
@@ -342,11 +441,30 @@ private:
                 getRegionBaseByClassId(ClassId));
   }
 
+  // When the region is exhausted, an empty free list might only be detached
+  // by releaseToOSMaybe. Waits until it is back, with Region->Mutex held.
+  // Returns false if no release was in progress.
+  bool waitForRelease(RegionInfo *Region) {
+    if (!Region->Releasing)
+      return false;
+    do {
+      Region->Mutex.unlock();
+      yieldProcessor(16);
+      Region->Mutex.lock();
+    } while (Region->Releasing);
+    return true;
+  }
+
+  // Called with Region->Mutex held, which is dropped while the pages are
+  // released.
   NOINLINE uptr releaseToOSMaybe(RegionInfo *Region, uptr ClassId,
-                                 bool Force = false) {
+                                 bool Force = false, bool Background = false) {
     const uptr BlockSize = getSizeByClassId(ClassId);
     const uptr PageSize = getPageSizeCached();
 
+    if (Region->Releasing)
+      return 0; // Another thread is releasing the pages of this region.
+
     CHECK_GE(Region->Stats.PoppedBlocks, Region->Stats.PushedBlocks);
     const uptr BytesInFreeList =
         Region->AllocatedUser -
@@ -364,21 +482,37 @@ private:
       const s32 IntervalMs = ReleaseToOsIntervalMs;
       if (IntervalMs < 0)
         return 0;
+      const u64 Now = getMonotonicTime();
+      if (!Background &&
+          Now < atomic_load_relaxed(&BackgroundReleaseDeadlineNs))
+        return 0; // The background releaser takes care of it.
       if (Region->ReleaseInfo.LastReleaseAtNs +
               static_cast<uptr>(IntervalMs) * 1000000ULL >
-          getMonotonicTime()) {
+          Now) {
         return 0; // Memory was returned recently.
       }
     }
 
+    // The free list is detached while the mutex is dropped, so that its
+    // blocks can't be handed out while their pages are released. The blocks
+    // pushed in the meantime aren't in it, so their pages are kept.
+    IntrusiveList<TransferBatch> FreeList = Region->FreeList;
+    Region->FreeList.clear();
+    const uptr AllocatedPages = roundUpTo(Region->AllocatedUser, PageSize) /
+                                PageSize;
+    const uptr PushedBlocks = Region->Stats.PushedBlocks;
+    Region->Releasing = true;
+    Region->Mutex.unlock();
+
     ReleaseRecorder Recorder(Region->RegionBeg, &Region->Data);
-    releaseFreeMemoryToOS(&Region->FreeList, Region->RegionBeg,
-                          roundUpTo(Region->AllocatedUser, PageSize) / PageSize,
+    releaseFreeMemoryToOS(&FreeList, Region->RegionBeg, AllocatedPages,
                           BlockSize, &Recorder);
 
+    Region->Mutex.lock();
+    Region->Releasing = false;
+    Region->FreeList.append_back(&FreeList);
     if (Recorder.getReleasedRangesCount() > 0) {
-      Region->ReleaseInfo.PushedBlocksAtLastRelease =
-          Region->Stats.PushedBlocks;
+      Region->ReleaseInfo.PushedBlocksAtLastRelease = PushedBlocks;
       Region->ReleaseInfo.RangesReleased += Recorder.getReleasedRangesCount();
       Region->ReleaseInfo.LastReleasedBytes = Recorder.getReleasedBytes();
     }
@@ -23,9 +23,22 @@ namespace scudo {
 // For allocations requested with an alignment greater than or equal to a page,
 // the committed memory will amount to something close to Size - AlignmentHint
 // (pending rounding and headers).
-void *MapAllocator::allocate(uptr Size, uptr AlignmentHint, uptr *BlockEnd) {
+void *MapAllocator::allocate(uptr Size, uptr AlignmentHint, uptr *BlockEnd,
+                             bool ZeroContents) {
   DCHECK_GT(Size, AlignmentHint);
   const uptr PageSize = getPageSizeCached();
+  if (MaxEntriesCount) {
+    LargeBlock::Header *H = retrieveFromCache(
+        roundUpTo(Size + LargeBlock::getHeaderSize(), PageSize));
+    if (H) {
+      const uptr Ptr = reinterpret_cast<uptr>(H) + LargeBlock::getHeaderSize();
+      if (ZeroContents)
+        memset(reinterpret_cast<void *>(Ptr), 0, H->BlockEnd - Ptr);
+      if (BlockEnd)
+        *BlockEnd = H->BlockEnd;
+      return reinterpret_cast<void *>(Ptr);
+    }
+  }
   const uptr MapSize =
       roundUpTo(Size + LargeBlock::getHeaderSize(), PageSize) + 2 * PageSize;
   MapPlatformData Data = {};
@@ -92,6 +105,10 @@ void *MapAllocator::allocate(uptr Size, uptr AlignmentHint, uptr *BlockEnd) {
 
 void MapAllocator::deallocate(void *Ptr) {
   LargeBlock::Header *H = LargeBlock::getHeader(Ptr);
+  // Blocks evicted from the cache are unmapped once the lock is released.
+  CachedBlock Evicted[MaxCacheEntries];
+  u32 EvictedCount = 0;
+  bool Cached;
   {
     ScopedLock L(Mutex);
     LargeBlock::Header *Prev = H->Prev;
@@ -114,8 +131,13 @@ void MapAllocator::deallocate(void *Ptr) {
     FreedBytes += CommitSize;
     NumberOfFrees++;
     Stats.sub(StatAllocated, CommitSize);
-    Stats.sub(StatMapped, H->MapSize);
+    Cached = storeInCache(H, Evicted, &EvictedCount);
+    if (!Cached)
+      Stats.sub(StatMapped, H->MapSize);
   }
+  unmapCachedBlocks(Evicted, EvictedCount);
+  if (Cached)
+    return;
   void *Addr = reinterpret_cast<void *>(H->MapBase);
   const uptr Size = H->MapSize;
   MapPlatformData Data;
@@ -123,6 +145,134 @@ void MapAllocator::deallocate(void *Ptr) {
   unmap(Addr, Size, UNMAP_ALL, &Data);
 }
 
+// Returns the cached block that fits CommitSize best, if any. We don't want to
+// reuse a block that is much larger than the request, as its unused pages
+// would remain committed.
+LargeBlock::Header *MapAllocator::retrieveFromCache(uptr CommitSize) {
+  const uptr MaxCommitSize =
+      CommitSize + Max(CommitSize >> 2, 4 * getPageSizeCached());
+  ScopedLock L(Mutex);
+  u32 Best = CachedCount;
+  for (u32 I = 0; I < CachedCount; I++) {
+    if (Cache[I].CommitSize < CommitSize || Cache[I].CommitSize > MaxCommitSize)
+      continue;
+    if (Best == CachedCount || Cache[I].CommitSize < Cache[Best].CommitSize)
+      Best = I;
+  }
+  if (Best == CachedCount)
+    return nullptr;
+  const CachedBlock Block = Cache[Best];
+  Cache[Best] = Cache[--CachedCount];
+  CachedSize -= Block.CommitSize;
+  CacheHits++;
+  LargeBlock::Header *H =
+      reinterpret_cast<LargeBlock::Header *>(Block.CommitBase);
+  H->MapBase = Block.MapBase;
+  H->MapSize = Block.MapSize;
+  H->BlockEnd = Block.CommitBase + Block.CommitSize;
+  H->Data = Block.Data;
+  H->Next = nullptr;
+  H->Prev = Tail;
+  if (LIKELY(Tail))
+    Tail->Next = H;
+  Tail = H;
+  AllocatedBytes += Block.CommitSize;
+  if (LargestSize < Block.CommitSize)
+    LargestSize = Block.CommitSize;
+  NumberOfAllocs++;
+  Stats.add(StatAllocated, Block.CommitSize);
+  return H;
+}
+
+// Must be called with the lock held. Evicts the least recently freed blocks
+// until the new block fits, as well as the blocks that have been in the cache
+// for longer than ReleaseToOsIntervalMs.
+bool MapAllocator::storeInCache(LargeBlock::Header *H, CachedBlock *Evicted,
+                                u32 *EvictedCount) {
+  const uptr CommitSize = H->BlockEnd - reinterpret_cast<uptr>(H);
+  if (!MaxEntriesCount || CommitSize > MaxTotalCachedSize)
+    return false;
+  const u64 Time = getMonotonicTime();
+  if (ReleaseToOsIntervalMs >= 0) {
+    const u64 Interval = static_cast<u64>(ReleaseToOsIntervalMs) * 1000000;
+    if (Time >= Interval)
+      evictOlderThan(Time - Interval, Evicted, EvictedCount);
+  }
+  while (CachedCount == MaxEntriesCount ||
+         CachedSize + CommitSize > MaxTotalCachedSize) {
+    u32 Oldest = 0;
+    for (u32 I = 1; I < CachedCount; I++)
+      if (Cache[I].Time < Cache[Oldest].Time)
+        Oldest = I;
+    evictCachedBlock(Oldest, Evicted, EvictedCount);
+  }
+  CachedBlock &Block = Cache[CachedCount++];
+  Block.CommitBase = reinterpret_cast<uptr>(H);
+  Block.CommitSize = CommitSize;
+  Block.MapBase = H->MapBase;
+  Block.MapSize = H->MapSize;
+  Block.Data = H->Data;
+  Block.Time = Time;
+  CachedSize += CommitSize;
+  return true;
+}
+
+void MapAllocator::evictCachedBlock(u32 I, CachedBlock *Evicted,
+                                    u32 *EvictedCount) {
+  DCHECK_LT(I, CachedCount);
+  DCHECK_LT(*EvictedCount, MaxCacheEntries);
+  Evicted[(*EvictedCount)++] = Cache[I];
+  CachedSize -= Cache[I].CommitSize;
+  Stats.sub(StatMapped, Cache[I].MapSize);
+  CacheEvictions++;
+  Cache[I] = Cache[--CachedCount];
+}
+
+void MapAllocator::evictOlderThan(u64 Time, CachedBlock *Evicted,
+                                  u32 *EvictedCount) {
+  for (u32 I = 0; I < CachedCount;) {
+    if (Cache[I].Time <= Time)
+      evictCachedBlock(I, Evicted, EvictedCount);
+    else
+      I++;
+  }
+}
+
+uptr MapAllocator::unmapCachedBlocks(CachedBlock *Blocks, u32 Count) {
+  uptr Bytes = 0;
+  for (u32 I = 0; I < Count; I++) {
+    Bytes += Blocks[I].MapSize;
+    unmap(reinterpret_cast<void *>(Blocks[I].MapBase), Blocks[I].MapSize,
+          UNMAP_ALL, &Blocks[I].Data);
+  }
+  return Bytes;
+}
+
+uptr MapAllocator::releaseToOS() {
+  CachedBlock Evicted[MaxCacheEntries];
+  u32 EvictedCount = 0;
+  {
+    ScopedLock L(Mutex);
+    evictOlderThan(UINT64_MAX, Evicted, &EvictedCount);
+  }
+  return unmapCachedBlocks(Evicted, EvictedCount);
+}
+
+uptr MapAllocator::releaseExpiredToOS() {
+  if (ReleaseToOsIntervalMs < 0)
+    return 0;
+  const u64 Interval = static_cast<u64>(ReleaseToOsIntervalMs) * 1000000;
+  CachedBlock Evicted[MaxCacheEntries];
+  u32 EvictedCount = 0;
+  {
+    ScopedLock L(Mutex);
+    const u64 Time = getMonotonicTime();
+    if (Time >= Interval)
+      evictOlderThan(Time - Interval, Evicted, &EvictedCount);
+  }
+  return unmapCachedBlocks(Evicted, EvictedCount);
+}
+
 void MapAllocator::getStats(ScopedString *Str) const {
   Str->append(
       "Stats: MapAllocator: allocated %zu times (%zuK), freed %zu times "
@@ -130,6 +280,11 @@ void MapAllocator::getStats(ScopedString *Str) const {
       NumberOfAllocs, AllocatedBytes >> 10, NumberOfFrees, FreedBytes >> 10,
       NumberOfAllocs - NumberOfFrees, (AllocatedBytes - FreedBytes) >> 10,
       LargestSize >> 20);
+  if (MaxEntriesCount)
+    Str->append("Stats: MapAllocator: cache: %u/%u blocks (%zuK/%zuK), %u "
+                "hits, %u evictions\n",
+                CachedCount, MaxEntriesCount, CachedSize >> 10,
+                MaxTotalCachedSize >> 10, CacheHits, CacheEvictions);
 }
 
 } // namespace scudo
@@ -21,6 +21,11 @@ namespace scudo {
 // Blocks allocated will be preceded and followed by a guard page, and hold
 // their own header that is not checksummed: the guard pages and the Combined
 // header should be enough for our purpose.
+// Freed blocks can be kept mapped in a small cache, to be reused by subsequent
+// allocations of a similar size, which saves the map & unmap system calls as
+// well as the page faults. Cached blocks are unmapped after
+// ReleaseToOsIntervalMs, and the cache is bounded both in number of entries
+// and in total size.
 
 namespace LargeBlock {
 
@@ -49,17 +54,31 @@ static Header *getHeader(const void *Ptr) {
 
 class MapAllocator {
 public:
-  void initLinkerInitialized(GlobalStats *S) {
+  // The upper bound for the number of cached blocks.
+  static const u32 MaxCacheEntries = 32U;
+
+  // The cache is disabled when CacheMaxEntries or CacheMaxTotalSize are 0.
+  void initLinkerInitialized(GlobalStats *S, s32 ReleaseToOsInterval = -1,
+                             u32 CacheMaxEntries = 0,
+                             uptr CacheMaxTotalSize = 0) {
     Stats.initLinkerInitialized();
     if (LIKELY(S))
       S->link(&Stats);
+    ReleaseToOsIntervalMs = ReleaseToOsInterval;
+    MaxEntriesCount = Min(CacheMaxEntries, MaxCacheEntries);
+    MaxTotalCachedSize = CacheMaxTotalSize;
   }
-  void init(GlobalStats *S) {
+  void init(GlobalStats *S, s32 ReleaseToOsInterval = -1,
+            u32 CacheMaxEntries = 0, uptr CacheMaxTotalSize = 0) {
     memset(this, 0, sizeof(*this));
-    initLinkerInitialized(S);
+    initLinkerInitialized(S, ReleaseToOsInterval, CacheMaxEntries,
+                          CacheMaxTotalSize);
   }
 
-  void *allocate(uptr Size, uptr AlignmentHint = 0, uptr *BlockEnd = nullptr);
+  // Contrary to freshly mapped blocks, blocks reused from the cache are not
+  // guaranteed to be zero'd, hence the ZeroContents parameter.
+  void *allocate(uptr Size, uptr AlignmentHint = 0, uptr *BlockEnd = nullptr,
+                 bool ZeroContents = false);
 
   void deallocate(void *Ptr);
 
@@ -71,6 +90,12 @@ public:
     return getBlockEnd(Ptr) - reinterpret_cast<uptr>(Ptr);
   }
 
+  // Unmaps all the cached blocks. Returns the number of bytes unmapped.
+  uptr releaseToOS();
+  // Unmaps the blocks cached for longer than ReleaseToOsIntervalMs, which
+  // would otherwise stay mapped until the next deallocation.
+  uptr releaseExpiredToOS();
+
   void getStats(ScopedString *Str) const;
 
   void disable() { Mutex.lock(); }
@@ -83,8 +108,32 @@ public:
   }
 
 private:
+  struct CachedBlock {
+    uptr CommitBase;
+    uptr CommitSize;
+    uptr MapBase;
+    uptr MapSize;
+    MapPlatformData Data;
+    u64 Time; // When the block was freed.
+  };
+
+  LargeBlock::Header *retrieveFromCache(uptr CommitSize);
+  bool storeInCache(LargeBlock::Header *H, CachedBlock *Evicted,
+                    u32 *EvictedCount);
+  void evictCachedBlock(u32 I, CachedBlock *Evicted, u32 *EvictedCount);
+  void evictOlderThan(u64 Time, CachedBlock *Evicted, u32 *EvictedCount);
+  static uptr unmapCachedBlocks(CachedBlock *Blocks, u32 Count);
+
   HybridMutex Mutex;
   LargeBlock::Header *Tail;
+  CachedBlock Cache[MaxCacheEntries];
+  u32 CachedCount;
+  u32 MaxEntriesCount;
+  uptr CachedSize;
+  uptr MaxTotalCachedSize;
+  s32 ReleaseToOsIntervalMs;
+  u32 CacheHits;
+  u32 CacheEvictions;
   uptr AllocatedBytes;
   uptr FreedBytes;
   uptr LargestSize;
@@ -135,6 +135,172 @@ public:
   }
 };
 
+// The compile-time lookup tables of a TableSizeClassMap (see below), built from
+// the list of class sizes:
+// - up to 2^MidSizeLog, one entry per 2^MinSizeLog bytes: sizes in this range
+//   must be multiples of 2^MinSizeLog.
+// - after 2^MidSizeLog, one entry per step of a SizeClassMap with NumBits:
+//   sizes in this range must be representable with NumBits non-zero bits.
+// This guarantees that all the sizes sharing an entry map to the same class.
+template <u8 MinSizeLog, u8 MidSizeLog, u8 NumBits, u32... ClassSizes>
+struct SizeClassLookupTables {
+  static const uptr MinSize = 1UL << MinSizeLog;
+  static const uptr MidSize = 1UL << MidSizeLog;
+  static const u8 S = NumBits - 1;
+  static const uptr M = (1UL << S) - 1;
+  static const uptr NumSizes = sizeof...(ClassSizes);
+  static constexpr u32 Sizes[NumSizes] = {ClassSizes...};
+
+  static constexpr uptr log2(uptr X) { return X > 1 ? 1 + log2(X >> 1) : 0; }
+
+  // For Size > MidSize, the sizes in (2^L + I * 2^(L - S),
+  // 2^L + (I + 1) * 2^(L - S)] share the same index.
+  static constexpr uptr getLargeIndex(uptr Size) {
+    return ((log2(Size - 1) - MidSizeLog) << S) +
+           (((Size - 1) >> (log2(Size - 1) - S)) & M);
+  }
+
+  static const uptr NumSmall = MidSize / MinSize + 1;
+  static const uptr NumLarge = (Sizes[NumSizes - 1] > MidSize)
+                                   ? getLargeIndex(Sizes[NumSizes - 1]) + 1
+                                   : 1;
+
+  constexpr SizeClassLookupTables() : Small(), Large(), Valid(true) {
+    uptr ClassId = 1;
+    for (uptr I = 0; I < NumSmall; I++) {
+      while (ClassId <= NumSizes && Sizes[ClassId - 1] < I * MinSize)
+        ClassId++;
+      Small[I] = static_cast<u8>(ClassId);
+    }
+    for (uptr I = 0; I < NumLarge; I++) {
+      const uptr L = MidSizeLog + (I >> S);
+      const uptr Lower = (1UL << L) + (I & M) * (1UL << (L - S));
+      const uptr Upper = Lower + (1UL << (L - S));
+      while (ClassId <= NumSizes && Sizes[ClassId - 1] <= Lower)
+        ClassId++;
+      Large[I] = static_cast<u8>(ClassId);
+      // A class size strictly within a step would require a search.
+      if (ClassId <= NumSizes && Sizes[ClassId - 1] < Upper)
+        Valid = false;
+    }
+    for (uptr I = 0; I < NumSizes; I++) {
+      if ((I && Sizes[I] <= Sizes[I - 1]) ||
+          (Sizes[I] <= MidSize && Sizes[I] % MinSize))
+        Valid = false;
+    }
+  }
+
+  uptr getClassIdBySize(uptr Size) const {
+    if (Size <= MidSize)
+      return Small[(Size + MinSize - 1) >> MinSizeLog];
+    const uptr L = getMostSignificantSetBitIndex(Size - 1);
+    return Large[((L - MidSizeLog) << S) + (((Size - 1) >> (L - S)) & M)];
+  }
+
+  u8 Small[NumSmall];
+  u8 Large[NumLarge];
+  bool Valid;
+};
+
+template <u8 MinSizeLog, u8 MidSizeLog, u8 NumBits, u32... ClassSizes>
+constexpr u32 SizeClassLookupTables<MinSizeLog, MidSizeLog, NumBits,
+                                    ClassSizes...>::Sizes[];
+
+// TableSizeClassMap maps allocation sizes to an explicit list of class sizes,
+// in increasing order, with O(1) lookups in compile-time tables. This allows
+// for classes that fit the dominant allocation sizes of a program, as computed
+// by tools/compute_size_class_config.cpp from the histogram gathered with the
+// track_allocation_sizes flag.
+//
+// Class 0 is the batch class, and classes 1 to NumClasses - 1 have the sizes
+// listed in ClassSizes. See SizeClassLookupTables for the constraints on
+// those. MaxNumCachedHint & MaxBytesCachedLog have the same meaning as for
+// SizeClassMap.
+
+template <u32 MaxNumCachedHintT, u8 MaxBytesCachedLog, u8 MinSizeLog,
+          u8 MidSizeLog, u8 NumBits, u32... ClassSizes>
+class TableSizeClassMap {
+  typedef SizeClassLookupTables<MinSizeLog, MidSizeLog, NumBits, ClassSizes...>
+      LookupTablesT;
+  static constexpr LookupTablesT Tables = LookupTablesT();
+  COMPILER_CHECK(Tables.Valid);
+
+public:
+  static const u32 MaxNumCachedHint = MaxNumCachedHintT;
+
+  static const uptr MaxSize = LookupTablesT::Sizes[sizeof...(ClassSizes) - 1];
+  static const uptr NumClasses = sizeof...(ClassSizes) + 1;
+  COMPILER_CHECK(NumClasses <= 256);
+  static const uptr LargestClassId = NumClasses - 1;
+  static const uptr BatchClassId = 0;
+
+  static uptr getSizeByClassId(uptr ClassId) {
+    DCHECK_NE(ClassId, BatchClassId);
+    return LookupTablesT::Sizes[ClassId - 1];
+  }
+
+  static uptr getClassIdBySize(uptr Size) {
+    DCHECK_LE(Size, MaxSize);
+    return Tables.getClassIdBySize(Size);
+  }
+
+  static u32 getMaxCachedHint(uptr Size) {
+    DCHECK_LE(Size, MaxSize);
+    DCHECK_NE(Size, 0);
+    const u32 N = static_cast<u32>((1UL << MaxBytesCachedLog) / Size);
+    return Max(1U, Min(MaxNumCachedHint, N));
+  }
+
+  static void print() {
+    ScopedString Buffer(1024);
+    uptr PrevS = 0;
+    uptr TotalCached = 0;
+    for (uptr I = 1; I < NumClasses; I++) {
+      const uptr S = getSizeByClassId(I);
+      const uptr D = S - PrevS;
+      const uptr P = PrevS ? (D * 100 / PrevS) : 0;
+      const uptr Cached = getMaxCachedHint(S) * S;
+      Buffer.append(
+          "C%02zu => S: %zu diff: +%zu %02zu%% Cached: %zu %zu; id %zu\n", I,
+          S, D, P, getMaxCachedHint(S), Cached, getClassIdBySize(S));
+      TotalCached += Cached;
+      PrevS = S;
+    }
+    Buffer.append("Total Cached: %zu\n", TotalCached);
+    Buffer.output();
+  }
+
+  static void validate() {
+    for (uptr C = 1; C < NumClasses; C++) {
+      const uptr S = getSizeByClassId(C);
+      CHECK_NE(S, 0U);
+      CHECK_EQ(getClassIdBySize(S), C);
+      if (C < LargestClassId)
+        CHECK_EQ(getClassIdBySize(S + 1), C + 1);
+      if (S > 1 && (C == 1 || getSizeByClassId(C - 1) < S - 1))
+        CHECK_EQ(getClassIdBySize(S - 1), C);
+    }
+    // Do not perform the loop if the maximum size is too large.
+    if (MaxSize > (1UL << 19))
+      return;
+    for (uptr S = 1; S <= MaxSize; S++) {
+      const uptr C = getClassIdBySize(S);
+      CHECK_LT(C, NumClasses);
+      CHECK_GE(getSizeByClassId(C), S);
+      if (C > 1)
+        CHECK_LT(getSizeByClassId(C - 1), S);
+    }
+  }
+};
+
+template <u32 MaxNumCachedHintT, u8 MaxBytesCachedLog, u8 MinSizeLog,
+          u8 MidSizeLog, u8 NumBits, u32... ClassSizes>
+constexpr typename TableSizeClassMap<MaxNumCachedHintT, MaxBytesCachedLog,
+                                     MinSizeLog, MidSizeLog, NumBits,
+                                     ClassSizes...>::LookupTablesT
+    TableSizeClassMap<MaxNumCachedHintT, MaxBytesCachedLog, MinSizeLog,
+                      MidSizeLog, NumBits, ClassSizes...>::Tables;
+
 typedef SizeClassMap<3, 5, 8, 17, 8, 10> DefaultSizeClassMap;
 
 // TODO(kostyak): further tune class maps for Android & Fuchsia.
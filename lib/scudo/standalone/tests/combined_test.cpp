@@ -11,6 +11,7 @@
 
 #include "gtest/gtest.h"
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -25,7 +26,16 @@ static constexpr scudo::Chunk::Origin Origin = scudo::Chunk::Origin::Malloc;
 // parameters are on the low end, to avoid having to loop excessively in some
 // tests.
 static bool UseQuarantine = false;
+static bool UseBackgroundRelease = false;
+static bool UseSizeHistogram = false;
+static bool UseDeferredHeaderChecks = false;
 extern "C" const char *__scudo_default_options() {
+  if (UseDeferredHeaderChecks)
+    return "deferred_header_checks=true";
+  if (UseBackgroundRelease)
+    return "release_to_os_background=true:release_to_os_interval_ms=0";
+  if (UseSizeHistogram)
+    return "track_allocation_sizes=true";
   if (!UseQuarantine)
     return "";
   return "quarantine_size_kb=256:thread_local_quarantine_size_kb=128:"
@@ -208,8 +218,17 @@ template <class Config> static void testAllocatorThreaded() {
   Allocator->releaseToOS();
 }
 
+struct SharedCachesConfig : scudo::DefaultConfig {
+  template <class A> using TSDRegistryT = scudo::TSDRegistrySharedT<A, 64U>;
+};
+
+struct PerCPUCachesConfig : scudo::DefaultConfig {
+  template <class A> using TSDRegistryT = scudo::TSDRegistryPerCPUT<A, 64U>;
+};
+
 TEST(ScudoCombinedTest, ThreadedCombined) {
   testAllocatorThreaded<scudo::DefaultConfig>();
+  testAllocatorThreaded<PerCPUCachesConfig>();
 #if SCUDO_WORDSIZE == 64U
   testAllocatorThreaded<scudo::FuchsiaConfig>();
 #endif
@@ -219,6 +238,251 @@ TEST(ScudoCombinedTest, ThreadedCombined) {
   testAllocatorThreaded<scudo::AndroidSvelteConfig>();
 }
 
+// A distinct config, so that the allocator gets its own thread local state.
+struct BackgroundReleaseConfig : scudo::DefaultConfig {};
+
+TEST(ScudoCombinedTest, BackgroundRelease) {
+  using AllocatorT = scudo::Allocator<BackgroundReleaseConfig>;
+  auto Deleter = [](AllocatorT *A) {
+    A->unmapTestOnly();
+    delete A;
+  };
+  UseBackgroundRelease = true;
+  std::unique_ptr<AllocatorT, decltype(Deleter)> Allocator(new AllocatorT,
+                                                           Deleter);
+  Allocator->reset();
+
+  std::vector<void *> V;
+  for (scudo::uptr I = 0; I < 1024U; I++)
+    V.push_back(Allocator->allocate(1U << 12, Origin));
+  for (void *P : V)
+    Allocator->deallocate(P, Origin);
+  // Deallocations don't start the releaser thread.
+  std::vector<char> Buffer(4096U);
+  Allocator->getStats(Buffer.data(), Buffer.size());
+  EXPECT_EQ(std::string(Buffer.data()).find("Stats: Releaser: "),
+            std::string::npos);
+
+  Allocator->startBackgroundRelease();
+  for (scudo::uptr I = 0; I < 1024U; I++)
+    V[I] = Allocator->allocate(1U << 12, Origin);
+  for (void *P : V)
+    Allocator->deallocate(P, Origin);
+
+  std::string Stats;
+  for (scudo::uptr I = 0; I < 50U; I++) {
+    Allocator->getStats(Buffer.data(), Buffer.size());
+    Stats = Buffer.data();
+    if (Stats.find("Releaser: 0 passes") == std::string::npos)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  EXPECT_NE(Stats.find("Stats: Releaser: "), std::string::npos);
+  EXPECT_EQ(Stats.find("Releaser: 0 passes"), std::string::npos);
+  UseBackgroundRelease = false;
+}
+
+struct SizeHistogramConfig : scudo::DefaultConfig {};
+
+TEST(ScudoCombinedTest, SizeHistogram) {
+  using AllocatorT = scudo::Allocator<SizeHistogramConfig>;
+  auto Deleter = [](AllocatorT *A) {
+    A->unmapTestOnly();
+    delete A;
+  };
+  UseSizeHistogram = true;
+  std::unique_ptr<AllocatorT, decltype(Deleter)> Allocator(new AllocatorT,
+                                                           Deleter);
+  Allocator->reset();
+  for (scudo::uptr I = 0; I < 3U; I++)
+    Allocator->deallocate(Allocator->allocate(88U, Origin), Origin);
+  Allocator->deallocate(Allocator->allocate(152U, Origin), Origin);
+  UseSizeHistogram = false;
+
+  std::vector<char> Buffer(4096U);
+  Allocator->getStats(Buffer.data(), Buffer.size());
+  const std::string Stats(Buffer.data());
+  const scudo::uptr HeaderSize = scudo::Chunk::getHeaderSize();
+  char Expected[64];
+  snprintf(Expected, sizeof(Expected), "Stats: SizeHistogram: %zu:3 %zu:1\n",
+           scudo::roundUpTo(88U, 1U << SCUDO_MIN_ALIGNMENT_LOG) + HeaderSize,
+           scudo::roundUpTo(152U, 1U << SCUDO_MIN_ALIGNMENT_LOG) + HeaderSize);
+  EXPECT_NE(Stats.find(Expected), std::string::npos);
+}
+
+// Many more threads than CPUs doing malloc/free of small chunks, to compare
+// the TSD registries. Run with --gtest_also_run_disabled_tests.
+template <class Config> static void benchmarkMallocFree(const char *Name) {
+  using AllocatorT = scudo::Allocator<Config>;
+  auto Deleter = [](AllocatorT *A) {
+    A->unmapTestOnly();
+    delete A;
+  };
+  std::unique_ptr<AllocatorT, decltype(Deleter)> Allocator(new AllocatorT,
+                                                           Deleter);
+  Allocator->reset();
+  const scudo::uptr NumThreads =
+      8U * scudo::Max(1U, std::thread::hardware_concurrency());
+  constexpr scudo::uptr NumIterations = 1U << 16;
+  std::vector<std::thread> Threads;
+  const auto Start = std::chrono::steady_clock::now();
+  for (scudo::uptr I = 0; I < NumThreads; I++)
+    Threads.push_back(std::thread([&Allocator, I]() {
+      void *Ring[16] = {};
+      scudo::u32 State = static_cast<scudo::u32>(I) + 1U;
+      for (scudo::uptr J = 0; J < NumIterations; J++) {
+        void *&P = Ring[J % ARRAY_SIZE(Ring)];
+        if (P)
+          Allocator->deallocate(P, Origin);
+        State = State * 1103515245U + 12345U;
+        P = Allocator->allocate(16U + (State >> 16) % 512U, Origin);
+      }
+      for (void *P : Ring)
+        Allocator->deallocate(P, Origin);
+    }));
+  for (auto &T : Threads)
+    T.join();
+  const double Elapsed = std::chrono::duration<double, std::nano>(
+                             std::chrono::steady_clock::now() - Start)
+                             .count();
+  printf("%s: %zu threads, %.1f ns per malloc/free, TSD is %zu bytes\n", Name,
+         NumThreads, Elapsed / (NumThreads * NumIterations),
+         sizeof(scudo::TSD<AllocatorT>));
+}
+
+TEST(ScudoCombinedTest, DISABLED_BenchmarkTSDRegistries) {
+  benchmarkMallocFree<scudo::DefaultConfig>("Exclusive");
+  benchmarkMallocFree<SharedCachesConfig>("Shared");
+  benchmarkMallocFree<PerCPUCachesConfig>("PerCPU");
+}
+
+struct DeferredChecksConfig : scudo::DefaultConfig {};
+
+TEST(ScudoCombinedTest, DeferredHeaderChecks) {
+  using AllocatorT = scudo::Allocator<DeferredChecksConfig>;
+  auto Deleter = [](AllocatorT *A) {
+    A->unmapTestOnly();
+    delete A;
+  };
+  UseDeferredHeaderChecks = true;
+  std::unique_ptr<AllocatorT, decltype(Deleter)> Allocator(new AllocatorT,
+                                                           Deleter);
+  Allocator->reset();
+
+  const scudo::uptr Size = 64U;
+  // Frees enough chunks for the ones freed previously to be verified.
+  auto FreeChunks = [&Allocator, Size]() {
+    void *Chunks[32];
+    for (void *&Q : Chunks)
+      Q = Allocator->allocate(Size, Origin);
+    for (void *Q : Chunks)
+      Allocator->deallocate(Q, Origin);
+  };
+  void *P = Allocator->allocate(Size, Origin);
+  EXPECT_NE(P, nullptr);
+  UseDeferredHeaderChecks = false;
+  // Corrupt the size of the chunk: the free goes through, but its block isn't
+  // reused before the header is verified.
+  scudo::u64 *H =
+      reinterpret_cast<scudo::u64 *>(scudo::Chunk::getAtomicHeader(P));
+  *H ^= 1ULL << 12;
+  Allocator->deallocate(P, Origin);
+  EXPECT_DEATH(FreeChunks(), "corrupted chunk header");
+  // Once repaired, the header is verified and the block reused.
+  *H ^= 1ULL << 12;
+  FreeChunks();
+  std::vector<void *> V;
+  for (scudo::uptr I = 0; I < 64U; I++)
+    V.push_back(Allocator->allocate(Size, Origin));
+  EXPECT_NE(std::find(V.begin(), V.end(), P), V.end());
+  for (void *Q : V)
+    if (Q != P)
+      Allocator->deallocate(Q, Origin);
+
+  // A forged offset doesn't get the block of another chunk reused.
+  void *Q = Allocator->allocate(Size, Origin);
+  void *R = Allocator->allocate(Size, Origin);
+  if (Q < R)
+    std::swap(Q, R);
+  scudo::u64 *QH =
+      reinterpret_cast<scudo::u64 *>(scudo::Chunk::getAtomicHeader(Q));
+  const scudo::u64 OffsetMask = 0xffffULL << 32;
+  const scudo::u64 Offset = *QH & OffsetMask;
+  *QH = (*QH & ~OffsetMask) |
+        (static_cast<scudo::u64>(reinterpret_cast<scudo::uptr>(Q) -
+                                 reinterpret_cast<scudo::uptr>(R)) >>
+         SCUDO_MIN_ALIGNMENT_LOG)
+            << 32;
+  Allocator->deallocate(Q, Origin);
+  EXPECT_DEATH(FreeChunks(), "corrupted chunk header");
+  *QH = (*QH & ~OffsetMask) | Offset;
+  Allocator->deallocate(R, Origin);
+
+  // Errors are still reported, after verifying the header.
+  EXPECT_DEATH(Allocator->deallocate(P, Origin, Size + 8U), "");
+  *H ^= 1ULL << 12;
+  EXPECT_DEATH(Allocator->deallocate(P, Origin, Size + 8U),
+               "corrupted chunk header");
+  *H ^= 1ULL << 12;
+  Allocator->deallocate(P, Origin);
+  EXPECT_DEATH(Allocator->deallocate(P, Origin), "invalid chunk state");
+
+  // The chunks freed by a thread are verified when its cache is destroyed.
+  EXPECT_DEATH(std::thread([&Allocator, Size]() {
+                 void *Q = Allocator->allocate(Size, Origin);
+                 *reinterpret_cast<scudo::u64 *>(
+                     scudo::Chunk::getAtomicHeader(Q)) ^= 1ULL << 12;
+                 Allocator->deallocate(Q, Origin);
+               }).join(),
+               "corrupted chunk header");
+  std::thread([&Allocator, Size]() {
+    void *Q = Allocator->allocate(Size, Origin);
+    Allocator->deallocate(Q, Origin);
+  }).join();
+}
+
+struct ImmediateChecksBenchmarkConfig : scudo::DefaultConfig {};
+struct DeferredChecksBenchmarkConfig : scudo::DefaultConfig {};
+
+// Single thread malloc/free of small chunks, with and without the deferred
+// header checks. Run with --gtest_also_run_disabled_tests.
+template <class Config>
+static void benchmarkHeaderChecks(const char *Name, bool Deferred) {
+  using AllocatorT = scudo::Allocator<Config>;
+  auto Deleter = [](AllocatorT *A) {
+    A->unmapTestOnly();
+    delete A;
+  };
+  UseDeferredHeaderChecks = Deferred;
+  std::unique_ptr<AllocatorT, decltype(Deleter)> Allocator(new AllocatorT,
+                                                           Deleter);
+  Allocator->reset();
+  Allocator->deallocate(Allocator->allocate(1U, Origin), Origin);
+  UseDeferredHeaderChecks = false;
+  constexpr scudo::uptr NumIterations = 1U << 22;
+  void *Ring[64] = {};
+  scudo::u32 State = 1U;
+  const auto Start = std::chrono::steady_clock::now();
+  for (scudo::uptr I = 0; I < NumIterations; I++) {
+    void *&P = Ring[I % ARRAY_SIZE(Ring)];
+    if (P)
+      Allocator->deallocate(P, Origin);
+    State = State * 1103515245U + 12345U;
+    P = Allocator->allocate(16U + (State >> 16) % 256U, Origin);
+  }
+  const double Elapsed = std::chrono::duration<double, std::nano>(
+                             std::chrono::steady_clock::now() - Start)
+                             .count();
+  for (void *P : Ring)
+    Allocator->deallocate(P, Origin);
+  printf("%s: %.1f ns per malloc/free\n", Name, Elapsed / NumIterations);
+}
+
+TEST(ScudoCombinedTest, DISABLED_BenchmarkDeferredHeaderChecks) {
+  benchmarkHeaderChecks<ImmediateChecksBenchmarkConfig>("Immediate", false);
+  benchmarkHeaderChecks<DeferredChecksBenchmarkConfig>("Deferred", true);
+}
+
 struct DeathConfig {
   // Tiny allocator, its Primary only serves chunks of 1024 bytes.
   using DeathSizeClassMap = scudo::SizeClassMap<1U, 10U, 10U, 10U, 1U, 10U>;
@@ -12,6 +12,7 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -55,6 +56,10 @@ TEST(ScudoPrimaryTest, BasicPrimary) {
   using SizeClassMap = scudo::DefaultSizeClassMap;
   testPrimary<scudo::SizeClassAllocator32<SizeClassMap, 18U>>();
   testPrimary<scudo::SizeClassAllocator64<SizeClassMap, 24U>>();
+  using TableSizeClassMap =
+      scudo::TableSizeClassMap<8, 10, 4, 8, 3, 32, 64, 112, 176, 256, 512,
+                               4096, 1 << 16>;
+  testPrimary<scudo::SizeClassAllocator64<TableSizeClassMap, 24U>>();
 }
 
 // The 64-bit SizeClassAllocator can be easily OOM'd with small region sizes.
@@ -95,6 +100,36 @@ TEST(ScudoPrimaryTest, Primary64OOM) {
   Allocator.unmapTestOnly();
 }
 
+// A fresh 64-bit Primary refills the cache with a span of contiguous blocks,
+// several batches worth, which the cache shuffles all together.
+TEST(ScudoPrimaryTest, Primary64SpanRefill) {
+  using Primary = scudo::SizeClassAllocator64<scudo::DefaultSizeClassMap, 24U>;
+  using CacheT = Primary::CacheT;
+  using TransferBatch = CacheT::TransferBatch;
+  Primary Allocator;
+  Allocator.init(/*ReleaseToOsInterval=*/-1);
+  CacheT Cache;
+  Cache.init(nullptr, &Allocator);
+  const scudo::uptr ClassId = 1U;
+  const scudo::uptr Size = Primary::getSizeByClassId(ClassId);
+  const scudo::u32 Count = TransferBatch::getMaxCached(Size);
+  const scudo::u32 SpanCount = CacheT::BlockSpan::MaxBatches * Count;
+  std::vector<scudo::uptr> V;
+  for (scudo::u32 I = 0; I < SpanCount; I++)
+    V.push_back(reinterpret_cast<scudo::uptr>(Cache.allocate(ClassId)));
+  // The first batch is drawn from the whole span.
+  const scudo::uptr Beg = *std::min_element(V.begin(), V.end());
+  EXPECT_GE(*std::max_element(V.begin(), V.begin() + Count) - Beg,
+            Count * Size);
+  std::sort(V.begin(), V.end());
+  for (scudo::u32 I = 1; I < SpanCount; I++)
+    EXPECT_EQ(V[I] - V[I - 1], Size);
+  for (scudo::uptr P : V)
+    Cache.deallocate(ClassId, reinterpret_cast<void *>(P));
+  Cache.destroy(nullptr);
+  Allocator.unmapTestOnly();
+}
+
 template <typename Primary> static void testIteratePrimary() {
   auto Deleter = [](Primary *P) {
     P->unmapTestOnly();
@@ -224,3 +259,54 @@ TEST(ScudoPrimaryTest, ReleaseToOS) {
   testReleaseToOS<scudo::SizeClassAllocator32<SizeClassMap, 18U>>();
   testReleaseToOS<scudo::SizeClassAllocator64<SizeClassMap, 24U>>();
 }
+
+// Pages are released with the size class mutex dropped. Blocks allocated in
+// the meantime must not lose their contents.
+template <typename Primary> static void testReleaseToOSThreaded() {
+  auto Deleter = [](Primary *P) {
+    P->unmapTestOnly();
+    delete P;
+  };
+  std::unique_ptr<Primary, decltype(Deleter)> Allocator(new Primary, Deleter);
+  Allocator->init(/*ReleaseToOsInterval=*/-1);
+  const scudo::uptr Size = scudo::getPageSizeCached() / 2;
+  const scudo::uptr ClassId = Primary::SizeClassMap::getClassIdBySize(Size);
+  std::atomic<bool> Done(false);
+  std::thread Releaser([&]() {
+    while (!Done)
+      Allocator->releaseToOS();
+  });
+  std::thread Threads[4];
+  for (scudo::uptr T = 0; T < 4U; T++) {
+    Threads[T] = std::thread([&, T]() {
+      typename Primary::CacheT Cache;
+      Cache.init(nullptr, Allocator.get());
+      for (scudo::uptr Round = 0; Round < 64U; Round++) {
+        std::vector<void *> V;
+        for (scudo::uptr I = 0; I < 256U; I++) {
+          void *P = Cache.allocate(ClassId);
+          ASSERT_NE(P, nullptr);
+          memset(P, static_cast<int>(T + 1), Size);
+          V.push_back(P);
+        }
+        for (void *P : V) {
+          EXPECT_EQ(reinterpret_cast<char *>(P)[Size - 1],
+                    static_cast<char>(T + 1));
+          Cache.deallocate(ClassId, P);
+        }
+        Cache.drain();
+      }
+      Cache.destroy(nullptr);
+    });
+  }
+  for (auto &T : Threads)
+    T.join();
+  Done = true;
+  Releaser.join();
+}
+
+TEST(ScudoPrimaryTest, ReleaseToOSThreaded) {
+  using SizeClassMap = scudo::DefaultSizeClassMap;
+  testReleaseToOSThreaded<scudo::SizeClassAllocator32<SizeClassMap, 18U>>();
+  testReleaseToOSThreaded<scudo::SizeClassAllocator64<SizeClassMap, 24U>>();
+}
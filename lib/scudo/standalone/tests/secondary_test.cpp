@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -106,6 +107,114 @@ TEST(ScudoSecondaryTest, SecondaryIterate) {
   Str.output();
 }
 
+TEST(ScudoSecondaryTest, SecondaryCache) {
+  const scudo::uptr PageSize = scudo::getPageSizeCached();
+  const scudo::uptr Size = 1U << 18;
+  scudo::MapAllocator *L = new scudo::MapAllocator;
+  L->init(nullptr, /*ReleaseToOsInterval=*/-1, /*CacheMaxEntries=*/4U,
+          /*CacheMaxTotalSize=*/8 * Size);
+
+  // A freed block is reused for a similar size, and zero'd if requested.
+  void *P = L->allocate(Size);
+  EXPECT_NE(P, nullptr);
+  memset(P, 'A', Size);
+  L->deallocate(P);
+  void *Q = L->allocate(Size - PageSize, 0, nullptr, /*ZeroContents=*/true);
+  EXPECT_EQ(P, Q);
+  for (scudo::uptr I = 0; I < Size - PageSize; I++)
+    ASSERT_EQ(reinterpret_cast<char *>(Q)[I], 0);
+  L->deallocate(Q);
+
+  // But not for a much smaller or a larger one.
+  Q = L->allocate(Size / 2);
+  EXPECT_NE(P, Q);
+  void *R = L->allocate(Size * 2);
+  EXPECT_NE(P, R);
+  L->deallocate(Q);
+  L->deallocate(R);
+
+  // The cache is bounded both in number of entries and in total size.
+  std::vector<void *> V;
+  for (scudo::uptr I = 0; I < 8U; I++)
+    V.push_back(L->allocate(Size));
+  for (void *Ptr : V)
+    L->deallocate(Ptr);
+  scudo::ScopedString Str(1024);
+  L->getStats(&Str);
+  EXPECT_NE(strstr(Str.data(), "cache: 4/4 blocks"), nullptr);
+  V.clear();
+  for (scudo::uptr I = 0; I < 2U; I++)
+    V.push_back(L->allocate(Size * 3));
+  for (void *Ptr : V)
+    L->deallocate(Ptr);
+  Str.clear();
+  L->getStats(&Str);
+  EXPECT_EQ(strstr(Str.data(), "cache: 4/4 blocks"), nullptr);
+
+  // Once released, the cached blocks are unmapped.
+  L->releaseToOS();
+  Str.clear();
+  L->getStats(&Str);
+  EXPECT_NE(strstr(Str.data(), "cache: 0/4 blocks"), nullptr);
+  P = L->allocate(Size);
+  L->deallocate(P);
+  L->releaseToOS();
+  EXPECT_DEATH(memset(P, 'A', Size), "");
+
+  // Blocks are unmapped after the release interval.
+  L->init(nullptr, /*ReleaseToOsInterval=*/0, 4U, 8 * Size);
+  P = L->allocate(Size);
+  Q = L->allocate(Size);
+  L->deallocate(P);
+  L->deallocate(Q);
+  EXPECT_DEATH(memset(P, 'A', Size), "");
+
+  // Expired blocks are also unmapped without another deallocation.
+  L->init(nullptr, /*ReleaseToOsInterval=*/100, 4U, 8 * Size);
+  P = L->allocate(Size);
+  L->deallocate(P);
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  EXPECT_GE(L->releaseExpiredToOS(), Size);
+  EXPECT_EQ(L->releaseExpiredToOS(), 0U);
+  Str.clear();
+  L->getStats(&Str);
+  EXPECT_NE(strstr(Str.data(), "cache: 0/4 blocks"), nullptr);
+  Str.output();
+}
+
+// Allocates and frees large blocks of random sizes in the 256K-4M range,
+// with and without the cache. Run with --gtest_also_run_disabled_tests.
+TEST(ScudoSecondaryTest, DISABLED_BenchmarkSecondaryChurn) {
+  for (scudo::u32 Entries : {0U, 32U}) {
+    scudo::MapAllocator *L = new scudo::MapAllocator;
+    L->init(nullptr, /*ReleaseToOsInterval=*/5000, Entries, 64U << 20);
+    std::srand(42);
+    std::vector<void *> V(8U, nullptr);
+    const auto Start = std::chrono::steady_clock::now();
+    for (scudo::uptr I = 0; I < 20000U; I++) {
+      void *&P = V[static_cast<scudo::uptr>(std::rand()) % V.size()];
+      if (P)
+        L->deallocate(P);
+      const scudo::uptr Size = (1U << 18) + (std::rand() % (15U << 18));
+      P = L->allocate(Size);
+      // Touch a few pages, as a user would.
+      for (scudo::uptr J = 0; J < Size; J += Size / 8)
+        reinterpret_cast<char *>(P)[J] = 'A';
+    }
+    const auto Elapsed = std::chrono::steady_clock::now() - Start;
+    for (void *P : V)
+      L->deallocate(P);
+    printf("%u cache entries: %lldms\n", Entries,
+           static_cast<long long>(
+               std::chrono::duration_cast<std::chrono::milliseconds>(Elapsed)
+                   .count()));
+    scudo::ScopedString Str(1024);
+    L->getStats(&Str);
+    Str.output();
+    L->releaseToOS();
+  }
+}
+
 static std::mutex Mutex;
 static std::condition_variable Cv;
 static bool Ready = false;
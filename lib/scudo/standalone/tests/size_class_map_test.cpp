@@ -36,3 +36,22 @@ TEST(ScudoSizeClassMapTest, LargeMaxSizeClassMap) {
   testSizeClassMap<scudo::SizeClassMap<3, 4, 8, 63, 128, 16>>();
 }
 #endif
+
+// Fits allocations of 48, 88 and 152 bytes (plus header), and is more
+// geometric afterwards.
+typedef scudo::TableSizeClassMap<8, 10, 4, 8, 3, 32, 64, 112, 176, 256, 320,
+                                 384, 512, 768, 1024, 2048, 4096, 1 << 14,
+                                 1 << 17>
+    TestTableSizeClassMap;
+
+TEST(ScudoSizeClassMapTest, TableSizeClassMap) {
+  testSizeClassMap<TestTableSizeClassMap>();
+  EXPECT_EQ(TestTableSizeClassMap::getClassIdBySize(48 + 16), 2U);
+  EXPECT_EQ(TestTableSizeClassMap::getClassIdBySize(88 + 16), 3U);
+  EXPECT_EQ(TestTableSizeClassMap::getClassIdBySize(152 + 16), 4U);
+  EXPECT_EQ(TestTableSizeClassMap::getClassIdBySize(100000U), 14U);
+}
+
+TEST(ScudoSizeClassMapTest, OneClassTableSizeClassMap) {
+  testSizeClassMap<scudo::TableSizeClassMap<1, 5, 5, 5, 1, 32>>();
+}
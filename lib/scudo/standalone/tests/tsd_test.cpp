@@ -7,6 +7,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "tsd_exclusive.h"
+#include "tsd_percpu.h"
 #include "tsd_shared.h"
 
 #include "gtest/gtest.h"
@@ -54,6 +55,11 @@ struct SharedCaches {
   using TSDRegistryT = scudo::TSDRegistrySharedT<Allocator, 16U>;
 };
 
+struct PerCPUCaches {
+  template <class Allocator>
+  using TSDRegistryT = scudo::TSDRegistryPerCPUT<Allocator, 16U>;
+};
+
 struct ExclusiveCaches {
   template <class Allocator>
   using TSDRegistryT = scudo::TSDRegistryExT<Allocator>;
@@ -105,9 +111,29 @@ template <class AllocatorT> static void testRegistry() {
     TSD->unlock();
 }
 
+TEST(ScudoTSDTest, CurrentCPU) {
+  const volatile scudo::u32 *CPUIdPtr = scudo::getCurrentCPUIdPtr();
+  if (!CPUIdPtr)
+    return;
+  // The thread could be migrated in between the two reads, retry a few times.
+  bool Match = false;
+  for (scudo::uptr I = 0; I < 100U && !Match; I++)
+    Match = *CPUIdPtr == scudo::getCurrentCPU();
+  EXPECT_TRUE(Match);
+  // A second call from the same thread must return the same area.
+  EXPECT_EQ(CPUIdPtr, scudo::getCurrentCPUIdPtr());
+}
+
+TEST(ScudoTSDTest, NumberOfPossibleCPUs) {
+  const scudo::u32 N = scudo::getNumberOfPossibleCPUs();
+  EXPECT_GE(N, scudo::getNumberOfCPUs());
+  EXPECT_LT(scudo::getCurrentCPU(), N);
+}
+
 TEST(ScudoTSDTest, TSDRegistryBasic) {
   testRegistry<MockAllocator<OneCache>>();
   testRegistry<MockAllocator<SharedCaches>>();
+  testRegistry<MockAllocator<PerCPUCaches>>();
   testRegistry<MockAllocator<ExclusiveCaches>>();
 }
 
@@ -164,5 +190,6 @@ template <class AllocatorT> static void testRegistryThreaded() {
 TEST(ScudoTSDTest, TSDRegistryThreaded) {
   testRegistryThreaded<MockAllocator<OneCache>>();
   testRegistryThreaded<MockAllocator<SharedCaches>>();
+  testRegistryThreaded<MockAllocator<PerCPUCaches>>();
   testRegistryThreaded<MockAllocator<ExclusiveCaches>>();
 }
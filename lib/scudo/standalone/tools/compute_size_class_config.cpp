@@ -0,0 +1,262 @@
+//===-- compute_size_class_config.cpp -------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Computes the list of class sizes of a TableSizeClassMap that minimizes the
+// internal fragmentation for a given allocation sizes histogram, as output in
+// the statistics of an allocator running with track_allocation_sizes=true
+// (the "Stats: SizeHistogram:" lines).
+//
+// Build & usage:
+//   c++ -std=c++14 -O2 compute_size_class_config.cpp -o compute_sc_config
+//   SCUDO_OPTIONS=track_allocation_sizes=true ./program # + malloc_stats()
+//   ./compute_sc_config -classes=40 stats.txt
+//
+// The sizes in the histogram include the chunk header and alignment, so they
+// can be used as class sizes directly. Class sizes up to 2^mid-size-log are
+// multiples of 2^min-size-log, and the ones after are limited to num-bits
+// non-zero bits, to fit the lookup tables of a TableSizeClassMap. The largest
+// class is always 2^max-size-log, so that all the Primary sizes are covered.
+//
+//===----------------------------------------------------------------------===//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace {
+
+struct Options {
+  unsigned Classes = 40;
+  unsigned MinSizeLog = 4;
+  unsigned MidSizeLog = 12;
+  unsigned NumBits = 4;
+  unsigned MaxSizeLog = 17;
+  unsigned MaxNumCached = 8;
+  unsigned MaxBytesCachedLog = 10;
+  const char *Name = "TunedSizeClassMap";
+};
+
+void printUsage(const char *Argv0) {
+  fprintf(stderr,
+          "Usage: %s [-classes=N] [-min-size-log=N] [-mid-size-log=N] "
+          "[-num-bits=N] [-max-size-log=N] [-max-num-cached=N] "
+          "[-max-bytes-cached-log=N] [-name=S] [stats file...]\n",
+          Argv0);
+}
+
+bool parseFlag(const char *Arg, const char *Name, unsigned *Value) {
+  const size_t Length = strlen(Name);
+  if (strncmp(Arg, Name, Length) != 0 || Arg[Length] != '=')
+    return false;
+  *Value = static_cast<unsigned>(strtoul(Arg + Length + 1, nullptr, 10));
+  return true;
+}
+
+unsigned log2Floor(uint64_t X) {
+  unsigned L = 0;
+  while (X >>= 1)
+    L++;
+  return L;
+}
+
+// Rounds Size up to the closest size that can be a class of the table.
+uint64_t roundUpToClassSize(const Options &O, uint64_t Size) {
+  const uint64_t MinSize = 1ULL << O.MinSizeLog;
+  if (Size <= (1ULL << O.MidSizeLog))
+    return (Size + MinSize - 1) & ~(MinSize - 1);
+  const unsigned L = log2Floor(Size - 1);
+  const uint64_t Step = 1ULL << (L - (O.NumBits - 1));
+  return (Size + Step - 1) & ~(Step - 1);
+}
+
+// The class size for Size in SizeClassMap<3, 5, 8, 17>, for comparison.
+uint64_t getDefaultClassSize(uint64_t Size) {
+  if (Size <= 256)
+    return (Size + 31) & ~31ULL;
+  const unsigned L = log2Floor(Size - 1);
+  const uint64_t Step = 1ULL << (L - 2);
+  return (Size + Step - 1) & ~(Step - 1);
+}
+
+bool readHistogram(FILE *F, const Options &O,
+                   std::map<uint64_t, uint64_t> *Histogram) {
+  const char Prefix[] = "Stats: SizeHistogram:";
+  const uint64_t MaxSize = 1ULL << O.MaxSizeLog;
+  char Line[4096];
+  while (fgets(Line, sizeof(Line), F)) {
+    const char *P = strstr(Line, Prefix);
+    if (!P)
+      continue;
+    P += sizeof(Prefix) - 1;
+    for (;;) {
+      char *End;
+      const uint64_t Size = strtoull(P, &End, 10);
+      if (End == P || *End != ':')
+        break;
+      P = End + 1;
+      const uint64_t Count = strtoull(P, &End, 10);
+      if (End == P)
+        return false;
+      P = End;
+      if (Size == 0 || Size > MaxSize) {
+        fprintf(stderr, "Ignoring size %llu larger than 2^%u\n",
+                static_cast<unsigned long long>(Size), O.MaxSizeLog);
+        continue;
+      }
+      (*Histogram)[Size] += Count;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int Argc, char **Argv) {
+  Options O;
+  std::vector<const char *> Files;
+  for (int I = 1; I < Argc; I++) {
+    const char *Arg = Argv[I];
+    if (Arg[0] != '-') {
+      Files.push_back(Arg);
+      continue;
+    }
+    if (strncmp(Arg, "-name=", 6) == 0) {
+      O.Name = Arg + 6;
+      continue;
+    }
+    if (!parseFlag(Arg, "-classes", &O.Classes) &&
+        !parseFlag(Arg, "-min-size-log", &O.MinSizeLog) &&
+        !parseFlag(Arg, "-mid-size-log", &O.MidSizeLog) &&
+        !parseFlag(Arg, "-num-bits", &O.NumBits) &&
+        !parseFlag(Arg, "-max-size-log", &O.MaxSizeLog) &&
+        !parseFlag(Arg, "-max-num-cached", &O.MaxNumCached) &&
+        !parseFlag(Arg, "-max-bytes-cached-log", &O.MaxBytesCachedLog)) {
+      printUsage(Argv[0]);
+      return 1;
+    }
+  }
+  if (O.Classes == 0 || O.Classes > 255 || O.NumBits == 0 ||
+      O.MinSizeLog > O.MidSizeLog || O.MidSizeLog > O.MaxSizeLog ||
+      O.MaxSizeLog >= 32 || O.MidSizeLog < O.NumBits - 1) {
+    fprintf(stderr, "Invalid options\n");
+    return 1;
+  }
+
+  std::map<uint64_t, uint64_t> Histogram;
+  if (Files.empty()) {
+    if (!readHistogram(stdin, O, &Histogram)) {
+      fprintf(stderr, "Malformed histogram\n");
+      return 1;
+    }
+  }
+  for (const char *Path : Files) {
+    FILE *F = fopen(Path, "r");
+    if (!F) {
+      fprintf(stderr, "Failed to open %s\n", Path);
+      return 1;
+    }
+    const bool Ok = readHistogram(F, O, &Histogram);
+    fclose(F);
+    if (!Ok) {
+      fprintf(stderr, "Malformed histogram in %s\n", Path);
+      return 1;
+    }
+  }
+  if (Histogram.empty()) {
+    fprintf(stderr, "No \"Stats: SizeHistogram:\" entries found\n");
+    return 1;
+  }
+
+  // Group the sizes by the smallest class size that can hold them: those are
+  // the candidate class sizes, and the largest class has to be included.
+  const uint64_t MaxSize = 1ULL << O.MaxSizeLog;
+  std::vector<uint64_t> Candidates;
+  std::vector<uint64_t> Counts, Sums; // Per candidate, then prefix sums.
+  for (const auto &Entry : Histogram) {
+    const uint64_t ClassSize = roundUpToClassSize(O, Entry.first);
+    if (Candidates.empty() || Candidates.back() != ClassSize) {
+      Candidates.push_back(ClassSize);
+      Counts.push_back(0);
+      Sums.push_back(0);
+    }
+    Counts.back() += Entry.second;
+    Sums.back() += Entry.first * Entry.second;
+  }
+  if (Candidates.back() != MaxSize) {
+    Candidates.push_back(MaxSize);
+    Counts.push_back(0);
+    Sums.push_back(0);
+  }
+  const size_t N = Candidates.size();
+  std::vector<uint64_t> CountPrefix(N + 1, 0), SumPrefix(N + 1, 0);
+  for (size_t I = 0; I < N; I++) {
+    CountPrefix[I + 1] = CountPrefix[I] + Counts[I];
+    SumPrefix[I + 1] = SumPrefix[I] + Sums[I];
+  }
+  // The waste of serving the candidates (I, J] with the class Candidates[J-1].
+  auto Waste = [&](size_t I, size_t J) {
+    return Candidates[J - 1] * (CountPrefix[J] - CountPrefix[I]) -
+           (SumPrefix[J] - SumPrefix[I]);
+  };
+
+  // Best[K][J] is the minimal waste for the candidates [0, J) with K classes,
+  // the largest one being Candidates[J - 1].
+  const size_t K = std::min<size_t>(O.Classes, N);
+  const uint64_t Infinity = ~0ULL;
+  std::vector<std::vector<uint64_t>> Best(
+      K + 1, std::vector<uint64_t>(N + 1, Infinity));
+  std::vector<std::vector<size_t>> Previous(K + 1,
+                                            std::vector<size_t>(N + 1, 0));
+  Best[0][0] = 0;
+  for (size_t C = 1; C <= K; C++) {
+    for (size_t J = C; J <= N; J++) {
+      for (size_t I = C - 1; I < J; I++) {
+        if (Best[C - 1][I] == Infinity)
+          continue;
+        const uint64_t W = Best[C - 1][I] + Waste(I, J);
+        if (W < Best[C][J]) {
+          Best[C][J] = W;
+          Previous[C][J] = I;
+        }
+      }
+    }
+  }
+  std::vector<uint64_t> Classes;
+  for (size_t C = K, J = N; C > 0; J = Previous[C][J], C--)
+    Classes.push_back(Candidates[J - 1]);
+  std::reverse(Classes.begin(), Classes.end());
+
+  uint64_t Total = 0, TotalBytes = 0, DefaultWaste = 0;
+  for (const auto &Entry : Histogram) {
+    Total += Entry.second;
+    TotalBytes += Entry.first * Entry.second;
+    DefaultWaste +=
+        (getDefaultClassSize(Entry.first) - Entry.first) * Entry.second;
+  }
+  const uint64_t TableWaste = Best[K][N];
+  printf("// Computed from %llu allocations: %.2f%% of the bytes wasted to "
+         "internal\n"
+         "// fragmentation, versus %.2f%% with DefaultSizeClassMap.\n",
+         static_cast<unsigned long long>(Total),
+         100.0 * static_cast<double>(TableWaste) /
+             static_cast<double>(TotalBytes + TableWaste),
+         100.0 * static_cast<double>(DefaultWaste) /
+             static_cast<double>(TotalBytes + DefaultWaste));
+  printf("typedef TableSizeClassMap<%u, %u, %u, %u, %u", O.MaxNumCached,
+         O.MaxBytesCachedLog, O.MinSizeLog, O.MidSizeLog, O.NumBits);
+  for (size_t I = 0; I < Classes.size(); I++)
+    printf(",%s%llu", I % 8 == 0 ? "\n                          " : " ",
+           static_cast<unsigned long long>(Classes[I]));
+  printf(">\n    %s;\n", O.Name);
+  return 0;
+}
@@ -25,10 +25,15 @@ namespace scudo {
 template <class Allocator> struct ALIGNED(SCUDO_CACHE_LINE_SIZE) TSD {
   typename Allocator::CacheT Cache;
   typename Allocator::QuarantineCacheT QuarantineCache;
+  // With deferred_header_checks, the chunks freed without verifying their
+  // header. Their blocks only go to the Cache once the headers are verified.
+  void *UnverifiedChunks[16];
+  u32 NumUnverifiedChunks;
   u8 DestructorIterations;
 
   void initLinkerInitialized(Allocator *Instance) {
     Instance->initCache(&Cache);
+    NumUnverifiedChunks = 0;
     DestructorIterations = PTHREAD_DESTRUCTOR_ITERATIONS;
   }
   void init(Allocator *Instance) {
@@ -0,0 +1,145 @@
+//===-- tsd_percpu.h --------------------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SCUDO_TSD_PERCPU_H_
+#define SCUDO_TSD_PERCPU_H_
+
+#include "linux.h" // for getAndroidTlsPtr()
+#include "tsd.h"
+
+#include <pthread.h>
+
+namespace scudo {
+
+// A registry with one TSD per CPU, up to MaxTSDCount. Contrary to the shared
+// registry, a thread is not bound to a TSD: it uses the TSD of the CPU it is
+// running on, which on Linux is read from the area maintained by the kernel
+// for restartable sequences, without a system call. The memory used doesn't
+// grow with the number of threads, and collisions only happen when a thread
+// gets preempted or migrated while holding a TSD, in which case we try-lock
+// the TSDs of the neighboring CPUs.
+template <class Allocator, u32 MaxTSDCount> struct TSDRegistryPerCPUT {
+  void initLinkerInitialized(Allocator *Instance) {
+    Instance->initLinkerInitialized();
+    CHECK_EQ(pthread_key_create(&PThreadKey, nullptr), 0); // For non-TLS
+    // The TSDs are indexed by CPU id, so that the CPUs of a sparse affinity
+    // mask don't share them.
+    NumberOfTSDs = Min(Max(1U, getNumberOfPossibleCPUs()), MaxTSDCount);
+    TSDs = reinterpret_cast<TSD<Allocator> *>(
+        map(nullptr, sizeof(TSD<Allocator>) * NumberOfTSDs, "scudo:tsd"));
+    for (u32 I = 0; I < NumberOfTSDs; I++)
+      TSDs[I].initLinkerInitialized(Instance);
+    Initialized = true;
+  }
+  void init(Allocator *Instance) {
+    memset(this, 0, sizeof(*this));
+    initLinkerInitialized(Instance);
+  }
+
+  void unmapTestOnly() {
+    unmap(reinterpret_cast<void *>(TSDs),
+          sizeof(TSD<Allocator>) * NumberOfTSDs);
+  }
+
+  ALWAYS_INLINE void initThreadMaybe(Allocator *Instance,
+                                     UNUSED bool MinimalInit) {
+    if (LIKELY(getCPUIdPtr()))
+      return;
+    initThread(Instance);
+  }
+
+  ALWAYS_INLINE TSD<Allocator> *getTSDAndLock(bool *UnlockRequired) {
+    const volatile u32 *CPUIdPtr = getCPUIdPtr();
+    DCHECK(CPUIdPtr);
+    u32 CPU = *CPUIdPtr;
+    if (UNLIKELY(CPU == NoCPUId))
+      CPU = getCurrentCPU();
+    const u32 Index = CPU % NumberOfTSDs;
+    *UnlockRequired = true;
+    if (LIKELY(TSDs[Index].tryLock()))
+      return &TSDs[Index];
+    return getTSDAndLockSlow(Index);
+  }
+
+private:
+  // Used as the CPU id word of threads for which the platform doesn't provide
+  // one, in which case we go through getCurrentCPU().
+  static constexpr u32 NoCPUId = ~0U;
+  static const volatile u32 NoCPUIdWord;
+
+  ALWAYS_INLINE void setCPUIdPtr(const volatile u32 *CPUIdPtr) {
+#if SCUDO_ANDROID
+    *getAndroidTlsPtr() = reinterpret_cast<uptr>(CPUIdPtr);
+#elif SCUDO_LINUX
+    ThreadCPUIdPtr = CPUIdPtr;
+#else
+    CHECK_EQ(pthread_setspecific(PThreadKey, const_cast<u32 *>(CPUIdPtr)), 0);
+#endif
+  }
+
+  ALWAYS_INLINE const volatile u32 *getCPUIdPtr() {
+#if SCUDO_ANDROID
+    return reinterpret_cast<const volatile u32 *>(*getAndroidTlsPtr());
+#elif SCUDO_LINUX
+    return ThreadCPUIdPtr;
+#else
+    return reinterpret_cast<const volatile u32 *>(
+        pthread_getspecific(PThreadKey));
+#endif
+  }
+
+  void initOnceMaybe(Allocator *Instance) {
+    ScopedLock L(Mutex);
+    if (LIKELY(Initialized))
+      return;
+    initLinkerInitialized(Instance); // Sets Initialized.
+  }
+
+  NOINLINE void initThread(Allocator *Instance) {
+    initOnceMaybe(Instance);
+    const volatile u32 *CPUIdPtr = getCurrentCPUIdPtr();
+    setCPUIdPtr(CPUIdPtr ? CPUIdPtr : &NoCPUIdWord);
+  }
+
+  NOINLINE TSD<Allocator> *getTSDAndLockSlow(u32 Index) {
+    // The TSD of our CPU is most likely held by a thread that was preempted
+    // or migrated. Try the following ones before waiting on ours.
+    u32 Candidate = Index;
+    for (u32 I = 1; I < Min(4U, NumberOfTSDs); I++) {
+      if (++Candidate == NumberOfTSDs)
+        Candidate = 0;
+      if (TSDs[Candidate].tryLock())
+        return &TSDs[Candidate];
+    }
+    TSDs[Index].lock();
+    return &TSDs[Index];
+  }
+
+  pthread_key_t PThreadKey;
+  u32 NumberOfTSDs;
+  TSD<Allocator> *TSDs;
+  bool Initialized;
+  HybridMutex Mutex;
+#if SCUDO_LINUX && !SCUDO_ANDROID
+  static THREADLOCAL const volatile u32 *ThreadCPUIdPtr;
+#endif
+};
+
+template <class Allocator, u32 MaxTSDCount>
+const volatile u32 TSDRegistryPerCPUT<Allocator, MaxTSDCount>::NoCPUIdWord =
+    TSDRegistryPerCPUT<Allocator, MaxTSDCount>::NoCPUId;
+
+#if SCUDO_LINUX && !SCUDO_ANDROID
+template <class Allocator, u32 MaxTSDCount>
+THREADLOCAL const volatile u32
+    *TSDRegistryPerCPUT<Allocator, MaxTSDCount>::ThreadCPUIdPtr;
+#endif
+
+} // namespace scudo
+
+#endif // SCUDO_TSD_PERCPU_H_
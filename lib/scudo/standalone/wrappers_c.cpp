@@ -34,6 +34,10 @@ extern "C" {
 
 INTERFACE void __scudo_print_stats(void) { Allocator.printStats(); }
 
+INTERFACE void __scudo_start_background_release(void) {
+  Allocator.startBackgroundRelease();
+}
+
 } // extern "C"
 
 #endif // !SCUDO_ANDROID || !_BIONIC
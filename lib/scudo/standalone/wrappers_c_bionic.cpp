@@ -44,6 +44,11 @@ INTERFACE void __scudo_print_stats(void) {
   SvelteAllocator.printStats();
 }
 
+INTERFACE void __scudo_start_background_release(void) {
+  Allocator.startBackgroundRelease();
+  SvelteAllocator.startBackgroundRelease();
+}
+
 } // extern "C"
 
 #endif // SCUDO_ANDROID && _BIONIC
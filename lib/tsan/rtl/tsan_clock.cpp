@@ -13,6 +13,19 @@
 #include "tsan_rtl.h"
 #include "sanitizer_common/sanitizer_placement_new.h"
 
+#if defined(__x86_64__) && !SANITIZER_GO
+# define TSAN_CLOCK_SIMD 1
+// <immintrin.h> transitively includes <stdlib.h>,
+// and it's prohibited to include std headers into tsan runtime.
+// So we do this dirty trick (see tsan_rtl.cpp).
+# define _MM_MALLOC_H_INCLUDED
+# define __MM_MALLOC_H
+# include <cpuid.h>
+# include <immintrin.h>
+#else
+# define TSAN_CLOCK_SIMD 0
+#endif
+
 // SyncClock and ThreadClock implement vector clocks for sync variables
 // (mutexes, atomic variables, file descriptors, etc) and threads, respectively.
 // ThreadClock contains fixed-size vector clock for maximum number of threads.
@@ -104,6 +117,178 @@ static void UnrefClockBlock(ClockCache *c, u32 idx, uptr blocks) {
   ctx->clock_alloc.Free(c, idx);
 }
 
+// Kernels for the O(N) parts of acquire, release and release-store.
+// They process one continuous range of clock elements (at most one
+// ClockBlock) at a time. The vector versions rely on ClockElem layout:
+// epoch lives in the low kClkBits of the 64-bit word, so a ClockElem with
+// reused == 0 is bit-identical to its epoch, and all epochs fit into
+// a positive signed 64-bit integer.
+struct ClockKernels {
+  // dst[i] = max(dst[i], src[i].epoch), returns true if anything changed.
+  bool (*acquire)(u64 *dst, const ClockElem *src, uptr n);
+  // dst[i].epoch = max(dst[i].epoch, src[i]), dst[i].reused = 0.
+  void (*release)(ClockElem *dst, const u64 *src, uptr n);
+  // dst[i].epoch = src[i], dst[i].reused = 0.
+  void (*store)(ClockElem *dst, const u64 *src, uptr n);
+};
+
+static bool AcquireScalar(u64 *dst, const ClockElem *src, uptr n) {
+  bool acquired = false;
+  for (uptr i = 0; i < n; i++) {
+    u64 epoch = src[i].epoch;
+    if (dst[i] < epoch) {
+      dst[i] = epoch;
+      acquired = true;
+    }
+  }
+  return acquired;
+}
+
+static void ReleaseScalar(ClockElem *dst, const u64 *src, uptr n) {
+  for (uptr i = 0; i < n; i++) {
+    dst[i].epoch = max(dst[i].epoch, src[i]);
+    dst[i].reused = 0;
+  }
+}
+
+static void StoreScalar(ClockElem *dst, const u64 *src, uptr n) {
+  for (uptr i = 0; i < n; i++) {
+    dst[i].epoch = src[i];
+    dst[i].reused = 0;
+  }
+}
+
+#if TSAN_CLOCK_SIMD
+static const u64 kEpochMask = (1ull << kClkBits) - 1;
+
+__attribute__((target("sse4.2")))
+static bool AcquireSSE42(u64 *dst, const ClockElem *src, uptr n) {
+  const __m128i mask = _mm_set1_epi64x(kEpochMask);
+  __m128i acquired = _mm_setzero_si128();
+  uptr i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i s = _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i])), mask);
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&dst[i]));
+    __m128i gt = _mm_cmpgt_epi64(s, d);
+    acquired = _mm_or_si128(acquired, gt);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]),
+                     _mm_blendv_epi8(d, s, gt));
+  }
+  bool tail = AcquireScalar(dst + i, src + i, n - i);
+  return !_mm_testz_si128(acquired, acquired) || tail;
+}
+
+__attribute__((target("sse4.2")))
+static void ReleaseSSE42(ClockElem *dst, const u64 *src, uptr n) {
+  const __m128i mask = _mm_set1_epi64x(kEpochMask);
+  uptr i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i *p = reinterpret_cast<__m128i *>(&dst[i]);
+    __m128i d = _mm_and_si128(_mm_loadu_si128(p), mask);
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+    _mm_storeu_si128(p, _mm_blendv_epi8(d, s, _mm_cmpgt_epi64(s, d)));
+  }
+  ReleaseScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse4.2")))
+static void StoreSSE42(ClockElem *dst, const u64 *src, uptr n) {
+  uptr i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(&dst[i]),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i])));
+  }
+  StoreScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static bool AcquireAVX2(u64 *dst, const ClockElem *src, uptr n) {
+  const __m256i mask = _mm256_set1_epi64x(kEpochMask);
+  __m256i acquired = _mm256_setzero_si256();
+  uptr i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i s = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i])), mask);
+    __m256i d =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&dst[i]));
+    __m256i gt = _mm256_cmpgt_epi64(s, d);
+    acquired = _mm256_or_si256(acquired, gt);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&dst[i]),
+                        _mm256_blendv_epi8(d, s, gt));
+  }
+  bool tail = AcquireScalar(dst + i, src + i, n - i);
+  return !_mm256_testz_si256(acquired, acquired) || tail;
+}
+
+__attribute__((target("avx2")))
+static void ReleaseAVX2(ClockElem *dst, const u64 *src, uptr n) {
+  const __m256i mask = _mm256_set1_epi64x(kEpochMask);
+  uptr i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i *p = reinterpret_cast<__m256i *>(&dst[i]);
+    __m256i d = _mm256_and_si256(_mm256_loadu_si256(p), mask);
+    __m256i s =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i]));
+    _mm256_storeu_si256(p, _mm256_blendv_epi8(d, s, _mm256_cmpgt_epi64(s, d)));
+  }
+  ReleaseScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void StoreAVX2(ClockElem *dst, const u64 *src, uptr n) {
+  uptr i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(&dst[i]),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i])));
+  }
+  StoreScalar(dst + i, src + i, n - i);
+}
+
+#ifndef bit_SSE4_2
+# define bit_SSE4_2 bit_SSE42  // clang and gcc have different defines.
+#endif
+#endif  // TSAN_CLOCK_SIMD
+
+static const ClockKernels clock_kernels[] = {
+  {AcquireScalar, ReleaseScalar, StoreScalar},
+#if TSAN_CLOCK_SIMD
+  {AcquireSSE42, ReleaseSSE42, StoreSSE42},
+  {AcquireAVX2, ReleaseAVX2, StoreAVX2},
+#endif
+};
+
+// Index into clock_kernels plus one, 0 means not yet selected.
+static atomic_uint32_t clock_simd;
+
+ClockSimd ClockSimdSupported() {
+#if TSAN_CLOCK_SIMD
+  if (CPUHasAVX2())
+    return kClockSimdAVX2;
+  u32 eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2))
+    return kClockSimdSSE42;
+#endif
+  return kClockSimdScalar;
+}
+
+void SetClockSimdForTesting(ClockSimd simd) {
+  CHECK_LE(simd, ClockSimdSupported());
+  atomic_store_relaxed(&clock_simd, simd + 1);
+}
+
+static const ClockKernels &GetClockKernels() {
+  u32 simd = atomic_load_relaxed(&clock_simd);
+  if (UNLIKELY(simd == 0)) {
+    // Racy, but all threads select the same kernels.
+    simd = ClockSimdSupported() + 1;
+    atomic_store_relaxed(&clock_simd, simd);
+  }
+  return clock_kernels[simd - 1];
+}
+
 ThreadClock::ThreadClock(unsigned tid, unsigned reused)
     : tid_(tid)
     , reused_(reused + 1)  // 0 has special meaning
@@ -155,14 +340,12 @@ void ThreadClock::acquire(ClockCache *c, SyncClock *src) {
     // O(N) acquire.
     CPP_STAT_INC(StatClockAcquireFull);
     nclk_ = max(nclk_, nclk);
+    const ClockKernels &kernels = GetClockKernels();
     u64 *dst_pos = &clk_[0];
-    for (ClockElem &src_elem : *src) {
-      u64 epoch = src_elem.epoch;
-      if (*dst_pos < epoch) {
-        *dst_pos = epoch;
-        acquired = true;
-      }
-      dst_pos++;
+    for (SyncClock::Iter it = src->begin(); it != src->end(); it.NextRange()) {
+      uptr n = it.range_size();
+      acquired |= kernels.acquire(dst_pos, it.range(), n);
+      dst_pos += n;
     }
 
     // Remember that this thread has acquired this clock.
@@ -213,11 +396,12 @@ void ThreadClock::release(ClockCache *c, SyncClock *dst) {
     CPP_STAT_INC(StatClockReleaseAcquired);
   // Update dst->clk_.
   dst->FlushDirty();
+  const ClockKernels &kernels = GetClockKernels();
   uptr i = 0;
-  for (ClockElem &ce : *dst) {
-    ce.epoch = max(ce.epoch, clk_[i]);
-    ce.reused = 0;
-    i++;
+  for (SyncClock::Iter it = dst->begin(); it != dst->end(); it.NextRange()) {
+    uptr n = it.range_size();
+    kernels.release(it.range(), &clk_[i], n);
+    i += n;
   }
   // Clear 'acquired' flag in the remaining elements.
   if (nclk_ < dst->size_)
@@ -280,11 +464,12 @@ void ThreadClock::ReleaseStore(ClockCache *c, SyncClock *dst) {
   dst->Unshare(c);
   // Note: dst can be larger than this ThreadClock.
   // This is fine since clk_ beyond size is all zeros.
+  const ClockKernels &kernels = GetClockKernels();
   uptr i = 0;
-  for (ClockElem &ce : *dst) {
-    ce.epoch = clk_[i];
-    ce.reused = 0;
-    i++;
+  for (SyncClock::Iter it = dst->begin(); it != dst->end(); it.NextRange()) {
+    uptr n = it.range_size();
+    kernels.store(it.range(), &clk_[i], n);
+    i += n;
   }
   for (uptr i = 0; i < kDirtyTids; i++)
     dst->dirty_[i].tid = kInvalidTid;
@@ -20,6 +20,20 @@ namespace __tsan {
 typedef DenseSlabAlloc<ClockBlock, 1<<16, 1<<10> ClockAlloc;
 typedef DenseSlabAllocCache ClockCache;
 
+// Instruction sets that can be used for O(N) clock operations.
+// The best supported one is selected at runtime on first use.
+enum ClockSimd {
+  kClockSimdScalar,
+  kClockSimdSSE42,
+  kClockSimdAVX2,
+};
+
+// Returns the best instruction set supported by the current CPU.
+ClockSimd ClockSimdSupported();
+// Forces O(N) clock operations to use the given instruction set.
+// Used only in tests and benchmarks.
+void SetClockSimdForTesting(ClockSimd simd);
+
 // The clock that lives in sync variables (mutexes, atomics, etc).
 class SyncClock {
  public:
@@ -46,6 +60,12 @@ class SyncClock {
     bool operator!=(const Iter& other);
     ClockElem &operator*();
 
+    // Block-wise iteration: the current continuous range is
+    // [range(), range() + range_size()), NextRange skips to the next one.
+    ClockElem *range();
+    uptr range_size();
+    void NextRange();
+
    private:
     SyncClock *parent_;
     // [pos_, end_) is the current continuous range of clock elements.
@@ -220,6 +240,18 @@ ALWAYS_INLINE bool SyncClock::Iter::operator!=(const SyncClock::Iter& other) {
 ALWAYS_INLINE ClockElem &SyncClock::Iter::operator*() {
   return *pos_;
 }
+
+ALWAYS_INLINE ClockElem *SyncClock::Iter::range() {
+  return pos_;
+}
+
+ALWAYS_INLINE uptr SyncClock::Iter::range_size() {
+  return end_ - pos_;
+}
+
+ALWAYS_INLINE void SyncClock::Iter::NextRange() {
+  Next();
+}
 }  // namespace __tsan
 
 #endif  // TSAN_CLOCK_H
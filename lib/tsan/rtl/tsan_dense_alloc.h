@@ -14,6 +14,11 @@
 // allocates/free indices of objects and provide a functionality to map
 // the index onto the real pointer. The index is u32, that is, 2 times smaller
 // than uptr (hense the Dense prefix).
+//
+// Caches refill from and drain to one of kShards central freelists selected
+// in InitCache, so that processors on different NUMA nodes neither contend
+// on one mutex nor hand each other remote memory. New slabs are carved by
+// the refilling thread, hence first touched on its node.
 //===----------------------------------------------------------------------===//
 #ifndef TSAN_DENSE_ALLOC_H
 #define TSAN_DENSE_ALLOC_H
@@ -28,6 +33,7 @@ class DenseSlabAllocCache {
   static const uptr kSize = 128;
   typedef u32 IndexT;
   uptr pos;
+  uptr shard;
   IndexT cache[kSize];
   template<typename T, uptr kL1Size, uptr kL2Size> friend class DenseSlabAlloc;
 };
@@ -37,6 +43,7 @@ class DenseSlabAlloc {
  public:
   typedef DenseSlabAllocCache Cache;
   typedef typename Cache::IndexT IndexT;
+  static const uptr kShards = 8;
 
   explicit DenseSlabAlloc(const char *name) {
     // Check that kL1Size and kL2Size are sane.
@@ -46,7 +53,8 @@ class DenseSlabAlloc {
     // Check that it makes sense to use the dense alloc.
     CHECK_GE(sizeof(T), sizeof(IndexT));
     internal_memset(map_, 0, sizeof(map_));
-    freelist_ = 0;
+    for (uptr i = 0; i < kShards; i++)
+      shards_[i].freelist = 0;
     fillpos_ = 0;
     name_ = name;
   }
@@ -78,60 +86,96 @@ class DenseSlabAlloc {
   }
 
   void FlushCache(Cache *c) {
-    SpinMutexLock lock(&mtx_);
+    Shard *s = &shards_[c->shard];
+    SpinMutexLock lock(&s->mtx);
     while (c->pos) {
       IndexT idx = c->cache[--c->pos];
-      *(IndexT*)Map(idx) = freelist_;
-      freelist_ = idx;
+      *(IndexT*)Map(idx) = s->freelist;
+      s->freelist = idx;
     }
   }
 
-  void InitCache(Cache *c) {
+  // Caches with the same shard share a central freelist. Callers should pass
+  // the same shard for caches used on the same NUMA node.
+  void InitCache(Cache *c, uptr shard = 0) {
     c->pos = 0;
+    c->shard = shard % kShards;
     internal_memset(c->cache, 0, sizeof(c->cache));
   }
 
  private:
+  // Each shard takes a cache line of its own.
+  struct ALIGNED(kCacheLineSize) Shard {
+    SpinMutex mtx;
+    IndexT freelist;
+  };
+  COMPILER_CHECK(sizeof(Shard) == kCacheLineSize);
+
+  Shard shards_[kShards];
   T *map_[kL1Size];
-  SpinMutex mtx_;
-  IndexT freelist_;
+  SpinMutex mtx_;  // Protects map_ growth.
   uptr fillpos_;
   const char *name_;
 
   void Refill(Cache *c) {
-    SpinMutexLock lock(&mtx_);
-    if (freelist_ == 0) {
-      if (fillpos_ == kL1Size) {
-        Printf("ThreadSanitizer: %s overflow (%zu*%zu). Dying.\n",
-            name_, kL1Size, kL2Size);
-        Die();
-      }
-      VPrintf(2, "ThreadSanitizer: growing %s: %zu out of %zu*%zu\n",
-          name_, fillpos_, kL1Size, kL2Size);
-      T *batch = (T*)MmapOrDie(kL2Size * sizeof(T), name_);
-      // Reserve 0 as invalid index.
-      IndexT start = fillpos_ == 0 ? 1 : 0;
-      for (IndexT i = start; i < kL2Size; i++) {
-        new(batch + i) T;
-        *(IndexT*)(batch + i) = i + 1 + fillpos_ * kL2Size;
-      }
-      *(IndexT*)(batch + kL2Size - 1) = 0;
-      freelist_ = fillpos_ * kL2Size + start;
-      map_[fillpos_++] = batch;
+    Shard *s = &shards_[c->shard];
+    {
+      SpinMutexLock lock(&s->mtx);
+      if (s->freelist == 0)
+        AllocSlab(s);
+      Pop(s, c);
+    }
+    // The address space is exhausted, take free objects from other shards.
+    for (uptr i = 1; i < kShards && c->pos == 0; i++) {
+      Shard *other = &shards_[(c->shard + i) % kShards];
+      SpinMutexLock lock(&other->mtx);
+      Pop(other, c);
+    }
+    if (c->pos == 0) {
+      Printf("ThreadSanitizer: %s overflow (%zu*%zu). Dying.\n",
+          name_, kL1Size, kL2Size);
+      Die();
     }
-    for (uptr i = 0; i < Cache::kSize / 2 && freelist_ != 0; i++) {
-      IndexT idx = freelist_;
+  }
+
+  void Pop(Shard *s, Cache *c) {
+    for (uptr i = 0; i < Cache::kSize / 2 && s->freelist != 0; i++) {
+      IndexT idx = s->freelist;
       c->cache[c->pos++] = idx;
-      freelist_ = *(IndexT*)Map(idx);
+      s->freelist = *(IndexT*)Map(idx);
+    }
+  }
+
+  void AllocSlab(Shard *s) {
+    // Called with s->mtx held, lock order is shard mutex -> mtx_.
+    uptr pos;
+    {
+      SpinMutexLock lock(&mtx_);
+      if (fillpos_ == kL1Size)
+        return;
+      pos = fillpos_++;
+    }
+    VPrintf(2, "ThreadSanitizer: growing %s: %zu out of %zu*%zu\n",
+        name_, pos, kL1Size, kL2Size);
+    T *batch = (T*)MmapOrDie(kL2Size * sizeof(T), name_);
+    // Reserve 0 as invalid index.
+    IndexT start = pos == 0 ? 1 : 0;
+    for (IndexT i = start; i < kL2Size; i++) {
+      new(batch + i) T;
+      *(IndexT*)(batch + i) = i + 1 + pos * kL2Size;
     }
+    *(IndexT*)(batch + kL2Size - 1) = 0;
+    s->freelist = pos * kL2Size + start;
+    map_[pos] = batch;
   }
 
   void Drain(Cache *c) {
-    SpinMutexLock lock(&mtx_);
+    Shard *s = &shards_[c->shard];
+    SpinMutexLock lock(&s->mtx);
     for (uptr i = 0; i < Cache::kSize / 2; i++) {
       IndexT idx = c->cache[--c->pos];
-      *(IndexT*)Map(idx) = freelist_;
-      freelist_ = idx;
+      *(IndexT*)Map(idx) = s->freelist;
+      s->freelist = idx;
     }
   }
 };
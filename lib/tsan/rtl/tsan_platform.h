@@ -1010,6 +1010,8 @@ void InitializePlatformEarly();
 void CheckAndProtect();
 void InitializeShadowMemoryPlatform();
 void FlushShadowMemory();
+// Returns the CPU and the NUMA node the calling thread runs on, or zeros.
+void GetCurrentCpu(uptr *cpu, uptr *node);
 void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive);
 int ExtractResolvFDs(void *state, int *fds, int nfd);
 int ExtractRecvmsgFDs(void *msg, int *fds, int nfd);
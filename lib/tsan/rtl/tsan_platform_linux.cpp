@@ -131,14 +131,14 @@ void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive) {
   uptr mem[MemCount];
   internal_memset(mem, 0, sizeof(mem[0]) * MemCount);
   __sanitizer::GetMemoryProfile(FillProfileCallback, mem, 7);
-  StackDepotStats *stacks = StackDepotGetStats();
+  StackDepotStats stacks = StackDepotGetStats();
   internal_snprintf(buf, buf_size,
       "RSS %zd MB: shadow:%zd meta:%zd file:%zd mmap:%zd"
       " trace:%zd heap:%zd other:%zd stacks=%zd[%zd] nthr=%zd/%zd\n",
       mem[MemTotal] >> 20, mem[MemShadow] >> 20, mem[MemMeta] >> 20,
       mem[MemFile] >> 20, mem[MemMmap] >> 20, mem[MemTrace] >> 20,
       mem[MemHeap] >> 20, mem[MemOther] >> 20,
-      stacks->allocated >> 20, stacks->n_uniq_ids,
+      stacks.allocated >> 20, stacks.n_uniq_ids,
       nlive, nthread);
 }
 
@@ -150,6 +150,18 @@ void FlushShadowMemoryCallback(
 }
 #endif
 
+void GetCurrentCpu(uptr *cpu, uptr *node) {
+  *cpu = 0;
+  *node = 0;
+#if SANITIZER_LINUX
+  unsigned c, n;
+  if (internal_iserror(internal_getcpu(&c, &n)))
+    return;
+  *cpu = c;
+  *node = n;
+#endif
+}
+
 void FlushShadowMemory() {
 #if SANITIZER_LINUX
   StopTheWorld(FlushShadowMemoryCallback, 0);
@@ -109,6 +109,11 @@ void cur_thread_finalize() {
 void FlushShadowMemory() {
 }
 
+void GetCurrentCpu(uptr *cpu, uptr *node) {
+  *cpu = 0;
+  *node = 0;
+}
+
 static void RegionMemUsage(uptr start, uptr end, uptr *res, uptr *dirty) {
   vm_address_t address = start;
   vm_address_t end_address = end;
@@ -153,7 +158,7 @@ void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive) {
   RegionMemUsage(AppMemBeg(), AppMemEnd(), &app_res, &app_dirty);
 #endif
 
-  StackDepotStats *stacks = StackDepotGetStats();
+  StackDepotStats stacks = StackDepotGetStats();
   internal_snprintf(buf, buf_size,
     "shadow   (0x%016zx-0x%016zx): resident %zd kB, dirty %zd kB\n"
     "meta     (0x%016zx-0x%016zx): resident %zd kB, dirty %zd kB\n"
@@ -178,7 +183,7 @@ void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive) {
 #else  // !SANITIZER_GO
     AppMemBeg(), AppMemEnd(), app_res / 1024, app_dirty / 1024,
 #endif
-    stacks->n_uniq_ids, stacks->allocated / 1024,
+    stacks.n_uniq_ids, stacks.allocated / 1024,
     nthread, nlive);
 }
 
@@ -23,6 +23,11 @@ namespace __tsan {
 void FlushShadowMemory() {
 }
 
+void GetCurrentCpu(uptr *cpu, uptr *node) {
+  *cpu = 0;
+  *node = 0;
+}
+
 void WriteMemoryProfile(char *buf, uptr buf_size, uptr nthread, uptr nlive) {
 }
 
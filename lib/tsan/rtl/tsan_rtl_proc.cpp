@@ -17,11 +17,22 @@
 
 namespace __tsan {
 
+// Processors created on the same NUMA node share the dense allocators'
+// central freelists; a node gets two shards to spread the refill contention.
+static uptr ProcShard() {
+  uptr cpu, node;
+  GetCurrentCpu(&cpu, &node);
+  return node * 2 + cpu % 2;
+}
+
 Processor *ProcCreate() {
   void *mem = InternalAlloc(sizeof(Processor));
   internal_memset(mem, 0, sizeof(Processor));
   Processor *proc = new(mem) Processor;
   proc->thr = nullptr;
+  uptr shard = ProcShard();
+  ctx->clock_alloc.InitCache(&proc->clock_cache, shard);
+  ctx->metamap.OnProcCreate(proc, shard);
 #if !SANITIZER_GO
   AllocatorProcStart(proc);
 #endif
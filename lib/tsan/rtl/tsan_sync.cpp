@@ -288,6 +288,11 @@ void MetaMap::MoveMemory(uptr src, uptr dst, uptr sz) {
   }
 }
 
+void MetaMap::OnProcCreate(Processor *proc, uptr shard) {
+  block_alloc_.InitCache(&proc->block_cache, shard);
+  sync_alloc_.InitCache(&proc->sync_cache, shard);
+}
+
 void MetaMap::OnProcIdle(Processor *proc) {
   block_alloc_.FlushCache(&proc->block_cache);
   sync_alloc_.FlushCache(&proc->sync_cache);
@@ -124,6 +124,7 @@ class MetaMap {
 
   void MoveMemory(uptr src, uptr dst, uptr sz);
 
+  void OnProcCreate(Processor *proc, uptr shard);
   void OnProcIdle(Processor *proc);
 
  private:
@@ -13,7 +13,10 @@
 #include "tsan_interface.h"
 #include "tsan_defs.h"
 #include "gtest/gtest.h"
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 const int kSize = 128;
 const int kRepeat = 2*1024*1024;
@@ -102,3 +105,42 @@ TEST(DISABLED_BENCH, MutexLocal) {
   }
   ScopedThread().Destroy(m);
 }
+
+namespace {
+const int kHandoffMutexes = 16;
+const int kHandoffIters = 64 * 1024;
+pthread_mutex_t handoff_mtx[kHandoffMutexes];
+
+void *HandoffThread(void *arg) {
+  uintptr_t tid = (uintptr_t)arg;
+  for (int i = 0; i < kHandoffIters; i++) {
+    pthread_mutex_t *m = &handoff_mtx[(tid + i) % kHandoffMutexes];
+    pthread_mutex_lock(m);
+    pthread_mutex_unlock(m);
+  }
+  return 0;
+}
+}  // namespace
+
+// Every lock acquires and every unlock releases a vector clock, so with more
+// threads this stresses clock block allocation from the processor caches.
+TEST(DISABLED_BENCH, MutexHandoff) {
+  for (int i = 0; i < kHandoffMutexes; i++)
+    pthread_mutex_init(&handoff_mtx[i], 0);
+  for (int nthread = 1; nthread <= 64; nthread *= 2) {
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t th[64];
+    for (int i = 0; i < nthread; i++)
+      pthread_create(&th[i], 0, HandoffThread, (void *)(uintptr_t)i);
+    for (int i = 0; i < nthread; i++)
+      pthread_join(th[i], 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("MutexHandoff: %2d threads: %.2f Mops/s\n", nthread,
+           (double)nthread * kHandoffIters / secs / 1e6);
+  }
+  for (int i = 0; i < kHandoffMutexes; i++)
+    pthread_mutex_destroy(&handoff_mtx[i]);
+}
@@ -490,4 +490,58 @@ TEST(Clock, Fuzzer) {
   }
 }
 
+TEST(Clock, FuzzerSimd) {
+  for (int simd = kClockSimdScalar; simd <= ClockSimdSupported(); simd++) {
+    SetClockSimdForTesting((ClockSimd)simd);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int seed = tv.tv_sec + tv.tv_usec;
+    printf("simd=%d seed=%d\n", simd, seed);
+    srand(seed);
+    bool ok = ClockFuzzer(false);
+    if (!ok) {
+      srand(seed);
+      ClockFuzzer(true);
+    }
+    SetClockSimdForTesting(ClockSimdSupported());
+    ASSERT_TRUE(ok);
+  }
+}
+
+// Two threads handing off a sync object back and forth, so that every
+// acquire and release takes the O(N) path.
+TEST(DISABLED_BENCH, ClockAcquireRelease) {
+  const char *kSimdNames[] = {"scalar", "sse4.2", "avx2"};
+  const int kIters = 200000;
+  const unsigned kTids[] = {64, 256, 1024};
+  for (unsigned ntid : kTids) {
+    for (int simd = kClockSimdScalar; simd <= ClockSimdSupported(); simd++) {
+      SetClockSimdForTesting((ClockSimd)simd);
+      ThreadClock *thr0 = new ThreadClock(0);
+      ThreadClock *thr1 = new ThreadClock(1);
+      for (unsigned i = 2; i < ntid; i++)
+        thr0->set(&cache, i, i);
+      SyncClock sync;
+      timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int i = 0; i < kIters; i++) {
+        ThreadClock *thr = i % 2 ? thr1 : thr0;
+        thr->acquire(&cache, &sync);
+        thr->tick();
+        thr->release(&cache, &sync);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      u64 ns = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec -
+               start.tv_nsec;
+      printf("tids=%u %s: %llu ns/op\n", ntid, kSimdNames[simd], ns / kIters);
+      sync.Reset(&cache);
+      thr0->ResetCached(&cache);
+      thr1->ResetCached(&cache);
+      delete thr0;
+      delete thr1;
+    }
+  }
+  SetClockSimdForTesting(ClockSimdSupported());
+}
+
 }  // namespace __tsan
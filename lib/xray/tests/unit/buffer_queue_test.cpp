@@ -14,9 +14,13 @@
 #include "gtest/gtest.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <future>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 namespace __xray {
 namespace {
@@ -230,5 +234,147 @@ TEST(BufferQueueTest, GenerationalSupportAcrossThreads) {
   ASSERT_EQ(Counter.load(std::memory_order_acquire), 0);
 }
 
+TEST(BufferQueueTest, HandsOutLeastRecentlyReleased) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 3, Success);
+  ASSERT_TRUE(Success);
+  BufferQueue::Buffer B0, B1, B2;
+  ASSERT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.getBuffer(B1), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.getBuffer(B2), BufferQueue::ErrorCode::Ok);
+  void *Data0 = B0.Data;
+  void *Data1 = B1.Data;
+  ASSERT_EQ(Buffers.releaseBuffer(B1), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.releaseBuffer(B0), BufferQueue::ErrorCode::Ok);
+
+  // Releasing a buffer twice must not make it available twice.
+  BufferQueue::Buffer Copy = B2;
+  ASSERT_EQ(Buffers.releaseBuffer(B2), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.releaseBuffer(Copy), BufferQueue::ErrorCode::Ok);
+
+  ASSERT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(B0.Data, Data1);
+  ASSERT_EQ(Buffers.getBuffer(B1), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(B1.Data, Data0);
+  ASSERT_EQ(Buffers.getBuffer(B2), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(Buffers.getBuffer(Copy), BufferQueue::ErrorCode::NotEnoughMemory);
+}
+
+TEST(BufferQueueTest, StreamingRecyclesWrittenOutBuffers) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 2, Success, /*S=*/true);
+  ASSERT_TRUE(Success);
+  ASSERT_TRUE(Buffers.streaming());
+  BufferQueue::Buffer B0, B1, Out;
+  ASSERT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.getBuffer(B1), BufferQueue::ErrorCode::Ok);
+  void *Data0 = B0.Data;
+  void *Data1 = B1.Data;
+  EXPECT_FALSE(Buffers.getReleasedBuffer(Out));
+  ASSERT_EQ(Buffers.releaseBuffer(B1), BufferQueue::ErrorCode::Ok);
+  ASSERT_EQ(Buffers.releaseBuffer(B0), BufferQueue::ErrorCode::Ok);
+
+  // Released buffers can't be handed out until they are recycled.
+  EXPECT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::NotEnoughMemory);
+  ASSERT_TRUE(Buffers.getReleasedBuffer(Out));
+  EXPECT_EQ(Out.Data, Data1);
+  ASSERT_EQ(Buffers.recycleBuffer(Out), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(Out.Data, nullptr);
+
+  // Only the buffers that haven't been written out are visited by apply.
+  size_t Count = 0;
+  Buffers.apply([&](const BufferQueue::Buffer &B) {
+    EXPECT_EQ(B.Data, Data0);
+    ++Count;
+  });
+  EXPECT_EQ(Count, 1u);
+  ASSERT_EQ(Buffers.getBuffer(B0), BufferQueue::ErrorCode::Ok);
+  EXPECT_EQ(B0.Data, Data1);
+
+  // Released buffers can still be written out while finalizing.
+  ASSERT_EQ(Buffers.finalize(), BufferQueue::ErrorCode::Ok);
+  ASSERT_TRUE(Buffers.getReleasedBuffer(Out));
+  EXPECT_EQ(Out.Data, Data0);
+  EXPECT_FALSE(Buffers.getReleasedBuffer(Out));
+}
+
+TEST(BufferQueueTest, ReleaseWhileReinitializing) {
+  bool Success = false;
+  BufferQueue Buffers(kSize, 4, Success);
+  ASSERT_TRUE(Success);
+  std::atomic<bool> Done{false};
+  auto F = [&] {
+    BufferQueue::Buffer B;
+    while (!Done.load(std::memory_order_acquire)) {
+      if (Buffers.getBuffer(B) != BufferQueue::ErrorCode::Ok) {
+        std::this_thread::yield();
+        continue;
+      }
+      memset(B.Data, 0xff, B.Size);
+      ASSERT_EQ(Buffers.releaseBuffer(B), BufferQueue::ErrorCode::Ok);
+    }
+  };
+  std::vector<std::thread> Workers;
+  for (size_t I = 0; I < 4; ++I)
+    Workers.emplace_back(F);
+
+  // The buffers and rings of each generation are unmapped by the next init,
+  // while the workers keep getting and releasing buffers.
+  static constexpr size_t kGenerations = 20000;
+  for (size_t I = 0; I < kGenerations; ++I) {
+    ASSERT_EQ(Buffers.finalize(), BufferQueue::ErrorCode::Ok);
+    ASSERT_EQ(Buffers.init(kSize, 4 + 4 * (I % 2)),
+              BufferQueue::ErrorCode::Ok);
+  }
+  Done.store(true, std::memory_order_release);
+  for (auto &T : Workers)
+    T.join();
+
+  // All the buffers of the last generation are available again.
+  BufferQueue::Buffer B[8];
+  for (auto &Buf : B)
+    ASSERT_EQ(Buffers.getBuffer(Buf), BufferQueue::ErrorCode::Ok);
+  BufferQueue::Buffer Extra;
+  EXPECT_EQ(Buffers.getBuffer(Extra), BufferQueue::ErrorCode::NotEnoughMemory);
+}
+
+// Measures the throughput of getting and releasing buffers, by number of
+// threads. Run with --gtest_also_run_disabled_tests.
+TEST(BufferQueueTest, DISABLED_BenchmarkGetAndRelease) {
+  static constexpr size_t kIterations = 1 << 20;
+  for (size_t Threads = 1; Threads <= 64; Threads *= 2) {
+    bool Success = false;
+    BufferQueue Buffers(kSize, 2 * Threads, Success);
+    ASSERT_TRUE(Success);
+    std::atomic<bool> Go{false};
+    std::atomic<size_t> Failures{0};
+    std::vector<std::thread> Workers;
+    for (size_t I = 0; I < Threads; ++I)
+      Workers.emplace_back([&] {
+        while (!Go.load(std::memory_order_acquire))
+          std::this_thread::yield();
+        BufferQueue::Buffer B;
+        for (size_t J = 0; J < kIterations / Threads; ++J) {
+          if (Buffers.getBuffer(B) != BufferQueue::ErrorCode::Ok) {
+            Failures.fetch_add(1, std::memory_order_relaxed);
+            continue;
+          }
+          Buffers.releaseBuffer(B);
+        }
+      });
+    const auto Start = std::chrono::steady_clock::now();
+    Go.store(true, std::memory_order_release);
+    for (auto &T : Workers)
+      T.join();
+    const double Elapsed = std::chrono::duration<double, std::nano>(
+                               std::chrono::steady_clock::now() - Start)
+                               .count();
+    printf("%2zu threads: %.1f ns per get/release pair, %.2fM pairs/s, %zu "
+           "failures\n",
+           Threads, Elapsed / kIterations, kIterations * 1e3 / Elapsed,
+           Failures.load());
+  }
+}
+
 } // namespace
 } // namespace __xray
@@ -0,0 +1,203 @@
+//===-- patching_test.cpp -------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a function call tracing system.
+//
+//===----------------------------------------------------------------------===//
+#include "xray/xray_interface.h"
+#include "xray_flags.h"
+#include "xray_interface_internal.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sys/mman.h>
+#include <vector>
+
+extern __sanitizer::atomic_uint8_t XRayInitialized;
+extern __xray::XRaySledMap XRayInstrMap;
+
+namespace __xray {
+namespace {
+
+#if defined(__x86_64__)
+
+// Sets up a fake instrumentation map, with |Functions| functions each having
+// an entry and an exit sled, in pages mapped close enough to the trampolines.
+class FakeSleds {
+  static constexpr size_t kFunctionSize = 64;
+  static constexpr size_t kExitOffset = 32;
+  char *Code = nullptr;
+  size_t CodeSize = 0;
+  std::vector<XRaySledEntry> Sleds;
+  std::vector<XRayFunctionSledIndex> Index;
+
+public:
+  explicit FakeSleds(size_t Functions) {
+    CodeSize = Functions * kFunctionSize;
+    const uintptr_t Hint =
+        (reinterpret_cast<uintptr_t>(__xray_FunctionEntry) & ~0xfffUL) +
+        (256UL << 20);
+    void *P = mmap(reinterpret_cast<void *>(Hint), CodeSize,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (P == MAP_FAILED)
+      return;
+    const int64_t Distance =
+        reinterpret_cast<int64_t>(P) -
+        reinterpret_cast<int64_t>(__xray_FunctionEntry);
+    if (Distance > (1LL << 30) || Distance < -(1LL << 30)) {
+      munmap(P, CodeSize);
+      return;
+    }
+    Code = static_cast<char *>(P);
+    for (size_t F = 0; F < Functions; ++F) {
+      char *Function = Code + F * kFunctionSize;
+      // jmp +9, then nops.
+      Function[0] = '\xeb';
+      Function[1] = '\x09';
+      memset(Function + 2, 0x90, 9);
+      // ret, then nops.
+      Function[kExitOffset] = '\xc3';
+      memset(Function + kExitOffset + 1, 0x90, 10);
+
+      XRaySledEntry Entry = {};
+      Entry.Address = reinterpret_cast<uint64_t>(Function);
+      Entry.Function = reinterpret_cast<uint64_t>(Function);
+      Entry.Kind = XRayEntryType::ENTRY;
+      Sleds.push_back(Entry);
+      XRaySledEntry Exit = Entry;
+      Exit.Address += kExitOffset;
+      Exit.Kind = XRayEntryType::EXIT;
+      Sleds.push_back(Exit);
+    }
+    mprotect(Code, CodeSize, PROT_READ | PROT_EXEC);
+    for (size_t F = 0; F < Functions; ++F)
+      Index.push_back({&Sleds[2 * F], &Sleds[2 * F + 2]});
+    XRayInstrMap = {Sleds.data(), Sleds.size(), Index.data(), Index.size()};
+    atomic_store(&XRayInitialized, 1, memory_order_release);
+  }
+
+  ~FakeSleds() {
+    atomic_store(&XRayInitialized, 0, memory_order_release);
+    XRayInstrMap = {};
+    if (Code != nullptr)
+      munmap(Code, CodeSize);
+  }
+
+  bool ok() const { return Code != nullptr; }
+
+  // Returns the function id in the entry sled of function |F| if it is
+  // patched, or 0.
+  uint32_t patchedId(size_t F) const {
+    const char *Function = Code + F * kFunctionSize;
+    if (Function[0] != '\x41' || Function[1] != '\xba')
+      return 0;
+    uint32_t Id;
+    memcpy(&Id, Function + 2, sizeof(Id));
+    return Id;
+  }
+
+  bool exitPatched(size_t F) const {
+    return Code[F * kFunctionSize + kExitOffset] != '\xc3';
+  }
+};
+
+TEST(PatchingTest, PatchesAllSledsFromThreads) {
+  constexpr size_t kFunctions = 20000;
+  FakeSleds Sleds(kFunctions);
+  if (!Sleds.ok())
+    return; // Couldn't map pages close to the trampolines.
+  for (int Threads : {1, 4}) {
+    flags()->xray_patching_threads = Threads;
+    ASSERT_EQ(__xray_patch(), XRayPatchingStatus::SUCCESS);
+    for (size_t F = 0; F < kFunctions; ++F) {
+      ASSERT_EQ(Sleds.patchedId(F), F + 1);
+      ASSERT_TRUE(Sleds.exitPatched(F));
+    }
+    ASSERT_EQ(__xray_unpatch(), XRayPatchingStatus::SUCCESS);
+    for (size_t F = 0; F < kFunctions; ++F) {
+      ASSERT_EQ(Sleds.patchedId(F), 0u);
+      ASSERT_FALSE(Sleds.exitPatched(F));
+    }
+  }
+  flags()->xray_patching_threads = 1;
+}
+
+// Patches the sleds the way controlPatching(...) used to: one mprotect(...)
+// of all the pages from the lowest to the highest sled, then each sled in
+// order from the calling thread.
+void patchAllSequentially(bool Enable) {
+  uint64_t MinAddress = XRayInstrMap.Sleds[0].Address;
+  uint64_t MaxAddress = MinAddress;
+  for (size_t I = 0; I < XRayInstrMap.Entries; ++I) {
+    MinAddress = std::min(MinAddress, XRayInstrMap.Sleds[I].Address);
+    MaxAddress = std::max(MaxAddress, XRayInstrMap.Sleds[I].Address);
+  }
+  // The sleds are 11 bytes long on x86_64.
+  const uint64_t Begin = MinAddress & ~0xfffULL;
+  const size_t Length = MaxAddress + 11 - Begin;
+  ASSERT_EQ(mprotect(reinterpret_cast<void *>(Begin), Length,
+                     PROT_READ | PROT_WRITE | PROT_EXEC),
+            0);
+  uint32_t FuncId = 0;
+  uint64_t CurFun = 0;
+  for (size_t I = 0; I < XRayInstrMap.Entries; ++I) {
+    const auto &Sled = XRayInstrMap.Sleds[I];
+    if (Sled.Function != CurFun) {
+      ++FuncId;
+      CurFun = Sled.Function;
+    }
+    if (Sled.Kind == XRayEntryType::ENTRY)
+      patchFunctionEntry(Enable, FuncId, Sled, __xray_FunctionEntry);
+    else
+      patchFunctionExit(Enable, FuncId, Sled);
+  }
+  mprotect(reinterpret_cast<void *>(Begin), Length, PROT_READ | PROT_EXEC);
+}
+
+// Compares patching all the sleds sequentially after a single mprotect(...),
+// with controlPatching(...), from a number of threads. Note that the latter
+// makes one mprotect(...) call per range of contiguous pages holding sleds,
+// rather than a single one: the fake sleds are all in a single range, real
+// binaries have more.
+TEST(PatchingTest, DISABLED_BenchmarkPatching) {
+  constexpr size_t kFunctions = 250000;
+  FakeSleds Sleds(kFunctions);
+  ASSERT_TRUE(Sleds.ok());
+  using Clock = std::chrono::steady_clock;
+  auto Millis = [](Clock::duration D) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(D).count();
+  };
+
+  // Fault the pages in first, so that all the runs below see them mapped.
+  ASSERT_EQ(__xray_patch(), XRayPatchingStatus::SUCCESS);
+  ASSERT_EQ(__xray_unpatch(), XRayPatchingStatus::SUCCESS);
+
+  auto Start = Clock::now();
+  patchAllSequentially(true);
+  printf("%zu sleds, sequentially: %lldms\n", 2 * kFunctions,
+         static_cast<long long>(Millis(Clock::now() - Start)));
+  ASSERT_EQ(Sleds.patchedId(kFunctions - 1), kFunctions);
+  patchAllSequentially(false);
+
+  for (int Threads : {1, 2, 4, 8}) {
+    flags()->xray_patching_threads = Threads;
+    Start = Clock::now();
+    ASSERT_EQ(__xray_patch(), XRayPatchingStatus::SUCCESS);
+    printf("%zu sleds, controlPatching with %d thread(s): %lldms\n",
+           2 * kFunctions, Threads,
+           static_cast<long long>(Millis(Clock::now() - Start)));
+    ASSERT_EQ(__xray_unpatch(), XRayPatchingStatus::SUCCESS);
+  }
+  flags()->xray_patching_threads = 1;
+}
+
+#endif // defined(__x86_64__)
+
+} // namespace
+} // namespace __xray
@@ -231,5 +231,35 @@ TEST(profileCollectorServiceTest, PostSerializeCollectMultipleThread) {
   ValidateBlock(B);
 }
 
+TEST(profileCollectorServiceTest, PostSerializeCollectManyThreadsInParallel) {
+  profilingFlags()->setDefaults();
+  profilingFlags()->serialization_threads = 4;
+
+  profileCollectorService::reset();
+
+  constexpr int kThreads = 16;
+  std::vector<std::thread> Threads;
+  for (int I = 0; I < kThreads; ++I)
+    Threads.emplace_back(threadProcessing);
+  for (auto &T : Threads)
+    T.join();
+
+  profileCollectorService::serialize();
+
+  // Ensure that we see one block per thread, numbered in order.
+  auto B = profileCollectorService::nextBuffer({nullptr, 0});
+  ValidateFileHeaderBlock(B);
+  for (u32 I = 0; I < kThreads; ++I) {
+    B = profileCollectorService::nextBuffer(B);
+    ValidateBlock(B);
+    u32 BlockNum;
+    internal_memcpy(&BlockNum, static_cast<const char *>(B.Data) + 4,
+                    sizeof(BlockNum));
+    EXPECT_EQ(BlockNum, I);
+  }
+  B = profileCollectorService::nextBuffer(B);
+  EXPECT_EQ(B.Data, nullptr);
+}
+
 } // namespace
 } // namespace __xray
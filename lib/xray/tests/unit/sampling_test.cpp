@@ -0,0 +1,127 @@
+//===-- sampling_test.cpp -------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a function call tracing system.
+//
+//===----------------------------------------------------------------------===//
+#include "xray_sampling.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+namespace __xray {
+namespace {
+
+// The frame address of the handler for calls made at the given depth.
+uintptr_t frameAt(int Depth) { return 0x100000 - Depth * 0x100; }
+
+TEST(SamplingTest, DisabledByDefault) {
+  initSampling(0, 0, 0, 0);
+  EXPECT_FALSE(samplingEnabled());
+  initSampling(1, 0, 0, 0);
+  EXPECT_FALSE(samplingEnabled());
+}
+
+TEST(SamplingTest, OneInNCalls) {
+  std::thread([] {
+    initSampling(4, 0, 0, 0);
+    ASSERT_TRUE(samplingEnabled());
+    int Sampled = 0;
+    for (int I = 0; I < 100; ++I) {
+      bool Entry = sampleEvent(1, XRayEntryType::ENTRY, frameAt(0));
+      EXPECT_EQ(Entry, I % 4 == 0);
+      EXPECT_EQ(sampleEvent(1, XRayEntryType::EXIT, frameAt(0)), Entry);
+      Sampled += Entry;
+    }
+    EXPECT_EQ(Sampled, 25);
+  }).join();
+}
+
+TEST(SamplingTest, ExitsMatchEntries) {
+  std::thread([] {
+    initSampling(2, 0, 0, 0);
+    // The exit of a call entered before sampling started isn't passed on.
+    EXPECT_FALSE(sampleEvent(1, XRayEntryType::EXIT, frameAt(0)));
+
+    // Nested calls keep the decisions taken on their entries, deeper than the
+    // number of tracked levels too.
+    constexpr int kDepth = 100;
+    bool Decisions[kDepth];
+    for (int I = 0; I < kDepth; ++I)
+      Decisions[I] = sampleEvent(I + 1, XRayEntryType::ENTRY, frameAt(I));
+    for (int I = kDepth - 1; I >= 0; --I)
+      EXPECT_EQ(sampleEvent(I + 1,
+                            I % 3 ? XRayEntryType::EXIT : XRayEntryType::TAIL,
+                            frameAt(I)),
+                Decisions[I]);
+    EXPECT_TRUE(Decisions[0]);
+    EXPECT_FALSE(Decisions[1]);
+    EXPECT_EQ(Decisions[kDepth - 1], Decisions[63]);
+
+    // Other events are always passed on.
+    EXPECT_TRUE(sampleEvent(1, XRayEntryType::CUSTOM_EVENT, frameAt(0)));
+  }).join();
+}
+
+TEST(SamplingTest, ResynchronizesAfterUnwinding) {
+  std::thread([] {
+    initSampling(2, 0, 0, 0);
+    // Calls of function 2 from function 1 which are unwound back to function 1
+    // over and over, eg: by exceptions caught there, more times than there are
+    // tracked levels.
+    EXPECT_TRUE(sampleEvent(1, XRayEntryType::ENTRY, frameAt(0)));
+    for (int I = 0; I < 1000; ++I) {
+      sampleEvent(2, XRayEntryType::ENTRY, frameAt(1));
+      sampleEvent(3, XRayEntryType::ENTRY, frameAt(2));
+    }
+    // The following calls are still sampled one in two, with matching exits.
+    int Sampled = 0;
+    for (int I = 0; I < 100; ++I) {
+      bool Entry = sampleEvent(4, XRayEntryType::ENTRY, frameAt(1));
+      EXPECT_EQ(sampleEvent(4, XRayEntryType::EXIT, frameAt(1)), Entry);
+      Sampled += Entry;
+    }
+    EXPECT_EQ(Sampled, 50);
+
+    // The exit of a call ends the calls it made which didn't exit.
+    bool Entry = sampleEvent(2, XRayEntryType::ENTRY, frameAt(1));
+    sampleEvent(3, XRayEntryType::ENTRY, frameAt(2));
+    EXPECT_EQ(sampleEvent(2, XRayEntryType::EXIT, frameAt(1)), Entry);
+    EXPECT_FALSE(sampleEvent(3, XRayEntryType::EXIT, frameAt(2)));
+    EXPECT_TRUE(sampleEvent(1, XRayEntryType::EXIT, frameAt(0)));
+    EXPECT_FALSE(sampleEvent(1, XRayEntryType::EXIT, frameAt(0)));
+  }).join();
+}
+
+TEST(SamplingTest, RateLimitPerFunction) {
+  std::thread([] {
+    initSampling(0, 0, 10, 2);
+    ASSERT_TRUE(samplingEnabled());
+    int Sampled[2] = {};
+    for (int I = 0; I < 1000; ++I) {
+      for (int32_t F = 1; F <= 2; ++F) {
+        bool Entry = sampleEvent(F, XRayEntryType::ENTRY, frameAt(0));
+        EXPECT_EQ(sampleEvent(F, XRayEntryType::EXIT, frameAt(0)), Entry);
+        Sampled[F - 1] += Entry;
+      }
+    }
+    // The loop may straddle a second boundary.
+    EXPECT_GE(Sampled[0], 10);
+    EXPECT_LE(Sampled[0], 20);
+    EXPECT_GE(Sampled[1], 10);
+    EXPECT_LE(Sampled[1], 20);
+    // Functions we don't have a rate for are not limited.
+    for (int I = 0; I < 100; ++I) {
+      EXPECT_TRUE(sampleEvent(3, XRayEntryType::ENTRY, frameAt(0)));
+      EXPECT_TRUE(sampleEvent(3, XRayEntryType::EXIT, frameAt(0)));
+    }
+    initSampling(0, 0, 0, 0);
+  }).join();
+}
+
+} // namespace
+} // namespace __xray
@@ -47,10 +47,10 @@ void decRefCount(BufferQueue::ControlBlock *C, size_t Size, size_t Count) {
     deallocControlBlock(C, Size, Count);
 }
 
-void incRefCount(BufferQueue::ControlBlock *C) {
-  if (C == nullptr)
+void addRefCount(BufferQueue::ControlBlock *C, uint64_t N) {
+  if (C == nullptr || N == 0)
     return;
-  atomic_fetch_add(&C->RefCount, 1, memory_order_acq_rel);
+  atomic_fetch_add(&C->RefCount, N, memory_order_acq_rel);
 }
 
 // We use a struct to ensure that we are allocating one atomic_uint64_t per
@@ -67,12 +67,20 @@ constexpr size_t kExtentsSize = sizeof(ExtentsPadded);
 
 } // namespace
 
-BufferQueue::ErrorCode BufferQueue::init(size_t BS, size_t BC) {
+BufferQueue::ErrorCode BufferQueue::init(size_t BS, size_t BC, bool S) {
   SpinMutexLock Guard(&Mutex);
 
   if (!finalizing())
     return BufferQueue::ErrorCode::AlreadyInitialized;
 
+  // Wait for the calls still using the buffers and rings. Those that start
+  // from now on see Resetting, and don't use them until we're done.
+  atomic_store(&Resetting, 1, memory_order_seq_cst);
+  auto DoneResetting = at_scope_exit(
+      [this] { atomic_store(&Resetting, 0, memory_order_release); });
+  while (atomic_load(&InFlight, memory_order_acquire) != 0)
+    internal_sched_yield();
+
   cleanupBuffers();
 
   bool Success = false;
@@ -106,6 +114,32 @@ BufferQueue::ErrorCode BufferQueue::init(size_t BS, size_t BC) {
   if (Buffers == nullptr)
     return BufferQueue::ErrorCode::NotEnoughMemory;
 
+  auto CleanupBuffers = at_scope_exit([&, this] {
+    if (Success)
+      return;
+    deallocateBuffer(Buffers, BufferCount);
+    Buffers = nullptr;
+  });
+
+  CellCount = RoundUpToPowerOfTwo(BufferCount > 0 ? BufferCount : 1);
+  Available.Cells = initArray<QueueCell>(CellCount);
+  if (Available.Cells == nullptr)
+    return BufferQueue::ErrorCode::NotEnoughMemory;
+
+  auto CleanupAvailable = at_scope_exit([&, this] {
+    if (Success)
+      return;
+    deallocateBuffer(Available.Cells, CellCount);
+    Available.Cells = nullptr;
+  });
+
+  Streaming = S;
+  if (Streaming) {
+    Released.Cells = initArray<QueueCell>(CellCount);
+    if (Released.Cells == nullptr)
+      return BufferQueue::ErrorCode::NotEnoughMemory;
+  }
+
   // At this point we increment the generation number to associate the buffers
   // to the new generation.
   atomic_fetch_add(&Generation, 1, memory_order_acq_rel);
@@ -132,18 +166,20 @@ BufferQueue::ErrorCode BufferQueue::init(size_t BS, size_t BC) {
     Buf.ExtentsBackingStore = ExtentsBackingStore;
     Buf.Count = BufferCount;
     T.Used = false;
+    atomic_store(&T.Out, 0, memory_order_relaxed);
   }
 
-  Next = Buffers;
-  First = Buffers;
-  LiveBuffers = 0;
+  // All the buffers start out available, in order.
+  initRing(Available, BufferCount);
+  if (Streaming)
+    initRing(Released, 0);
   atomic_store(&Finalizing, 0, memory_order_release);
   Success = true;
   return BufferQueue::ErrorCode::Ok;
 }
 
-BufferQueue::BufferQueue(size_t B, size_t N,
-                         bool &Success) XRAY_NEVER_INSTRUMENT
+BufferQueue::BufferQueue(size_t B, size_t N, bool &Success,
+                         bool S) XRAY_NEVER_INSTRUMENT
     : BufferSize(B),
       BufferCount(N),
       Mutex(),
@@ -151,70 +187,191 @@ BufferQueue::BufferQueue(size_t B, size_t N,
       BackingStore(nullptr),
       ExtentsBackingStore(nullptr),
       Buffers(nullptr),
-      Next(Buffers),
-      First(Buffers),
-      LiveBuffers(0),
-      Generation{0} {
-  Success = init(B, N) == BufferQueue::ErrorCode::Ok;
+      CellCount(0),
+      Available(),
+      Released(),
+      Streaming(false),
+      Generation{0},
+      InFlight{0},
+      Resetting{0} {
+  Success = init(B, N, S) == BufferQueue::ErrorCode::Ok;
+}
+
+void BufferQueue::initRing(IndexRing &R, size_t Count) {
+  // The cells past the last index are ready to be written to at their
+  // position.
+  for (size_t i = 0; i < CellCount; ++i) {
+    R.Cells[i].Index = i;
+    atomic_store(&R.Cells[i].Sequence, i < Count ? i + 1 : i,
+                 memory_order_relaxed);
+  }
+  atomic_store(&R.DequeuePos, 0, memory_order_relaxed);
+  atomic_store(&R.EnqueuePos, Count, memory_order_release);
+}
+
+bool BufferQueue::popIndex(IndexRing &R, size_t &Index) {
+  const uint64_t Mask = CellCount - 1;
+  atomic_uint64_t::Type Pos = atomic_load(&R.DequeuePos, memory_order_relaxed);
+  while (true) {
+    QueueCell &C = R.Cells[Pos & Mask];
+    const uint64_t Seq = atomic_load(&C.Sequence, memory_order_acquire);
+    const int64_t Diff = static_cast<int64_t>(Seq - (Pos + 1));
+    if (Diff == 0) {
+      // The cell holds the index for this position, try to claim it. On
+      // failure, Pos is updated to the current position.
+      if (atomic_compare_exchange_weak(&R.DequeuePos, &Pos, Pos + 1,
+                                       memory_order_relaxed)) {
+        Index = C.Index;
+        // Make the cell writable at the position it will have one lap later.
+        atomic_store(&C.Sequence, Pos + Mask + 1, memory_order_release);
+        return true;
+      }
+    } else if (Diff < 0) {
+      // The cell hasn't been written to yet for this position. Either there is
+      // no available buffer, or the thread that claimed the position in
+      // pushIndex hasn't written to the cell yet, which we wait for.
+      if (atomic_load(&R.EnqueuePos, memory_order_acquire) == Pos)
+        return false;
+      internal_sched_yield();
+      Pos = atomic_load(&R.DequeuePos, memory_order_relaxed);
+    } else {
+      // Another thread got this position first.
+      Pos = atomic_load(&R.DequeuePos, memory_order_relaxed);
+    }
+  }
+}
+
+void BufferQueue::pushIndex(IndexRing &R, size_t Index) {
+  const uint64_t Mask = CellCount - 1;
+  atomic_uint64_t::Type Pos = atomic_load(&R.EnqueuePos, memory_order_relaxed);
+  while (true) {
+    QueueCell &C = R.Cells[Pos & Mask];
+    const uint64_t Seq = atomic_load(&C.Sequence, memory_order_acquire);
+    const int64_t Diff = static_cast<int64_t>(Seq - Pos);
+    // There are never more buffers to push than cells, so the ring can't be
+    // full: the cell is either writable at this position, or has been written
+    // to by another thread.
+    DCHECK_GE(Diff, 0);
+    if (Diff == 0) {
+      if (atomic_compare_exchange_weak(&R.EnqueuePos, &Pos, Pos + 1,
+                                       memory_order_relaxed)) {
+        C.Index = Index;
+        atomic_store(&C.Sequence, Pos + 1, memory_order_release);
+        return;
+      }
+    } else {
+      Pos = atomic_load(&R.EnqueuePos, memory_order_relaxed);
+    }
+  }
+}
+
+bool BufferQueue::enter() {
+  // This pairs with the store of Resetting and the load of InFlight in
+  // init(...): either we see Resetting, or init(...) sees us.
+  atomic_fetch_add(&InFlight, 1, memory_order_seq_cst);
+  if (!atomic_load(&Resetting, memory_order_seq_cst))
+    return true;
+  leave();
+  return false;
+}
+
+void BufferQueue::leave() {
+  atomic_fetch_sub(&InFlight, 1, memory_order_release);
 }
 
 BufferQueue::ErrorCode BufferQueue::getBuffer(Buffer &Buf) {
+  // init(...) only runs on a finalized queue.
+  if (!enter())
+    return ErrorCode::QueueFinalizing;
+  auto Leave = at_scope_exit([this] { leave(); });
+
   if (atomic_load(&Finalizing, memory_order_acquire))
     return ErrorCode::QueueFinalizing;
 
-  BufferRep *B = nullptr;
-  {
-    SpinMutexLock Guard(&Mutex);
-    if (LiveBuffers == BufferCount)
-      return ErrorCode::NotEnoughMemory;
-    B = Next++;
-    if (Next == (Buffers + BufferCount))
-      Next = Buffers;
-    ++LiveBuffers;
-  }
+  size_t Index;
+  if (!popIndex(Available, Index))
+    return ErrorCode::NotEnoughMemory;
 
-  incRefCount(BackingStore);
-  incRefCount(ExtentsBackingStore);
-  Buf = B->Buff;
+  auto &B = Buffers[Index];
+  atomic_store(&B.Out, 1, memory_order_relaxed);
+  Buf = B.Buff;
   Buf.Generation = generation();
-  B->Used = true;
+  B.Used = true;
   return ErrorCode::Ok;
 }
 
 BufferQueue::ErrorCode BufferQueue::releaseBuffer(Buffer &Buf) {
-  // Check whether the buffer being referred to is within the bounds of the
-  // backing store's range.
-  BufferRep *B = nullptr;
-  {
-    SpinMutexLock Guard(&Mutex);
-    if (Buf.Generation != generation() || LiveBuffers == 0) {
-      Buf = {};
-      decRefCount(Buf.BackingStore, Buf.Size, Buf.Count);
-      decRefCount(Buf.ExtentsBackingStore, kExtentsSize, Buf.Count);
-      return BufferQueue::ErrorCode::Ok;
-    }
+  // If init(...) is replacing the buffers, wait for it: the buffer then belongs
+  // to a previous generation.
+  while (!enter())
+    internal_sched_yield();
+  auto Leave = at_scope_exit([this] { leave(); });
+
+  // A buffer from a previous generation gives up its reference to the backing
+  // stores it came from.
+  if (Buf.Generation != generation()) {
+    decRefCount(Buf.BackingStore, Buf.Size, Buf.Count);
+    decRefCount(Buf.ExtentsBackingStore, kExtentsSize, Buf.Count);
+    Buf = {};
+    return BufferQueue::ErrorCode::Ok;
+  }
 
-    if (Buf.Data < &BackingStore->Data ||
-        Buf.Data > &BackingStore->Data + (BufferCount * BufferSize))
-      return BufferQueue::ErrorCode::UnrecognizedBuffer;
+  const size_t Index = getBufferIndex(Buf.Data);
+  if (Index == BufferCount)
+    return BufferQueue::ErrorCode::UnrecognizedBuffer;
 
-    --LiveBuffers;
-    B = First++;
-    if (First == (Buffers + BufferCount))
-      First = Buffers;
+  // Buffers that are not handed out (eg: released twice) are ignored.
+  if (atomic_exchange(&Buffers[Index].Out, 0, memory_order_acq_rel) != 0)
+    pushIndex(Streaming ? Released : Available, Index);
+  Buf = {};
+  return ErrorCode::Ok;
+}
+
+bool BufferQueue::getReleasedBuffer(Buffer &Buf) {
+  if (!enter())
+    return false;
+  auto Leave = at_scope_exit([this] { leave(); });
+
+  size_t Index;
+  if (!Streaming || !popIndex(Released, Index))
+    return false;
+  Buf = Buffers[Index].Buff;
+  Buf.Generation = generation();
+  return true;
+}
+
+BufferQueue::ErrorCode BufferQueue::recycleBuffer(Buffer &Buf) {
+  while (!enter())
+    internal_sched_yield();
+  auto Leave = at_scope_exit([this] { leave(); });
+
+  if (Buf.Generation != generation()) {
+    Buf = {};
+    return BufferQueue::ErrorCode::Ok;
   }
 
-  // Now that the buffer has been released, we mark it as "used".
-  B->Buff = Buf;
-  B->Used = true;
-  decRefCount(Buf.BackingStore, Buf.Size, Buf.Count);
-  decRefCount(Buf.ExtentsBackingStore, kExtentsSize, Buf.Count);
-  atomic_store(B->Buff.Extents, atomic_load(Buf.Extents, memory_order_acquire),
-               memory_order_release);
+  const size_t Index = getBufferIndex(Buf.Data);
+  if (!Streaming || Index == BufferCount)
+    return BufferQueue::ErrorCode::UnrecognizedBuffer;
+
+  // The buffer has been written out, it won't be visited by apply(...).
+  Buffers[Index].Used = false;
+  pushIndex(Available, Index);
   Buf = {};
   return ErrorCode::Ok;
 }
 
+size_t BufferQueue::getBufferIndex(const void *Data) const {
+  // Check whether the buffer being referred to is one of the buffers of the
+  // backing store.
+  const char *Base = BackingStore->Data;
+  const char *D = static_cast<const char *>(Data);
+  if (D < Base || D >= Base + (BufferCount * BufferSize) ||
+      (D - Base) % BufferSize != 0)
+    return BufferCount;
+  return (D - Base) / BufferSize;
+}
+
 BufferQueue::ErrorCode BufferQueue::finalize() {
   if (atomic_exchange(&Finalizing, 1, memory_order_acq_rel))
     return ErrorCode::QueueFinalizing;
@@ -222,14 +379,29 @@ BufferQueue::ErrorCode BufferQueue::finalize() {
 }
 
 void BufferQueue::cleanupBuffers() {
+  // The buffers still handed out now hold a reference to the backing stores,
+  // which they will give up when released.
+  uint64_t Outstanding = 0;
+  if (Buffers != nullptr)
+    for (auto B = Buffers, E = Buffers + BufferCount; B != E; ++B)
+      if (atomic_load(&B->Out, memory_order_acquire))
+        ++Outstanding;
+  addRefCount(BackingStore, Outstanding);
+  addRefCount(ExtentsBackingStore, Outstanding);
+
   for (auto B = Buffers, E = Buffers + BufferCount; B != E; ++B)
     B->~BufferRep();
   deallocateBuffer(Buffers, BufferCount);
+  deallocateBuffer(Available.Cells, CellCount);
+  deallocateBuffer(Released.Cells, CellCount);
   decRefCount(BackingStore, BufferSize, BufferCount);
   decRefCount(ExtentsBackingStore, kExtentsSize, BufferCount);
   BackingStore = nullptr;
   ExtentsBackingStore = nullptr;
   Buffers = nullptr;
+  Available.Cells = nullptr;
+  Released.Cells = nullptr;
+  CellCount = 0;
   BufferCount = 0;
   BufferSize = 0;
 }
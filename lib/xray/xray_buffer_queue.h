@@ -28,6 +28,16 @@ namespace __xray {
 /// get from or return buffers to the queue. This is one key component of the
 /// "flight data recorder" (FDR) mode to support ongoing XRay function call
 /// trace collection.
+///
+/// Getting and releasing buffers is lock-free: the indices of the available
+/// buffers are kept in a bounded multi-producer/multi-consumer ring, where each
+/// cell has a sequence number telling whether it can be written to or read from
+/// at a given position (see Dmitry Vyukov's bounded MPMC queue). Buffers are
+/// handed out in the order they were released, so that the oldest data gets
+/// overwritten first. Only init(...) and apply(...) take the mutex. Before
+/// replacing the buffers and rings, init(...) waits for the calls using them to
+/// return; calls made in the meantime fail if they would get a buffer, or wait
+/// for init(...) to be done if they would return one.
 class BufferQueue {
 public:
   /// ControlBlock represents the memory layout of how we interpret the backing
@@ -71,6 +81,29 @@ public:
     // This is true if the buffer has been returned to the available queue, and
     // is considered "used" by another thread.
     bool Used = false;
+
+    // This is non-zero while the buffer is handed out. A handed out buffer
+    // holds a reference to the backing stores only once they are replaced by
+    // a new generation.
+    atomic_uint8_t Out;
+  };
+
+  // A cell of a ring of buffer indices.
+  struct QueueCell {
+    atomic_uint64_t Sequence;
+    size_t Index;
+  };
+
+  // A ring of buffer indices, with a power of two number of cells so that
+  // positions map to cells with a mask. The positions to dequeue from and to
+  // enqueue to are each on their own cache line.
+  struct IndexRing {
+    QueueCell *Cells;
+    char Pad0[kCacheLineSize];
+    atomic_uint64_t DequeuePos;
+    char Pad1[kCacheLineSize];
+    atomic_uint64_t EnqueuePos;
+    char Pad2[kCacheLineSize];
   };
 
 private:
@@ -149,23 +182,52 @@ private:
   // A dynamically allocated array of BufferRep instances.
   BufferRep *Buffers;
 
-  // Pointer to the next buffer to be handed out.
-  BufferRep *Next;
+  // The number of cells of the rings below.
+  size_t CellCount;
 
-  // Pointer to the entry in the array where the next released buffer will be
-  // placed.
-  BufferRep *First;
+  // The indices of the buffers that can be handed out.
+  IndexRing Available;
 
-  // Count of buffers that have been handed out through 'getBuffer'.
-  size_t LiveBuffers;
+  // In streaming mode, the indices of the buffers that have been released but
+  // not written out yet.
+  IndexRing Released;
+  bool Streaming;
 
   // We use a generation number to identify buffers and which generation they're
   // associated with.
   atomic_uint64_t Generation;
 
+  // The number of calls using the buffers and rings, which init(...) waits to
+  // drop to zero before replacing them.
+  atomic_uint64_t InFlight;
+
+  // Non-zero while init(...) replaces the buffers and rings.
+  atomic_uint8_t Resetting;
+
   /// Releases references to the buffers backed by the current buffer queue.
   void cleanupBuffers();
 
+  /// Registers a call using the buffers and rings, returning false if init(...)
+  /// is replacing them.
+  bool enter();
+
+  /// Unregisters a call registered with enter().
+  void leave();
+
+  /// Sets up a ring with the indices of the first |Count| buffers in it.
+  void initRing(IndexRing &R, size_t Count);
+
+  /// Pops the least recently pushed index of the ring, returning false if
+  /// there is none.
+  bool popIndex(IndexRing &R, size_t &Index);
+
+  /// Pushes an index to the ring.
+  void pushIndex(IndexRing &R, size_t Index);
+
+  /// Returns the index of the buffer of the current generation with the data
+  /// |Data|, or BufferCount if there is none.
+  size_t getBufferIndex(const void *Data) const;
+
 public:
   enum class ErrorCode : unsigned {
     Ok,
@@ -195,8 +257,8 @@ public:
   }
 
   /// Initialise a queue of size |N| with buffers of size |B|. We report success
-  /// through |Success|.
-  BufferQueue(size_t B, size_t N, bool &Success);
+  /// through |Success|. See init(...) for |S|.
+  BufferQueue(size_t B, size_t N, bool &Success, bool S = false);
 
   /// Updates |Buf| to contain the pointer to an appropriate buffer. Returns an
   /// error in case there are no available buffers to return when we will run
@@ -223,11 +285,33 @@ public:
   /// Initializes the buffer queue, starting a new generation. We can re-set the
   /// size of buffers with |BS| along with the buffer count with |BC|.
   ///
+  /// In streaming mode (|S| is true), released buffers are not handed out
+  /// again until they have been retrieved with getReleasedBuffer(...), written
+  /// out, and returned with recycleBuffer(...). This allows for continuous
+  /// tracing with a fixed number of buffers.
+  ///
   /// Returns:
   ///   - ErrorCode::Ok when we successfully initialize the buffer. This
   ///   requires that the buffer queue is previously finalized.
   ///   - ErrorCode::AlreadyInitialized when the buffer queue is not finalized.
-  ErrorCode init(size_t BS, size_t BC);
+  ErrorCode init(size_t BS, size_t BC, bool S = false);
+
+  /// In streaming mode, updates |Buf| to the least recently released buffer
+  /// that hasn't been retrieved yet. Returns false if there is none. This works
+  /// while finalizing as well.
+  bool getReleasedBuffer(Buffer &Buf);
+
+  /// In streaming mode, makes a buffer obtained through getReleasedBuffer(...)
+  /// available to getBuffer(...) again, and updates |Buf| to point to nullptr.
+  ///
+  /// Returns:
+  ///   - ErrorCode::Ok when the buffer is recycled, or belongs to a previous
+  ///     generation.
+  ///   - ErrorCode::UnrecognizedBuffer for when this BufferQueue does not own
+  ///     the buffer being recycled.
+  ErrorCode recycleBuffer(Buffer &Buf);
+
+  bool streaming() const { return Streaming; }
 
   bool finalizing() const {
     return atomic_load(&Finalizing, memory_order_acquire);
@@ -251,7 +335,8 @@ public:
 
   /// Applies the provided function F to each Buffer in the queue, only if the
   /// Buffer is marked 'used' (i.e. has been the result of getBuffer(...) and a
-  /// releaseBuffer(...) operation).
+  /// releaseBuffer(...) operation). In streaming mode, recycled buffers are no
+  /// longer marked 'used'.
   template <class F> void apply(F Fn) XRAY_NEVER_INSTRUMENT {
     SpinMutexLock G(&Mutex);
     for (auto I = begin(), E = end(); I != E; ++I)
@@ -89,6 +89,12 @@ static atomic_uint64_t TicksPerSec{0};
 static atomic_sint32_t LogFlushStatus = {
     XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING};
 
+// In streaming mode, the log we write the buffers to as they get released, and
+// the thread doing so until the log is flushed.
+static LogWriter *StreamWriter = nullptr;
+static pthread_t StreamThread;
+static atomic_uint8_t StreamStop{0};
+
 // This function will initialize the thread-local data structure used by the FDR
 // logging implementation and return a reference to it. The implementation
 // details require a bit of care to maintain.
@@ -275,6 +281,91 @@ XRayBuffer fdrIterator(const XRayBuffer B) {
   return Result;
 }
 
+// Writes out the buffers that have been released so far in streaming mode,
+// and makes them available to getBuffer(...) again. We write the buffers in
+// batches, each preceded by its extents like in fdrLoggingFlush(), with a
+// single system call per batch. Returns the number of buffers written out.
+static size_t writeReleasedBuffers(LogWriter *LW) XRAY_NEVER_INSTRUMENT {
+  static constexpr size_t kBatchSize = 16;
+  BufferQueue::Buffer Buffers[kBatchSize];
+  MetadataRecord ExtentsRecords[kBatchSize];
+  struct iovec Iov[2 * kBatchSize];
+  size_t Total = 0;
+  while (true) {
+    size_t Count = 0;
+    int IovCount = 0;
+    while (Count < kBatchSize && BQ->getReleasedBuffer(Buffers[Count])) {
+      auto &B = Buffers[Count];
+      auto BufferExtents = atomic_load(B.Extents, memory_order_acquire);
+      DCHECK(BufferExtents <= B.Size);
+      if (BufferExtents > 0) {
+        ExtentsRecords[Count] =
+            createMetadataRecord<MetadataRecord::RecordKinds::BufferExtents>(
+                BufferExtents);
+        Iov[IovCount++] = {&ExtentsRecords[Count], sizeof(MetadataRecord)};
+        Iov[IovCount++] = {B.Data, BufferExtents};
+      }
+      ++Count;
+    }
+    if (Count == 0)
+      return Total;
+    LW->WriteAll(Iov, IovCount);
+    for (size_t I = 0; I < Count; ++I) {
+      auto EC = BQ->recycleBuffer(Buffers[I]);
+      if (EC != BufferQueue::ErrorCode::Ok)
+        Report("Failed to recycle buffer at %p; error=%s\n", Buffers[I].Data,
+               BufferQueue::getErrorString(EC));
+    }
+    Total += Count;
+  }
+}
+
+static void *streamingThread(void *) XRAY_NEVER_INSTRUMENT {
+  while (!atomic_load(&StreamStop, memory_order_acquire))
+    if (writeReleasedBuffers(StreamWriter) == 0)
+      SleepForMillis(fdrFlags()->streaming_interval_ms);
+  return nullptr;
+}
+
+// Opens the log for streaming mode, writes its header, and starts the thread
+// writing out the released buffers.
+static bool startStreaming() XRAY_NEVER_INSTRUMENT {
+  LogWriter *LW = nullptr;
+#if !SANITIZER_FUCHSIA
+  if (fdrFlags()->streaming_fd >= 0) {
+    // We write to a duplicate of the descriptor, so that closing the log when
+    // flushing leaves the one provided open.
+    int Fd = dup(fdrFlags()->streaming_fd);
+    if (Fd == -1) {
+      Report("XRay FDR: Cannot duplicate streaming_fd=%d; errno = %d\n",
+             fdrFlags()->streaming_fd, errno);
+      return false;
+    }
+    LW = allocate<LogWriter>();
+    new (LW) LogWriter(Fd);
+  }
+#endif
+  if (LW == nullptr)
+    LW = LogWriter::Open();
+  if (LW == nullptr)
+    return false;
+
+  XRayFileHeader Header = fdrCommonHeaderInfo();
+  Header.FdrData = FdrAdditionalHeaderData{BQ->ConfiguredBufferSize()};
+  LW->WriteAll(reinterpret_cast<char *>(&Header),
+               reinterpret_cast<char *>(&Header) + sizeof(Header));
+
+  StreamWriter = LW;
+  atomic_store(&StreamStop, 0, memory_order_release);
+  if (pthread_create(&StreamThread, nullptr, streamingThread, nullptr) != 0) {
+    Report("XRay FDR: Cannot start the streaming thread.\n");
+    LogWriter::Close(LW);
+    StreamWriter = nullptr;
+    return false;
+  }
+  return true;
+}
+
 // Must finalize before flushing.
 XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
   if (atomic_load(&LoggingStatus, memory_order_acquire) !=
@@ -303,6 +394,19 @@ XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
   // finalised before attempting to flush the log.
   SleepForMillis(fdrFlags()->grace_period_ms);
 
+  // In streaming mode, stop the thread writing out the released buffers: we
+  // write out the remaining ones below, then close the log.
+  if (StreamWriter != nullptr) {
+    atomic_store(&StreamStop, 1, memory_order_release);
+    pthread_join(StreamThread, nullptr);
+  }
+  auto CloseStreamWriter = at_scope_exit([] {
+    if (StreamWriter == nullptr)
+      return;
+    LogWriter::Close(StreamWriter);
+    StreamWriter = nullptr;
+  });
+
   // At this point, we're going to uninstall the iterator implementation, before
   // we decide to do anything further with the global buffer queue.
   __xray_log_remove_buffer_iterator();
@@ -338,17 +442,22 @@ XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
   //      (fixed-sized) and let the tools reading the buffers deal with the data
   //      afterwards.
   //
-  LogWriter *LW = LogWriter::Open();
+  // In streaming mode, the header and the buffers released so far have been
+  // written out already, so we only write out the buffers that are left.
+  LogWriter *LW = StreamWriter;
   if (LW == nullptr) {
-    auto Result = XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING;
-    atomic_store(&LogFlushStatus, Result, memory_order_release);
-    return Result;
-  }
+    LW = LogWriter::Open();
+    if (LW == nullptr) {
+      auto Result = XRayLogFlushStatus::XRAY_LOG_NOT_FLUSHING;
+      atomic_store(&LogFlushStatus, Result, memory_order_release);
+      return Result;
+    }
 
-  XRayFileHeader Header = fdrCommonHeaderInfo();
-  Header.FdrData = FdrAdditionalHeaderData{BQ->ConfiguredBufferSize()};
-  LW->WriteAll(reinterpret_cast<char *>(&Header),
-               reinterpret_cast<char *>(&Header) + sizeof(Header));
+    XRayFileHeader Header = fdrCommonHeaderInfo();
+    Header.FdrData = FdrAdditionalHeaderData{BQ->ConfiguredBufferSize()};
+    LW->WriteAll(reinterpret_cast<char *>(&Header),
+                 reinterpret_cast<char *>(&Header) + sizeof(Header));
+  }
 
   // Release the current thread's buffer before we attempt to write out all the
   // buffers. This ensures that in case we had only a single thread going, that
@@ -357,6 +466,11 @@ XRayLogFlushStatus fdrLoggingFlush() XRAY_NEVER_INSTRUMENT {
   if (TLD.Controller != nullptr)
     TLD.Controller->flush();
 
+  // The buffers written out this way are no longer marked "used", so that the
+  // ones that are still in use by other threads are left to apply(...).
+  if (BQ->streaming())
+    writeReleasedBuffers(LW);
+
   BQ->apply([&](const BufferQueue::Buffer &B) {
     // Starting at version 2 of the FDR logging implementation, we only write
     // the records identified by the extents of the buffer. We use the Extents
@@ -664,13 +778,14 @@ XRayLogInitStatus fdrLoggingInit(size_t, size_t, void *Options,
   if (BQ == nullptr) {
     bool Success = false;
     BQ = reinterpret_cast<BufferQueue *>(&BufferQueueStorage);
-    new (BQ) BufferQueue(BufferSize, BufferMax, Success);
+    new (BQ) BufferQueue(BufferSize, BufferMax, Success, FDRFlags.streaming);
     if (!Success) {
       Report("BufferQueue init failed.\n");
       return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
     }
   } else {
-    if (BQ->init(BufferSize, BufferMax) != BufferQueue::ErrorCode::Ok) {
+    if (BQ->init(BufferSize, BufferMax, FDRFlags.streaming) !=
+        BufferQueue::ErrorCode::Ok) {
       if (Verbosity())
         Report("Failed to re-initialize global buffer queue. Init failed.\n");
       return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
@@ -705,6 +820,15 @@ XRayLogInitStatus fdrLoggingInit(size_t, size_t, void *Options,
                atomic_load_relaxed(&TicksPerSec) *
                    fdrFlags()->func_duration_threshold_us / 1000000,
                memory_order_release);
+
+  if (FDRFlags.streaming && !startStreaming()) {
+    Report("XRay FDR: Failed to start streaming mode.\n");
+    BQ->finalize();
+    atomic_store(&LoggingStatus, XRayLogInitStatus::XRAY_LOG_UNINITIALIZED,
+                 memory_order_release);
+    return XRayLogInitStatus::XRAY_LOG_UNINITIALIZED;
+  }
+
   // Arg1 handler should go in first to avoid concurrent code accidentally
   // falling back to arg0 when it should have ran arg1.
   __xray_set_handler_arg1(fdrLoggingHandleArg1);
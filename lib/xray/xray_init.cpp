@@ -19,6 +19,7 @@
 #include "xray_defs.h"
 #include "xray_flags.h"
 #include "xray_interface_internal.h"
+#include "xray_sampling.h"
 
 extern "C" {
 void __xray_init();
@@ -87,6 +88,10 @@ void __xray_init() XRAY_NEVER_INSTRUMENT {
     XRayInstrMap.SledsIndex = __start_xray_fn_idx;
     XRayInstrMap.Functions = __stop_xray_fn_idx - __start_xray_fn_idx;
   }
+  initSampling(Max(flags()->xray_sample_every, 0),
+               Max(flags()->xray_sample_interval_us, 0),
+               Max(flags()->xray_sample_max_per_function, 0),
+               XRayInstrMap.Functions);
   atomic_store(&XRayInitialized, true, memory_order_release);
 
 #ifndef XRAY_NO_PREINIT
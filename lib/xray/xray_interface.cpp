@@ -18,6 +18,7 @@
 #include <cstdio>
 #include <errno.h>
 #include <limits>
+#include <pthread.h>
 #include <string.h>
 #include <sys/mman.h>
 
@@ -30,9 +31,12 @@
 
 #include "sanitizer_common/sanitizer_addrhashmap.h"
 #include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_placement_new.h"
 
+#include "xray_allocator.h"
 #include "xray_defs.h"
 #include "xray_flags.h"
+#include "xray_sampling.h"
 
 extern __sanitizer::SpinMutex XRayInstrMapMutex;
 extern __sanitizer::atomic_uint8_t XRayInitialized;
@@ -224,6 +228,54 @@ XRayPatchingStatus patchFunction(int32_t FuncId,
   return XRayPatchingStatus::SUCCESS;
 }
 
+// Calls Fn(Begin, End) for each range of contiguous pages holding sleds, in
+// the order of the sleds in the instrumentation map. The sleds are normally
+// sorted by address, in which case the ranges don't overlap.
+template <class F>
+void forEachSledPages(const XRaySledMap &InstrMap, size_t PageSize,
+                      F Fn) XRAY_NEVER_INSTRUMENT {
+  uptr Begin = 0;
+  uptr End = 0;
+  for (std::size_t I = 0; I < InstrMap.Entries; ++I) {
+    const uptr Address = InstrMap.Sleds[I].Address;
+    const uptr SledBegin = Address & ~(PageSize - 1);
+    const uptr SledEnd = RoundUpTo(Address + cSledLength, PageSize);
+    if (End != 0 && SledBegin <= End && SledEnd >= Begin) {
+      Begin = Min(Begin, SledBegin);
+      End = Max(End, SledEnd);
+      continue;
+    }
+    if (End != 0)
+      Fn(Begin, End);
+    Begin = SledBegin;
+    End = SledEnd;
+  }
+  if (End != 0)
+    Fn(Begin, End);
+}
+
+// A run of sleds to patch, starting with the sleds of function FuncId.
+struct SledChunk {
+  const XRaySledEntry *Begin;
+  const XRaySledEntry *End;
+  uint32_t FuncId;
+  bool Enable;
+};
+
+void *patchSledChunk(void *Arg) XRAY_NEVER_INSTRUMENT {
+  const auto &Chunk = *static_cast<const SledChunk *>(Arg);
+  uint32_t FuncId = Chunk.FuncId;
+  uint64_t CurFun = Chunk.Begin->Function;
+  for (auto *Sled = Chunk.Begin; Sled != Chunk.End; ++Sled) {
+    if (Sled->Function != CurFun) {
+      ++FuncId;
+      CurFun = Sled->Function;
+    }
+    patchSled(*Sled, Chunk.Enable, FuncId);
+  }
+  return nullptr;
+}
+
 // controlPatching implements the common internals of the patching/unpatching
 // implementation. |Enable| defines whether we're enabling or disabling the
 // runtime XRay instrumentation.
@@ -253,27 +305,6 @@ XRayPatchingStatus controlPatching(bool Enable) XRAY_NEVER_INSTRUMENT {
   if (InstrMap.Entries == 0)
     return XRayPatchingStatus::NOT_INITIALIZED;
 
-  uint32_t FuncId = 1;
-  uint64_t CurFun = 0;
-
-  // First we want to find the bounds for which we have instrumentation points,
-  // and try to get as few calls to mprotect(...) as possible. We're assuming
-  // that all the sleds for the instrumentation map are contiguous as a single
-  // set of pages. When we do support dynamic shared object instrumentation,
-  // we'll need to do this for each set of page load offsets per DSO loaded. For
-  // now we're assuming we can mprotect the whole section of text between the
-  // minimum sled address and the maximum sled address (+ the largest sled
-  // size).
-  auto MinSled = InstrMap.Sleds[0];
-  auto MaxSled = InstrMap.Sleds[InstrMap.Entries - 1];
-  for (std::size_t I = 0; I < InstrMap.Entries; I++) {
-    const auto &Sled = InstrMap.Sleds[I];
-    if (Sled.Address < MinSled.Address)
-      MinSled = Sled;
-    if (Sled.Address > MaxSled.Address)
-      MaxSled = Sled;
-  }
-
   const size_t PageSize = flags()->xray_page_size_override > 0
                               ? flags()->xray_page_size_override
                               : GetPageSizeCached();
@@ -282,27 +313,76 @@ XRayPatchingStatus controlPatching(bool Enable) XRAY_NEVER_INSTRUMENT {
     return XRayPatchingStatus::FAILED;
   }
 
-  void *PageAlignedAddr =
-      reinterpret_cast<void *>(MinSled.Address & ~(PageSize - 1));
-  size_t MProtectLen =
-      (MaxSled.Address - reinterpret_cast<uptr>(PageAlignedAddr)) + cSledLength;
-  MProtectHelper Protector(PageAlignedAddr, MProtectLen, PageSize);
-  if (Protector.MakeWriteable() == -1) {
+  // First we want to find the ranges of pages that hold sleds, and make all
+  // of them writeable for the time of the patching. This takes one call to
+  // mprotect(...) per range, and leaves the pages between the ranges alone,
+  // which may not be mapped.
+  size_t RangeCount = 0;
+  forEachSledPages(InstrMap, PageSize, [&](uptr, uptr) { ++RangeCount; });
+  auto *Protectors = allocateBuffer<MProtectHelper>(RangeCount);
+  if (Protectors == nullptr)
+    return XRayPatchingStatus::FAILED;
+  size_t Protected = 0;
+  auto ProtectorsCleanup = at_scope_exit([&] {
+    for (size_t I = 0; I < Protected; ++I)
+      Protectors[I].~MProtectHelper();
+    deallocateBuffer(Protectors, RangeCount);
+  });
+  bool ProtectionFailed = false;
+  forEachSledPages(InstrMap, PageSize, [&](uptr Begin, uptr End) {
+    if (ProtectionFailed)
+      return;
+    auto *Protector = new (&Protectors[Protected++]) MProtectHelper(
+        reinterpret_cast<void *>(Begin), End - Begin, PageSize);
+    ProtectionFailed = Protector->MakeWriteable() == -1;
+  });
+  if (ProtectionFailed) {
     Report("Failed mprotect: %d\n", errno);
     return XRayPatchingStatus::FAILED;
   }
 
-  for (std::size_t I = 0; I < InstrMap.Entries; ++I) {
-    auto &Sled = InstrMap.Sleds[I];
-    auto F = Sled.Function;
-    if (CurFun == 0)
-      CurFun = F;
-    if (F != CurFun) {
+  // Then we split the sleds in chunks at function boundaries, patched from as
+  // many threads. Function ids are assigned in the order of the sleds.
+  constexpr size_t MaxPatchingThreads = 64;
+  constexpr size_t MinSledsPerChunk = 4096;
+  SledChunk Chunks[MaxPatchingThreads];
+  const size_t MaxChunks =
+      Min(Min<size_t>(Max(flags()->xray_patching_threads, 1),
+                      MaxPatchingThreads),
+          Max<size_t>(InstrMap.Entries / MinSledsPerChunk, 1));
+  const size_t ChunkSize = InstrMap.Entries / MaxChunks;
+  size_t ChunkCount = 1;
+  Chunks[0] = {InstrMap.Sleds, nullptr, 1, Enable};
+  if (MaxChunks > 1) {
+    uint32_t FuncId = 1;
+    uint64_t CurFun = InstrMap.Sleds[0].Function;
+    for (std::size_t I = 1; I < InstrMap.Entries; ++I) {
+      const auto *Sled = &InstrMap.Sleds[I];
+      if (Sled->Function == CurFun)
+        continue;
       ++FuncId;
-      CurFun = F;
+      CurFun = Sled->Function;
+      if (ChunkCount < MaxChunks && I >= ChunkCount * ChunkSize) {
+        Chunks[ChunkCount - 1].End = Sled;
+        Chunks[ChunkCount++] = {Sled, nullptr, FuncId, Enable};
+      }
     }
-    patchSled(Sled, Enable, FuncId);
   }
+  Chunks[ChunkCount - 1].End = InstrMap.Sleds + InstrMap.Entries;
+
+  pthread_t Threads[MaxPatchingThreads];
+  bool Started[MaxPatchingThreads] = {};
+  for (size_t I = 1; I < ChunkCount; ++I)
+    Started[I] =
+        pthread_create(&Threads[I], nullptr, patchSledChunk, &Chunks[I]) == 0;
+  patchSledChunk(&Chunks[0]);
+  for (size_t I = 1; I < ChunkCount; ++I) {
+    if (Started[I])
+      pthread_join(Threads[I], nullptr);
+    else
+      patchSledChunk(&Chunks[I]);
+  }
+
   atomic_store(&XRayPatching, false,
                             memory_order_release);
   PatchingSuccess = true;
@@ -372,6 +452,11 @@ int __xray_set_handler(void (*entry)(int32_t,
                                      XRayEntryType)) XRAY_NEVER_INSTRUMENT {
   if (atomic_load(&XRayInitialized,
                                memory_order_acquire)) {
+    // With sampling, the sleds call the handler through the sampling one.
+    if (entry != nullptr && __xray::samplingEnabled()) {
+      __xray::setSampledHandler(entry);
+      entry = __xray::sampledHandler;
+    }
 
     atomic_store(&__xray::XRayPatchedFunction,
                               reinterpret_cast<uintptr_t>(entry),
@@ -450,6 +535,11 @@ int __xray_set_handler_arg1(void (*entry)(int32_t, XRayEntryType, uint64_t)) {
                                 memory_order_acquire))
     return 0;
 
+  if (entry != nullptr && samplingEnabled()) {
+    setSampledHandlerArg1(entry);
+    entry = sampledHandlerArg1;
+  }
+
   // A relaxed write might not be visible even if the current thread gets
   // scheduled on a different CPU/NUMA node.  We need to wait for everyone to
   // have this handler installed for consistency of collected data across CPUs.
@@ -62,28 +62,28 @@ struct ThreadData {
   FunctionCallTrie::Allocators Allocators;
   FunctionCallTrie FCT;
   tid_t TId;
+  ThreadData *Next;
 };
 
-using ThreadDataArray = Array<ThreadData>;
-using ThreadDataAllocator = ThreadDataArray::AllocatorType;
-
-// We use a separate buffer queue for the backing store for the allocator used
-// by the ThreadData array. This lets us host the buffers, allocators, and tries
-// associated with a thread by moving the data into the array instead of
-// attempting to copy the data to a separately backed set of tries.
+// We use a separate buffer queue for the backing store of the ThreadData
+// slots. This lets us host the buffers, allocators, and tries associated with a
+// thread by moving the data into a slot instead of attempting to copy the data
+// to a separately backed set of tries.
+//
+// Threads publish their data without taking a lock: they claim a slot by
+// bumping ThreadDataOffset, move their data into it, then push the slot onto
+// the ThreadDataHead list. The list only ever grows until the next reset(), so
+// serialize() can walk a snapshot of it while other threads keep posting.
 static typename std::aligned_storage<
     sizeof(BufferQueue), alignof(BufferQueue)>::type BufferQueueStorage;
 static BufferQueue *BQ = nullptr;
 static BufferQueue::Buffer Buffer;
-static typename std::aligned_storage<sizeof(ThreadDataAllocator),
-                                     alignof(ThreadDataAllocator)>::type
-    ThreadDataAllocatorStorage;
-static typename std::aligned_storage<sizeof(ThreadDataArray),
-                                     alignof(ThreadDataArray)>::type
-    ThreadDataArrayStorage;
+static atomic_uintptr_t ThreadDataOffset{0};
+static atomic_uintptr_t ThreadDataHead{0};
 
-static ThreadDataAllocator *TDAllocator = nullptr;
-static ThreadDataArray *TDArray = nullptr;
+// The number of post(...) calls that may be using the slots, which reset()
+// waits for before releasing their backing store.
+static atomic_uint32_t PostsInFlight{0};
 
 using ProfileBufferArray = Array<ProfileBuffer>;
 using ProfileBufferArrayAllocator = typename ProfileBufferArray::AllocatorType;
@@ -111,8 +111,9 @@ void post(BufferQueue *Q, FunctionCallTrie &&T,
           tid_t TId) XRAY_NEVER_INSTRUMENT {
   DCHECK_NE(Q, nullptr);
 
-  // Bail out early if the collector has not been initialized.
-  if (!atomic_load(&CollectorInitialized, memory_order_acquire)) {
+  // If the collector has not been initialized, or if we fail to find a slot
+  // for the data, we should destroy the objects handed us.
+  auto Discard = [&]() XRAY_NEVER_INSTRUMENT {
     T.~FunctionCallTrie();
     A.~Allocators();
     Q->releaseBuffer(B.NodeBuffer);
@@ -120,27 +121,38 @@ void post(BufferQueue *Q, FunctionCallTrie &&T,
     Q->releaseBuffer(B.ShadowStackBuffer);
     Q->releaseBuffer(B.NodeIdPairBuffer);
     B.~Buffers();
+  };
+
+  // This pairs with reset(), which clears CollectorInitialized then waits for
+  // PostsInFlight to drop to 0: either it sees us in flight, or we see the
+  // collector uninitialized.
+  atomic_fetch_add(&PostsInFlight, 1, memory_order_seq_cst);
+  auto PostDone = at_scope_exit([]() XRAY_NEVER_INSTRUMENT {
+    atomic_fetch_sub(&PostsInFlight, 1, memory_order_release);
+  });
+
+  // Bail out early if the collector has not been initialized.
+  if (!atomic_load(&CollectorInitialized, memory_order_seq_cst)) {
+    Discard();
     return;
   }
 
-  {
-    SpinMutexLock Lock(&GlobalMutex);
-    DCHECK_NE(TDAllocator, nullptr);
-    DCHECK_NE(TDArray, nullptr);
-
-    if (TDArray->AppendEmplace(Q, std::move(B), std::move(A), std::move(T),
-                               TId) == nullptr) {
-      // If we fail to add the data to the array, we should destroy the objects
-      // handed us.
-      T.~FunctionCallTrie();
-      A.~Allocators();
-      Q->releaseBuffer(B.NodeBuffer);
-      Q->releaseBuffer(B.RootsBuffer);
-      Q->releaseBuffer(B.ShadowStackBuffer);
-      Q->releaseBuffer(B.NodeIdPairBuffer);
-      B.~Buffers();
-    }
+  const uptr SlotSize = RoundUpTo(sizeof(ThreadData), alignof(ThreadData));
+  const uptr Offset =
+      atomic_fetch_add(&ThreadDataOffset, SlotSize, memory_order_relaxed);
+  if (Offset + SlotSize > Buffer.Size) {
+    Discard();
+    return;
   }
+
+  auto *TD = new (static_cast<char *>(Buffer.Data) + Offset) ThreadData{
+      Q, std::move(B), std::move(A), std::move(T), TId, nullptr};
+  uptr Head = atomic_load(&ThreadDataHead, memory_order_relaxed);
+  do {
+    TD->Next = reinterpret_cast<ThreadData *>(Head);
+  } while (!atomic_compare_exchange_weak(&ThreadDataHead, &Head,
+                                         reinterpret_cast<uptr>(TD),
+                                         memory_order_release));
 }
 
 // A PathArray represents the function id's representing a stack trace. In this
@@ -227,12 +239,94 @@ static void serializeRecords(ProfileBuffer *Buffer, const BlockHeader &Header,
   DCHECK_EQ(NextPtr - static_cast<uint8_t *>(Buffer->Data), Buffer->Size);
 }
 
+// Serializes the trie of a thread into a newly allocated block, using the
+// arenas for the intermediary data. The block is left empty if the trie is
+// empty, and its number is filled in once all the blocks are serialized.
+static void serializeTrie(ProfileBuffer *Block, const ThreadData &TD,
+                          uint8_t *ProfileArena,
+                          uint8_t *PathArena) XRAY_NEVER_INSTRUMENT {
+  *Block = {nullptr, 0};
+  if (TD.FCT.getRoots().empty())
+    return;
+
+  using ProfileRecordAllocator = typename ProfileRecordArray::AllocatorType;
+  ProfileRecordAllocator PRAlloc(ProfileArena,
+                                 profilingFlags()->global_allocator_max);
+  ProfileRecord::PathAllocator PathAlloc(
+      PathArena, profilingFlags()->global_allocator_max);
+  ProfileRecordArray ProfileRecords(PRAlloc);
+
+  // First, we want to compute the amount of space we're going to need. We'll
+  // use a local allocator and an __xray::Array<...> to store the intermediary
+  // data, then compute the size as we're going along. Then we'll allocate the
+  // contiguous space to contain the thread buffer data.
+  populateRecords(ProfileRecords, PathAlloc, TD.FCT);
+  DCHECK(!ProfileRecords.empty());
+
+  // Go through each record, to compute the sizes.
+  //
+  // header size = block size (4 bytes)
+  //   + block number (4 bytes)
+  //   + thread id (8 bytes)
+  // record size = path ids (4 bytes * number of ids + sentinel 4 bytes)
+  //   + call count (8 bytes)
+  //   + local time (8 bytes)
+  //   + end of record (8 bytes)
+  u32 CumulativeSizes = 0;
+  for (const auto &Record : ProfileRecords)
+    CumulativeSizes += 20 + (4 * Record.Path.size());
+
+  BlockHeader Header{16 + CumulativeSizes, 0, TD.TId};
+  const size_t Size = sizeof(Header) + CumulativeSizes;
+  void *Data = allocateBuffer(Size);
+  if (Data == nullptr)
+    return;
+  *Block = {Data, Size};
+  serializeRecords(Block, Header, ProfileRecords);
+}
+
+// The tries to serialize, shared by the threads doing so: each thread claims
+// the next trie in turn, and stores its serialized form in the corresponding
+// entry of Blocks.
+struct SerializationState {
+  const ThreadData **Tries;
+  ProfileBuffer *Blocks;
+  uptr Count;
+  atomic_uintptr_t Next;
+};
+
+static void *serializeTries(void *Arg) XRAY_NEVER_INSTRUMENT {
+  auto &State = *static_cast<SerializationState *>(Arg);
+  auto MaxSize = profilingFlags()->global_allocator_max;
+  auto ProfileArena = allocateBuffer(MaxSize);
+  if (ProfileArena == nullptr)
+    return nullptr;
+
+  auto ProfileArenaCleanup = at_scope_exit(
+      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(ProfileArena, MaxSize); });
+
+  auto PathArena = allocateBuffer(MaxSize);
+  if (PathArena == nullptr)
+    return nullptr;
+
+  auto PathArenaCleanup = at_scope_exit(
+      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(PathArena, MaxSize); });
+
+  for (uptr I = atomic_fetch_add(&State.Next, 1, memory_order_relaxed);
+       I < State.Count;
+       I = atomic_fetch_add(&State.Next, 1, memory_order_relaxed))
+    serializeTrie(&State.Blocks[I], *State.Tries[I], ProfileArena, PathArena);
+  return nullptr;
+}
+
 } // namespace
 
 void serialize() XRAY_NEVER_INSTRUMENT {
   if (!atomic_load(&CollectorInitialized, memory_order_acquire))
     return;
 
+  // The lock only orders serialize() with reset() and nextBuffer(): threads
+  // keep posting their tries while we serialize the ones posted so far.
   SpinMutexLock Lock(&GlobalMutex);
 
   // Clear out the global ProfileBuffers, if it's not empty.
@@ -240,72 +334,72 @@ void serialize() XRAY_NEVER_INSTRUMENT {
     deallocateBuffer(reinterpret_cast<unsigned char *>(B.Data), B.Size);
   ProfileBuffers->trim(ProfileBuffers->size());
 
-  DCHECK_NE(TDArray, nullptr);
-  if (TDArray->empty())
+  // Take a snapshot of the tries posted so far, in the order they were posted.
+  const auto *Head = reinterpret_cast<const ThreadData *>(
+      atomic_load(&ThreadDataHead, memory_order_acquire));
+  uptr Count = 0;
+  for (const auto *TD = Head; TD != nullptr; TD = TD->Next)
+    ++Count;
+  if (Count == 0)
     return;
 
-  // Then repopulate the global ProfileBuffers.
-  u32 I = 0;
-  auto MaxSize = profilingFlags()->global_allocator_max;
-  auto ProfileArena = allocateBuffer(MaxSize);
-  if (ProfileArena == nullptr)
+  auto Tries = allocateBuffer<const ThreadData *>(Count);
+  if (Tries == nullptr)
     return;
-
-  auto ProfileArenaCleanup = at_scope_exit(
-      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(ProfileArena, MaxSize); });
-
-  auto PathArena = allocateBuffer(profilingFlags()->global_allocator_max);
-  if (PathArena == nullptr)
+  auto TriesCleanup = at_scope_exit(
+      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(Tries, Count); });
+  uptr I = Count;
+  for (const auto *TD = Head; TD != nullptr; TD = TD->Next)
+    Tries[--I] = TD;
+
+  auto Blocks = initArray<ProfileBuffer>(Count);
+  if (Blocks == nullptr)
     return;
-
-  auto PathArenaCleanup = at_scope_exit(
-      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(PathArena, MaxSize); });
-
-  for (const auto &ThreadTrie : *TDArray) {
-    using ProfileRecordAllocator = typename ProfileRecordArray::AllocatorType;
-    ProfileRecordAllocator PRAlloc(ProfileArena,
-                                   profilingFlags()->global_allocator_max);
-    ProfileRecord::PathAllocator PathAlloc(
-        PathArena, profilingFlags()->global_allocator_max);
-    ProfileRecordArray ProfileRecords(PRAlloc);
-
-    // First, we want to compute the amount of space we're going to need. We'll
-    // use a local allocator and an __xray::Array<...> to store the intermediary
-    // data, then compute the size as we're going along. Then we'll allocate the
-    // contiguous space to contain the thread buffer data.
-    if (ThreadTrie.FCT.getRoots().empty())
+  auto BlocksCleanup = at_scope_exit(
+      [&]() XRAY_NEVER_INSTRUMENT { deallocateBuffer(Blocks, Count); });
+
+  // The tries are independent from one another, so we serialize them from
+  // several threads, this one included, each with its own arenas.
+  constexpr uptr MaxSerializationThreads = 64;
+  SerializationState State{Tries, Blocks, Count, {0}};
+  uptr ThreadCount = Min<uptr>(
+      Min<uptr>(Max(profilingFlags()->serialization_threads, 1), Count),
+      MaxSerializationThreads);
+  pthread_t Threads[MaxSerializationThreads];
+  uptr Started = 0;
+  while (Started + 1 < ThreadCount &&
+         pthread_create(&Threads[Started], nullptr, serializeTries, &State) ==
+             0)
+    ++Started;
+  serializeTries(&State);
+  for (uptr T = 0; T < Started; ++T)
+    pthread_join(Threads[T], nullptr);
+
+  // Then repopulate the global ProfileBuffers, numbering the blocks in order.
+  u32 BlockNum = 0;
+  for (I = 0; I < Count; ++I) {
+    auto &B = Blocks[I];
+    if (B.Data == nullptr)
       continue;
-
-    populateRecords(ProfileRecords, PathAlloc, ThreadTrie.FCT);
-    DCHECK(!ThreadTrie.FCT.getRoots().empty());
-    DCHECK(!ProfileRecords.empty());
-
-    // Go through each record, to compute the sizes.
-    //
-    // header size = block size (4 bytes)
-    //   + block number (4 bytes)
-    //   + thread id (8 bytes)
-    // record size = path ids (4 bytes * number of ids + sentinel 4 bytes)
-    //   + call count (8 bytes)
-    //   + local time (8 bytes)
-    //   + end of record (8 bytes)
-    u32 CumulativeSizes = 0;
-    for (const auto &Record : ProfileRecords)
-      CumulativeSizes += 20 + (4 * Record.Path.size());
-
-    BlockHeader Header{16 + CumulativeSizes, I++, ThreadTrie.TId};
-    auto B = ProfileBuffers->Append({});
-    B->Size = sizeof(Header) + CumulativeSizes;
-    B->Data = allocateBuffer(B->Size);
-    DCHECK_NE(B->Data, nullptr);
-    serializeRecords(B, Header, ProfileRecords);
+    internal_memcpy(static_cast<char *>(B.Data) +
+                        offsetof(BlockHeader, BlockNum),
+                    &BlockNum, sizeof(BlockNum));
+    if (ProfileBuffers->Append(B) == nullptr) {
+      deallocateBuffer(reinterpret_cast<unsigned char *>(B.Data), B.Size);
+      continue;
+    }
+    ++BlockNum;
   }
 }
 
 void reset() XRAY_NEVER_INSTRUMENT {
-  atomic_store(&CollectorInitialized, 0, memory_order_release);
+  atomic_store(&CollectorInitialized, 0, memory_order_seq_cst);
   SpinMutexLock Lock(&GlobalMutex);
 
+  // Wait for the threads that are posting data to be done with the slots.
+  while (atomic_load(&PostsInFlight, memory_order_seq_cst) != 0)
+    internal_sched_yield();
+
   if (ProfileBuffers != nullptr) {
     // Clear out the profile buffers that have been serialized.
     for (auto &B : *ProfileBuffers)
@@ -314,25 +408,18 @@ void reset() XRAY_NEVER_INSTRUMENT {
     ProfileBuffers = nullptr;
   }
 
-  if (TDArray != nullptr) {
-    // Release the resources as required.
-    for (auto &TD : *TDArray) {
-      TD.BQ->releaseBuffer(TD.Buffers.NodeBuffer);
-      TD.BQ->releaseBuffer(TD.Buffers.RootsBuffer);
-      TD.BQ->releaseBuffer(TD.Buffers.ShadowStackBuffer);
-      TD.BQ->releaseBuffer(TD.Buffers.NodeIdPairBuffer);
-    }
-    // We don't bother destroying the array here because we've already
-    // potentially freed the backing store for the array. Instead we're going to
-    // reset the pointer to nullptr, and re-use the storage later instead
-    // (placement-new'ing into the storage as-is).
-    TDArray = nullptr;
-  }
-
-  if (TDAllocator != nullptr) {
-    TDAllocator->~Allocator();
-    TDAllocator = nullptr;
+  // Release the resources as required. We don't bother destroying the slots
+  // here, as we're releasing their backing store.
+  for (auto *TD = reinterpret_cast<ThreadData *>(
+           atomic_load(&ThreadDataHead, memory_order_acquire));
+       TD != nullptr; TD = TD->Next) {
+    TD->BQ->releaseBuffer(TD->Buffers.NodeBuffer);
+    TD->BQ->releaseBuffer(TD->Buffers.RootsBuffer);
+    TD->BQ->releaseBuffer(TD->Buffers.ShadowStackBuffer);
+    TD->BQ->releaseBuffer(TD->Buffers.NodeIdPairBuffer);
   }
+  atomic_store(&ThreadDataHead, 0, memory_order_relaxed);
+  atomic_store(&ThreadDataOffset, 0, memory_order_relaxed);
 
   if (Buffer.Data != nullptr) {
     BQ->releaseBuffer(Buffer);
@@ -365,13 +452,6 @@ void reset() XRAY_NEVER_INSTRUMENT {
   ProfileBuffers =
       reinterpret_cast<ProfileBufferArray *>(&ProfileBuffersStorage);
 
-  new (&ThreadDataAllocatorStorage)
-      ThreadDataAllocator(Buffer.Data, Buffer.Size);
-  TDAllocator =
-      reinterpret_cast<ThreadDataAllocator *>(&ThreadDataAllocatorStorage);
-  new (&ThreadDataArrayStorage) ThreadDataArray(*TDAllocator);
-  TDArray = reinterpret_cast<ThreadDataArray *>(&ThreadDataArrayStorage);
-
   atomic_store(&CollectorInitialized, 1, memory_order_release);
 }
 
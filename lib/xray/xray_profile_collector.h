@@ -34,7 +34,8 @@ namespace profileCollectorService {
 ///
 /// Moves the collection of FunctionCallTrie, Allocators, and Buffers associated
 /// with a thread's data to the queue. This takes ownership of the memory
-/// associated with a thread, and manages those exclusively.
+/// associated with a thread, and manages those exclusively. This does not
+/// take a lock, and does not wait for a concurrent serialize().
 ///
 void post(BufferQueue *Q, FunctionCallTrie &&T,
           FunctionCallTrie::Allocators &&A,
@@ -55,6 +56,9 @@ void post(BufferQueue *Q, FunctionCallTrie &&T,
 ///     - cumulative local time (64 bit)
 ///     - record delimiter (64 bit, 0x0)
 ///
+/// The tries are serialized from up to `serialization_threads` threads, and
+/// only the ones posted before the call are serialized.
+///
 void serialize();
 
 /// The reset function will clear out any internal memory held by the
@@ -0,0 +1,227 @@
+//===-- xray_sampling.cpp --------------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a dynamic runtime instrumentation system.
+//
+// Implementation of the sampling of the function entry and exit events.
+//===----------------------------------------------------------------------===//
+#include "xray_sampling.h"
+
+#include <time.h>
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "xray_allocator.h"
+#include "xray_defs.h"
+#include "xray_tsc.h"
+
+namespace __xray {
+
+namespace {
+
+// The configuration, set once by initSampling(...).
+struct SamplingConfig {
+  bool Enabled;
+  bool TSCSupported;
+  uint32_t EveryN;
+  uint64_t IntervalTicks;
+  uint32_t MaxPerSecond;
+  uint64_t TicksPerSecond;
+
+  // For each function id, the second the calls are counted for in the upper
+  // bits, and the number of calls recorded during that second in the lower
+  // ones.
+  atomic_uint64_t *Rates;
+  size_t Functions;
+};
+
+constexpr unsigned kRateCountBits = 24;
+constexpr uint64_t kRateCountMask = (1ULL << kRateCountBits) - 1;
+
+// A call in progress, with the decision taken on its entry. Frame is the
+// frame address of the handler called on the entry: the frames of the calls
+// which are still in progress are above the frames of the calls they made.
+struct SampledCall {
+  uintptr_t Frame;
+  int32_t FuncId;
+  bool Sampled;
+};
+
+constexpr uint32_t kMaxTrackedDepth = 64;
+
+// The sampling state of a thread. The calls deeper than the number of tracked
+// ones share the decision taken for the deepest tracked call.
+struct SamplingState {
+  SampledCall Calls[kMaxTrackedDepth];
+  uint32_t Depth;
+  uint32_t Untracked;
+  uint32_t Countdown;
+  uint64_t NextSampleTicks;
+};
+
+SamplingConfig Config;
+thread_local SamplingState State;
+
+atomic_uintptr_t SampledFunction{0};
+atomic_uintptr_t SampledArgLogger{0};
+
+} // namespace
+
+static uint64_t readTicks() XRAY_NEVER_INSTRUMENT {
+  if (Config.TSCSupported) {
+    uint8_t CPU;
+    return readTSC(CPU);
+  }
+  timespec TS;
+  if (clock_gettime(CLOCK_MONOTONIC, &TS) != 0)
+    return 0;
+  return TS.tv_sec * NanosecondsPerSecond + TS.tv_nsec;
+}
+
+// Counts a call of the function against its limit for the current second,
+// returning false if the limit has been reached.
+static bool withinRateLimit(int32_t FuncId,
+                            uint64_t Ticks) XRAY_NEVER_INSTRUMENT {
+  if (FuncId <= 0 || static_cast<size_t>(FuncId) > Config.Functions)
+    return true;
+  auto &Rate = Config.Rates[FuncId - 1];
+  const uint64_t Second = Ticks / Config.TicksPerSecond;
+  atomic_uint64_t::Type Old = atomic_load(&Rate, memory_order_relaxed);
+  while (true) {
+    uint64_t New;
+    if ((Old >> kRateCountBits) != Second)
+      New = (Second << kRateCountBits) | 1;
+    else if ((Old & kRateCountMask) >= Config.MaxPerSecond)
+      return false;
+    else
+      New = Old + 1;
+    if (atomic_compare_exchange_weak(&Rate, &Old, New, memory_order_relaxed))
+      return true;
+  }
+}
+
+void initSampling(uint32_t EveryN, uint64_t IntervalUs, uint32_t MaxPerSecond,
+                  size_t Functions) XRAY_NEVER_INSTRUMENT {
+  if (Config.Rates != nullptr)
+    deallocateBuffer(Config.Rates, Config.Functions);
+  Config = {};
+  Config.EveryN = EveryN > 1 ? EveryN : 0;
+  Config.MaxPerSecond =
+      Min<uint32_t>(MaxPerSecond, static_cast<uint32_t>(kRateCountMask));
+  Config.Enabled = Config.EveryN != 0 || IntervalUs != 0 || MaxPerSecond != 0;
+  if (IntervalUs == 0 && MaxPerSecond == 0)
+    return;
+
+  Config.TSCSupported = probeRequiredCPUFeatures();
+  Config.TicksPerSecond =
+      Config.TSCSupported ? getTSCFrequency() : NanosecondsPerSecond;
+  if (Config.TicksPerSecond == 0)
+    Config.TicksPerSecond = NanosecondsPerSecond;
+  Config.IntervalTicks = IntervalUs * (Config.TicksPerSecond / 1000000);
+  if (Config.MaxPerSecond != 0 && Functions != 0) {
+    // Freshly mapped memory is zeroed, which is an empty rate.
+    Config.Rates = allocateBuffer<atomic_uint64_t>(Functions);
+    if (Config.Rates == nullptr) {
+      Report("XRay: Cannot allocate the per-function sampling rates.\n");
+      Config.MaxPerSecond = 0;
+      return;
+    }
+    Config.Functions = Functions;
+  }
+}
+
+bool samplingEnabled() XRAY_NEVER_INSTRUMENT { return Config.Enabled; }
+
+bool sampleEvent(int32_t FuncId, XRayEntryType Type,
+                 uintptr_t Frame) XRAY_NEVER_INSTRUMENT {
+  auto &S = State;
+  if (Type == XRayEntryType::EXIT || Type == XRayEntryType::TAIL) {
+    if (S.Untracked != 0) {
+      --S.Untracked;
+      return S.Calls[kMaxTrackedDepth - 1].Sampled;
+    }
+    // The exit matches the innermost call of the function, the calls entered
+    // after it were unwound (eg: by an exception or longjmp). Calls that were
+    // entered before the handler was installed aren't recorded.
+    for (uint32_t I = S.Depth; I > 0; --I) {
+      if (S.Calls[I - 1].FuncId == FuncId) {
+        S.Depth = I - 1;
+        return S.Calls[I - 1].Sampled;
+      }
+    }
+    return false;
+  }
+  if (Type != XRayEntryType::ENTRY && Type != XRayEntryType::LOG_ARGS_ENTRY)
+    return true;
+
+  // The calls whose frames are not above the frame of this one were unwound.
+  if (S.Depth != 0 && S.Calls[S.Depth - 1].Frame <= Frame) {
+    do
+      --S.Depth;
+    while (S.Depth != 0 && S.Calls[S.Depth - 1].Frame <= Frame);
+    S.Untracked = 0;
+  }
+  if (S.Depth == kMaxTrackedDepth) {
+    ++S.Untracked;
+    return S.Calls[kMaxTrackedDepth - 1].Sampled;
+  }
+
+  bool Sample = true;
+  if (Config.EveryN != 0) {
+    if (S.Countdown != 0) {
+      --S.Countdown;
+      Sample = false;
+    } else {
+      S.Countdown = Config.EveryN - 1;
+    }
+  }
+  if (Sample && (Config.IntervalTicks != 0 || Config.MaxPerSecond != 0)) {
+    const uint64_t Ticks = readTicks();
+    if (Ticks < S.NextSampleTicks)
+      Sample = false;
+    else if (Config.MaxPerSecond != 0 && !withinRateLimit(FuncId, Ticks))
+      Sample = false;
+    else
+      S.NextSampleTicks = Ticks + Config.IntervalTicks;
+  }
+  S.Calls[S.Depth++] = {Frame, FuncId, Sample};
+  return Sample;
+}
+
+void sampledHandler(int32_t FuncId, XRayEntryType Type) XRAY_NEVER_INSTRUMENT {
+  if (!sampleEvent(FuncId, Type, GET_CURRENT_FRAME()))
+    return;
+  auto Fn = reinterpret_cast<void (*)(int32_t, XRayEntryType)>(
+      atomic_load(&SampledFunction, memory_order_acquire));
+  if (Fn != nullptr)
+    Fn(FuncId, Type);
+}
+
+void sampledHandlerArg1(int32_t FuncId, XRayEntryType Type,
+                        uint64_t Arg1) XRAY_NEVER_INSTRUMENT {
+  if (!sampleEvent(FuncId, Type, GET_CURRENT_FRAME()))
+    return;
+  auto Fn = reinterpret_cast<void (*)(int32_t, XRayEntryType, uint64_t)>(
+      atomic_load(&SampledArgLogger, memory_order_acquire));
+  if (Fn != nullptr)
+    Fn(FuncId, Type, Arg1);
+}
+
+void setSampledHandler(void (*Handler)(int32_t, XRayEntryType))
+    XRAY_NEVER_INSTRUMENT {
+  atomic_store(&SampledFunction, reinterpret_cast<uintptr_t>(Handler),
+               memory_order_release);
+}
+
+void setSampledHandlerArg1(void (*Handler)(int32_t, XRayEntryType, uint64_t))
+    XRAY_NEVER_INSTRUMENT {
+  atomic_store(&SampledArgLogger, reinterpret_cast<uintptr_t>(Handler),
+               memory_order_release);
+}
+
+} // namespace __xray
@@ -0,0 +1,57 @@
+//===-- xray_sampling.h ----------------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of XRay, a dynamic runtime instrumentation system.
+//
+// Sampling of the function entry and exit events, so that the handlers only
+// see a fraction of the function calls.
+//===----------------------------------------------------------------------===//
+#ifndef XRAY_XRAY_SAMPLING_H
+#define XRAY_XRAY_SAMPLING_H
+
+#include "xray/xray_interface.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace __xray {
+
+/// Configures the sampling of the function calls, for the handlers installed
+/// from then on:
+///
+///   - |EveryN| records one in N calls of each thread, 0 or 1 records all.
+///   - |IntervalUs| records at most one call per interval on each thread.
+///   - |MaxPerSecond| records at most this many calls of each function per
+///     second, across threads. |Functions| is the number of function ids.
+///
+/// The decision to record a call is taken on its entry, and the exit of the
+/// call is recorded if and only if its entry was, so that handlers always see
+/// matched entries and exits. Sampling is disabled when all of |EveryN|,
+/// |IntervalUs| and |MaxPerSecond| are 0.
+void initSampling(uint32_t EveryN, uint64_t IntervalUs, uint32_t MaxPerSecond,
+                  size_t Functions);
+
+/// Returns true when the installed handlers should go through sampling.
+bool samplingEnabled();
+
+/// Returns whether the event should be passed on to the handler, updating the
+/// sampling state of the current thread. |Frame| is the frame address of the
+/// handler, which must be at the same distance from the entry of the function
+/// for all the entry events. The calls whose entries have frames at or below
+/// it are known to have been unwound.
+bool sampleEvent(int32_t FuncId, XRayEntryType Type, uintptr_t Frame);
+
+/// Handlers that pass the sampled events on to the given handlers, and the
+/// functions that set those.
+void sampledHandler(int32_t FuncId, XRayEntryType Type);
+void sampledHandlerArg1(int32_t FuncId, XRayEntryType Type, uint64_t Arg1);
+void setSampledHandler(void (*Handler)(int32_t, XRayEntryType));
+void setSampledHandlerArg1(void (*Handler)(int32_t, XRayEntryType, uint64_t));
+
+} // namespace __xray
+
+#endif // XRAY_XRAY_SAMPLING_H
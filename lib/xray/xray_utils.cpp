@@ -71,6 +71,14 @@ void LogWriter::WriteAll(const char *Begin, const char *End) XRAY_NEVER_INSTRUME
   Offset += TotalBytes;
 }
 
+void LogWriter::WriteAll(struct iovec *Iov,
+                         int Count) XRAY_NEVER_INSTRUMENT {
+  for (int I = 0; I < Count; ++I) {
+    const char *Begin = static_cast<const char *>(Iov[I].iov_base);
+    WriteAll(Begin, Begin + Iov[I].iov_len);
+  }
+}
+
 void LogWriter::Flush() XRAY_NEVER_INSTRUMENT {
   // Nothing to do here since WriteAll writes directly into the VMO.
 }
@@ -150,6 +158,31 @@ void LogWriter::WriteAll(const char *Begin, const char *End) XRAY_NEVER_INSTRUME
   }
 }
 
+void LogWriter::WriteAll(struct iovec *Iov,
+                         int Count) XRAY_NEVER_INSTRUMENT {
+  while (Count > 0) {
+    auto Written = writev(Fd, Iov, Count);
+    if (Written < 0) {
+      if (errno == EINTR)
+        continue; // Try again.
+      Report("Failed to write; errno = %d\n", errno);
+      return;
+    }
+    if (Written == 0)
+      return;
+    // Skip what has been written, which may end in the middle of an iovec.
+    while (Count > 0 && static_cast<size_t>(Written) >= Iov->iov_len) {
+      Written -= Iov->iov_len;
+      ++Iov;
+      --Count;
+    }
+    if (Count > 0) {
+      Iov->iov_base = static_cast<char *>(Iov->iov_base) + Written;
+      Iov->iov_len -= Written;
+    }
+  }
+}
+
 void LogWriter::Flush() XRAY_NEVER_INSTRUMENT {
   fsync(Fd);
 }
@@ -17,6 +17,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <utility>
 
 #include "sanitizer_common/sanitizer_common.h"
@@ -38,6 +39,10 @@ public:
  // Write a character range into a log.
  void WriteAll(const char *Begin, const char *End);
 
+ // Write the character ranges of |Count| iovecs into a log, in order. The
+ // iovecs are updated as they get written.
+ void WriteAll(struct iovec *Iov, int Count);
+
  void Flush();
 
  // Returns a new log instance initialized using the flag-provided values.
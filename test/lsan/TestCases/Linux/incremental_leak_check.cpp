@@ -0,0 +1,56 @@
+// Test for incremental on-demand leak checking. On kernels without soft-dirty
+// page tracking, the checks are full ones and must find the same leaks.
+// RUN: LSAN_BASE="use_stacks=0:use_registers=0:incremental=1"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: %env_lsan_opts=$LSAN_BASE %run %t recoverable 2>&1 | \
+// RUN:   FileCheck %s --check-prefix=RECOVERABLE
+// RUN: %env_lsan_opts=$LSAN_BASE:full_check_period=2 %run %t periodic 2>&1 | \
+// RUN:   FileCheck %s --check-prefix=PERIODIC
+// RUN: %env_lsan_opts=$LSAN_BASE not %run %t exit 2>&1 | \
+// RUN:   FileCheck %s --check-prefix=EXIT
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sanitizer/lsan_interface.h>
+
+void **old_chunk;
+
+int main(int argc, char *argv[]) {
+  assert(argc == 2);
+  old_chunk = (void **)malloc(2 * sizeof(void *));
+  old_chunk[0] = malloc(23);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+
+  if (!strcmp(argv[1], "recoverable")) {
+    // New chunks are found whether they are reachable from an old chunk or
+    // leaked.
+    old_chunk[1] = malloc(42);
+    fprintf(stderr, "Test alloc: %p.\n", malloc(1337));
+    assert(__lsan_do_recoverable_leak_check() == 1);
+    // RECOVERABLE: Test alloc:
+    // RECOVERABLE-NOT: Direct leak of 42 byte
+    // RECOVERABLE: SUMMARY: {{(Leak|Address)}}Sanitizer: 1337 byte(s) leaked in 1 allocation(s).
+    _exit(0);
+  }
+
+  // The old chunk becomes unreachable, which an incremental check may miss.
+  old_chunk = nullptr;
+  if (!strcmp(argv[1], "periodic")) {
+    // The second check is a full one.
+    fprintf(stderr, "Full check.\n");
+    assert(__lsan_do_recoverable_leak_check() == 1);
+    // PERIODIC: Full check.
+    // PERIODIC: SUMMARY: {{(Leak|Address)}}Sanitizer: {{[0-9]+}} byte(s) leaked in 2 allocation(s).
+    _exit(0);
+  }
+
+  // The check at exit is a full one, even after an incremental check.
+  __lsan_do_recoverable_leak_check();
+  fprintf(stderr, "Exit check.\n");
+  return 0;
+  // EXIT: Exit check.
+  // EXIT: SUMMARY: {{(Leak|Address)}}Sanitizer: {{[0-9]+}} byte(s) leaked in 2 allocation(s).
+}
@@ -0,0 +1,71 @@
+// Test that the incremental leak checks only scan the pages written to since
+// the previous check, where the kernel tracks the soft-dirty pages. Elsewhere,
+// the checks are full ones, and only that is tested.
+// RUN: LSAN_BASE="use_stacks=0:use_registers=0:incremental=1"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: %env_lsan_opts=$LSAN_BASE not %run %t 2>&1 | FileCheck %s
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sanitizer/lsan_interface.h>
+
+// Whether a page written to after clearing the soft-dirty bits has its bit
+// set, as the runtime checks.
+static bool SoftDirtySupported() {
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if (fd == -1)
+    return false;
+  bool cleared = write(fd, "4", 1) == 1;
+  close(fd);
+  if (!cleared)
+    return false;
+  long page_size = sysconf(_SC_PAGESIZE);
+  char *page = (char *)mmap(nullptr, page_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(page != MAP_FAILED);
+  *(volatile char *)page = 1;
+  uint64_t entry = 0;
+  fd = open("/proc/self/pagemap", O_RDONLY);
+  if (fd != -1) {
+    off_t offset = (uintptr_t)page / page_size * sizeof(entry);
+    if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
+      entry = 0;
+    close(fd);
+  }
+  munmap(page, page_size);
+  return entry & (1ULL << 55);
+}
+
+void **chunk;
+void *global;
+
+int main() {
+  bool incremental = SoftDirtySupported();
+  fprintf(stderr, "Soft-dirty pages supported: %d.\n", incremental);
+  long page_size = sysconf(_SC_PAGESIZE);
+  const size_t kPages = 16;
+  chunk = (void **)malloc(kPages * page_size);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+
+  // New chunks are found through the page written to in an old chunk, and
+  // through a global.
+  chunk[5 * page_size / sizeof(void *)] = malloc(42);
+  global = malloc(43);
+  assert(__lsan_do_recoverable_leak_check() == 0);
+
+  // The old chunk becomes unreachable. An incremental check doesn't scan the
+  // pages that weren't written to, and still finds it reachable.
+  chunk = nullptr;
+  assert(__lsan_do_recoverable_leak_check() == (incremental ? 0 : 1));
+  fprintf(stderr, "Exit check.\n");
+  return 0;
+}
+
+// CHECK: Soft-dirty pages supported
+// CHECK: Exit check.
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: {{[0-9]+}} byte(s) leaked in 2 allocation(s).
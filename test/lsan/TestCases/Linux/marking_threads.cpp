@@ -0,0 +1,78 @@
+// Test that the leaks found by several marking threads are the same as the
+// leaks found by a single one, on a heap graph larger than a frontier.
+// RUN: LSAN_BASE="use_stacks=0:use_registers=0"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: %env_lsan_opts=$LSAN_BASE:marking_threads=1 not %run %t > %t.1.log 2>&1
+// RUN: %env_lsan_opts=$LSAN_BASE:marking_threads=4 not %run %t > %t.4.log 2>&1
+// RUN: FileCheck %s < %t.1.log
+// RUN: FileCheck %s < %t.4.log
+// RUN: grep "leak of" %t.1.log | sort > %t.1.leaks
+// RUN: grep "leak of" %t.4.log | sort > %t.4.leaks
+// RUN: diff %t.1.leaks %t.4.leaks
+
+#include <stdlib.h>
+
+struct Node {
+  Node *edges[8];
+};
+
+static const int kNumNodes = 200000;
+static const int kNumLists = 10;
+static const int kListLength = 100;
+
+Node **nodes;
+
+__attribute__((noinline)) Node *AllocateReachable() {
+  return (Node *)calloc(1, sizeof(Node));
+}
+
+__attribute__((noinline)) Node *AllocateLeakedHead() {
+  return (Node *)calloc(1, sizeof(Node));
+}
+
+__attribute__((noinline)) Node *AllocateLeakedTail() {
+  return (Node *)calloc(1, sizeof(Node));
+}
+
+__attribute__((noinline)) void LeakList() {
+  Node *head = AllocateLeakedHead();
+  Node *node = head;
+  for (int i = 1; i < kListLength; i++) {
+    node->edges[i % 8] = AllocateLeakedTail();
+    node = node->edges[i % 8];
+  }
+}
+
+int main() {
+  srand(42);
+  nodes = (Node **)malloc(kNumNodes * sizeof(Node *));
+  for (int i = 0; i < kNumNodes; i++)
+    nodes[i] = AllocateReachable();
+  // The nodes are shuffled, and only the first one is reachable from the
+  // array: the others are reached through a binary tree, and the remaining
+  // edges point to random nodes.
+  for (int i = kNumNodes - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    Node *node = nodes[i];
+    nodes[i] = nodes[j];
+    nodes[j] = node;
+  }
+  for (int i = 0; i < kNumNodes; i++) {
+    for (int j = 0; j < 2; j++)
+      if (2 * i + 1 + j < kNumNodes)
+        nodes[i]->edges[j] = nodes[2 * i + 1 + j];
+    for (int j = 2; j < 8; j++)
+      nodes[i]->edges[j] = nodes[rand() % kNumNodes];
+  }
+  for (int i = 1; i < kNumNodes; i++)
+    nodes[i] = nullptr;
+  for (int i = 0; i < kNumLists; i++)
+    LeakList();
+  return 0;
+}
+
+// CHECK: LeakSanitizer: detected memory leaks
+// CHECK-DAG: Direct leak of 640 byte(s) in 10 object(s) allocated from:
+// CHECK-DAG: Indirect leak of 63360 byte(s) in 990 object(s) allocated from:
+// CHECK-NOT: AllocateReachable
+// CHECK: SUMMARY: {{(Leak|Address)}}Sanitizer: 64000 byte(s) leaked in 1000 allocation(s).
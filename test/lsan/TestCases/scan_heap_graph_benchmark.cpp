@@ -0,0 +1,72 @@
+// A benchmark that measures how fast the leak check scans a synthetic heap
+// graph: nodes holding a few pointers to other nodes, and words that are not
+// heap pointers (small integers, doubles, strings, code and stack addresses).
+// Usage: ./a.out number_of_nodes number_of_checks
+// RUN: LSAN_BASE="use_ld_allocations=0"
+// RUN: %clangxx_lsan %s -o %t
+// RUN: %env_lsan_opts=$LSAN_BASE %run %t 100000 2 2>&1 | FileCheck %s
+// RUN: %env_lsan_opts=$LSAN_BASE:use_unaligned=1 %run %t 100000 2 2>&1 | FileCheck %s
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sanitizer/lsan_interface.h>
+
+struct Node {
+  Node *edges[4];
+  unsigned long words[28];
+};
+
+Node **nodes;
+
+static double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  assert(argc == 3);
+  const int num_nodes = atoi(argv[1]);
+  const int num_checks = atoi(argv[2]);
+  int stack_word;
+  srand(42);
+  nodes = (Node **)malloc(num_nodes * sizeof(Node *));
+  for (int i = 0; i < num_nodes; i++)
+    nodes[i] = (Node *)malloc(sizeof(Node));
+  for (int i = 0; i < num_nodes; i++) {
+    Node *node = nodes[i];
+    for (int j = 0; j < 4; j++)
+      node->edges[j] = nodes[rand() % num_nodes];
+    for (int j = 0; j < 28; j++) {
+      unsigned long word;
+      switch (j % 7) {
+      case 0: word = rand() % 1000; break;
+      case 1: { double d = rand() / 7.0; memcpy(&word, &d, sizeof(d)); break; }
+      case 2: memcpy(&word, "a string", sizeof(word)); break;
+      case 3: word = (unsigned long)&main; break;
+      case 4: word = (unsigned long)&stack_word; break;
+      case 5: word = ((unsigned long)rand() << 16) ^ rand(); break;
+      default: word = 0; break;
+      }
+      node->words[j] = word;
+    }
+  }
+
+  double best = 0;
+  for (int i = 0; i < num_checks; i++) {
+    double start = Now();
+    int leaks = __lsan_do_recoverable_leak_check();
+    double elapsed = Now() - start;
+    assert(leaks == 0);
+    if (i == 0 || elapsed < best)
+      best = elapsed;
+  }
+  double bytes = (double)num_nodes * sizeof(Node);
+  fprintf(stderr, "Scanned %.1f MB of heap in %.1f ms: %.1f MB/s\n",
+          bytes / 1e6, best * 1e3, bytes / 1e6 / best);
+  return 0;
+}
+
+// CHECK: Scanned {{.*}} MB/s
@@ -0,0 +1,23 @@
+// Check that the counters are persisted in continuous mode, even if the
+// process is killed and never gets to write its profile at exit.
+//
+// RUN: %clang_profgen -Wl,-u,__llvm_profile_page_aligned_counters -o %t %s
+// RUN: rm -f %t.profraw
+// RUN: env LLVM_PROFILE_FILE=%t%c.profraw not --crash %run %t
+// RUN: llvm-profdata show --all-functions --counts %t.profraw | FileCheck %s
+
+#include <signal.h>
+
+void __attribute__((noinline)) foo(void) {}
+
+int main(void) {
+  for (int I = 0; I < 10; ++I)
+    foo();
+  raise(SIGKILL);
+  return 0;
+}
+
+// CHECK-LABEL: foo:
+// CHECK: Function count: 10
+// CHECK-LABEL: main:
+// CHECK: Function count: 1
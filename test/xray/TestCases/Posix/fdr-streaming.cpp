@@ -0,0 +1,65 @@
+// Check that the streaming mode writes out many more buffers than buffer_max,
+// to a new log file or to a descriptor, and that the log can be read back.
+//
+// RUN: rm -rf %t && mkdir %t
+// RUN: %clangxx_xray -g -std=c++11 %s -o %t.exe
+// RUN: XRAY_OPTIONS="patch_premain=false xray_logfile_base=%t/ verbosity=1" \
+// RUN:   XRAY_FDR_OPTIONS="func_duration_threshold_us=0 buffer_size=4096 \
+// RUN:   buffer_max=2 streaming=true streaming_interval_ms=1" \
+// RUN:   %run %t.exe 2>&1 | FileCheck %s
+// RUN: %llvm_xray convert --symbolize --output-format=yaml -instr_map=%t.exe \
+// RUN:   %t/* | FileCheck %s --check-prefix TRACE
+// RUN: %llvm_xray convert --symbolize --output-format=yaml -instr_map=%t.exe \
+// RUN:   %t/* | grep -c "kind: function-enter" | FileCheck %s --check-prefix COUNT
+//
+// RUN: rm -f %t.fd.log
+// RUN: XRAY_OPTIONS="patch_premain=false xray_logfile_base=%t/fd- verbosity=1" \
+// RUN:   XRAY_FDR_OPTIONS="func_duration_threshold_us=0 buffer_size=4096 \
+// RUN:   buffer_max=2 streaming=true streaming_interval_ms=1 streaming_fd=3" \
+// RUN:   %run %t.exe 3>%t.fd.log 2>&1 | FileCheck %s --check-prefix FD
+// RUN: not ls %t/fd-*
+// RUN: %llvm_xray convert --symbolize --output-format=yaml -instr_map=%t.exe \
+// RUN:   %t.fd.log | FileCheck %s --check-prefix TRACE
+// RUN: %llvm_xray convert --symbolize --output-format=yaml -instr_map=%t.exe \
+// RUN:   %t.fd.log | grep -c "kind: function-enter" | \
+// RUN:   FileCheck %s --check-prefix COUNT
+//
+// FIXME: Make llvm-xray work on non-x86_64 as well.
+// REQUIRES: x86_64-target-arch
+// REQUIRES: built-in-llvm-tree
+
+#include "xray/xray_log_interface.h"
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+[[clang::xray_always_instrument]] void __attribute__((noinline)) f() {}
+
+int main(int argc, char *argv[]) {
+  assert(__xray_log_init_mode("xray-fdr", "") ==
+         XRayLogInitStatus::XRAY_LOG_INITIALIZED);
+  __xray_patch();
+  // Less than a buffer is filled at a time, and the streaming thread gets
+  // plenty of time to write it out and recycle it, so that no event is lost
+  // even though only two buffers exist.
+  for (int I = 0; I < 50; ++I) {
+    for (int J = 0; J < 100; ++J)
+      f();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  __xray_unpatch();
+  assert(__xray_log_finalize() == XRayLogInitStatus::XRAY_LOG_FINALIZED);
+  assert(__xray_log_flushLog() == XRayLogFlushStatus::XRAY_LOG_FLUSHED);
+  return 0;
+}
+
+// CHECK: XRay: Log file in '{{.*}}'
+// CHECK-NOT: Failed
+// FD-NOT: XRay: Log file in
+// FD-NOT: Failed
+
+// TRACE: records:
+// TRACE-NEXT: - { type: 0, func-id: [[FID:[0-9]+]], function: {{.*f.*}}, cpu: {{.*}}, thread: [[THREAD:[0-9]+]], process: [[PROCESS:[0-9]+]], kind: function-enter, tsc: {{[0-9]+}}, data: '' }
+// TRACE-NEXT: - { type: 0, func-id: [[FID]], function: {{.*f.*}}, cpu: {{.*}}, thread: [[THREAD]], process: [[PROCESS]], kind: {{function-exit|function-tail-exit}}, tsc: {{[0-9]+}}, data: '' }
+
+// COUNT: 5000
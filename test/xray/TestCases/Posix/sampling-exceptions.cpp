@@ -0,0 +1,65 @@
+// Check that the calls unwound by exceptions, which never exit, don't throw
+// off the sampling of the calls made afterwards.
+//
+// RUN: %clangxx_xray -std=c++11 %s -o %t
+// RUN: XRAY_OPTIONS="patch_premain=false xray_sample_every=2" %run %t 2>&1 | \
+// RUN:   FileCheck %s
+//
+// REQUIRES: x86_64-target-arch
+
+#include "xray/xray_interface.h"
+#include <cstdint>
+#include <cstdio>
+
+static int Entries[64];
+static int Exits[64];
+
+[[clang::xray_never_instrument]] void handler(int32_t FuncId,
+                                              XRayEntryType Type) {
+  if (FuncId < 0 || FuncId >= 64)
+    return;
+  if (Type == XRayEntryType::ENTRY)
+    ++Entries[FuncId];
+  else
+    ++Exits[FuncId];
+}
+
+[[clang::xray_always_instrument]] void __attribute__((noinline)) thrower() {
+  throw 42;
+}
+
+[[clang::xray_always_instrument]] void __attribute__((noinline)) catcher() {
+  // Many more calls are unwound than the sampling tracks.
+  for (int I = 0; I < 1000; ++I) {
+    try {
+      thrower();
+    } catch (int) {
+    }
+  }
+}
+
+[[clang::xray_always_instrument]] void __attribute__((noinline)) leaf() {}
+
+[[clang::xray_never_instrument]] static int32_t idOf(void (*Fn)()) {
+  for (size_t Id = 1; Id <= __xray_max_function_id(); ++Id)
+    if (__xray_function_address(Id) == reinterpret_cast<uintptr_t>(Fn))
+      return static_cast<int32_t>(Id);
+  return 0;
+}
+
+[[clang::xray_never_instrument]] int main() {
+  __xray_set_handler(handler);
+  __xray_patch();
+  catcher();
+  for (int I = 0; I < 100; ++I)
+    leaf();
+  __xray_unpatch();
+
+  const int32_t Catcher = idOf(catcher);
+  printf("catcher: %d entries, %d exits\n", Entries[Catcher], Exits[Catcher]);
+  // CHECK: catcher: [[N:[01]]] entries, [[N]] exits
+  const int32_t Leaf = idOf(leaf);
+  printf("leaf: %d entries, %d exits\n", Entries[Leaf], Exits[Leaf]);
+  // CHECK-NEXT: leaf: 50 entries, 50 exits
+  return 0;
+}